@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# bench_spawn.sh
+#
+# Mittaa kopioiden käynnistysnopeuden (käynnistyksiä sekunnissa) sekä sivuvirheet ja muistin käytön
+# jokaisella käynnistystavalla 100, 1000 ja 10000 kopiolla, kun pääohjelmassa on kirjoitettu muistialue.
+# Lopuksi verrataan useaa kierrosta uusilla kopioilla ja valmiiksi käynnistetyllä joukolla (--pool).
+#
+# Käyttö: ./bench_spawn.sh [keko-MB] [kierrokset]
+
+set -e
+
+HEAP=${1:-64}
+ROUNDS=${2:-5}
+STRATEGIES="fork vfork clone3 posix_spawn"
+
+# Ajaa pingpongin annetuilla valinnoilla ja tulostaa: käynnistyksiä/s, pääohjelman sivuvirheet luonnin
+# aikana, sivuvirheet kopiota kohden, kopion RSS ja sivutaulut (kt) ja kokonaisaika (ms)
+run() {
+    ./pingpong --no-delay --quiet --reap pidfd --heap "$HEAP" "$@" | awk '
+        /^Käynnistyksiä/ { gsub(/[(\/s)]/, "", $3); rate = $3 }
+        /^Sivuvirheet/ { gsub(/,/, "", $5); parent = $5; gsub(/\(/, "", $8); child = $8 }
+        /^Muisti/ { rss = $9; pte = $13 }
+        /Yhteensä/ { total = $2 }
+        END { print rate, parent, child, rss, pte, total }'
+}
+
+echo "Pääohjelman muisti: $HEAP Mt, prosessoreita: $(nproc)"
+printf '%-12s %8s %12s %14s %14s %10s %10s\n' tapa kopioita käynn./s "pääohj. sivuv." "sivuv./kopio" "RSS kt" "PTE kt"
+for copies in 100 1000 10000; do
+    for strategy in $STRATEGIES; do
+        set -- $(run --kopioita "$copies" --spawn "$strategy")
+        printf '%-12s %8s %12s %14s %14s %10s %10s\n' "$strategy" "$copies" "$1" "$2" "$3" "$4" "$5"
+    done
+done
+
+echo
+echo "$ROUNDS kierrosta, 1000 kopiota: kokonaisaika (ms)"
+printf '%-12s %14s %14s\n' tapa "uudet kopiot" "--pool"
+for strategy in $STRATEGIES; do
+    set -- $(run --kopioita 1000 --spawn "$strategy" --rounds "$ROUNDS")
+    fresh=$6
+    set -- $(run --kopioita 1000 --spawn "$strategy" --rounds "$ROUNDS" --pool)
+    printf '%-12s %14s %14s\n' "$strategy" "$fresh" "$6"
+done
@@ -1,124 +1,359 @@
 /*
  * 22-signaali ping-pong
  *
- * Tämä ohjelma luo kopioita itsestään. Kopiot lähettävät SIGUSR1-signaalin pääohjelmalle,
+ * Tämä ohjelma luo kopioita itsestään. Kopiot lähettävät reaaliaikasignaalin (SIGRTMIN) pääohjelmalle,
  * joka vastaanottaa ne ja lähettää SIGUSR2-signaalin kaikille kopioille.
  * Kopio lopettaa vastaanotettuaan SIGUSR2-signaalin.
  * Pääohjelma odottaa kaikkien kopioiden päättyvän ja lopettaa itse, kun kaikki kopiot ovat päättyneet.
  *
+ * Tavalliset signaalit (kuten SIGUSR1) eivät jonoudu: jos samaa signaalia lähetetään useita ennen kuin
+ * edellinen on käsitelty, ne yhdistyvät yhdeksi, ja suurella kopiomäärällä osa menetetään.
+ * Reaaliaikasignaalit jonoutuvat, ja sigqueue() liittää signaaliin kopion numeron. Pääohjelma pitää
+ * signaalit estettyinä ja lukee ne signalfd-kuvaajasta suurina erinä, joten signaalinkäsittelijää ei
+ * tarvita eikä kopioiden luontia tarvitse hidastaa.
+ *
+ * Ryhmätilassa (--group) kopiot liitetään omaan prosessiryhmäänsä, ja pääohjelma lähettää SIGUSR2-signaalin
+ * kaikille kopioille yhdellä kill(-ryhmä, SIGUSR2) -kutsulla. Kopioiden päättyminen voidaan odottaa
+ * pidfd-kuvaajilla (jokaisen kopion kuvaaja epoll-joukossa) tai SIGCHLD-signaaleilla signalfd-kuvaajasta,
+ * jolloin jokainen päättyminen huomataan heti ilman toistuvaa kyselyä. Lopuksi ohjelma tulostaa
+ * vaiheiden kestot.
+ *
+ * Kopiot voidaan käynnistää fork()-kutsun sijaan uudelleen käynnistämällä ohjelma (vfork, clone3 tai
+ * posix_spawn, ks. spawn.h), jolloin pääohjelman muistin sivutauluja ei kopioida. Tällainen kopio saa
+ * numeronsa valinnalla --kopio. Ping-pongin voi toistaa useita kierroksia; valmiiksi käynnistetyn
+ * joukon tilassa (--pool) samat kopiot jatkavat kierroksesta toiseen, SIGUSR2 aloittaa seuraavan
+ * kierroksen ja SIGTERM lopettaa kopiot.
+ *
+ * Signaalien sijaan kopiot voivat ilmoittaa saapumisestaan jaetun muistin laskurilla ja futexilla
+ * tai eventfd-laskureilla (--transport, ks. transport.h). Useamman --pool-kierroksen jälkeen ohjelma
+ * tulostaa kierroksen viiveen jakauman: aika vapautuksen alusta siihen, kun kaikki kopiot ovat
+ * saapuneet seuraavalle kierrokselle.
+ *
  * Ohjelman kääntäminen ja ajaminen:
  *  1. make
- *  2. ./pingpong --kopioita X (jossa X on kopioiden määrä)
+ *  2. ./pingpong --kopioita X [valinnat] (jossa X on kopioiden määrä)
+ *       --spawn T       kopioiden käynnistystapa: fork (oletus), vfork, clone3 tai posix_spawn
+ *       --pool          käynnistä kopiot kerran ja käytä niitä kaikilla kierroksilla
+ *       --rounds N      ping-pong-kierrosten määrä (oletus 1)
+ *       --transport T   viestintätapa: signal (oletus), futex tai eventfd
+ *       --heap MB       varaa ja kirjoita pääohjelmaan MB megatavua muistia ennen kopioiden luontia
+ *       --group         lähetä SIGUSR2 kopioiden prosessiryhmälle yhdellä kutsulla
+ *       --reap T        kopioiden odotustapa: poll (waitpid-kysely, oletus), pidfd tai sigchld
+ *       --no-delay      jätä seuraamista helpottavat sekunnin tauot pois
+ *       --quiet         älä tulosta jokaisen kopion viestejä
  *  3. make clean (lopuksi käännetyn ohjelman poistamiseen)
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <getopt.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "spawn.h"
+#include "transport.h"
+
+#ifndef P_PIDFD
+#define P_PIDFD 3  // waitid(): odotettava prosessi annetaan pidfd-kuvaajana (Linux 5.4+)
+#endif
+
+#define SIGNAL_BATCH 256  // Kerralla signalfd-kuvaajasta luettavien signaalien enimmäismäärä
+#define EVENT_BATCH 256   // Kerralla epoll-joukosta luettavien tapahtumien enimmäismäärä
+#define SELF_EXE "/proc/self/exe"  // Uudelleen käynnistettävä ohjelma (vfork, clone3, posix_spawn)
+
+// Kopioiden odotustapa
+enum reap_mode {
+    REAP_POLL,     // waitpid(WNOHANG) ja lyhyt tauko, jos yksikään kopio ei ole päättynyt
+    REAP_PIDFD,    // Jokaisen kopion pidfd-kuvaaja epoll-joukossa
+    REAP_SIGCHLD,  // SIGCHLD-signaalit signalfd-kuvaajasta ja waitid(WNOHANG)
+};
+
+// Ohjelman vaiheet, joiden kestot mitataan
+enum phase {
+    PHASE_SPAWN,      // Kopioiden luonti
+    PHASE_PING,       // Kopioiden saapumisten (signaalien) vastaanotto
+    PHASE_BROADCAST,  // Kopioiden vapautus (SIGUSR2, viimeisellä --pool-kierroksella SIGTERM)
+    PHASE_REAP,       // Kopioiden päättymisen odotus
+    PHASE_COUNT,
+};
+
 int copy_count;            // Kopioiden määrä
-int received_signals = 0;  // Vastaanotettujen SIGUSR1-signaalien määrä pääohjelmassa
+int received_signals = 0;  // Vastaanotettujen signaalien määrä pääohjelmassa
 int *copy_pids;            // Kopioiden prosessi-id:t
+int *pid_fds;              // Kopioiden pidfd-kuvaajat (--reap pidfd)
+bool quiet = false;        // Jätetäänkö kopiokohtaiset viestit tulostamatta
+bool group = false;        // Lähetetäänkö SIGUSR2 prosessiryhmälle
+bool no_delay = false;     // Jätetäänkö sekunnin tauot pois
+bool pool = false;         // Käytetäänkö samoja kopioita kaikilla kierroksilla
+enum reap_mode reap_mode = REAP_POLL;
+enum spawn_mode spawn_mode = SPAWN_FORK;
+struct transport transport = {.kind = TRANSPORT_SIGNAL};  // Viestintätapa ja sen välineet
+char *program_name;           // Ohjelman nimi kopioiden argumentteihin
+double phase_ms[PHASE_COUNT];  // Vaiheiden kestot millisekunteina (kaikki kierrokset yhteensä)
+long spawned = 0;              // Käynnistettyjen kopioiden määrä
+long spawn_faults = 0;         // Pääohjelman sivuvirheet kopioiden luonnin aikana
+long copy_rss_kb = -1;         // Elossa olevan kopion muisti (VmRSS) kilotavuina
+long copy_pte_kb = -1;         // Kopion sivutaulujen koko (VmPTE) kilotavuina
 
-// Käsittelijä pääohjelman vastaanottamille SIGUSR1-signaalille
-void sigusr1_handler(int signum) {
-    received_signals++;
-    printf("Pääohjelma: Vastaanotettu SIGUSR1 (%d/%d).\n", received_signals, copy_count);
-
-    // Jos kaikki SIGUSR1-signaalit on vastaanotettu, lähetetään SIGUSR2-signaalit kopioille
-    if (received_signals == copy_count) {
-        printf("Pääohjelma: Kaikki SIGUSR1-signaalit vastaanotettu. Lähetetään SIGUSR2-signaalit kopioille.\n");
+// Nykyinen aika millisekunteina
+double now_ms(void) {
+    struct timespec ts;
 
-        sleep(1);  // Pieni viive seuraamisen vuoksi
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
 
-        for (int i = 0; i < copy_count; i++) {
-            kill(copy_pids[i], SIGUSR2);  // Lähetä SIGUSR2-signaalit kopioille kill() systeemikutsulla, joka ottaa parametreina prosessin id:n ja signaalin
-            usleep(5000);                 // Lyhyt viive ennen seuraavan signaalin lähetystä
-        }
+// Pieni viive seuraamisen vuoksi (ei --no-delay-valinnalla)
+void delay(void) {
+    if (!no_delay) {
+        sleep(1);
     }
 }
 
-// Käsittelijä kopioiden vastaanottamille SIGUSR2-signaalille
-void sigusr2_handler(int signum) {
-    printf("Kopio PID %d: vastaanotti SIGUSR2, lopetetaan.\n", getpid());  // Tulosta prosessin-id kutsumalla getpid() funktiota
-    exit(EXIT_SUCCESS);                                                    // Lopeta kopio
-}
+// Kopioprosessi. Kopio perii pääohjelmalta estetyt signaalit (SIGRTMIN ja SIGUSR2, --pool-tilassa myös
+// SIGTERM), joten SIGUSR2 jää odottamaan, vaikka se tulisi ennen kuin kopio ehtii odottaa sitä.
+void copy_process(int index) {
+    union sigval value = {.sival_int = index};  // Signaalin mukana kulkeva kopion numero
+    struct timespec retry = {0, 100000};        // Odotus, jos signaalijono on täynnä (100 µs)
+    sigset_t pong;
+    int sig;
+    int released;
 
-// Kopioprosessi
-void copy_process() {
-    printf("Kopio PID %d: Lähetetään SIGUSR1.\n", getpid());
-    kill(getppid(), SIGUSR1);          // Lähetä SIGUSR1-signaali pääohjelmalle. getppid() palauttaa prosessin vanhemman (pääohjelman) id:n
-    signal(SIGUSR2, sigusr2_handler);  // Rekisteröi käsittelijä SIGUSR2-signaalille signal() funktiolla, joka ottaa parametreina signaalin ja käsittelijän
-    pause();                           // Nuku ja odota SIGUSR2-signaalia
-}
+    // Ryhmätilassa kopiot eivät ole päätteen etualaryhmässä, joten Ctrl-C ei tavoita niitä: kopio
+    // lopetetaan, jos pääohjelma päättyy ennen sitä
+    if (group) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() == 1) {
+            exit(EXIT_FAILURE);  // Pääohjelma päättyi jo ennen prctl()-kutsua
+        }
+    }
 
-int main(int argc, char *argv[]) {
-    // Puskurointi pois tulostuksesta päällekkäisyyksien välttämiseksi, parametreina stdout, bufferi NULL, moodi _IONBF (ei puskurointia), koko 0
-    setvbuf(stdout, NULL, _IONBF, 0);
+    // Muut viestintätavat: saapuminen ja vapautuksen odotus, kunnes pääohjelma käskee lopettaa
+    if (transport.kind != TRANSPORT_SIGNAL) {
+        do {
+            if (!quiet) {
+                printf("Kopio PID %d: Ilmoitetaan saapuminen (%s).\n", getpid(), transport_name(transport.kind));
+            }
+            if (transport_arrive(&transport) < 0 || (released = transport_wait(&transport)) < 0) {
+                exit(EXIT_FAILURE);
+            }
+        } while (released);
+        if (!quiet) {
+            printf("Kopio PID %d: vapautettiin, lopetetaan.\n", getpid());
+        }
+        exit(EXIT_SUCCESS);
+    }
 
-    // Tarkistetaan parametrit
-    if (argc != 3 || strcmp(argv[1], "--kopioita") != 0) {
-        printf("Käyttö: %s --kopioita X\n", argv[0]);  // Tulostetaan ohjeet, jos parametrit ovat väärät
-        return EXIT_FAILURE;                           // Lopetetaan ohjelma jos parametrit ovat väärät
+    sigemptyset(&pong);
+    sigaddset(&pong, SIGUSR2);
+    if (pool) {
+        sigaddset(&pong, SIGTERM);
     }
 
-    copy_count = atoi(argv[2]);                    // Valittujen kopioiden määrä talteen integeriksi
-    copy_pids = malloc(copy_count * sizeof(int));  // Muistin varaus kopiotaulukolle kopiomäärän mukaan
+    // Yksi kierros: signaali pääohjelmalle ja vastauksen odotus. --pool-tilassa SIGUSR2 aloittaa
+    // seuraavan kierroksen ja SIGTERM lopettaa; muuten kopio lopettaa SIGUSR2-signaaliin.
+    while (1) {
+        if (!quiet) {
+            printf("Kopio PID %d: Lähetetään SIGRTMIN.\n", getpid());
+        }
 
-    // Tarkista muistin varaus
-    if (copy_pids == NULL) {
-        perror("malloc");
-        exit(EXIT_FAILURE);  // Lopeta ohjelma, jos muistin varaus epäonnistuu
+        // Lähetä reaaliaikasignaali pääohjelmalle sigqueue() systeemikutsulla. getppid() palauttaa prosessin vanhemman (pääohjelman) id:n.
+        // Jonossa olevien signaalien määrä on rajattu (RLIMIT_SIGPENDING): jos jono on täynnä, yritetään hetken päästä uudelleen.
+        while (sigqueue(getppid(), SIGRTMIN, value) < 0) {
+            if (errno != EAGAIN) {
+                perror("sigqueue");
+                exit(EXIT_FAILURE);
+            }
+            nanosleep(&retry, NULL);
+        }
+
+        // Odota vastausta sigwaitinfo() funktiolla (signaalit ovat estettyjä, joten käsittelijää ei tarvita)
+        while ((sig = sigwaitinfo(&pong, NULL)) < 0) {
+            // EINTR: odotus keskeytyi (esimerkiksi pysäytyssignaali), odotetaan uudelleen
+        }
+        if (!pool || sig == SIGTERM) {
+            break;
+        }
+        if (!quiet) {
+            printf("Kopio PID %d: vastaanotti SIGUSR2, seuraava kierros.\n", getpid());
+        }
     }
+    if (!quiet) {
+        printf("Kopio PID %d: vastaanotti %s, lopetetaan.\n", getpid(), sig == SIGTERM ? "SIGTERM" : "SIGUSR2");  // Tulosta prosessin-id kutsumalla getpid() funktiota
+    }
+    exit(EXIT_SUCCESS);  // Lopeta kopio
+}
+
+// Lukee kopioiden signaalit signalfd-kuvaajasta, kunnes jokaiselta kopiolta on saatu signaali.
+// Yksi read() palauttaa kerralla kaikki jonossa olevat signaalit (enintään SIGNAL_BATCH). Palauttaa 0 tai -1.
+int wait_pings(int signal_fd, char *pinged) {
+    struct signalfd_siginfo info[SIGNAL_BATCH];
+
+    while (received_signals < copy_count) {
+        ssize_t len = read(signal_fd, info, sizeof(info));
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read signalfd");
+            return -1;
+        }
+        for (size_t i = 0; i < len / sizeof(info[0]); i++) {
+            int index = info[i].ssi_int;  // sigqueue()-kutsun mukana lähetetty kopion numero
 
-    // Tämän structin käytön apuna on hyödynnetty tekoälyä (ChatGPT)
-    struct sigaction signal_action = {0};        // Alustus struct signaalin käsittelylle sigaction structilla
-    signal_action.sa_handler = sigusr1_handler;  // Pääohjelman SIGUSR1-signaalin käsittelijä structiin
-    signal_action.sa_flags = SA_RESTART;         // SA_RESTART lippu, jotta keskeytyneet kutsut aloitetaan alusta
+            // Hyväksytään vain omien kopioiden signaalit, kukin kerran
+            if (info[i].ssi_code != SI_QUEUE || index < 0 || index >= copy_count || pinged[index] ||
+                (pid_t)info[i].ssi_pid != copy_pids[index]) {
+                continue;
+            }
+            pinged[index] = 1;
+            received_signals++;
+            if (!quiet) {
+                printf("Pääohjelma: Vastaanotettu SIGRTMIN kopiolta %d (%d/%d).\n", index, received_signals, copy_count);
+            }
+        }
+    }
+    return 0;
+}
 
-    // Rekisteröi käsittelijä SIGUSR1-signaalille sigaction() systeemikutsulla, joka ottaa parametreina signaalin, sigaction-structin ja NULL (ei vanhaa käsittelijää)
-    sigaction(SIGUSR1, &signal_action, NULL);
+// Käynnistää kopion index uudelleen käynnistettynä ohjelmana (vfork, clone3 tai posix_spawn).
+// Kopio saa numeronsa ja asetuksensa argumentteina. Palauttaa kopion id:n tai -1.
+pid_t exec_copy(int index) {
+    char index_arg[16];
+    char channel[32];
+    char *argv[12];
+    int n = 0;
 
-    printf("Pääohjelma: Luodaan %d kopiota.\n", copy_count);
-    sleep(1);  // Pieni viive seuraamisen vuoksi
+    snprintf(index_arg, sizeof(index_arg), "%d", index);
+    argv[n++] = program_name;
+    argv[n++] = "--kopio";
+    argv[n++] = index_arg;
+    if (quiet) {
+        argv[n++] = "--quiet";
+    }
+    if (group) {
+        argv[n++] = "--group";
+    }
+    if (pool) {
+        argv[n++] = "--pool";
+    }
+    if (transport.kind != TRANSPORT_SIGNAL) {
+        transport_channel(&transport, index, channel, sizeof(channel));
+        argv[n++] = "--transport";
+        argv[n++] = (char *)transport_name(transport.kind);
+        argv[n++] = "--kanava";
+        argv[n++] = channel;
+    }
+    argv[n] = NULL;
+    return spawn_exec(spawn_mode, SELF_EXE, argv, group ? (index == 0 ? 0 : copy_pids[0]) : -1);
+}
 
-    // Kopioiden luonti
+// Luo kopiot. Ryhmätilassa ensimmäisestä kopiosta tulee prosessiryhmän johtaja, ja muut kopiot
+// liitetään sen ryhmään. fork()-kopiossa ryhmä asetetaan sekä kopiossa että pääohjelmassa, jotta se on
+// voimassa ennen kuin kumpikaan jatkaa; muut käynnistystavat asettavat sen ennen execve()-kutsua.
+// Palauttaa 0 tai -1.
+int spawn_copies(void) {
     for (int i = 0; i < copy_count; i++) {
-        int pid = fork();  // Luo kopio fork() funktiolla, joka "monistaa" prosessin ja palauttaa uuden prosessin id:n
+        int pid;
+
+        if (spawn_mode != SPAWN_FORK) {
+            pid = exec_copy(i);
+            if (pid < 0) {
+                perror(spawn_name(spawn_mode));
+                return -1;
+            }
+            copy_pids[i] = pid;
+            spawned++;
+            if (!quiet) {
+                printf("Pääohjelma: Luotu kopio PID %d.\n", pid);
+            }
+            continue;
+        }
+
+        pid = fork();  // Luo kopio fork() funktiolla, joka "monistaa" prosessin ja palauttaa uuden prosessin id:n
 
         // Jos palautettu id on 0, ollaan kopiossa ja kutsutaan copy_process() funktiota ja aloitetaan kopion toiminta
         if (pid == 0) {
-            copy_process();
-        }
-        // Pääohjelmassa, jos palautettu id on positiivinen eli uuden kopion id
-        else if (pid > 0) {
-            copy_pids[i] = pid;  // Tallenna kopion PID taulukkoon
-            printf("Pääohjelma: Luotu kopio PID %d.\n", pid);
-            usleep(5000);  // Pieni viive ennen seuraavan kopion luontia
+            if (group) {
+                setpgid(0, i == 0 ? 0 : copy_pids[0]);
+            }
+            transport_select(&transport, i);
+            copy_process(i);
         }
         // Jos fork() palauttaa -1, on tapahtunut virhe
-        else {
+        if (pid < 0) {
             perror("fork");
-            free(copy_pids);     // vapautetaan muisti
-            exit(EXIT_FAILURE);  // lopetetaan ohjelma
+            return -1;
+        }
+
+        // Pääohjelmassa palautettu id on uuden kopion id
+        copy_pids[i] = pid;  // Tallenna kopion PID taulukkoon
+        spawned++;
+        if (group) {
+            setpgid(pid, i == 0 ? pid : copy_pids[0]);  // Virhe (kopio jo päättynyt tai ryhmässä) ei haittaa
+        }
+        if (!quiet) {
+            printf("Pääohjelma: Luotu kopio PID %d.\n", pid);
         }
     }
+    return 0;
+}
 
-    printf("Pääohjelma: Odotetaan kopioita.\n");
-    sleep(1);  // Pieni viive seuraamisen vuoksi
+// Avaa jokaiselle kopiolle pidfd-kuvaajan, joka tulee luettavaksi kopion päättyessä, ja lisää sen
+// epoll-joukkoon. Kuvaajat avataan vasta kaikkien kopioiden luonnin jälkeen: muuten jokainen kopio
+// perisi aiempien kopioiden kuvaajat, ja kuvaajataulun kopiointi ja sulkeminen kasvaisi kopioiden
+// määrän neliönä. Kopiot odottavat SIGUSR2-signaalia, joten yksikään ei ole vielä päättynyt.
+// Palauttaa 0 tai -1.
+int watch_copies(int epoll_fd) {
+    for (int i = 0; i < copy_count; i++) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
 
-    // Odotetaan kopioita
-    while (copy_count > 0) {
+        pid_fds[i] = syscall(SYS_pidfd_open, copy_pids[i], 0);
+        if (pid_fds[i] < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pid_fds[i], &ev) < 0) {
+            perror("pidfd_open");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Lähettää signaalin sig kaikille kopioille
+void broadcast(int sig) {
+    if (group) {
+        kill(-copy_pids[0], sig);  // Negatiivinen id: signaali kaikille ryhmän prosesseille
+        return;
+    }
+    for (int i = 0; i < copy_count; i++) {
+        kill(copy_pids[i], sig);  // Lähetä signaalit kopioille kill() systeemikutsulla, joka ottaa parametreina prosessin id:n ja signaalin
+    }
+}
+
+// Odottaa kopiot kyselemällä waitpid()-funktiolla. Palauttaa 0 tai -1.
+int reap_poll(void) {
+    int remaining = copy_count;
+
+    while (remaining > 0) {
         // Etsitään päättyneitä kopioita (arvo -1 = mikä tahansa kopio), ei tallenneta tilanne informaatiota (NULL) ja palataan heti, jos ei löydy (WNOHANG)
         pid_t pid = waitpid(-1, NULL, WNOHANG);  // waitpid() palauttaa kopion id:n, jos kopio on päättynyt, muuten 0
 
         if (pid > 0) {
-            printf("Pääohjelma: Kopio PID %d on päättynyt.\n", pid);
-            copy_count--;  // Vähennetään odotettavia kopioita
+            if (!quiet) {
+                printf("Pääohjelma: Kopio PID %d on päättynyt.\n", pid);
+            }
+            remaining--;  // Vähennetään odotettavia kopioita
         }
         // Jos ei päättyneitä kopioita, odotetaan hetki
         else if (pid == 0) {
@@ -127,13 +362,475 @@ int main(int argc, char *argv[]) {
         // Jos virhe ei ole signaalikeskeytys, poistutaan
         else if (errno != EINTR) {
             perror("waitpid");
-            break;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Odottaa kopiot niiden pidfd-kuvaajilla: epoll_wait() palauttaa kerralla kaikki päättyneet kopiot,
+// ja waitid(P_PIDFD) korjaa juuri sen kopion. Palauttaa 0 tai -1.
+int reap_pidfd(int epoll_fd) {
+    struct epoll_event events[EVENT_BATCH];
+    int remaining = copy_count;
+
+    while (remaining > 0) {
+        int n = epoll_wait(epoll_fd, events, EVENT_BATCH, -1);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            int index = events[i].data.u32;
+            siginfo_t info;
+
+            if (waitid(P_PIDFD, pid_fds[index], &info, WEXITED) < 0) {
+                perror("waitid");
+                return -1;
+            }
+            close(pid_fds[index]);  // Sulkeminen poistaa kuvaajan myös epoll-joukosta
+            if (!quiet) {
+                printf("Pääohjelma: Kopio PID %d on päättynyt.\n", info.si_pid);
+            }
+            remaining--;
+        }
+    }
+    return 0;
+}
+
+// Odottaa kopiot SIGCHLD-signaaleilla. SIGCHLD on tavallinen signaali, joten samanaikaiset
+// päättymiset yhdistyvät yhdeksi signaaliksi; siksi jokaisen signaalin jälkeen korjataan kaikki
+// päättyneet kopiot waitid(WNOHANG)-kutsuilla, ja signaalia odotetaan vasta, kun niitä ei ole.
+// Palauttaa 0 tai -1.
+int reap_sigchld(int sigchld_fd) {
+    struct signalfd_siginfo buf[SIGNAL_BATCH];
+    int remaining = copy_count;
+
+    while (remaining > 0) {
+        siginfo_t info;
+
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("waitid");
+            return -1;
+        }
+        if (info.si_pid != 0) {
+            if (!quiet) {
+                printf("Pääohjelma: Kopio PID %d on päättynyt.\n", info.si_pid);
+            }
+            remaining--;
+            continue;
+        }
+        // Yksikään kopio ei ole päättynyt: odota seuraavaa SIGCHLD-signaalia
+        if (read(sigchld_fd, buf, sizeof(buf)) < 0 && errno != EINTR) {
+            perror("read signalfd");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Tulostaa vaiheiden kestot
+void print_phases(int rounds) {
+    static const char *names[PHASE_COUNT] = {
+        [PHASE_SPAWN] = "Kopioiden luonti",
+        [PHASE_PING] = "Saapumisten vastaanotto",
+        [PHASE_BROADCAST] = "Kopioiden vapautus",
+        [PHASE_REAP] = "Kopioiden odotus",
+    };
+
+    double total = 0;
+
+    printf("Vaiheiden kestot (%d kopiota, %d kierrosta, %s, %s%s, ilman taukoja):\n", copy_count, rounds,
+           transport_name(transport.kind), spawn_name(spawn_mode), pool ? " --pool" : "");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        printf("  %-28s %10.3f ms\n", names[i], phase_ms[i]);
+        total += phase_ms[i];
+    }
+    printf("  %-28s %10.3f ms\n", "Yhteensä", total);
+}
+
+// Lukee elossa olevan kopion muistin käytön /proc/PID/status-tiedostosta. Päättyneiden kopioiden
+// ru_maxrss ei kelpaa: vfork- ja clone3-kopion huippuarvoon lasketaan pääohjelman muisti, jota kopio
+// käytti ennen execve()-kutsua. VmPTE kertoo, paljonko fork() kopioi sivutauluja kopiota kohden.
+void sample_copy_memory(pid_t pid) {
+    char path[64], line[128];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if ((f = fopen(path, "r")) == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        sscanf(line, "VmRSS: %ld", &copy_rss_kb);
+        sscanf(line, "VmPTE: %ld", &copy_pte_kb);
+    }
+    fclose(f);
+}
+
+// Vertailufunktio qsort()-kutsulle
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Tulostaa kierrosviiveiden jakauman (n mittausta millisekunteina; järjestää taulukon)
+void print_latency(double *samples, int n) {
+    static const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+    double sum = 0;
+
+    if (n == 0) {
+        return;
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    printf("Kierroksen viive (vapautus -> kaikki kopiot saapuneet, %d mittausta):\n", n);
+    printf("  %-10s %12.1f µs\n", "min", samples[0] * 1e3);
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        char name[16];
+
+        snprintf(name, sizeof(name), "p%g", percentiles[i] * 100);
+        printf("  %-10s %12.1f µs\n", name, samples[(int)(percentiles[i] * (n - 1))] * 1e3);
+    }
+    printf("  %-10s %12.1f µs\n", "max", samples[n - 1] * 1e3);
+    printf("  %-10s %12.1f µs\n", "keskiarvo", sum / n * 1e3);
+}
+
+// Tulostaa käynnistysnopeuden sekä sivuvirheet ja muistin käytön. Kopioiden sivuvirheet ovat kaikkien
+// päättyneiden kopioiden yhteenlasketut sivuvirheet.
+void print_resources(void) {
+    struct rusage self, children;
+
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    printf("Käynnistyksiä %ld (%.0f/s)\n", spawned, spawned / (phase_ms[PHASE_SPAWN] / 1e3));
+    printf("Sivuvirheet: pääohjelma luonnin aikana %ld, kopiot %ld (%.1f kopiota kohden)\n", spawn_faults,
+           children.ru_minflt, (double)children.ru_minflt / spawned);
+    printf("Muisti: pääohjelman suurin RSS %ld kt, kopion RSS %ld kt ja sivutaulut %ld kt\n", self.ru_maxrss,
+           copy_rss_kb, copy_pte_kb);
+}
+
+// Luo kopiot ja kirjaa luonnin keston ja pääohjelman sivuvirheet. Virheen sattuessa lopettaa jo
+// luodut kopiot ja koko ohjelman.
+void run_spawn(int epoll_fd) {
+    struct rusage before, after;
+    double start = now_ms();
+
+    getrusage(RUSAGE_SELF, &before);
+    if (spawn_copies() < 0 || (reap_mode == REAP_PIDFD && watch_copies(epoll_fd) < 0)) {
+        // Lopeta jo luodut kopiot (ne odottavat SIGUSR2-signaalia)
+        for (int i = 0; i < copy_count && copy_pids[i] > 0; i++) {
+            kill(copy_pids[i], SIGKILL);
+        }
+        exit(EXIT_FAILURE);
+    }
+    getrusage(RUSAGE_SELF, &after);
+    phase_ms[PHASE_SPAWN] += now_ms() - start;
+    spawn_faults += after.ru_minflt - before.ru_minflt;
+}
+
+int main(int argc, char *argv[]) {
+    sigset_t signals;     // Pääohjelman ja kopioiden estämät signaalit
+    sigset_t sigchld;     // SIGCHLD (--reap sigchld)
+    char *pinged;         // Onko kopiolta saatu signaali tällä kierroksella
+    char *heap = NULL;    // Pääohjelman suuri muistialue (--heap)
+    char *channel = NULL; // Uudelleen käynnistetyn kopion viestintävälineet (--kanava)
+    double *latency;      // Kierrosviiveet millisekunteina (--pool)
+    int latency_count = 0;
+    double released_at = 0;  // Edellisen vapautuksen alku
+    long heap_mb = 0;     // Muistialueen koko megatavuina
+    int rounds = 1;       // Ping-pong-kierrosten määrä
+    int copy_index = -1;  // Uudelleen käynnistetyn kopion numero (--kopio)
+    bool verbose;         // Tulostetaanko kierroksen viestit ja pidetäänkö tauot
+    int signal_fd;        // Kuvaaja, josta estetyt signaalit luetaan
+    int sigchld_fd = -1;  // Kuvaaja, josta SIGCHLD-signaalit luetaan (--reap sigchld)
+    int epoll_fd = -1;    // Kopioiden pidfd-kuvaajien epoll-joukko (--reap pidfd)
+    int result = 0;
+    double start;
+    int opt;
+
+    // Puskurointi pois tulostuksesta päällekkäisyyksien välttämiseksi, parametreina stdout, bufferi NULL, moodi _IONBF (ei puskurointia), koko 0
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    // Komentoriviltä luettavat valinnat getopt_long-funktiolle
+    static const struct option long_options[] = {
+        {"kopioita", required_argument, NULL, 'k'},
+        {"spawn", required_argument, NULL, 's'},
+        {"pool", no_argument, NULL, 'p'},
+        {"rounds", required_argument, NULL, 'o'},
+        {"heap", required_argument, NULL, 'm'},
+        {"group", no_argument, NULL, 'g'},
+        {"reap", required_argument, NULL, 'r'},
+        {"no-delay", no_argument, NULL, 'n'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"transport", required_argument, NULL, 't'},
+        {"kopio", required_argument, NULL, 'c'},   // Sisäinen: uudelleen käynnistetyn kopion numero
+        {"kanava", required_argument, NULL, 'a'},  // Sisäinen: kopion viestintävälineet
+        {NULL, 0, NULL, 0},
+    };
+
+    // Tarkistetaan parametrit
+    copy_count = 0;
+    program_name = argv[0];
+    while ((opt = getopt_long(argc, argv, "k:s:po:m:t:gr:nqc:a:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k':
+                copy_count = atoi(optarg);  // Valittujen kopioiden määrä talteen integeriksi
+                break;
+            case 's':
+                if ((result = spawn_parse(optarg)) < 0) {
+                    copy_count = 0;
+                    optind = argc;
+                } else {
+                    spawn_mode = result;
+                }
+                break;
+            case 'p':
+                pool = true;
+                break;
+            case 'o':
+                rounds = atoi(optarg);
+                break;
+            case 'm':
+                heap_mb = atol(optarg);
+                break;
+            case 'g':
+                group = true;
+                break;
+            case 'r':
+                if (strcmp(optarg, "poll") == 0) {
+                    reap_mode = REAP_POLL;
+                } else if (strcmp(optarg, "pidfd") == 0) {
+                    reap_mode = REAP_PIDFD;
+                } else if (strcmp(optarg, "sigchld") == 0) {
+                    reap_mode = REAP_SIGCHLD;
+                } else {
+                    copy_count = 0;
+                    optind = argc;
+                }
+                break;
+            case 'n':
+                no_delay = true;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case 't':
+                if ((result = transport_parse(optarg)) < 0) {
+                    copy_count = 0;
+                    optind = argc;
+                } else {
+                    transport.kind = result;
+                }
+                break;
+            case 'c':
+                copy_index = atoi(optarg);
+                break;
+            case 'a':
+                channel = optarg;
+                break;
+            default:
+                copy_count = 0;
+                optind = argc;
+                break;
+        }
+    }
+
+    // Uudelleen käynnistetty kopio: estetyt signaalit on peritty pääohjelmalta
+    if (copy_index >= 0) {
+        if (transport.kind != TRANSPORT_SIGNAL &&
+            (channel == NULL || transport_attach(&transport, transport.kind, channel) < 0)) {
+            fprintf(stderr, "Virheellinen kanava: %s\n", channel ? channel : "(puuttuu)");
+            return EXIT_FAILURE;
+        }
+        copy_process(copy_index);
+    }
+
+    if (copy_count <= 0 || rounds <= 0 || heap_mb < 0 || optind != argc) {
+        // Tulostetaan ohjeet, jos parametrit ovat väärät
+        printf("Käyttö: %s --kopioita X [--spawn fork|vfork|clone3|posix_spawn] [--pool] [--rounds N] [--heap MB]\n"
+               "       [--transport signal|futex|eventfd] [--group] [--reap poll|pidfd|sigchld] [--no-delay] [--quiet]\n",
+               argv[0]);
+        return EXIT_FAILURE;  // Lopetetaan ohjelma jos parametrit ovat väärät
+    }
+    result = 0;
+    verbose = rounds == 1 || !quiet;
+
+    copy_pids = calloc(copy_count, sizeof(int));  // Muistin varaus kopiotaulukolle kopiomäärän mukaan
+    pid_fds = malloc(copy_count * sizeof(int));
+    pinged = calloc(copy_count, 1);
+    latency = malloc(rounds * sizeof(double));
+
+    // Tarkista muistin varaus
+    if (copy_pids == NULL || pid_fds == NULL || pinged == NULL || latency == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);  // Lopeta ohjelma, jos muistin varaus epäonnistuu
+    }
+
+    // Suuri pääohjelma: muisti kirjoitetaan, jotta sivut ja niiden sivutaulut ovat todella olemassa
+    if (heap_mb > 0) {
+        heap = malloc(heap_mb << 20);
+        if (heap == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        memset(heap, 1, heap_mb << 20);
+    }
+
+    // pidfd-odotuksessa ja eventfd-viestinnässä jokainen kopio vie kuvaajan: nosta raja sallittuun
+    // enimmäismäärään
+    if (reap_mode == REAP_PIDFD || transport.kind == TRANSPORT_EVENTFD) {
+        struct rlimit limit;
+
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+    if (transport_open(&transport, transport.kind, copy_count) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (reap_mode == REAP_PIDFD) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            perror("epoll_create1");
+            exit(EXIT_FAILURE);
         }
     }
-    sleep(1);  // Pieni viive seuraamisen vuoksi
+
+    // Estä SIGRTMIN ja SIGUSR2 ennen kopioiden luontia: pääohjelma lukee SIGRTMIN-signaalit signalfd-kuvaajasta,
+    // ja kopiot perivät estot, joten yksikään signaali ei ehdi tulla käsittelemättömänä ennen odotusta
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGRTMIN);
+    sigaddset(&signals, SIGUSR2);
+    if (pool) {
+        sigaddset(&signals, SIGTERM);  // Kopioiden lopetussignaali --pool-tilassa
+    }
+    if (reap_mode == REAP_SIGCHLD) {
+        sigaddset(&signals, SIGCHLD);  // Päättymisestä kertova signaali jää odottamaan signalfd-lukua
+    }
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) < 0) {
+        perror("sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGRTMIN);
+    signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+    if (reap_mode == REAP_SIGCHLD) {
+        sigemptyset(&sigchld);
+        sigaddset(&sigchld, SIGCHLD);
+        if ((sigchld_fd = signalfd(-1, &sigchld, SFD_CLOEXEC)) < 0) {
+            perror("signalfd");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("Pääohjelma: Luodaan %d kopiota (%s%s).\n", copy_count, spawn_name(spawn_mode),
+           pool ? ", samat kopiot kaikilla kierroksilla" : "");
+    delay();
+
+    for (int round = 0; round < rounds && result == 0; round++) {
+        bool last = round == rounds - 1;
+        int sig = pool && last ? SIGTERM : SIGUSR2;  // --pool: SIGUSR2 jatkaa ja SIGTERM lopettaa
+
+        // Kopioiden luonti (--pool-tilassa vain ensimmäisellä kierroksella)
+        if (!pool || round == 0) {
+            run_spawn(epoll_fd);
+        }
+
+        // Kopioiden signaalit ovat jonossa, vaikka niitä ei vielä luettaisi
+        memset(pinged, 0, copy_count);
+        received_signals = 0;
+        start = now_ms();
+        if (transport.kind == TRANSPORT_SIGNAL) {
+            result = wait_pings(signal_fd, pinged);
+        } else {
+            result = transport_gather(&transport);
+        }
+        if (result < 0) {
+            exit(EXIT_FAILURE);
+        }
+        phase_ms[PHASE_PING] += now_ms() - start;
+        if (pool && round > 0) {
+            latency[latency_count++] = now_ms() - released_at;  // Vapautuksesta kaikkien saapumiseen
+        }
+        if (round == 0) {
+            sample_copy_memory(copy_pids[copy_count - 1]);  // Kaikki kopiot odottavat vastausta
+        }
+        if (verbose && transport.kind == TRANSPORT_SIGNAL) {
+            printf("Pääohjelma: Kaikki %d signaalia vastaanotettu. Lähetetään %s-signaalit kopioille%s.\n", copy_count,
+                   sig == SIGTERM ? "SIGTERM" : "SIGUSR2", group ? " (prosessiryhmälle)" : "");
+            delay();
+        } else if (verbose) {
+            printf("Pääohjelma: Kaikki %d kopiota saapuneet (%s). Vapautetaan kopiot%s.\n", copy_count,
+                   transport_name(transport.kind), !pool || last ? " lopettamaan" : "");
+            delay();
+        }
+
+        start = released_at = now_ms();
+        if (transport.kind == TRANSPORT_SIGNAL) {
+            broadcast(sig);
+        } else if (transport_release(&transport, !pool || last) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        phase_ms[PHASE_BROADCAST] += now_ms() - start;
+
+        // --pool-tilassa kopiot jatkavat seuraavalle kierrokselle
+        if (pool && !last) {
+            continue;
+        }
+        if (verbose) {
+            printf("Pääohjelma: Odotetaan kopioita.\n");
+        }
+
+        // Odotetaan kopioita
+        start = now_ms();
+        switch (reap_mode) {
+            case REAP_PIDFD:
+                result = reap_pidfd(epoll_fd);
+                break;
+            case REAP_SIGCHLD:
+                result = reap_sigchld(sigchld_fd);
+                break;
+            default:
+                result = reap_poll();
+                break;
+        }
+        phase_ms[PHASE_REAP] += now_ms() - start;
+    }
+    delay();
 
     printf("Kaikki kopiot ovat päättyneet.\n");
+    print_phases(rounds);
+    print_latency(latency, latency_count);
+    print_resources();
 
+    close(signal_fd);
+    if (sigchld_fd >= 0) {
+        close(sigchld_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+    transport_close(&transport);
+    free(latency);
+    free(heap);
+    free(pinged);
+    free(pid_fds);
     free(copy_pids);  // Vapauta muisti lopuksi
-    return EXIT_SUCCESS;
+    return result < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
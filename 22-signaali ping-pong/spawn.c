@@ -0,0 +1,191 @@
+/*
+ * spawn.c
+ *
+ * Kopioiden käynnistystavat (ks. spawn.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "spawn.h"
+
+#include <errno.h>
+#include <linux/sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CLONE_STACK_SIZE (32 * 1024)  // clone3-lapsen pino: riittää setpgid()- ja execve()-kutsuille
+
+extern char **environ;
+
+// Lapsen tiedot. Lapsi jakaa pääohjelman muistin, joten se lukee tiedot ja kirjoittaa virheen suoraan
+// pääohjelman muuttujiin; pääohjelma on pysähdyksissä, kunnes lapsi on kutsunut execve()-funktiota.
+struct spawn_child {
+    const char *path;    // Käynnistettävä ohjelma
+    char *const *argv;   // Ohjelman argumentit
+    pid_t pgid;          // Prosessiryhmä (< 0 = ei muuteta)
+    volatile int error;  // Epäonnistuneen execve()-kutsun errno (0 = onnistui)
+};
+
+static void *clone_stack;  // clone3-lapsen pino (kaikille lapsille sama, koska ne ajetaan yksi kerrallaan)
+
+const char *spawn_name(enum spawn_mode mode) {
+    static const char *names[] = {
+        [SPAWN_FORK] = "fork",
+        [SPAWN_VFORK] = "vfork",
+        [SPAWN_CLONE3] = "clone3",
+        [SPAWN_POSIX_SPAWN] = "posix_spawn",
+    };
+
+    return names[mode];
+}
+
+int spawn_parse(const char *name) {
+    for (int mode = SPAWN_FORK; mode <= SPAWN_POSIX_SPAWN; mode++) {
+        if (strcmp(name, spawn_name(mode)) == 0) {
+            return mode;
+        }
+    }
+    return -1;
+}
+
+// Lapsen toiminta vfork()- ja clone3()-kutsun jälkeen: vain järjestelmäkutsuja, koska muisti on
+// pääohjelman. Palaa vain, jos execve() epäonnistuu.
+static int child_exec(void *arg) {
+    struct spawn_child *c = arg;
+
+    if (c->pgid >= 0 && setpgid(0, c->pgid) < 0) {
+        c->error = errno;
+        return 127;
+    }
+    execve(c->path, c->argv, environ);
+    c->error = errno;
+    return 127;
+}
+
+// Käynnistää lapsen vfork()-kutsulla
+static pid_t spawn_vfork(struct spawn_child *c) {
+    pid_t pid = vfork();
+
+    if (pid == 0) {
+        _exit(child_exec(c));
+    }
+    return pid;
+}
+
+// Ajaa clone3()-kutsun, jonka lapsi ajaa omassa pinossaan funktion fn(arg) ja päättyy sen
+// palautusarvoon. C-kirjastossa ei ole clone3()-funktiota, eikä pelkkä syscall() kelpaa: lapsi jatkaisi
+// syscall()-funktion paluusta uudessa pinossa, jossa ei ole yhtään pinokehystä. Palauttaa lapsen
+// prosessi-id:n tai negatiivisen virhekoodin.
+static long clone3_run(struct clone_args *args, int (*fn)(void *), void *arg) {
+#if defined(__x86_64__)
+    register long rax __asm__("rax") = SYS_clone3;
+    register void *rdi __asm__("rdi") = args;
+    register long rsi __asm__("rsi") = sizeof(*args);
+    register int (*r12)(void *) __asm__("r12") = fn;  // Säilyy järjestelmäkutsun yli
+    register void *r13 __asm__("r13") = arg;
+
+    __asm__ volatile("syscall\n\t"
+                     "test %%rax, %%rax\n\t"
+                     "jnz 1f\n\t"
+                     // Lapsi: pino on args->stack + args->stack_size (16 tavun rajalla)
+                     "xor %%ebp, %%ebp\n\t"
+                     "mov %%r13, %%rdi\n\t"
+                     "call *%%r12\n\t"
+                     "mov %%eax, %%edi\n\t"
+                     "mov %[exit], %%eax\n\t"
+                     "syscall\n\t"
+                     "hlt\n\t"
+                     "1:\n\t"
+                     : "+r"(rax)
+                     : "r"(rdi), "r"(rsi), "r"(r12), "r"(r13), [exit] "i"(SYS_exit)
+                     : "rcx", "r11", "memory");
+    return rax;
+#else
+    (void)args;
+    (void)fn;
+    (void)arg;
+    return -ENOSYS;
+#endif
+}
+
+// Käynnistää lapsen clone3()-kutsulla omassa pinossaan
+static pid_t spawn_clone3(struct spawn_child *c) {
+    struct clone_args args;
+    long pid;
+
+    if (clone_stack == NULL) {
+        void *stack = mmap(NULL, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+                           -1, 0);
+
+        if (stack == MAP_FAILED) {
+            return -1;
+        }
+        clone_stack = stack;
+    }
+
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_VM | CLONE_VFORK | CLONE_CLEAR_SIGHAND;
+    args.exit_signal = SIGCHLD;
+    args.stack = (uintptr_t)clone_stack;
+    args.stack_size = CLONE_STACK_SIZE;
+
+    pid = clone3_run(&args, child_exec, c);
+    if (pid < 0) {
+        errno = -pid;
+        return -1;
+    }
+    return pid;
+}
+
+// Käynnistää lapsen posix_spawn()-funktiolla
+static pid_t spawn_posix(struct spawn_child *c) {
+    posix_spawnattr_t attr;
+    pid_t pid;
+    int err;
+
+    posix_spawnattr_init(&attr);
+    if (c->pgid >= 0) {
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, c->pgid);
+    }
+    err = posix_spawn(&pid, c->path, NULL, &attr, c->argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+pid_t spawn_exec(enum spawn_mode mode, const char *path, char *const argv[], pid_t pgid) {
+    struct spawn_child c = {path, argv, pgid, 0};
+    pid_t pid;
+
+    switch (mode) {
+        case SPAWN_VFORK:
+            pid = spawn_vfork(&c);
+            break;
+        case SPAWN_CLONE3:
+            pid = spawn_clone3(&c);
+            break;
+        case SPAWN_POSIX_SPAWN:
+            return spawn_posix(&c);
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    // Lapsi on jo kutsunut execve()-funktiota tai päättynyt: jos execve() epäonnistui, korjataan lapsi
+    if (pid > 0 && c.error != 0) {
+        waitpid(pid, NULL, 0);
+        errno = c.error;
+        return -1;
+    }
+    return pid;
+}
@@ -0,0 +1,44 @@
+/*
+ * spawn.h
+ *
+ * Kopioiden käynnistystavat. fork() kopioi koko osoiteavaruuden sivutaulut, joten sen hinta kasvaa
+ * pääohjelman muistin mukana, ja kopion ja pääohjelman ensimmäiset kirjoitukset jaettuihin sivuihin
+ * aiheuttavat sivuvirheitä (copy-on-write). Muut tavat käynnistävät ohjelman uudelleen (execve), eikä
+ * sivutauluja kopioida lainkaan:
+ *
+ *  - vfork: lapsi käyttää pääohjelman muistia ja pinoa, ja pääohjelma on pysähdyksissä, kunnes lapsi
+ *    on kutsunut execve()-funktiota.
+ *  - clone3: kuten vfork (CLONE_VM | CLONE_VFORK), mutta lapsi ajetaan omassa pienessä pinossaan, eikä
+ *    pääohjelman pinokehyksiä voi sotkea. CLONE_CLEAR_SIGHAND palauttaa lapsen signaalinkäsittelijät
+ *    oletuksiin, joten mikään käsittelijä ei pääse ajamaan jaetussa muistissa ennen execve()-kutsua.
+ *  - posix_spawn: C-kirjaston toteutus, joka tekee Linuxissa saman clone(CLONE_VM | CLONE_VFORK)
+ *    -kutsulla.
+ *
+ * Lapsi perii estetyt signaalit myös execve()-kutsun yli.
+ */
+
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <sys/types.h>
+
+// Kopion käynnistystapa
+enum spawn_mode {
+    SPAWN_FORK,         // fork(): kopio jatkaa pääohjelman muistin kopiossa
+    SPAWN_VFORK,        // vfork() ja execve()
+    SPAWN_CLONE3,       // clone3() pienellä pinolla ja execve()
+    SPAWN_POSIX_SPAWN,  // posix_spawn()
+};
+
+// Palauttaa käynnistystavan nimen
+const char *spawn_name(enum spawn_mode mode);
+
+// Palauttaa nimeä vastaavan käynnistystavan tai -1
+int spawn_parse(const char *name);
+
+// Käynnistää ohjelman path argumenteilla argv käynnistystavalla mode (ei SPAWN_FORK). Jos pgid >= 0,
+// lapsi liitetään prosessiryhmään pgid (0 = uusi ryhmä, jonka johtaja lapsi on) ennen execve()-kutsua.
+// Palauttaa lapsen prosessi-id:n tai -1 (errno kertoo syyn, myös epäonnistuneen execve()-kutsun).
+pid_t spawn_exec(enum spawn_mode mode, const char *path, char *const argv[], pid_t pgid);
+
+#endif
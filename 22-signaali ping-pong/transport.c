@@ -0,0 +1,243 @@
+/*
+ * transport.c
+ *
+ * Ping-pongin viestintätavat (ks. transport.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "transport.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RELEASE_CONTINUE 1  // Vapautuskuvaajaan kirjoitettava arvo: seuraava kierros
+#define RELEASE_STOP 2      // Vapautuskuvaajaan kirjoitettava arvo: lopeta
+
+const char *transport_name(enum transport_kind kind) {
+    static const char *names[] = {
+        [TRANSPORT_SIGNAL] = "signal",
+        [TRANSPORT_FUTEX] = "futex",
+        [TRANSPORT_EVENTFD] = "eventfd",
+    };
+
+    return names[kind];
+}
+
+int transport_parse(const char *name) {
+    for (int kind = TRANSPORT_SIGNAL; kind <= TRANSPORT_EVENTFD; kind++) {
+        if (strcmp(name, transport_name(kind)) == 0) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+// Odottaa, kunnes sanan arvo ei enää ole value (tai herätys tulee). Jaettu muisti, joten
+// FUTEX_PRIVATE_FLAG ei kelpaa.
+static int futex_wait(atomic_uint *word, unsigned value) {
+    if (syscall(SYS_futex, word, FUTEX_WAIT, value, NULL, NULL, 0) < 0 && errno != EAGAIN && errno != EINTR) {
+        perror("futex");
+        return -1;
+    }
+    return 0;
+}
+
+// Herättää enintään n sanaa odottavaa prosessia
+static void futex_wake(atomic_uint *word, int n) {
+    syscall(SYS_futex, word, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+// Liittää jaetun muistin memfd-tiedostosta. Palauttaa 0 tai -1.
+static int map_barrier(struct transport *t) {
+    void *p = mmap(NULL, sizeof(struct barrier), PROT_READ | PROT_WRITE, MAP_SHARED, t->shm_fd, 0);
+
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    t->barrier = p;
+    return 0;
+}
+
+int transport_open(struct transport *t, enum transport_kind kind, int count) {
+    memset(t, 0, sizeof(*t));
+    t->kind = kind;
+    t->count = count;
+    t->shm_fd = -1;
+    t->arrival_fd = -1;
+    t->release_fd = -1;
+
+    switch (kind) {
+        case TRANSPORT_FUTEX:
+            t->shm_fd = memfd_create("pingpong", 0);
+            if (t->shm_fd < 0 || ftruncate(t->shm_fd, sizeof(struct barrier)) < 0) {
+                perror("memfd_create");
+                return -1;
+            }
+            if (map_barrier(t) < 0) {
+                return -1;
+            }
+            t->barrier->count = count;
+            return 0;
+
+        case TRANSPORT_EVENTFD:
+            t->arrival_fd = eventfd(0, 0);
+            t->release_fds = malloc(count * sizeof(int));
+            if (t->arrival_fd < 0 || t->release_fds == NULL) {
+                perror("eventfd");
+                return -1;
+            }
+            for (int i = 0; i < count; i++) {
+                if ((t->release_fds[i] = eventfd(0, 0)) < 0) {
+                    perror("eventfd");
+                    return -1;
+                }
+            }
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+void transport_channel(const struct transport *t, int index, char *buf, size_t size) {
+    if (t->kind == TRANSPORT_FUTEX) {
+        snprintf(buf, size, "%d", t->shm_fd);
+    } else {
+        snprintf(buf, size, "%d,%d", t->arrival_fd, t->release_fds[index]);
+    }
+}
+
+int transport_attach(struct transport *t, enum transport_kind kind, const char *channel) {
+    memset(t, 0, sizeof(*t));
+    t->kind = kind;
+    if (kind == TRANSPORT_FUTEX) {
+        if (sscanf(channel, "%d", &t->shm_fd) != 1 || map_barrier(t) < 0) {
+            return -1;
+        }
+        t->count = t->barrier->count;
+        return 0;
+    }
+    if (kind == TRANSPORT_EVENTFD && sscanf(channel, "%d,%d", &t->arrival_fd, &t->release_fd) == 2) {
+        return 0;
+    }
+    return -1;
+}
+
+void transport_select(struct transport *t, int index) {
+    if (t->kind == TRANSPORT_EVENTFD) {
+        t->release_fd = t->release_fds[index];
+    }
+}
+
+int transport_arrive(struct transport *t) {
+    uint64_t one = 1;
+
+    if (t->kind == TRANSPORT_EVENTFD) {
+        return write(t->arrival_fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+    }
+
+    // Kierros luetaan ennen saapumista: pääohjelma vaihtaa sen vasta, kun kaikki ovat saapuneet
+    t->generation = atomic_load(&t->barrier->generation);
+    if (atomic_fetch_add(&t->barrier->arrived, 1) + 1 == t->barrier->count) {
+        futex_wake(&t->barrier->arrived, 1);  // Viimeinen kopio herättää pääohjelman
+    }
+    return 0;
+}
+
+int transport_wait(struct transport *t) {
+    uint64_t value;
+
+    if (t->kind == TRANSPORT_EVENTFD) {
+        while (read(t->release_fd, &value, sizeof(value)) < 0) {
+            if (errno != EINTR) {
+                perror("read eventfd");
+                return -1;
+            }
+        }
+        return value == RELEASE_CONTINUE ? 1 : 0;
+    }
+
+    while (atomic_load(&t->barrier->generation) == t->generation) {
+        if (futex_wait(&t->barrier->generation, t->generation) < 0) {
+            return -1;
+        }
+    }
+    return atomic_load(&t->barrier->stop) ? 0 : 1;
+}
+
+int transport_gather(struct transport *t) {
+    uint64_t total = 0, value;
+    unsigned arrived;
+
+    if (t->kind == TRANSPORT_EVENTFD) {
+        // Yksi read() palauttaa kaikkien lukemisen jälkeen saapuneiden kopioiden määrän
+        while (total < (uint64_t)t->count) {
+            if (read(t->arrival_fd, &value, sizeof(value)) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("read eventfd");
+                return -1;
+            }
+            total += value;
+        }
+        return 0;
+    }
+
+    while ((arrived = atomic_load(&t->barrier->arrived)) < t->barrier->count) {
+        if (futex_wait(&t->barrier->arrived, arrived) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int transport_release(struct transport *t, bool stop) {
+    uint64_t value = stop ? RELEASE_STOP : RELEASE_CONTINUE;
+
+    if (t->kind == TRANSPORT_EVENTFD) {
+        for (int i = 0; i < t->count; i++) {
+            if (write(t->release_fds[i], &value, sizeof(value)) != sizeof(value)) {
+                perror("write eventfd");
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // Laskuri nollataan ennen kierroksen vaihtoa, joten vapautettu kopio saapuu jo uudelle kierrokselle
+    atomic_store(&t->barrier->arrived, 0);
+    atomic_store(&t->barrier->stop, stop);
+    atomic_fetch_add(&t->barrier->generation, 1);
+    futex_wake(&t->barrier->generation, INT_MAX);  // Yksi kutsu herättää kaikki kopiot
+    return 0;
+}
+
+void transport_close(struct transport *t) {
+    if (t->barrier != NULL) {
+        munmap(t->barrier, sizeof(struct barrier));
+    }
+    if (t->shm_fd >= 0) {
+        close(t->shm_fd);
+    }
+    if (t->arrival_fd >= 0) {
+        close(t->arrival_fd);
+    }
+    if (t->release_fds != NULL) {
+        for (int i = 0; i < t->count; i++) {
+            close(t->release_fds[i]);
+        }
+        free(t->release_fds);
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * transport.h
+ *
+ * Ping-pongin viestintätavat signaalien rinnalle. Signaaleissa jokainen viesti kulkee ytimen
+ * signaalijonon kautta ja herättää vastaanottajan erikseen; nämä tavat korvaavat sen:
+ *
+ *  - futex: jaetulla muistialueella on saapuneiden kopioiden laskuri ja kierroksen numero omilla
+ *    välimuistiriveillään. Kopio kasvattaa laskuria atomisesti, ja vain viimeinen kopio herättää
+ *    pääohjelman. Pääohjelma vapauttaa kaikki kopiot kasvattamalla kierroksen numeroa ja yhdellä
+ *    FUTEX_WAKE-kutsulla. Muistialue on memfd-tiedosto, jotta myös uudelleen käynnistetty kopio voi
+ *    liittää sen muistiinsa (fork()-kopiolle se on tavallinen MAP_SHARED-alue).
+ *  - eventfd: kopiot ilmoittavat saapumisensa yhteiseen eventfd-laskuriin, jonka pääohjelma lukee
+ *    summana, ja pääohjelma vapauttaa jokaisen kopion sen omalla eventfd-kuvaajalla. Yhteinen
+ *    semaforitilan eventfd ei kelpaa vapauttamiseen: kopio, joka ehtii seuraavalle kierrokselle,
+ *    voisi viedä toisen kopion vapautuksen.
+ *
+ * Kuvaajat luodaan ilman FD_CLOEXEC-lippua, ja uudelleen käynnistetty kopio saa niiden numerot
+ * kanava-argumenttina.
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Viestintätapa
+enum transport_kind {
+    TRANSPORT_SIGNAL,   // Reaaliaikasignaalit ja SIGUSR2 (pingpong.c)
+    TRANSPORT_FUTEX,    // Jaetun muistin laskuri ja futex
+    TRANSPORT_EVENTFD,  // eventfd-laskurit
+};
+
+// Jaetun muistin este (futex). Kopioiden ja pääohjelman kirjoittamat kentät ovat eri riveillä.
+struct barrier {
+    atomic_uint arrived __attribute__((aligned(64)));     // Saapuneet kopiot (kopiot kirjoittavat)
+    atomic_uint generation __attribute__((aligned(64)));  // Kierroksen numero (pääohjelma kirjoittaa)
+    atomic_uint stop;                                     // Lopetetaanko vapautuksen jälkeen
+    unsigned count;                                       // Kopioiden määrä
+};
+
+// Viestintätavan tila. Pääohjelma ja kopio käyttävät samaa rakennetta; fork()-kopio perii sen.
+struct transport {
+    enum transport_kind kind;
+    int count;                 // Kopioiden määrä
+    int shm_fd;                // Jaetun muistin memfd (futex)
+    struct barrier *barrier;   // Jaettu este (futex)
+    unsigned generation;       // Kopion odottama kierros (futex, kopio)
+    int arrival_fd;            // Saapumisten eventfd (eventfd)
+    int *release_fds;          // Kopioiden vapautuskuvaajat (eventfd, pääohjelma)
+    int release_fd;            // Kopion oma vapautuskuvaaja (eventfd, kopio)
+};
+
+// Palauttaa viestintätavan nimen
+const char *transport_name(enum transport_kind kind);
+
+// Palauttaa nimeä vastaavan viestintätavan tai -1
+int transport_parse(const char *name);
+
+// Luo viestintävälineet count kopiolle (ei TRANSPORT_SIGNAL). Palauttaa 0 tai -1.
+int transport_open(struct transport *t, enum transport_kind kind, int count);
+
+// Kirjoittaa puskuriin kopion index kanava-argumentin uudelleen käynnistettävälle kopiolle
+void transport_channel(const struct transport *t, int index, char *buf, size_t size);
+
+// Kopio: ottaa käyttöön kanava-argumentin (uudelleen käynnistetty kopio). Palauttaa 0 tai -1.
+int transport_attach(struct transport *t, enum transport_kind kind, const char *channel);
+
+// Kopio: valitsee perityistä välineistä kopion index omat (fork()-kopio)
+void transport_select(struct transport *t, int index);
+
+// Kopio: ilmoittaa saapumisesta. Palauttaa 0 tai -1.
+int transport_arrive(struct transport *t);
+
+// Kopio: odottaa vapautusta. Palauttaa 1 (jatka), 0 (lopeta) tai -1.
+int transport_wait(struct transport *t);
+
+// Pääohjelma: odottaa, kunnes kaikki kopiot ovat saapuneet. Palauttaa 0 tai -1.
+int transport_gather(struct transport *t);
+
+// Pääohjelma: vapauttaa kaikki kopiot; stop kertoo, lopettavatko ne. Palauttaa 0 tai -1.
+int transport_release(struct transport *t, bool stop);
+
+// Sulkee viestintävälineet
+void transport_close(struct transport *t);
+
+#endif
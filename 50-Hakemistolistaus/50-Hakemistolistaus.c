@@ -7,267 +7,1446 @@
  *
  * Ohjelman kääntäminen ja ajaminen:
  *  1. make
- *  2. ./50-Hakemistolistaus <hakemistopolku>
+ *  2. ./50-Hakemistolistaus [valinnat] <hakemistopolku>
+ *       --recursive    käy läpi myös alihakemistot rinnakkain
+ *       --threads N    rekursiivisen läpikäynnin säikeiden määrä (oletus: prosessorien määrä)
+ *       --unordered    tulosta hakemistot valmistumisjärjestyksessä (nopein, ei deterministinen)
+ *       --names-only   tulosta vain nimet
+ *       --type-only    tulosta vain tyyppi ja nimi
+ *       --dirbuf KOKO  getdents64-lukupuskurin koko
+ *       --engine=sync|uring  tilatietojen haku statx-kutsu kerrallaan tai io_uringin kautta
+ *       --queue-depth N      io_uring-jonon syvyys
+ *       --preload-ids  lataa kaikki käyttäjä- ja ryhmänimet välimuistiin etukäteen
+ *       --stats        tulosta lopuksi tilastot (mm. nimivälimuistin osumaprosentti)
+ *       --time=locale|iso|epoch  aikaleimojen muoto (paikallinen aika, ISO-8601 UTC tai epoch-nanosekunnit)
+ *       --format=text|ndjson|csv|bin  tulostusmuoto (koneluettavat muodot, ks. format.h)
+ *       --snapshot TIEDOSTO  tallenna tilannevedos (ks. snapshot.h)
+ *       --since TIEDOSTO     tulosta vain muutokset vedoksen jälkeen ja lue vain muuttuneet hakemistot
+ *       --watch[=fanotify|inotify]  jää seuraamaan muutoksia ja tulosta muuttuneet tiedostot (ks. watch.h)
+ *       --debounce MS        odota muutosten tauoamista näin monta millisekuntia ennen käsittelyä (oletus 100)
  *  3. make clean (lopuksi käännetyn ohjelman poistamiseen)
  */
 
+#define _GNU_SOURCE
+
 #include <dirent.h>
 #include <errno.h>
-#include <grp.h>
-#include <langinfo.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <locale.h>
-#include <pwd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
 #include <time.h>
 #include <unistd.h>
 
-// Tulostaa tiedoston tyypin ja siihen liittyvät oikeudet merkkijonona (esim. "d rwx rwx rwx")
-void print_permissions(mode_t mode) {
-    char permissions[14];  // Merkkijono tiedoston oikeuksille
+#include "dirread.h"
+#include "format.h"
+#include "idcache.h"
+#include "outbuf.h"
+#include "snapshot.h"
+#include "timefmt.h"
+#include "uring.h"
+#include "walk.h"
+#include "watch.h"
+#include "xattrat.h"
 
-    // Tiedoston tyyppi
+#define STAT_BATCH 256           // Kerralla haettavien tilatietojen vähimmäismäärä
+#define URING_DEFAULT_DEPTH 256  // Oletusmäärä samanaikaisia statx-pyyntöjä io_uring-moottorissa
+#define URING_MAX_DEPTH 4096     // Suurin sallittu jonon syvyys
+#define WATCH_DEFAULT_DEBOUNCE 100  // Oletusodotus (ms) muutosten tauoamiselle seurantatilassa
+
+// statx-kenttämaski: vain tulostettavat tilatiedot (laitenumero palautetaan aina)
+#define STATX_PRINT_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_ATIME | STATX_MTIME)
+
+// Tilannevedokseen tarvitaan lisäksi i-solmu ja muutosaika (ctime)
+#define STATX_SNAPSHOT_MASK (STATX_PRINT_MASK | STATX_INO | STATX_CTIME)
+
+// Tulostettavat tiedot
+enum list_mode {
+    LIST_FULL,   // Kaikki tilatiedot ja laajennetut attribuutit
+    LIST_NAMES,  // Vain nimet (ei stat-kutsuja)
+    LIST_TYPES,  // Tyyppi ja nimi (stat-kutsu vain, jos tiedostojärjestelmä ei kerro tyyppiä)
+};
+
+// Tilatietojen hakutapa
+enum stat_engine {
+    ENGINE_SYNC,   // statx-kutsu kerrallaan
+    ENGINE_URING,  // Satoja statx-pyyntöjä yhtä aikaa io_uringin kautta
+};
+
+// Komentoriviltä asetettavat listauksen valinnat
+static struct {
+    enum list_mode mode;        // Tulostustila
+    size_t dirbuf_size;         // getdents64-puskurin koko
+    enum stat_engine engine;    // Tilatietojen hakutapa
+    unsigned queue_depth;       // io_uring-jonon syvyys
+    enum output_format format;  // Tulostusmuoto
+    unsigned stat_mask;         // statx-kenttämaski
+    const char *snapshot_file;  // Tallennettava tilannevedos tai NULL
+    struct snapshot *since;     // Vertailtava vanha tilannevedos tai NULL
+    bool watch;                 // Seurataanko muutoksia listauksen jälkeen
+} list_options = {LIST_FULL, DIRREAD_DEFAULT_SIZE, ENGINE_SYNC, URING_DEFAULT_DEPTH, FORMAT_TEXT, STATX_PRINT_MASK, NULL, NULL, false};
+
+static atomic_bool uring_unavailable;  // Asetetaan, jos io_uringia ei voi käyttää (varoitus tulostetaan kerran)
+static atomic_ulong dirs_reused;       // Vedoksesta otetut (muuttumattomat) hakemistot
+static atomic_ulong dirs_rescanned;    // Uudelleen luetut hakemistot
+
+// Palauttaa tiedoston tyyppiä vastaavan merkin (kuten ls -l)
+static char file_type_char(mode_t mode) {
     if (S_ISDIR(mode))
-        permissions[0] = 'd';  // Hakemisto
+        return 'd';  // Hakemisto
     else if (S_ISLNK(mode))
-        permissions[0] = 'l';  // Symbolinen linkki
+        return 'l';  // Symbolinen linkki
     else if (S_ISREG(mode))
-        permissions[0] = '-';  // Tavallinen tiedosto
+        return '-';  // Tavallinen tiedosto
     else if (S_ISCHR(mode))
-        permissions[0] = 'c';  // Merkkilaitetiedosto
+        return 'c';  // Merkkilaitetiedosto
     else if (S_ISBLK(mode))
-        permissions[0] = 'b';  // Lohkolaitetiedosto
+        return 'b';  // Lohkolaitetiedosto
     else if (S_ISFIFO(mode))
-        permissions[0] = 'p';  // FIFO/putki
+        return 'p';  // FIFO/putki
     else if (S_ISSOCK(mode))
-        permissions[0] = 's';  // Socket
+        return 's';  // Socket
     else
-        permissions[0] = '?';
-
-    permissions[1] = ' ';
-
-    // Omistajan oikeudet
-    permissions[2] = (mode & S_IRUSR) ? 'r' : '-';  // Lukuoikeus
-    permissions[3] = (mode & S_IWUSR) ? 'w' : '-';  // Kirjoitusoikeus
-    permissions[4] = (mode & S_IXUSR) ? 'x' : '-';  // Suoritusoikeus (tavalliset tiedostot) ja hakuoikeus (hakemistot)
-
-    permissions[5] = ' ';
-
-    // Ryhmän oikeudet
-    permissions[6] = (mode & S_IRGRP) ? 'r' : '-';  // Lukuoikeus
-    permissions[7] = (mode & S_IWGRP) ? 'w' : '-';  // Kirjoitusoikeus
-    permissions[8] = (mode & S_IXGRP) ? 'x' : '-';  // Suoritusoikeus (tavalliset tiedostot) ja hakuoikeus (hakemistot)
-
-    permissions[9] = ' ';
+        return '?';
+}
 
-    // Muiden oikeudet
-    permissions[10] = (mode & S_IROTH) ? 'r' : '-';  // Lukuoikeus
-    permissions[11] = (mode & S_IWOTH) ? 'w' : '-';  // Kirjoitusoikeus
-    permissions[12] = (mode & S_IXOTH) ? 'x' : '-';  // Suoritusoikeus (tavalliset tiedostot) ja hakuoikeus (hakemistot)
+// Tulostaa tiedoston tyypin ja siihen liittyvät oikeudet merkkijonona (esim. "d rwx rwx rwx")
+void print_permissions(struct outbuf *out, mode_t mode) {
+    outbuf_lit(out, "  - Tyyppi ja oikeudet: ");
 
-    permissions[13] = '\0';  // Merkkijonon lopetusmerkki
+    // Tiedoston tyyppi
+    outbuf_putc(out, file_type_char(mode));
+    outbuf_putc(out, ' ');
 
-    // Tulosta lopullinen merkkijono tiedoston tyypistä ja oikeuksista
-    printf("  - Tyyppi ja oikeudet: %s\n", permissions);
+    // Omistajan, ryhmän ja muiden luku-, kirjoitus- ja suoritusoikeudet (hakemistoille hakuoikeus)
+    outbuf_put_permissions(out, mode);
+    outbuf_putc(out, '\n');
 }
 
 // Tulostaa tiedoston yleiset tilatiedot: koko, laite-id, oikeudet, omistajan ja ryhmän nimet tai id:t,
 // linkkien määrä, sekä viimeisimmät käyttö- ja muokkausajat.
-void print_stat_info(struct stat *file_stat) {  // stat-rakenne tiedoston tilatietojen tallentamiseen
-    struct passwd *pwd;                         // Osoitin käyttäjän tietoja sisältävään passwd-rakenteeseen
-    struct group *grp;                          // Osoitin ryhmän tietoja sisältävään group-rakenteeseen
-    struct tm *tm;                              // Osoitin tm-rakenteeseen, joka sisältää ajan tietoja
-    char date[256];                             // Merkkijono ajan muotoilua varten
+void print_stat_info(struct outbuf *out, const struct statx *stx) {  // statx-rakenne tiedoston tilatiedoille
+    const char *name;                                               // Omistajan tai ryhmän nimi välimuistista
+    char date[256];                                                 // Merkkijono ajan muotoilua varten
+    size_t len;                                                     // Muotoillun ajan pituus
 
     // Tulosta tiedoston koko tavuina
-    printf("  - Koko: %lld tavua\n", (long long)file_stat->st_size);
+    outbuf_lit(out, "  - Koko: ");
+    outbuf_put_u64(out, stx->stx_size);
+    outbuf_lit(out, " tavua\n");
 
-    // Tulosta tiedoston laite-id
-    printf("  - Laite id: %ld\n", (long)file_stat->st_dev);
+    // Tulosta tiedoston laite-id (statx palauttaa laitenumeron pää- ja alinumerona)
+    outbuf_lit(out, "  - Laite id: ");
+    outbuf_put_i64(out, (long)makedev(stx->stx_dev_major, stx->stx_dev_minor));
+    outbuf_putc(out, '\n');
 
     // Tulosta tiedoston tyyppi ja oikeudet
-    print_permissions(file_stat->st_mode);
+    print_permissions(out, stx->stx_mode);
 
     // Tulosta 'hard' linkkien määrä tiedostoon
-    printf("  - Linkit: %ld\n", file_stat->st_nlink);
+    outbuf_lit(out, "  - Linkit: ");
+    outbuf_put_u64(out, stx->stx_nlink);
+    outbuf_putc(out, '\n');
 
-    // Hae tiedoston omistajan käyttäjänimi getpwuid-funktiolla tai vaihtoehtoisesti uid-numero, jos nimeä ei löydy
-    if ((pwd = getpwuid(file_stat->st_uid)) != NULL) {
-        printf("  - Omistajan nimi: %-8.8s\n", pwd->pw_name);
+    // Hae tiedoston omistajan käyttäjänimi välimuistista (getpwuid_r vain ensimmäisellä kerralla) tai vaihtoehtoisesti uid-numero, jos nimeä ei löydy
+    if ((name = idcache_user_name(stx->stx_uid)) != NULL) {
+        outbuf_lit(out, "  - Omistajan nimi: ");
+        outbuf_put_padded(out, name, 8, 8);
     } else {
-        printf("  - Omistajan uid: %-8d\n", file_stat->st_uid);
+        outbuf_lit(out, "  - Omistajan uid: ");
+        outbuf_put_u64_padded(out, stx->stx_uid, 8);
     }
+    outbuf_putc(out, '\n');
 
-    // Hae tiedoston ryhmän nimi getgrgid-funktiolla tai vaihtoehtoisesti gid-numero, jos nimeä ei löydy
-    if ((grp = getgrgid(file_stat->st_gid)) != NULL) {
-        printf("  - Ryhmän nimi: %-8.8s\n", grp->gr_name);
+    // Hae tiedoston ryhmän nimi välimuistista (getgrgid_r vain ensimmäisellä kerralla) tai vaihtoehtoisesti gid-numero, jos nimeä ei löydy
+    if ((name = idcache_group_name(stx->stx_gid)) != NULL) {
+        outbuf_lit(out, "  - Ryhmän nimi: ");
+        outbuf_put_padded(out, name, 8, 8);
     } else {
-        printf("  - Ryhmän id: %-8d\n", file_stat->st_gid);
+        outbuf_lit(out, "  - Ryhmän id: ");
+        outbuf_put_u64_padded(out, stx->stx_gid, 8);
     }
+    outbuf_putc(out, '\n');
 
-    // Tulosta tiedoston viimeisin käyttöaika muotoiltuna localtime-funktiolla
-    tm = localtime(&file_stat->st_atime);
-    strftime(date, sizeof(date), nl_langinfo(D_T_FMT), tm);  // nl_langinfo palauttaa lokaalia tietoa parametrilla D_T_FMT, joka on aika ja päiväys formaatti
-    printf("  - Viimeksi käytetty: %s\n", date);
+    // Tulosta tiedoston viimeisin käyttöaika muotoiltuna (oletuksena lokaalin D_T_FMT-muodossa, joka on aika ja päiväys formaatti)
+    len = timefmt_format(date, sizeof(date), stx->stx_atime.tv_sec, stx->stx_atime.tv_nsec);
+    outbuf_lit(out, "  - Viimeksi käytetty: ");
+    outbuf_write(out, date, len);
+    outbuf_putc(out, '\n');
 
     // Tulosta tiedoston viimeisin muokkausaika muotoiltuna
-    tm = localtime(&file_stat->st_mtime);
-    strftime(date, sizeof(date), nl_langinfo(D_T_FMT), tm);
-    printf("  - Viimeksi muokattu: %s\n", date);
+    len = timefmt_format(date, sizeof(date), stx->stx_mtime.tv_sec, stx->stx_mtime.tv_nsec);
+    outbuf_lit(out, "  - Viimeksi muokattu: ");
+    outbuf_write(out, date, len);
+    outbuf_putc(out, '\n');
 }
 
-// Hakee ja tulostaa tiedoston mahdolliset laajennetut attribuutit, mikäli ne on käytettävissä
-void print_extended_attributes(const char *path) {
-    char *buf;         // Osoitin muistiin laajennettujen attribuuttien nimilistalle
-    char *key;         // Osoitin laajennetun attribuutin avaimeen
-    char *value;       // Osoitin laajennetun attribuutin arvoon
-    ssize_t buflen;    // Laajennettujen attribuuttien nimilistan koko
-    ssize_t keylen;    // Laajennetun attribuutin avaimen koko
-    ssize_t valuelen;  // Laajennetun attribuutin arvon koko
+// Hakee ja tulostaa tiedoston mahdolliset laajennetut attribuutit, mikäli ne on käytettävissä.
+// Tiedosto annetaan hakemiston tiedostokuvaajan ja nimen avulla, joten polkua ei ratkaista joka kutsulla.
+void print_extended_attributes(struct outbuf *out, int dirfd, const char *name, mode_t mode) {
+    struct xattr_target target;  // Tiedosto, jonka attribuutit luetaan
+    char listbuf[4096];          // Puskuri attribuuttien nimilistalle (riittää lähes aina)
+    char valuebuf[4096];         // Puskuri attribuutin arvolle (riittää lähes aina)
+    char *buf;                   // Osoitin laajennettujen attribuuttien nimilistaan
+    char *key;                   // Osoitin laajennetun attribuutin avaimeen
+    char *value;                 // Osoitin laajennetun attribuutin arvoon
+    ssize_t buflen;              // Laajennettujen attribuuttien nimilistan koko
+    ssize_t keylen;              // Laajennetun attribuutin avaimen koko
+    ssize_t valuelen;            // Laajennetun attribuutin arvon koko
 
-    printf("  - Laajennetut attribuutit:\n");
-
-    // Hae laajennettujen attribuuttien listan koko listxattr-funktiolla, parametreina tiedostopolku, listan osoitin (NULL) ja koko
-    buflen = listxattr(path, NULL, 0);
-    if (buflen == -1) {  // listxattr palauttaa -1, jos virhe
+    outbuf_lit(out, "  - Laajennetut attribuutit:\n");
 
+    // Hae laajennettujen attribuuttien nimilista. Lista haetaan suoraan puskuriin, joten kokoa ei
+    // tarvitse kysyä erikseen, ellei lista ole poikkeuksellisen pitkä.
+    xattr_target_init(&target, dirfd, name, mode);
+    buf = xattr_target_list_all(&target, listbuf, sizeof(listbuf), &buflen);
+    if (buf == NULL) {
         // Tarkista, tukeeko tiedostojärjestelmä laajennettuja attribuutteja
         if (errno == ENOTSUP) {  // virhe ENOTSUP = ei tuettu
-            printf("No extended attributes supported\n");
+            outbuf_lit(out, "No extended attributes supported\n");
         } else {
             perror("Error getting extended attributes list");
         }
+        xattr_target_close(&target);
         return;
     }
 
     // Tiedostolla ei ole laajennettuja attribuutteja
-    else if (buflen == 0) {
-        printf("      • ei laajennettuja attribuutteja\n");
+    if (buflen == 0) {
+        outbuf_lit(out, "      • ei laajennettuja attribuutteja\n");
+        xattr_target_close(&target);
         return;
-    } else {
-        // Varaa muisti laajennettujen attribuuttien nimilistalle
-        buf = malloc(buflen);
-        if (buf == NULL) {
-            perror("Error allocating memory for extended attributes list");
-            return;
-        }
-
-        // Hae laajennettujen attribuuttien nimet, parametreina tiedostopolku, listan osoitin ja koko
-        buflen = listxattr(path, buf, buflen);
-        if (buflen == -1) {
-            perror("Error getting extended attributes list");
-            free(buf);
-            return;
-        }
+    }
 
-        // Käsittele jokainen attribuutti erikseen
-        key = buf;  // Ensimmäinen avain
+    // Käsittele jokainen attribuutti erikseen
+    key = buf;  // Ensimmäinen avain
 
-        while (buflen > 0) {
-            printf("      • %s: ", key);
+    while (buflen > 0) {
+        outbuf_lit(out, "      • ");
+        outbuf_puts(out, key);
+        outbuf_lit(out, ": ");
 
-            // Hae laajennetun attribuutin arvon koko getxattr-funktiolla, parametreina tiedostopolku, avain (nimi), arvo (NULL) ja koko (0)
-            valuelen = getxattr(path, key, NULL, 0);
+        // Hae arvo ensin puskuriin; vain liian pitkälle arvolle kysytään koko ja varataan muisti
+        value = valuebuf;
+        valuelen = xattr_target_get(&target, key, valuebuf, sizeof(valuebuf) - 1);
+        if (valuelen == -1 && errno == ERANGE) {
+            valuelen = xattr_target_get(&target, key, NULL, 0);
             if (valuelen == -1) {
                 perror("Error getting extended attribute value size");
-            } else if (valuelen > 0) {
-                // Varaa muisti attribuutin arvolle
+            } else {
                 value = malloc(valuelen + 1);
                 if (value == NULL) {
                     perror("Error allocating memory for extended attribute value");
-                    free(buf);
-                    return;
-                }
-
-                // Hae laajennetun attribuutin arvo, parametreina tiedostopolku, avain (nimi), arvo ja koko
-                valuelen = getxattr(path, key, value, valuelen);
-                if (valuelen == -1) {
-                    perror("Error getting extended attribute value");
-                } else {
-                    value[valuelen] = '\0';  // Nollamerkki merkkijonon loppuun
-                    printf("%s", value);
+                    break;
                 }
-
-                // Vapauta muistissa oleva arvo
-                free(value);
-            } else if (valuelen == 0) {
-                printf("<ei arvoa>");
+                valuelen = xattr_target_get(&target, key, value, valuelen);
             }
+        }
 
-            printf("\n");
+        if (valuelen == -1) {
+            perror("Error getting extended attribute value");
+        } else if (valuelen > 0) {
+            value[valuelen] = '\0';  // Nollamerkki merkkijonon loppuun
+            outbuf_puts(out, value);  // Arvo tulostetaan ensimmäiseen nollamerkkiin asti
+        } else {
+            outbuf_lit(out, "<ei arvoa>");
+        }
 
-            // Siirrytään seuraavaan laajennettuun attribuuttiin
-            keylen = strlen(key) + 1;
-            buflen -= keylen;
-            key += keylen;
+        // Vapauta arvolle mahdollisesti varattu muisti
+        if (value != valuebuf) {
+            free(value);
         }
 
-        // Vapauta lopuksi varattu muisti attribuuttien nimilistalle
+        outbuf_putc(out, '\n');
+
+        // Siirrytään seuraavaan laajennettuun attribuuttiin
+        keylen = strlen(key) + 1;
+        buflen -= keylen;
+        key += keylen;
+    }
+
+    // Vapauta lopuksi nimilistalle mahdollisesti varattu muisti
+    if (buf != listbuf) {
         free(buf);
     }
+    xattr_target_close(&target);
 }
 
-// Avaa hakemiston ja listaa sen sisältämät tiedostot ja niiden tiedot yksi kerrallaan
-void list_directory(const char *path) {
-    DIR *dir;              // Hakemisto
-    struct dirent *entry;  // Tiedosto/hakemistosisältö
+// Hakemistosisältö, jonka tilatiedot haetaan muiden saman erän sisältöjen kanssa
+struct dir_entry {
+    const char *name;    // Tiedoston nimi (osoittaa hakemiston lukupuskuriin)
+    unsigned char type;  // Tiedoston tyyppi hakemistosta (d_type)
+    int error;           // statx-kutsun virhekoodi tai 0
+    struct statx stx;    // Tiedoston tilatiedot
+};
 
-    // Yritä avata annettu hakemisto opendir-funktiolla
-    dir = opendir(path);
-    if (dir == NULL) {
-        perror("Error opening directory");
-        return;
+// Erä hakemistosisältöjä, joiden tilatiedot haetaan ja tulostetaan yhdessä
+struct dir_batch {
+    struct dir_entry *entries;  // Erän hakemistosisällöt
+    int count;                  // Sisältöjen määrä
+    int cap;                    // Erän koko (vähintään io_uring-jonon syvyys)
+};
+
+// Säiekohtaiset työpuskurit, jotka käytetään uudelleen hakemistosta toiseen
+struct list_scratch {
+    char *dirbuf;                         // getdents64-lukupuskuri
+    struct dir_batch batch;               // Tilatietoerä
+    struct uring ring;                    // Säikeen io_uring-rengas (fd -1, jos ei käytössä)
+    struct format_block block;            // Koneluettavan tulostuksen lohko
+    struct snapshot_builder snap;         // Hakemiston tiedostot tilannevedosta varten
+    const struct snapshot_dir *snap_old;  // Hakemisto vanhassa vedoksessa tai NULL
+};
+
+static pthread_key_t scratch_key;                       // Säiekohtaisten työpuskurien avain
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;  // Avaimen kertaluontoinen luonti
+
+// Vapauttaa säikeen työpuskurit säikeen päättyessä
+static void scratch_free(void *arg) {
+    struct list_scratch *scratch = arg;
+
+    uring_free(&scratch->ring);
+    format_block_free(&scratch->block);
+    snapshot_builder_free(&scratch->snap);
+    free(scratch->batch.entries);
+    free(scratch->dirbuf);
+    free(scratch);
+}
+
+static void scratch_key_create(void) {
+    pthread_key_create(&scratch_key, scratch_free);
+}
+
+// Palauttaa kutsuvan säikeen työpuskurit ja varaa ne ensimmäisellä kutsulla
+static struct list_scratch *get_scratch(void) {
+    struct list_scratch *scratch;
+
+    pthread_once(&scratch_once, scratch_key_create);
+    scratch = pthread_getspecific(scratch_key);
+    if (scratch == NULL) {
+        scratch = calloc(1, sizeof(*scratch));
+        if (scratch == NULL) {
+            return NULL;
+        }
+        scratch->ring.fd = -1;
+
+        // io_uring-moottorissa koko jono pidetään täynnä, joten erässä on oltava vähintään jonon verran sisältöjä
+        scratch->batch.cap = list_options.engine == ENGINE_URING && list_options.queue_depth > STAT_BATCH ? list_options.queue_depth : STAT_BATCH;
+        scratch->batch.entries = malloc(scratch->batch.cap * sizeof(*scratch->batch.entries));
+        scratch->dirbuf = malloc(list_options.dirbuf_size);
+        if (scratch->batch.entries == NULL || scratch->dirbuf == NULL) {
+            scratch_free(scratch);
+            return NULL;
+        }
+
+        // Jokaisella säikeellä on oma rengas; jos sitä ei voida luoda, käytetään synkronista hakua
+        if (list_options.engine == ENGINE_URING && !atomic_load(&uring_unavailable) &&
+            uring_init(&scratch->ring, list_options.queue_depth) == -1) {
+            if (!atomic_exchange(&uring_unavailable, true)) {
+                perror("io_uring not available, using synchronous engine");
+            }
+        }
+        pthread_setspecific(scratch_key, scratch);
     }
+    return scratch;
+}
+
+// Hakee yhden sisällön tilatiedot statx-kutsulla hakemiston kuvaajan suhteen. Kenttämaski pyytää
+// vain tulostettavat tiedot, jolloin esim. verkkotiedostojärjestelmän ei tarvitse hakea muita.
+static void stat_entry(int dirfd, struct dir_entry *e) {
+    e->error = statx(dirfd, e->name, AT_STATX_SYNC_AS_STAT, list_options.stat_mask, &e->stx) == -1 ? errno : 0;
+}
 
-    // Käy läpi hakemiston sisältö tiedosto kerrallaan
-    while ((entry = readdir(dir)) != NULL) {  // readdir palauttaa NULL, kun hakemiston sisältö on käyty läpi
-        char filepath[1024];                  // Tiedostopolku
-        struct stat file_stat;                // Tiedoston tilatiedot
+// Hakee erän tilatiedot io_uringin kautta. Jonoon pidetään koko ajan lähetettynä jopa queue_depth
+// statx-pyyntöä, jolloin hitaan tallennuksen (FUSE, verkkolevyt) viive limittyy pyyntöjen kesken.
+static void stat_batch_uring(struct uring *ring, int dirfd, struct dir_batch *batch) {
+    int next = 0;      // Seuraava lähettämätön sisältö
+    int inflight = 0;  // Lähetettyjen, valmistumattomien pyyntöjen määrä
 
-        // Ohita '.' ja '..' hakemistot
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    while (next < batch->count || inflight > 0) {
+        struct io_uring_cqe *cqe;
+
+        // Täytä jono
+        while (next < batch->count) {
+            struct dir_entry *e = &batch->entries[next];
+            struct io_uring_sqe *sqe = uring_get_sqe(ring);
+            if (sqe == NULL) {
+                break;
+            }
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = (unsigned long)e->name;
+            sqe->len = list_options.stat_mask;
+            sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+            sqe->off = (unsigned long)&e->stx;
+            sqe->user_data = next;
+            next++;
+            inflight++;
+        }
+
+        // Lähetä pyynnöt ja odota vähintään yhden valmistumista
+        if (uring_submit_and_wait(ring, 1) == -1 && errno != EAGAIN && errno != EBUSY) {
+            // Rengas on käyttökelvoton: luovu siitä tässä säikeessä ja hae loput synkronisesti
+            perror("io_uring_enter");
+            uring_free(ring);
+            for (int i = 0; i < batch->count; i++) {
+                if (batch->entries[i].error == EINPROGRESS) {
+                    stat_entry(dirfd, &batch->entries[i]);
+                }
+            }
+            return;
         }
 
-        // Muodosta tiedostopolku hakemiston ja tiedoston nimen perusteella
-        snprintf(filepath, sizeof(filepath), "%s/%s", path, entry->d_name);
+        // Kerää valmistuneet pyynnöt
+        while ((cqe = uring_peek_cqe(ring)) != NULL) {
+            struct dir_entry *e = &batch->entries[cqe->user_data];
+
+            e->error = cqe->res < 0 ? -cqe->res : 0;
+            uring_cqe_seen(ring);
+            inflight--;
+
+            // Vanhat ytimet (< 5.6) eivät tunne IORING_OP_STATX-operaatiota
+            if (e->error == EINVAL || e->error == EOPNOTSUPP) {
+                stat_entry(dirfd, e);
+            }
+        }
+    }
+}
 
-        // Hae tiedoston tilatiedot stat-funktiolla ja tarkista mahdollinen virhe
-        if (stat(filepath, &file_stat) == -1) {
+// Hakee erän tilatiedot valitulla moottorilla
+static void stat_batch(struct list_scratch *scratch, int dirfd, struct dir_batch *batch) {
+    if (scratch->ring.fd != -1) {
+        for (int i = 0; i < batch->count; i++) {
+            batch->entries[i].error = EINPROGRESS;
+        }
+        stat_batch_uring(&scratch->ring, dirfd, batch);
+        return;
+    }
+
+    for (int i = 0; i < batch->count; i++) {
+        stat_entry(dirfd, &batch->entries[i]);
+    }
+}
+
+// Selvittää hakemistosisällön tyypin. Useimmat tiedostojärjestelmät kertovat sen suoraan
+// hakemistossa (d_type); muuten tyyppi haetaan fstatat-funktiolla seuraamatta symbolisia linkkejä.
+static unsigned char resolve_type(int dirfd, struct dir_entry *entry) {
+    struct stat link_stat;
+
+    if (entry->type == DT_UNKNOWN && fstatat(dirfd, entry->name, &link_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+        entry->type = IFTODT(link_stat.st_mode);
+    }
+    return entry->type;
+}
+
+// Tulostaa erän tiedostot ja niiden tiedot
+static void print_batch(struct outbuf *out, int dirfd, struct dir_batch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        struct dir_entry *e = &batch->entries[i];
+
+        // Tarkista tilatietojen haun mahdollinen virhe
+        if (e->error != 0) {
+            errno = e->error;
             perror("Error getting file status");
             continue;
         }
 
         // Tulosta tiedoston nimi
-        printf("Tiedosto: %s\n", entry->d_name);
+        outbuf_lit(out, "Tiedosto: ");
+        outbuf_puts(out, e->name);
+        outbuf_putc(out, '\n');
 
         // Tulosta tiedoston tilatiedot
-        print_stat_info(&file_stat);
+        print_stat_info(out, &e->stx);
 
         // Tulosta tiedoston mahdolliset laajennetut attribuutit
-        print_extended_attributes(filepath);
+        print_extended_attributes(out, dirfd, e->name, e->stx.stx_mode);
+
+        outbuf_putc(out, '\n');
+    }
+}
+
+// Täyttää vedoksen tiedoston tilatiedot. Attribuuttien tiiviste lasketaan uudelleen vain, jos tiedoston
+// muutosaika (ctime) on muuttunut vanhasta vedoksesta, sillä attribuuttien muuttaminen päivittää sen.
+static void snapshot_set(struct snapshot_entry *e, const struct snapshot_entry *old, int dirfd, const char *name,
+                         const struct statx *stx) {
+    snapshot_entry_set_stat(e, stx);
+    if (old != NULL && old->ino == e->ino && old->ctime_sec == e->ctime_sec && old->ctime_nsec == e->ctime_nsec) {
+        e->xattr_digest = old->xattr_digest;
+    } else {
+        e->xattr_digest = snapshot_xattr_digest(dirfd, name, stx->stx_mode);
+    }
+}
+
+// Lisää erän tiedostot hakemiston tilannevedokseen
+static void snapshot_batch(struct list_scratch *scratch, int dirfd) {
+    struct dir_batch *batch = &scratch->batch;
+
+    for (int i = 0; i < batch->count; i++) {
+        struct dir_entry *e = &batch->entries[i];
+        const struct snapshot_entry *old = NULL;
+        struct snapshot_entry *s;
+
+        // Muutostilassa erää ei tulosteta, joten virheet ilmoitetaan tässä
+        if (e->error != 0) {
+            if (list_options.since != NULL) {
+                errno = e->error;
+                perror("Error getting file status");
+            }
+            continue;
+        }
+
+        if (scratch->snap_old != NULL) {
+            old = snapshot_find_entry(list_options.since, scratch->snap_old, e->name);
+        }
+        s = snapshot_builder_add(&scratch->snap, e->name);
+        s->type = resolve_type(dirfd, e);
+        snapshot_set(s, old, dirfd, e->name, &e->stx);
+    }
+}
+
+// Kirjoittaa erän koneluettavassa muodossa. Erästä tulee yksi binäärimuodon lohko.
+static void format_batch(struct list_scratch *scratch, struct outbuf *out, const char *path, int dirfd) {
+    struct dir_batch *batch = &scratch->batch;
+
+    format_block_begin(&scratch->block, path, dirfd);
+    for (int i = 0; i < batch->count; i++) {
+        struct dir_entry *e = &batch->entries[i];
+
+        if (e->error != 0) {
+            errno = e->error;
+            perror("Error getting file status");
+            continue;
+        }
+        format_entry(&scratch->block, out, e->name, &e->stx);
+    }
+    format_block_end(&scratch->block, out);
+}
+
+// Käsittelee erän valitun tulostustilan mukaan ja tyhjentää sen. Nimi- ja tyyppitiloissa
+// tilatietoja ei haeta lainkaan, kun tyyppi tiedetään jo hakemistosta.
+static void flush_batch(struct list_scratch *scratch, struct outbuf *out, const char *path, int dirfd) {
+    struct dir_batch *batch = &scratch->batch;
+
+    switch (list_options.mode) {
+        case LIST_FULL:
+            stat_batch(scratch, dirfd, batch);
+            if (list_options.snapshot_file != NULL || list_options.since != NULL || list_options.watch) {
+                snapshot_batch(scratch, dirfd);
+            }
+            if (list_options.since != NULL) {
+                break;  // Muutostilassa tulostetaan vain muutokset hakemiston lopuksi
+            }
+            if (list_options.format == FORMAT_TEXT) {
+                print_batch(out, dirfd, batch);
+            } else {
+                format_batch(scratch, out, path, dirfd);
+            }
+            break;
+        case LIST_NAMES:
+            for (int i = 0; i < batch->count; i++) {
+                outbuf_puts(out, batch->entries[i].name);
+                outbuf_putc(out, '\n');
+            }
+            break;
+        case LIST_TYPES:
+            for (int i = 0; i < batch->count; i++) {
+                outbuf_putc(out, file_type_char(DTTOIF(resolve_type(dirfd, &batch->entries[i]))));
+                outbuf_putc(out, ' ');
+                outbuf_puts(out, batch->entries[i].name);
+                outbuf_putc(out, '\n');
+            }
+            break;
+    }
+    batch->count = 0;
+}
+
+// Tulostaa muutosrivin, esim. "Lisätty: polku/nimi"
+static void print_change(struct outbuf *out, const char *label, const char *path, const char *name) {
+    size_t len = strlen(path);
+
+    outbuf_puts(out, label);
+    outbuf_write(out, path, len);
+    if (len == 0 || path[len - 1] != '/') {
+        outbuf_putc(out, '/');
+    }
+    outbuf_puts(out, name);
+    outbuf_putc(out, '\n');
+}
+
+// Tulostaa poistetuiksi vanhan vedoksen hakemiston tiedostot
+static void print_removed_dir(struct outbuf *out, const struct snapshot_dir *d) {
+    const struct snapshot *since = list_options.since;
+
+    if (d == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < d->count; i++) {
+        print_change(out, "Poistettu: ", snapshot_str(since, d->path), snapshot_str(since, since->entries[d->first + i].name));
+    }
+}
+
+// Muodostaa polun path/name. Palauttaa varatun merkkijonon tai NULL (virheilmoitus tulostettu).
+static char *join_path(const char *path, const char *name) {
+    size_t len = strlen(path);
+    char *subpath = malloc(len + strlen(name) + 2);
+
+    if (subpath == NULL) {
+        perror("Error allocating path");
+        return NULL;
+    }
+    strcpy(subpath, path);
+    if (len == 0 || path[len - 1] != '/') {
+        subpath[len++] = '/';
+    }
+    strcpy(subpath + len, name);
+    return subpath;
+}
+
+// Tulostaa poistetuiksi vanhan vedoksen hakemiston path/name koko alipuun
+static void print_removed_subtree(struct outbuf *out, const char *path, const char *name) {
+    const struct snapshot *since = list_options.since;
+    size_t first, last;
+    char *subpath = join_path(path, name);
+
+    if (subpath == NULL) {
+        return;
+    }
+
+    // Hakemisto itse ja sen jälkeen alihakemistot, jotka ovat vedoksessa polun mukaan peräkkäin
+    print_removed_dir(out, snapshot_find_dir(since, subpath));
+    snapshot_subdirs(since, subpath, &first, &last);
+    for (size_t i = first; i < last; i++) {
+        print_removed_dir(out, &since->dirs[i]);
+    }
+    free(subpath);
+}
+
+// Vertaa hakemiston tiedostoja vanhaan vedokseen ja tulostaa lisätyt, poistetut ja muuttuneet tiedostot.
+// Molemmat ovat nimen mukaan järjestyksessä, joten ne käydään läpi rinnakkain.
+static void print_changes(struct outbuf *out, const char *path, const struct snapshot_dir *old, const struct snapshot_builder *b) {
+    const struct snapshot *since = list_options.since;
+    size_t nold = old != NULL ? old->count : 0;
+    size_t i = 0, j = 0;
+
+    while (i < b->count || j < nold) {
+        const struct snapshot_entry *n = i < b->count ? &b->entries[i] : NULL;
+        const struct snapshot_entry *o = j < nold ? &since->entries[old->first + j] : NULL;
+        int cmp = n == NULL ? 1 : o == NULL ? -1 : strcmp(snapshot_builder_name(b, n), snapshot_str(since, o->name));
+
+        if (cmp < 0) {
+            print_change(out, "Lisätty: ", path, snapshot_builder_name(b, n));
+            i++;
+        } else if (cmp > 0) {
+            print_change(out, "Poistettu: ", path, snapshot_str(since, o->name));
+            if (o->type == DT_DIR) {
+                print_removed_subtree(out, path, snapshot_str(since, o->name));
+            }
+            j++;
+        } else {
+            if (snapshot_entry_changed(o, n)) {
+                print_change(out, "Muuttunut: ", path, snapshot_builder_name(b, n));
+            }
+            // Hakemisto on korvattu muulla tiedostolla
+            if (o->type == DT_DIR && n->type != DT_DIR) {
+                print_removed_subtree(out, path, snapshot_str(since, o->name));
+            }
+            i++;
+            j++;
+        }
+    }
+}
+
+// Päättää hakemiston tilannevedoksen: tulostaa muutokset, lisää hakemiston uuteen vedokseen ja
+// seurantatilassa siirtää tiedostot seurattavan hakemiston vertailukohdaksi
+static void snapshot_finish(struct list_scratch *scratch, struct outbuf *out, const char *path, const struct statx *dirstx) {
+    struct watch_dir *d;
+
+    snapshot_builder_sort(&scratch->snap);
+    if (list_options.since != NULL) {
+        print_changes(out, path, scratch->snap_old, &scratch->snap);
+    }
+    if (list_options.snapshot_file != NULL) {
+        snapshot_writer_add_dir(path, dirstx, &scratch->snap);
+    }
+    if (list_options.watch && (d = watch_find_dir(path)) != NULL) {
+        watch_set_entries(d, &scratch->snap);
+    }
+}
+
+// Ottaa muuttumattoman hakemiston tiedostot vanhasta vedoksesta. Vain alihakemistojen tilatiedot haetaan
+// uudelleen, koska niiden sisältö on voinut muuttua, ja ne lisätään läpikäytäviksi. Palauttaa -1, jos
+// alihakemistoa ei löydy (hakemisto on muuttunut), jolloin hakemisto luetaan kokonaan.
+static int reuse_directory(struct list_scratch *scratch, int dirfd, const struct snapshot_dir *old, struct walk_dir *walk) {
+    const struct snapshot *since = list_options.since;
+
+    for (uint32_t i = 0; i < old->count; i++) {
+        const struct snapshot_entry *o = &since->entries[old->first + i];
+        const char *name = snapshot_str(since, o->name);
+        struct snapshot_entry *e = snapshot_builder_copy(&scratch->snap, o, name);
+
+        if (o->type == DT_DIR) {
+            struct dir_entry sub = {.name = name};
+
+            stat_entry(dirfd, &sub);
+            if (sub.error != 0) {
+                return -1;
+            }
+            snapshot_set(e, o, dirfd, name, &sub.stx);
+            if (walk != NULL) {
+                walk_add_child(walk, name);
+            }
+        }
+    }
+    return 0;
+}
+
+// Aloittaa hakemiston tilannevedoksen. Hakemiston muokkausaika luetaan ennen sisältöä, jotta lukemisen
+// aikana tehty muutos huomataan seuraavalla kerralla. Jos hakemisto ei ole muuttunut vanhan vedoksen
+// jälkeen, sen tiedostot otetaan vedoksesta lukematta hakemistoa; palauttaa silloin true.
+static bool snapshot_begin(struct list_scratch *scratch, struct outbuf *out, const char *path, int dirfd,
+                           struct statx *dirstx, struct walk_dir *walk) {
+    const struct snapshot *since = list_options.since;
+    const struct snapshot_dir *old;
+
+    snapshot_builder_reset(&scratch->snap);
+    scratch->snap_old = NULL;
+    if (statx(dirfd, "", AT_EMPTY_PATH, STATX_INO | STATX_MTIME, dirstx) == -1) {
+        perror("Error getting directory status");
+        memset(dirstx, 0, sizeof(*dirstx));  // Nollattu aika pakottaa lukemaan hakemiston seuraavalla kerralla
+    }
+    if (since == NULL) {
+        return false;
+    }
+
+    // Hakemisto on muuttumaton, jos se on sama i-solmu samalla muokkausajalla. Vedoksen aloitussekunnilla
+    // (tai juuri ennen) muokattu hakemisto luetaan aina, koska sitä on voitu muuttaa saman aikaleiman aikana
+    // vedoksen lukemisen jälkeen.
+    old = scratch->snap_old = snapshot_find_dir(since, path);
+    if (old == NULL || old->ino != dirstx->stx_ino || old->dev != makedev(dirstx->stx_dev_major, dirstx->stx_dev_minor) ||
+        old->mtime_sec != dirstx->stx_mtime.tv_sec || old->mtime_nsec != dirstx->stx_mtime.tv_nsec ||
+        old->mtime_sec >= since->header->started - 1) {
+        atomic_fetch_add_explicit(&dirs_rescanned, 1, memory_order_relaxed);
+        return false;
+    }
+    if (reuse_directory(scratch, dirfd, old, walk) == -1) {
+        snapshot_builder_reset(&scratch->snap);
+        atomic_fetch_add_explicit(&dirs_rescanned, 1, memory_order_relaxed);
+        return false;
+    }
+
+    atomic_fetch_add_explicit(&dirs_reused, 1, memory_order_relaxed);
+    snapshot_finish(scratch, out, path, dirstx);
+    return true;
+}
+
+// Avaa hakemiston ja listaa sen sisältämät tiedostot ja niiden tiedot out-virtaan. Hakemisto luetaan
+// getdents64-kutsulla suuressa puskurissa, ja kaikki tiedostokohtaiset kutsut tehdään hakemiston
+// kuvaajan suhteen, joten tiedostopolkuja ei muodosteta eikä niiden pituutta rajoiteta. Jos walk on
+// annettu, alihakemistot lisätään rinnakkaisen läpikäynnin jonoon ja tulostuksen kirjoittaa läpikäynti;
+// muuten tulostus kirjoitetaan stdout-kuvaajaan suurina paloina erien välissä.
+void list_directory(const char *path, struct outbuf *out, struct walk_dir *walk) {
+    struct list_scratch *scratch;          // Säikeen työpuskurit
+    struct dir_batch *batch;               // Käsiteltävä erä
+    struct dirreader reader;               // getdents64-lukija
+    const struct linux_dirent64 *entry;    // Tiedosto/hakemistosisältö lukupuskurissa
+    struct statx dirstx;                   // Hakemiston omat tilatiedot tilannevedosta varten
+    bool snapshot;                         // Kerätäänkö tilannevedosta
+    ssize_t len;                           // Luetun erän koko
+    int dfd;                               // Hakemiston tiedostokuvaaja
+
+    // Yritä avata annettu hakemisto
+    dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) {
+        perror("Error opening directory");
+        return;
+    }
+
+    scratch = get_scratch();
+    if (scratch == NULL) {
+        perror("Error allocating directory buffers");
+        close(dfd);
+        return;
+    }
+    batch = &scratch->batch;
+    batch->count = 0;
+
+    // Seurantatilassa hakemisto merkitään ennen lukemista, jotta lukemisen aikana tehdyt muutokset huomataan
+    if (list_options.watch) {
+        watch_add_dir(path);
+    }
+
+    // Muuttumatonta hakemistoa ei tarvitse lukea lainkaan
+    snapshot = list_options.snapshot_file != NULL || list_options.since != NULL || list_options.watch;
+    if (snapshot && snapshot_begin(scratch, out, path, dfd, &dirstx, walk)) {
+        close(dfd);
+        return;
+    }
+
+    // Lue hakemiston sisältö puskurillinen kerrallaan
+    dirreader_init(&reader, dfd, scratch->dirbuf, list_options.dirbuf_size);
+    while ((len = dirreader_fill(&reader)) > 0) {
+        while ((entry = dirreader_next(&reader)) != NULL) {
+            struct dir_entry *e;
+
+            // Ohita '.' ja '..' hakemistot
+            if (dirreader_is_dot(entry->d_name)) {
+                continue;
+            }
+
+            e = &batch->entries[batch->count++];
+            e->name = entry->d_name;
+            e->type = entry->d_type;
+
+            // Lisää alihakemisto rinnakkaisen läpikäynnin jonoon heti, jotta muut säikeet pääsevät töihin
+            // (symbolisia linkkejä ei seurata, jotta läpikäynti ei voi jäädä kiertämään silmukkaa)
+            if (walk != NULL && resolve_type(dfd, e) == DT_DIR) {
+                walk_add_child(walk, e->name);
+            }
+
+            if (batch->count == batch->cap) {
+                flush_batch(scratch, out, path, dfd);
+            }
+        }
+
+        // Erän nimet osoittavat lukupuskuriin, joten ne käsitellään ennen seuraavaa lukua
+        flush_batch(scratch, out, path, dfd);
+
+        // Suoratulostuksessa kirjoita, kun puskuriin on kertynyt tarpeeksi
+        if (walk == NULL && outbuf_size(out) >= OUTBUF_FLUSH_THRESHOLD) {
+            outbuf_flush(out, STDOUT_FILENO);
+        }
+    }
+
+    if (len == -1) {
+        perror("Error reading directory");
+    }
 
-        printf("\n");
+    if (snapshot) {
+        snapshot_finish(scratch, out, path, &dirstx);
     }
 
     // Sulje lopuksi hakemisto
-    closedir(dir);
+    close(dfd);
+}
+
+// Rinnakkaisen läpikäynnin käsittelijä: tulostaa hakemiston otsikon ja sisällön
+static void visit_directory(struct walk_dir *dir, struct outbuf *out) {
+    // Koneluettavissa muodoissa ja muutostilassa hakemisto on jokaisella rivillä, joten otsakkeita ei tulosteta
+    if (list_options.format != FORMAT_TEXT || list_options.since != NULL) {
+        list_directory(walk_dir_path(dir), out, dir);
+        return;
+    }
+
+    outbuf_lit(out, "Hakemisto: ");
+    outbuf_puts(out, walk_dir_path(dir));
+    outbuf_lit(out, "\n\n");
+    list_directory(walk_dir_path(dir), out, dir);
+
+    // Nimi- ja tyyppitiloissa hakemistot erotetaan tyhjällä rivillä
+    if (list_options.mode != LIST_FULL) {
+        outbuf_putc(out, '\n');
+    }
+}
+
+// Seurantatilan työtilat (muutokset käsitellään pääsäikeessä yksi hakemisto kerrallaan)
+static struct {
+    struct snapshot_builder found;    // Käsiteltävät nimet (muuttuneet nimet tai koko hakemisto)
+    struct snapshot_builder updates;  // Käsiteltyjen nimien uudet tiedot
+    struct snapshot_builder next;     // Hakemiston uudet tiedostot
+    char **pending;                   // Uudet alihakemistot, jotka luetaan ja lisätään seurantaan
+    size_t npending;
+    size_t pending_cap;
+    bool recursive;                   // Seurataanko uusia alihakemistoja
+} watch_work;
+
+// Tulostaa poistetun tiedoston valitussa muodossa
+static void print_removed(struct outbuf *out, const char *path, const char *name) {
+    if (list_options.format == FORMAT_TEXT) {
+        print_change(out, "Poistettu: ", path, name);
+    } else {
+        format_removed(out, path, name);
+    }
+}
+
+// watch_remove_tree-funktion käsittelijä: tulostaa poistuvan hakemiston tiedostot poistetuiksi
+static void print_removed_watch_dir(struct watch_dir *d, void *arg) {
+    for (size_t i = 0; i < d->entries.count; i++) {
+        print_removed(arg, d->path, snapshot_builder_name(&d->entries, &d->entries.entries[i]));
+    }
+}
+
+// Poistaa hakemiston path/name alipuun seurannasta ja tulostaa sen tiedostot poistetuiksi
+static void watch_remove_subtree(struct outbuf *out, const char *path, const char *name) {
+    char *subpath = join_path(path, name);
+
+    if (subpath != NULL) {
+        watch_remove_tree(subpath, print_removed_watch_dir, out);
+        free(subpath);
+    }
+}
+
+// Lisää uuden alihakemiston path/name luettavaksi
+static void watch_add_pending(const char *path, const char *name) {
+    char *subpath = join_path(path, name);
+
+    if (subpath == NULL) {
+        return;
+    }
+    if (watch_work.npending == watch_work.pending_cap) {
+        size_t cap = watch_work.pending_cap ? watch_work.pending_cap * 2 : 16;
+        char **pending = realloc(watch_work.pending, cap * sizeof(*pending));
+        if (pending == NULL) {
+            perror("Error allocating watch queue");
+            free(subpath);
+            return;
+        }
+        watch_work.pending = pending;
+        watch_work.pending_cap = cap;
+    }
+    watch_work.pending[watch_work.npending++] = subpath;
+}
+
+// Lukee hakemiston kaikki nimet ja tyypit kerääjään. Palauttaa 0 tai -1.
+static int watch_read_names(struct list_scratch *scratch, int dfd, struct snapshot_builder *found) {
+    const struct linux_dirent64 *entry;
+    struct dirreader reader;
+    ssize_t len;
+
+    dirreader_init(&reader, dfd, scratch->dirbuf, list_options.dirbuf_size);
+    while ((len = dirreader_fill(&reader)) > 0) {
+        while ((entry = dirreader_next(&reader)) != NULL) {
+            if (!dirreader_is_dot(entry->d_name)) {
+                snapshot_builder_add(found, entry->d_name)->type = entry->d_type;
+            }
+        }
+    }
+    if (len == -1) {
+        perror("Error reading directory");
+        return -1;
+    }
+    snapshot_builder_sort(found);
+    return 0;
+}
+
+// Vertaa erän tilatietoja hakemiston edellisiin tietoihin, tulostaa muuttuneet ja poistetut tiedostot
+// ja kerää uudet tiedot. Alihakemiston tilalle tullut muu tiedosto poistaa sen alipuun seurannasta.
+static void watch_update_batch(struct list_scratch *scratch, struct watch_dir *d, int dfd, struct outbuf *out, bool *header) {
+    struct dir_batch *batch = &scratch->batch;
+    int changed = 0;
+
+    for (int i = 0; i < batch->count; i++) {
+        struct dir_entry *e = &batch->entries[i];
+        const struct snapshot_entry *old = snapshot_builder_find(&d->entries, e->name);
+        struct snapshot_entry *s;
+
+        if (e->error == ENOENT) {
+            if (old != NULL) {
+                print_removed(out, d->path, e->name);
+                if (old->type == DT_DIR) {
+                    watch_remove_subtree(out, d->path, e->name);
+                }
+            }
+            continue;
+        }
+        if (e->error != 0) {
+            errno = e->error;
+            perror("Error getting file status");
+            if (old != NULL) {
+                snapshot_builder_copy(&watch_work.updates, old, e->name);
+            }
+            continue;
+        }
+
+        s = snapshot_builder_add(&watch_work.updates, e->name);
+        s->type = resolve_type(dfd, e);
+        snapshot_set(s, old, dfd, e->name, &e->stx);
+
+        if (old != NULL && old->type == DT_DIR && (s->type != DT_DIR || s->ino != old->ino)) {
+            watch_remove_subtree(out, d->path, e->name);
+        }
+        if (watch_work.recursive && s->type == DT_DIR && (old == NULL || old->type != DT_DIR || s->ino != old->ino)) {
+            watch_add_pending(d->path, e->name);
+        }
+
+        // Tulostetaan vain uudet ja muuttuneet tiedostot
+        if (old == NULL || snapshot_entry_changed(old, s)) {
+            batch->entries[changed++] = *e;
+        }
+    }
+
+    batch->count = changed;
+    if (changed == 0) {
+        return;
+    }
+    if (list_options.format != FORMAT_TEXT) {
+        format_batch(scratch, out, d->path, dfd);
+        return;
+    }
+    if (!*header) {
+        outbuf_lit(out, "Hakemisto: ");
+        outbuf_puts(out, d->path);
+        outbuf_lit(out, "\n\n");
+        *header = true;
+    }
+    print_batch(out, dfd, batch);
+}
+
+// Yhdistää hakemiston käsittelemättömät vanhat tiedostot ja käsiteltyjen nimien uudet tiedot (molemmat
+// nimen mukaan järjestyksessä) hakemiston uusiksi tiedostoiksi
+static void watch_merge_entries(struct watch_dir *d) {
+    const struct snapshot_builder *old = &d->entries;
+    const struct snapshot_builder *found = &watch_work.found;
+    const struct snapshot_builder *updates = &watch_work.updates;
+    struct snapshot_builder *next = &watch_work.next;
+    size_t i = 0, j = 0, k = 0;
+
+    snapshot_builder_reset(next);
+    while (i < old->count || j < updates->count) {
+        const char *on = NULL;
+        const char *un = j < updates->count ? snapshot_builder_name(updates, &updates->entries[j]) : NULL;
+
+        // Käsitellyn nimen vanhat tiedot korvautuvat (tai poistuvat)
+        if (i < old->count) {
+            on = snapshot_builder_name(old, &old->entries[i]);
+            while (k < found->count && strcmp(snapshot_builder_name(found, &found->entries[k]), on) < 0) {
+                k++;
+            }
+            if (k < found->count && strcmp(snapshot_builder_name(found, &found->entries[k]), on) == 0) {
+                i++;
+                continue;
+            }
+        }
+
+        if (un == NULL || (on != NULL && strcmp(on, un) < 0)) {
+            snapshot_builder_copy(next, &old->entries[i++], on);
+        } else {
+            snapshot_builder_copy(next, &updates->entries[j++], un);
+        }
+    }
+    watch_set_entries(d, next);
+}
+
+// Käsittelee muuttuneen hakemiston. Vain muuttuneiden nimien tilatiedot haetaan; kokonaan luettavan
+// hakemiston vanhat tiedostot, joita ei enää löydy, on poistettu.
+static void watch_update(struct watch_dir *d, char **names, size_t count, bool rescan, struct outbuf *out) {
+    struct list_scratch *scratch = get_scratch();
+    struct snapshot_builder *found = &watch_work.found;
+    bool header = false;  // Onko hakemiston otsikko tulostettu
+    int dfd;
+
+    if (scratch == NULL) {
+        perror("Error allocating directory buffers");
+        return;
+    }
+
+    // Poistettu hakemisto käsitellään ylähakemiston muutoksena
+    dfd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) {
+        if (errno != ENOENT && errno != ENOTDIR) {
+            perror("Error opening directory");
+        }
+        return;
+    }
+
+    snapshot_builder_reset(found);
+    snapshot_builder_reset(&watch_work.updates);
+    if (rescan) {
+        size_t k = 0;
+
+        if (watch_read_names(scratch, dfd, found) == -1) {
+            close(dfd);
+            return;
+        }
+        for (size_t i = 0; i < d->entries.count; i++) {
+            const struct snapshot_entry *old = &d->entries.entries[i];
+            const char *name = snapshot_builder_name(&d->entries, old);
+
+            while (k < found->count && strcmp(snapshot_builder_name(found, &found->entries[k]), name) < 0) {
+                k++;
+            }
+            if (k == found->count || strcmp(snapshot_builder_name(found, &found->entries[k]), name) != 0) {
+                print_removed(out, d->path, name);
+                if (old->type == DT_DIR) {
+                    watch_remove_subtree(out, d->path, name);
+                }
+            }
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            snapshot_builder_add(found, names[i])->type = DT_UNKNOWN;
+        }
+    }
+
+    // Hae tilatiedot erissä kuten listauksessa
+    for (size_t base = 0; base < found->count; base += scratch->batch.cap) {
+        struct dir_batch *batch = &scratch->batch;
+
+        batch->count = 0;
+        for (size_t i = base; i < found->count && batch->count < batch->cap; i++) {
+            struct dir_entry *e = &batch->entries[batch->count++];
+            e->name = snapshot_builder_name(found, &found->entries[i]);
+            e->type = found->entries[i].type;
+        }
+        stat_batch(scratch, dfd, batch);
+        watch_update_batch(scratch, d, dfd, out, &header);
+    }
+    close(dfd);
+
+    // Kokonaan luetun hakemiston tiedostot ovat kaikki uusia tietoja
+    if (rescan) {
+        watch_set_entries(d, &watch_work.updates);
+    } else {
+        watch_merge_entries(d);
+    }
+}
+
+// Seuraa muutoksia listauksen jälkeen. Muutokset käsitellään, kun tapahtumat ovat tauonneet, joten
+// esim. suuren hakemiston vaihtava git checkout käsitellään yhtenä kertana nimi kerrallaan tai
+// hakemistoittain luettuna. Palaa vain virheen sattuessa.
+static int watch_loop(int debounce_ms) {
+    struct outbuf out;
+    int status = 0;
+
+    outbuf_init(&out);
+    fprintf(stderr, "Seurataan muutoksia (%s)\n", watch_backend_name());
+    while (status == 0 && watch_wait(debounce_ms) == 0) {
+        struct watch_dir *d;
+        char **names;
+        size_t count;
+        bool rescan;
+
+        while ((d = watch_next_dirty(&names, &count, &rescan)) != NULL) {
+            watch_update(d, names, count, rescan, &out);
+
+            // Uudet alihakemistot luetaan kokonaan; niiden omat alihakemistot lisätään samaan jonoon
+            while (watch_work.npending > 0) {
+                char *path = watch_work.pending[--watch_work.npending];
+                struct watch_dir *sub = watch_add_dir(path);
+
+                if (sub != NULL) {
+                    watch_update(sub, NULL, 0, true, &out);
+                }
+                free(path);
+            }
+            if (outbuf_size(&out) >= OUTBUF_FLUSH_THRESHOLD && (status = outbuf_flush(&out, STDOUT_FILENO)) == -1) {
+                break;
+            }
+        }
+        if (status == 0) {
+            status = outbuf_flush(&out, STDOUT_FILENO);
+        }
+        if (status == -1) {
+            perror("Error writing output");
+        }
+    }
+    outbuf_free(&out);
+    return -1;
+}
+
+// Tulostaa tilastoyhteenvedon virhevirtaan
+static void print_stats(void) {
+    struct idcache_stats users, groups;
+
+    idcache_get_stats(&users, &groups);
+    fprintf(stderr, "Tilastot:\n");
+    fprintf(stderr, "  - Käyttäjänimet: %lu osumaa, %lu hakua NSS:ltä (osumaprosentti %.1f %%), %lu tunnistetta\n", users.hits,
+            users.misses, users.hits + users.misses ? 100.0 * users.hits / (users.hits + users.misses) : 0.0, users.entries);
+    fprintf(stderr, "  - Ryhmänimet: %lu osumaa, %lu hakua NSS:ltä (osumaprosentti %.1f %%), %lu tunnistetta\n", groups.hits,
+            groups.misses, groups.hits + groups.misses ? 100.0 * groups.hits / (groups.hits + groups.misses) : 0.0, groups.entries);
+    if (list_options.since != NULL) {
+        fprintf(stderr, "  - Tilannevedos: %lu hakemistoa ennallaan, %lu luettu uudelleen\n", atomic_load(&dirs_reused),
+                atomic_load(&dirs_rescanned));
+    }
+}
+
+// Lukee koon tavuina; sallii k- ja M-päätteet (esim. 256k, 4M). Palauttaa 0, jos koko on virheellinen.
+static size_t parse_size(const char *arg) {
+    char *end;
+    unsigned long long size = strtoull(arg, &end, 10);
+
+    if (end == arg) {
+        return 0;
+    }
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+    return *end == '\0' && size <= INT_MAX ? size : 0;
+}
+
+// Tulostaa ohjelman käyttöohjeen
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Käyttö: %s [--recursive] [--threads N] [--unordered] [--names-only | --type-only]\n"
+            "           [--dirbuf KOKO] [--engine=sync|uring] [--queue-depth N]\n"
+            "           [--preload-ids] [--stats] [--time=locale|iso|epoch]\n"
+            "           [--format=text|ndjson|csv|bin] [--snapshot TIEDOSTO] [--since TIEDOSTO]\n"
+            "           [--watch[=fanotify|inotify]] [--debounce MS]\n"
+            "           <hakemistopolku>\n",
+            program);
 }
 
 int main(int argc, char *argv[]) {
+    bool recursive = false;                      // Käydäänkö alihakemistot läpi
+    bool ordered = true;                         // Deterministinen tulostusjärjestys
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);  // Säikeiden määrä, oletuksena prosessorien määrä
+    bool preload_ids = false;                    // Ladataanko käyttäjät ja ryhmät välimuistiin etukäteen
+    bool stats = false;                          // Tulostetaanko tilastot lopuksi
+    enum time_style time_style = TIME_LOCALE;    // Aikaleimojen muoto
+    const char *since_file = NULL;               // Vertailtava tilannevedos
+    struct snapshot since;                       // Avattu vertailtava vedos
+    enum watch_backend watch_backend = WATCH_AUTO;  // Muutosten seurantatapa
+    int debounce = WATCH_DEFAULT_DEBOUNCE;       // Muutosten tauon odotus millisekunteina
+    int status = EXIT_SUCCESS;                   // Ohjelman paluuarvo
+    int opt;
+
+    // Komentoriviltä luettavat valinnat getopt_long-funktiolle
+    static const struct option long_options[] = {
+        {"recursive", no_argument, NULL, 'r'},
+        {"threads", required_argument, NULL, 't'},
+        {"unordered", no_argument, NULL, 'u'},
+        {"names-only", no_argument, NULL, 'n'},
+        {"type-only", no_argument, NULL, 'T'},
+        {"dirbuf", required_argument, NULL, 'b'},
+        {"engine", required_argument, NULL, 'e'},
+        {"queue-depth", required_argument, NULL, 'q'},
+        {"preload-ids", no_argument, NULL, 'P'},
+        {"stats", no_argument, NULL, 's'},
+        {"time", required_argument, NULL, 'M'},
+        {"format", required_argument, NULL, 'f'},
+        {"snapshot", required_argument, NULL, 'S'},
+        {"since", required_argument, NULL, 'I'},
+        {"watch", optional_argument, NULL, 'W'},
+        {"debounce", required_argument, NULL, 'D'},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((opt = getopt_long(argc, argv, "rt:unTb:e:q:PsM:f:S:I:W::D:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'r':
+                recursive = true;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                if (threads < 1) {
+                    fprintf(stderr, "Säikeiden määrän täytyy olla vähintään 1\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'u':
+                ordered = false;
+                break;
+            case 'n':
+                list_options.mode = LIST_NAMES;
+                break;
+            case 'T':
+                list_options.mode = LIST_TYPES;
+                break;
+            case 'b':
+                list_options.dirbuf_size = parse_size(optarg);
+                if (list_options.dirbuf_size < DIRREAD_MIN_SIZE) {
+                    fprintf(stderr, "Hakemistopuskurin koon täytyy olla vähintään %d tavua\n", DIRREAD_MIN_SIZE);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'e':
+                if (strcmp(optarg, "sync") == 0) {
+                    list_options.engine = ENGINE_SYNC;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    list_options.engine = ENGINE_URING;
+                } else {
+                    fprintf(stderr, "Tuntematon moottori: %s (sync tai uring)\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                list_options.queue_depth = atoi(optarg);
+                if (list_options.queue_depth < 1 || list_options.queue_depth > URING_MAX_DEPTH) {
+                    fprintf(stderr, "Jonon syvyyden täytyy olla väliltä 1-%d\n", URING_MAX_DEPTH);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'P':
+                preload_ids = true;
+                break;
+            case 's':
+                stats = true;
+                break;
+            case 'M':
+                if (strcmp(optarg, "locale") == 0) {
+                    time_style = TIME_LOCALE;
+                } else if (strcmp(optarg, "iso") == 0) {
+                    time_style = TIME_ISO;
+                } else if (strcmp(optarg, "epoch") == 0) {
+                    time_style = TIME_EPOCH;
+                } else {
+                    fprintf(stderr, "Tuntematon aikamuoto: %s (locale, iso tai epoch)\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    list_options.format = FORMAT_TEXT;
+                } else if (strcmp(optarg, "ndjson") == 0) {
+                    list_options.format = FORMAT_NDJSON;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    list_options.format = FORMAT_CSV;
+                } else if (strcmp(optarg, "bin") == 0) {
+                    list_options.format = FORMAT_BIN;
+                } else {
+                    fprintf(stderr, "Tuntematon tulostusmuoto: %s (text, ndjson, csv tai bin)\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                list_options.snapshot_file = optarg;
+                break;
+            case 'I':
+                since_file = optarg;
+                break;
+            case 'W':
+                list_options.watch = true;
+                if (optarg == NULL) {
+                    watch_backend = WATCH_AUTO;
+                } else if (strcmp(optarg, "fanotify") == 0) {
+                    watch_backend = WATCH_FANOTIFY;
+                } else if (strcmp(optarg, "inotify") == 0) {
+                    watch_backend = WATCH_INOTIFY;
+                } else {
+                    fprintf(stderr, "Tuntematon seurantatapa: %s (fanotify tai inotify)\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'D':
+                debounce = atoi(optarg);
+                if (debounce < 0 || debounce > 60000) {
+                    fprintf(stderr, "Odotusajan täytyy olla väliltä 0-60000 ms\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
     // Tarkista, että ohjelma saa oikean määrän parametreja
-    if (argc != 2) {
+    if (argc - optind != 1) {
         fprintf(stderr, "Väärä määrä annettuja parametreja\n");
-        fprintf(stderr, "Käyttö: %s <hakemistopolku>\n", argv[0]);
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Koneluettavat muodot, tilannevedokset ja seuranta sisältävät aina kaikki tiedot
+    if ((list_options.format != FORMAT_TEXT || list_options.snapshot_file != NULL || since_file != NULL || list_options.watch) &&
+        list_options.mode != LIST_FULL) {
+        fprintf(stderr, "--names-only ja --type-only toimivat vain tekstimuodossa ilman tilannevedosta ja seurantaa\n");
+        return EXIT_FAILURE;
+    }
+    if (list_options.watch && list_options.format == FORMAT_BIN) {
+        fprintf(stderr, "--watch tulostaa muutokset vain teksti-, NDJSON- tai CSV-muodossa\n");
+        return EXIT_FAILURE;
+    }
+    if (since_file != NULL && list_options.format != FORMAT_TEXT) {
+        fprintf(stderr, "--since tulostaa muutokset vain tekstimuodossa\n");
         return EXIT_FAILURE;
     }
 
-    // Kutsu list_directory funktiota annetulla hakemistopolulla
-    list_directory(argv[1]);
+    // Avaa vanha tilannevedos; hakemistojen polut ovat vertailukelpoisia vain samasta juuresta
+    if (since_file != NULL) {
+        if (snapshot_open(&since, since_file) == -1) {
+            return EXIT_FAILURE;
+        }
+        if (strcmp(snapshot_str(&since, since.header->root), argv[optind]) != 0) {
+            fprintf(stderr, "Tilannevedos %s on otettu hakemistosta %s\n", since_file, snapshot_str(&since, since.header->root));
+            snapshot_close(&since);
+            return EXIT_FAILURE;
+        }
+        list_options.since = &since;
+    }
+    if (list_options.snapshot_file != NULL) {
+        snapshot_writer_init(argv[optind]);
+    }
+    if (list_options.snapshot_file != NULL || since_file != NULL || list_options.watch) {
+        list_options.stat_mask = STATX_SNAPSHOT_MASK;
+    }
+
+    // Seuranta avataan ennen listausta, jotta hakemistot merkitään ennen niiden lukemista
+    if (list_options.watch) {
+        if (watch_init(watch_backend) == -1) {
+            return EXIT_FAILURE;
+        }
+        watch_work.recursive = recursive;
+    }
+
+    // Selvitä aikavyöhyke ja päiväysformaatti kerran ennen säikeiden luontia
+    timefmt_init(time_style);
+
+    // Lataa käyttäjä- ja ryhmänimet välimuistiin etukäteen, jos pyydetty
+    if (preload_ids) {
+        idcache_preload();
+    }
+
+    // Kirjoita koneluettavan muodon otsake ennen hakemistojen tulostusta
+    format_init(list_options.format);
+    if (list_options.format != FORMAT_TEXT) {
+        struct outbuf header;
+
+        outbuf_init(&header);
+        format_write_header(&header);
+        if (outbuf_flush(&header, STDOUT_FILENO) == -1) {
+            perror("Error writing output");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Rekursiivisessa tilassa hakemistopuu käydään läpi säiepoolilla
+    if (recursive) {
+        if (walk_tree(argv[optind], threads, ordered, visit_directory) == -1) {
+            status = EXIT_FAILURE;
+        }
+    } else {
+        struct outbuf out;  // Tulostuspuskuri
+
+        // Kutsu list_directory funktiota annetulla hakemistopolulla ja kirjoita loput tulostuksesta
+        outbuf_init(&out);
+        list_directory(argv[optind], &out, NULL);
+        if (outbuf_flush(&out, STDOUT_FILENO) == -1) {
+            perror("Error writing output");
+            status = EXIT_FAILURE;
+        }
+    }
+
+    // Tallenna uusi tilannevedos (vanha voi olla sama tiedosto, se korvataan vasta valmiilla vedoksella)
+    if (list_options.snapshot_file != NULL && snapshot_writer_finish(list_options.snapshot_file) == -1) {
+        status = EXIT_FAILURE;
+    }
+
+    if (stats) {
+        print_stats();
+    }
+
+    // Jää seuraamaan muutoksia (kunnes ohjelma lopetetaan tai tulostus epäonnistuu)
+    if (list_options.watch && status == EXIT_SUCCESS && watch_loop(debounce) == -1) {
+        status = EXIT_FAILURE;
+    }
+
+    if (list_options.since != NULL) {
+        snapshot_close(list_options.since);
+    }
 
-    return EXIT_SUCCESS;
+    return status;
 }
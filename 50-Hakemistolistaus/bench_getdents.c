@@ -0,0 +1,155 @@
+/*
+ * bench_getdents
+ *
+ * Mikrobenchmark, joka vertaa hakemiston lukemista readdir-silmukalla (kuten listaus teki aiemmin)
+ * ja suoraan getdents64-kutsulla eri puskurikoilla. Molemmat lukevat jokaisen sisällön nimen ja tyypin.
+ *
+ * Käyttö: ./bench_getdents [sisältöjen määrä] [toistot] [hakemistopolku]
+ *   Jos hakemistopolkua ei anneta, luodaan väliaikainen hakemisto annetulla määrällä tyhjiä tiedostoja.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dirread.h"
+
+static volatile unsigned long sink;  // Tyyppien summa, ettei kääntäjä poista lukusilmukoita
+
+// Nykyinen aika nanosekunteina
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Lukee hakemiston readdir-silmukalla ja palauttaa sisältöjen määrän
+static long read_readdir(const char *path, unsigned long *types) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    long count = 0;
+
+    if (dir == NULL) {
+        perror("Error opening directory");
+        exit(EXIT_FAILURE);
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        *types += entry->d_type;
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Lukee hakemiston getdents64-lukijalla ja palauttaa sisältöjen määrän
+static long read_getdents(const char *path, char *buf, size_t size, unsigned long *types) {
+    struct dirreader reader;
+    const struct linux_dirent64 *entry;
+    long count = 0;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd == -1) {
+        perror("Error opening directory");
+        exit(EXIT_FAILURE);
+    }
+    dirreader_init(&reader, fd, buf, size);
+    while (dirreader_fill(&reader) > 0) {
+        while ((entry = dirreader_next(&reader)) != NULL) {
+            if (dirreader_is_dot(entry->d_name)) {
+                continue;
+            }
+            *types += entry->d_type;
+            count++;
+        }
+    }
+    close(fd);
+    return count;
+}
+
+// Tulostaa yhden mittauksen tuloksen
+static void report(const char *name, long entries, int repeat, double ns, double base) {
+    printf("%-22s %10.1f ns/sisältö %14.0f sisältöä/s %7.2fx\n", name, ns / (entries * (double)repeat),
+           entries * (double)repeat * 1e9 / ns, base / ns);
+}
+
+int main(int argc, char *argv[]) {
+    long count = argc > 1 ? atol(argv[1]) : 100000;  // Luotavien sisältöjen määrä
+    int repeat = argc > 2 ? atoi(argv[2]) : 20;      // Toistojen määrä
+    char tmpdir[] = "/tmp/bench_getdents.XXXXXX";  // Väliaikainen hakemisto
+    const char *path = argc > 3 ? argv[3] : NULL;   // Luettava hakemisto
+    static const size_t sizes[] = {32 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+    unsigned long types = 0;
+    long entries;
+    double start, base;
+    char *buf;
+
+    // Luo väliaikainen hakemisto tyhjine tiedostoineen
+    if (path == NULL) {
+        path = mkdtemp(tmpdir);
+        if (path == NULL) {
+            perror("Error creating directory");
+            return EXIT_FAILURE;
+        }
+        int dfd = open(path, O_RDONLY | O_DIRECTORY);
+        for (long i = 0; i < count; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "tiedosto%ld", i);
+            close(openat(dfd, name, O_CREAT | O_WRONLY, 0644));
+        }
+        close(dfd);
+    }
+
+    buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    if (buf == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    // Lämmitä välimuistit ennen mittauksia
+    entries = read_readdir(path, &types);
+    printf("Hakemisto %s: %ld sisältöä, %d toistoa\n", path, entries, repeat);
+
+    start = now_ns();
+    for (int i = 0; i < repeat; i++) {
+        read_readdir(path, &types);
+    }
+    base = now_ns() - start;
+    report("readdir", entries, repeat, base, base);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        char name[32];
+
+        start = now_ns();
+        for (int i = 0; i < repeat; i++) {
+            read_getdents(path, buf, sizes[s], &types);
+        }
+        snprintf(name, sizeof(name), "getdents64 %zu KiB", sizes[s] / 1024);
+        report(name, entries, repeat, now_ns() - start, base);
+    }
+
+    // Poista väliaikainen hakemisto
+    if (argc <= 3) {
+        int dfd = open(path, O_RDONLY | O_DIRECTORY);
+        for (long i = 0; i < count; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "tiedosto%ld", i);
+            unlinkat(dfd, name, 0);
+        }
+        close(dfd);
+        rmdir(path);
+    }
+
+    free(buf);
+    sink = types;
+    return EXIT_SUCCESS;
+}
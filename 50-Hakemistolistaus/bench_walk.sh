@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# bench_walk.sh
+#
+# Mittaa rekursiivisen listauksen läpäisykyvyn eri säikeiden määrillä.
+#
+# Käyttö: ./bench_walk.sh [hakemistopolku] [toistot]
+#   Jos hakemistopolkua ei anneta, luodaan väliaikainen synteettinen hakemistopuu
+#   (BENCH_DIRS hakemistoa kahdella tasolla, BENCH_FILES tiedostoa kussakin).
+
+set -e
+
+PROGRAM=./50-Hakemistolistaus
+ROOT=$1
+REPEAT=${2:-3}
+MAXTHREADS=$(nproc)
+
+# Luo synteettinen hakemistopuu, jos polkua ei annettu
+if [ -z "$ROOT" ]; then
+    ROOT=$(mktemp -d)
+    trap 'rm -rf "$ROOT"' EXIT
+    dirs=${BENCH_DIRS:-32}
+    files=${BENCH_FILES:-200}
+    for a in $(seq "$dirs"); do
+        for b in $(seq "$dirs"); do
+            mkdir -p "$ROOT/d$a/e$b"
+            (cd "$ROOT/d$a/e$b" && seq "$files" | xargs touch)
+        done
+    done
+fi
+
+# Laske tiedostojen määrä kerran läpäisykyvyn laskemista varten
+entries=$($PROGRAM --recursive --threads 1 "$ROOT" | grep -c '^Tiedosto: ')
+echo "Hakemistopuu: $ROOT ($entries tiedostoa), prosessoreita: $MAXTHREADS"
+printf '%8s %12s %14s %8s\n' säikeet aika_ms tiedostoa/s skaalaus
+
+# Säikeiden määrät 1, 2, 4, ... aina kaksinkertaiseen prosessorimäärään asti
+threads=1
+base=
+while [ "$threads" -le $((MAXTHREADS * 2)) ]; do
+    best=
+    for i in $(seq "$REPEAT"); do
+        start=$(date +%s%N)
+        $PROGRAM --recursive --unordered --threads "$threads" "$ROOT" > /dev/null
+        end=$(date +%s%N)
+        ms=$(((end - start) / 1000000))
+        if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+            best=$ms
+        fi
+    done
+    [ "$best" -eq 0 ] && best=1
+    [ -z "$base" ] && base=$best
+    awk -v t="$threads" -v ms="$best" -v n="$entries" -v b="$base" \
+        'BEGIN { printf "%8d %12d %14.0f %7.2fx\n", t, ms, n * 1000 / ms, b / ms }'
+    threads=$((threads * 2))
+done
@@ -0,0 +1,29 @@
+/*
+ * dirread.c
+ *
+ * getdents64-pohjainen hakemistonlukija. glibc:n readdir lukee myös getdents64-kutsulla, mutta
+ * pienellä (32 KiB) puskurilla ja palauttaa sisällöt yksi kerrallaan funktiokutsun kautta.
+ */
+
+#define _GNU_SOURCE
+
+#include "dirread.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+void dirreader_init(struct dirreader *r, int fd, char *buf, size_t size) {
+    r->fd = fd;
+    r->buf = buf;
+    r->size = size;
+    r->pos = 0;
+    r->end = 0;
+}
+
+ssize_t dirreader_fill(struct dirreader *r) {
+    long len = syscall(SYS_getdents64, r->fd, r->buf, r->size);
+
+    r->pos = 0;
+    r->end = len > 0 ? (size_t)len : 0;
+    return len;
+}
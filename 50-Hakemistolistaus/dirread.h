@@ -0,0 +1,59 @@
+/*
+ * dirread.h
+ *
+ * Hakemiston lukeminen suoraan getdents64-systeemikutsulla isoon puskuriin. Sisällöt käsitellään
+ * puskurissa paikallaan, joten nimiä ei kopioida, ja yksi systeemikutsu palauttaa tuhansia sisältöjä.
+ */
+
+#ifndef DIRREAD_H
+#define DIRREAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define DIRREAD_DEFAULT_SIZE (256 * 1024)  // Oletuspuskurin koko tavuina
+#define DIRREAD_MIN_SIZE 4096              // Pienin sallittu puskuri (yksi sisältö mahtuu aina)
+
+// Ytimen palauttama hakemistosisältö (linux_dirent64, ks. getdents64(2))
+struct linux_dirent64 {
+    uint64_t d_ino;           // Inode-numero
+    int64_t d_off;            // Seuraavan sisällön sijainti
+    unsigned short d_reclen;  // Tämän sisällön pituus puskurissa
+    unsigned char d_type;     // Tiedoston tyyppi (DT_*) tai DT_UNKNOWN
+    char d_name[];            // Nollaan päättyvä nimi
+};
+
+struct dirreader {
+    int fd;       // Hakemiston tiedostokuvaaja
+    char *buf;    // Lukupuskuri (kutsujan omistama)
+    size_t size;  // Puskurin koko
+    size_t pos;   // Seuraavan sisällön sijainti puskurissa
+    size_t end;   // Puskurissa olevan datan pituus
+};
+
+// Alustaa lukijan. Puskurin täytyy olla vähintään DIRREAD_MIN_SIZE tavua ja 8 tavun kohdistettu.
+void dirreader_init(struct dirreader *r, int fd, char *buf, size_t size);
+
+// Lukee seuraavan erän sisältöjä puskuriin. Edellisen erän sisällöt eivät ole tämän jälkeen enää
+// käytettävissä. Palauttaa luettujen tavujen määrän, 0 hakemiston lopussa tai -1 virheen sattuessa.
+ssize_t dirreader_fill(struct dirreader *r);
+
+// Palauttaa puskurin seuraavan sisällön tai NULL, kun erä on käyty läpi
+static inline const struct linux_dirent64 *dirreader_next(struct dirreader *r) {
+    const struct linux_dirent64 *d;
+
+    if (r->pos >= r->end) {
+        return NULL;
+    }
+    d = (const struct linux_dirent64 *)(r->buf + r->pos);
+    r->pos += d->d_reclen;
+    return d;
+}
+
+// Onko nimi '.' tai '..'
+static inline int dirreader_is_dot(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+#endif
@@ -0,0 +1,559 @@
+/*
+ * format.c
+ *
+ * Koneluettavien tulostusmuotojen kirjoitus. NDJSON- ja CSV-rivit muotoillaan suoraan
+ * tulostuspuskuriin. Binäärimuodossa erän tiedot kerätään ensin sarakkeisiin ja merkkijonotauluun,
+ * ja lohko kirjoitetaan kokonaisuudessaan erän lopussa.
+ */
+
+#define _GNU_SOURCE
+
+#include "format.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+
+#include "idcache.h"
+#include "xattrat.h"
+
+#define FORMAT_MIN_CAP 64  // Sarakkeiden ja attribuuttisarakkeiden alkukoko
+
+static enum output_format output_format;  // Valittu tulostusmuoto
+
+static const char hex[] = "0123456789abcdef";
+
+void format_init(enum output_format format) {
+    output_format = format;
+}
+
+// Palauttaa n pyöristettynä ylöspäin 8:n monikertaan
+static size_t pad8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+// Palauttaa tiedostotyypin nimen NDJSON- ja CSV-muotoja varten
+static const char *type_name(mode_t mode) {
+    switch (mode & S_IFMT) {
+        case S_IFREG:
+            return "file";
+        case S_IFDIR:
+            return "dir";
+        case S_IFLNK:
+            return "symlink";
+        case S_IFCHR:
+            return "char";
+        case S_IFBLK:
+            return "block";
+        case S_IFIFO:
+            return "fifo";
+        case S_IFSOCK:
+            return "socket";
+        default:
+            return "unknown";
+    }
+}
+
+// Varaa taulukolle uuden koon. Tulostusta ei voi jatkaa ilman muistia.
+static void *grow_array(void *array, size_t count, size_t elem) {
+    array = realloc(array, count * elem);
+    if (array == NULL) {
+        perror("Error allocating format buffers");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+// Lisää tavut ja nollamerkin merkkijonotauluun ja palauttaa niiden siirtymän
+static uint32_t strtab_add(struct format_block *b, const void *data, size_t len) {
+    size_t off = b->strtab_len;
+
+    // Siirtymät ovat 32-bittisiä; erässä on enintään muutama sata tiedostoa, joten raja ei tule vastaan
+    if (off + len + 1 >= FORMAT_BIN_NONE) {
+        fprintf(stderr, "Merkkijonotaulu on liian suuri\n");
+        exit(EXIT_FAILURE);
+    }
+    if (off + len + 1 > b->strtab_cap) {
+        size_t cap = b->strtab_cap ? b->strtab_cap : 4096;
+        while (cap < off + len + 1) {
+            cap *= 2;
+        }
+        b->strtab = grow_array(b->strtab, cap, 1);
+        b->strtab_cap = cap;
+    }
+    memcpy(b->strtab + off, data, len);
+    b->strtab[off + len] = '\0';
+    b->strtab_len = off + len + 1;
+    return off;
+}
+
+// Lisää attribuutin attribuuttisarakkeisiin
+static void add_xattr(struct format_block *b, const char *key, const char *value, size_t len) {
+    if (b->nxattrs == b->xattr_cap) {
+        b->xattr_cap = b->xattr_cap ? b->xattr_cap * 2 : FORMAT_MIN_CAP;
+        b->xattr_key = grow_array(b->xattr_key, b->xattr_cap, sizeof(uint32_t));
+        b->xattr_value = grow_array(b->xattr_value, b->xattr_cap, sizeof(uint32_t));
+        b->xattr_len = grow_array(b->xattr_len, b->xattr_cap, sizeof(uint32_t));
+    }
+    b->xattr_key[b->nxattrs] = strtab_add(b, key, strlen(key));
+    b->xattr_value[b->nxattrs] = strtab_add(b, value, len);
+    b->xattr_len[b->nxattrs] = len;
+    b->nxattrs++;
+}
+
+// Lisää attribuutin lohkoon (xattr_target_foreach-funktion käsittelijä)
+static void visit_xattr(void *arg, const char *key, const char *value, ssize_t len) {
+    if (len == -1) {
+        perror("Error getting extended attribute value");
+        return;
+    }
+    add_xattr(arg, key, value, len);
+}
+
+// Lukee tiedoston laajennetut attribuutit attribuuttisarakkeisiin. Tuen puuttuminen ei ole virhe,
+// vaan tiedostolla ei silloin ole attribuutteja.
+static void collect_xattrs(struct format_block *b, const char *name, mode_t mode) {
+    struct xattr_target target;  // Tiedosto, jonka attribuutit luetaan
+
+    xattr_target_init(&target, b->dirfd, name, mode);
+    if (xattr_target_foreach(&target, visit_xattr, b) == -1 && errno != ENOTSUP) {
+        perror("Error getting extended attributes list");
+    }
+    xattr_target_close(&target);
+}
+
+// Palauttaa kelvollisen UTF-8-merkin pituuden tavuina tai 0, jos s ei ala kelvollisella merkillä
+static size_t utf8_char_len(const unsigned char *s, size_t len) {
+    unsigned char lo = 0x80, hi = 0xbf;  // Toisen tavun sallittu väli
+    size_t n;
+
+    if (s[0] < 0x80) {
+        return 1;
+    } else if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        if (s[0] == 0xe0) {
+            lo = 0xa0;  // Liian pitkä koodaus
+        } else if (s[0] == 0xed) {
+            hi = 0x9f;  // UTF-16-sijaismerkit
+        }
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        if (s[0] == 0xf0) {
+            lo = 0x90;  // Liian pitkä koodaus
+        } else if (s[0] == 0xf4) {
+            hi = 0x8f;  // Yli U+10FFFF
+        }
+    } else {
+        return 0;
+    }
+
+    if (len < n || s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (size_t i = 2; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+// Lisää tavut JSON-merkkijonona. Ohjausmerkit ja virheelliset UTF-8-tavut koodataan \u00XX-muotoon,
+// joten tulos on aina kelvollista JSONia (tarkat tavut saa binäärimuodosta).
+static void put_json_string(struct outbuf *out, const char *data, size_t len) {
+    const unsigned char *s = (const unsigned char *)data;
+    size_t run = 0;  // Sellaisenaan kopioitavien tavujen alku
+    size_t i = 0;
+
+    outbuf_putc(out, '"');
+    while (i < len) {
+        size_t n = 1;
+        char esc[6] = {'\\', 'u', '0', '0', 0, 0};
+
+        if (s[i] >= 0x20 && s[i] != '"' && s[i] != '\\' && s[i] < 0x80) {
+            i++;
+            continue;
+        }
+        if (s[i] >= 0x80 && (n = utf8_char_len(s + i, len - i)) > 0) {
+            i += n;
+            continue;
+        }
+
+        // Kopioi edeltävät tavut ja koodaa tämä tavu
+        outbuf_write(out, data + run, i - run);
+        switch (s[i]) {
+            case '"':
+                outbuf_lit(out, "\\\"");
+                break;
+            case '\\':
+                outbuf_lit(out, "\\\\");
+                break;
+            case '\n':
+                outbuf_lit(out, "\\n");
+                break;
+            case '\t':
+                outbuf_lit(out, "\\t");
+                break;
+            case '\r':
+                outbuf_lit(out, "\\r");
+                break;
+            default:
+                esc[4] = hex[s[i] >> 4];
+                esc[5] = hex[s[i] & 15];
+                outbuf_write(out, esc, sizeof(esc));
+                break;
+        }
+        i++;
+        run = i;
+    }
+    outbuf_write(out, data + run, i - run);
+    outbuf_putc(out, '"');
+}
+
+// Lisää CSV-kentän. Lainausmerkit lisätään vain, jos kentässä on pilkku, lainausmerkki tai rivinvaihto.
+static void put_csv_field(struct outbuf *out, const char *data, size_t len) {
+    size_t run = 0;
+
+    if (strcspn(data, ",\"\r\n") >= len) {
+        outbuf_write(out, data, len);
+        return;
+    }
+
+    outbuf_putc(out, '"');
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '"') {
+            outbuf_write(out, data + run, i + 1 - run);  // Lainausmerkki kahdennetaan
+            run = i;
+        }
+    }
+    outbuf_write(out, data + run, len - run);
+    outbuf_putc(out, '"');
+}
+
+// Lisää CSV-kenttään attribuutin avaimen tai arvon. Erottimet ja ohjausmerkit koodataan %XX-muotoon.
+static void put_csv_xattr_part(struct outbuf *out, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = data[i];
+
+        if (c < 0x20 || c == 0x7f || c == '%' || c == ';' || c == '=' || c == ',' || c == '"') {
+            outbuf_putc(out, '%');
+            outbuf_putc(out, hex[c >> 4]);
+            outbuf_putc(out, hex[c & 15]);
+        } else {
+            outbuf_putc(out, c);
+        }
+    }
+}
+
+// Kirjoittaa tiedoston NDJSON-rivinä
+static void put_ndjson(struct format_block *b, struct outbuf *out, const char *name, const struct statx *stx) {
+    const char *user = idcache_user_name(stx->stx_uid);
+    const char *group = idcache_group_name(stx->stx_gid);
+
+    outbuf_lit(out, "{\"dir\":");
+    put_json_string(out, b->dir, strlen(b->dir));
+    outbuf_lit(out, ",\"name\":");
+    put_json_string(out, name, strlen(name));
+    outbuf_lit(out, ",\"type\":\"");
+    outbuf_puts(out, type_name(stx->stx_mode));
+    outbuf_lit(out, "\",\"mode\":");
+    outbuf_put_u64(out, stx->stx_mode & 07777);
+    outbuf_lit(out, ",\"nlink\":");
+    outbuf_put_u64(out, stx->stx_nlink);
+    outbuf_lit(out, ",\"uid\":");
+    outbuf_put_u64(out, stx->stx_uid);
+    outbuf_lit(out, ",\"user\":");
+    if (user != NULL) {
+        put_json_string(out, user, strlen(user));
+    } else {
+        outbuf_lit(out, "null");
+    }
+    outbuf_lit(out, ",\"gid\":");
+    outbuf_put_u64(out, stx->stx_gid);
+    outbuf_lit(out, ",\"group\":");
+    if (group != NULL) {
+        put_json_string(out, group, strlen(group));
+    } else {
+        outbuf_lit(out, "null");
+    }
+    outbuf_lit(out, ",\"size\":");
+    outbuf_put_u64(out, stx->stx_size);
+    outbuf_lit(out, ",\"dev\":");
+    outbuf_put_u64(out, makedev(stx->stx_dev_major, stx->stx_dev_minor));
+    outbuf_lit(out, ",\"atime_sec\":");
+    outbuf_put_i64(out, stx->stx_atime.tv_sec);
+    outbuf_lit(out, ",\"atime_nsec\":");
+    outbuf_put_u64(out, stx->stx_atime.tv_nsec);
+    outbuf_lit(out, ",\"mtime_sec\":");
+    outbuf_put_i64(out, stx->stx_mtime.tv_sec);
+    outbuf_lit(out, ",\"mtime_nsec\":");
+    outbuf_put_u64(out, stx->stx_mtime.tv_nsec);
+    outbuf_lit(out, ",\"xattrs\":{");
+    for (uint32_t i = 0; i < b->nxattrs; i++) {
+        const char *key = b->strtab + b->xattr_key[i];
+
+        if (i > 0) {
+            outbuf_putc(out, ',');
+        }
+        put_json_string(out, key, strlen(key));
+        outbuf_putc(out, ':');
+        put_json_string(out, b->strtab + b->xattr_value[i], b->xattr_len[i]);
+    }
+    outbuf_lit(out, "}}\n");
+}
+
+// Kirjoittaa tiedoston CSV-rivinä (sarakkeet kuten format_write_header-funktion otsakerivillä)
+static void put_csv(struct format_block *b, struct outbuf *out, const char *name, const struct statx *stx) {
+    const char *user = idcache_user_name(stx->stx_uid);
+    const char *group = idcache_group_name(stx->stx_gid);
+
+    put_csv_field(out, b->dir, strlen(b->dir));
+    outbuf_putc(out, ',');
+    put_csv_field(out, name, strlen(name));
+    outbuf_putc(out, ',');
+    outbuf_puts(out, type_name(stx->stx_mode));
+    outbuf_putc(out, ',');
+    outbuf_put_u64(out, stx->stx_mode & 07777);
+    outbuf_putc(out, ',');
+    outbuf_put_u64(out, stx->stx_nlink);
+    outbuf_putc(out, ',');
+    outbuf_put_u64(out, stx->stx_uid);
+    outbuf_putc(out, ',');
+    if (user != NULL) {
+        put_csv_field(out, user, strlen(user));
+    }
+    outbuf_putc(out, ',');
+    outbuf_put_u64(out, stx->stx_gid);
+    outbuf_putc(out, ',');
+    if (group != NULL) {
+        put_csv_field(out, group, strlen(group));
+    }
+    outbuf_putc(out, ',');
+    outbuf_put_u64(out, stx->stx_size);
+    outbuf_putc(out, ',');
+    outbuf_put_u64(out, makedev(stx->stx_dev_major, stx->stx_dev_minor));
+    outbuf_putc(out, ',');
+    outbuf_put_i64(out, stx->stx_atime.tv_sec);
+    outbuf_putc(out, ',');
+    outbuf_put_u64(out, stx->stx_atime.tv_nsec);
+    outbuf_putc(out, ',');
+    outbuf_put_i64(out, stx->stx_mtime.tv_sec);
+    outbuf_putc(out, ',');
+    outbuf_put_u64(out, stx->stx_mtime.tv_nsec);
+    outbuf_putc(out, ',');
+
+    // Attribuutit muodossa avain=arvo;avain=arvo
+    for (uint32_t i = 0; i < b->nxattrs; i++) {
+        const char *key = b->strtab + b->xattr_key[i];
+
+        if (i > 0) {
+            outbuf_putc(out, ';');
+        }
+        put_csv_xattr_part(out, key, strlen(key));
+        outbuf_putc(out, '=');
+        put_csv_xattr_part(out, b->strtab + b->xattr_value[i], b->xattr_len[i]);
+    }
+    outbuf_lit(out, "\r\n");
+}
+
+// Palauttaa käyttäjän nimen siirtymän merkkijonotaulussa. Peräkkäisillä tiedostoilla on yleensä
+// sama omistaja, jolloin nimeä ei lisätä tauluun uudelleen.
+static uint32_t bin_user(struct format_block *b, uid_t uid) {
+    if (uid != b->last_uid) {
+        const char *user = idcache_user_name(uid);
+        b->last_uid = uid;
+        b->last_user = user != NULL ? strtab_add(b, user, strlen(user)) : FORMAT_BIN_NONE;
+    }
+    return b->last_user;
+}
+
+// Palauttaa ryhmän nimen siirtymän merkkijonotaulussa
+static uint32_t bin_group(struct format_block *b, gid_t gid) {
+    if (gid != b->last_gid) {
+        const char *group = idcache_group_name(gid);
+        b->last_gid = gid;
+        b->last_group = group != NULL ? strtab_add(b, group, strlen(group)) : FORMAT_BIN_NONE;
+    }
+    return b->last_group;
+}
+
+// Lisää tiedoston binäärimuodon sarakkeisiin
+static void put_bin(struct format_block *b, const char *name, const struct statx *stx) {
+    uint32_t i = b->count;
+
+    if (i == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : FORMAT_MIN_CAP;
+        b->atime_sec = grow_array(b->atime_sec, b->cap, sizeof(int64_t));
+        b->mtime_sec = grow_array(b->mtime_sec, b->cap, sizeof(int64_t));
+        b->size = grow_array(b->size, b->cap, sizeof(uint64_t));
+        b->dev = grow_array(b->dev, b->cap, sizeof(uint64_t));
+        b->atime_nsec = grow_array(b->atime_nsec, b->cap, sizeof(uint32_t));
+        b->mtime_nsec = grow_array(b->mtime_nsec, b->cap, sizeof(uint32_t));
+        b->mode = grow_array(b->mode, b->cap, sizeof(uint32_t));
+        b->nlink = grow_array(b->nlink, b->cap, sizeof(uint32_t));
+        b->uid = grow_array(b->uid, b->cap, sizeof(uint32_t));
+        b->gid = grow_array(b->gid, b->cap, sizeof(uint32_t));
+        b->name = grow_array(b->name, b->cap, sizeof(uint32_t));
+        b->user = grow_array(b->user, b->cap, sizeof(uint32_t));
+        b->group = grow_array(b->group, b->cap, sizeof(uint32_t));
+        b->xattr_first = grow_array(b->xattr_first, b->cap, sizeof(uint32_t));
+        b->xattr_count = grow_array(b->xattr_count, b->cap, sizeof(uint32_t));
+    }
+
+    b->atime_sec[i] = stx->stx_atime.tv_sec;
+    b->mtime_sec[i] = stx->stx_mtime.tv_sec;
+    b->size[i] = stx->stx_size;
+    b->dev[i] = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    b->atime_nsec[i] = stx->stx_atime.tv_nsec;
+    b->mtime_nsec[i] = stx->stx_mtime.tv_nsec;
+    b->mode[i] = stx->stx_mode;
+    b->nlink[i] = stx->stx_nlink;
+    b->uid[i] = stx->stx_uid;
+    b->gid[i] = stx->stx_gid;
+    b->name[i] = strtab_add(b, name, strlen(name));
+    b->user[i] = bin_user(b, stx->stx_uid);
+    b->group[i] = bin_group(b, stx->stx_gid);
+    b->xattr_first[i] = b->nxattrs;
+    collect_xattrs(b, name, stx->stx_mode);
+    b->xattr_count[i] = b->nxattrs - b->xattr_first[i];
+    b->count++;
+}
+
+// Lisää sarakkeen ja täyttää sen nollilla 8 tavun monikertaan
+static void put_column(struct outbuf *out, const void *data, size_t len) {
+    static const char zeros[8];
+
+    outbuf_write(out, data, len);
+    outbuf_write(out, zeros, pad8(len) - len);
+}
+
+void format_write_header(struct outbuf *out) {
+    switch (output_format) {
+        case FORMAT_CSV:
+            outbuf_lit(out, "dir,name,type,mode,nlink,uid,user,gid,group,size,dev,atime_sec,atime_nsec,mtime_sec,mtime_nsec,xattrs\r\n");
+            break;
+        case FORMAT_BIN: {
+            struct format_bin_header header = {FORMAT_BIN_MAGIC, FORMAT_BIN_VERSION, FORMAT_BIN_BYTE_ORDER};
+            outbuf_write(out, (const char *)&header, sizeof(header));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void format_block_begin(struct format_block *b, const char *dir, int dirfd) {
+    b->dir = dir;
+    b->dirfd = dirfd;
+    b->count = 0;
+    b->nxattrs = 0;
+    b->strtab_len = 0;
+    b->last_uid = (uid_t)-1;
+    b->last_gid = (gid_t)-1;
+}
+
+void format_entry(struct format_block *b, struct outbuf *out, const char *name, const struct statx *stx) {
+    if (output_format == FORMAT_BIN) {
+        put_bin(b, name, stx);
+        return;
+    }
+
+    // Tekstimuodoissa attribuutit kerätään vain tämän tiedoston ajaksi
+    b->nxattrs = 0;
+    b->strtab_len = 0;
+    collect_xattrs(b, name, stx->stx_mode);
+    if (output_format == FORMAT_NDJSON) {
+        put_ndjson(b, out, name, stx);
+    } else {
+        put_csv(b, out, name, stx);
+    }
+}
+
+void format_removed(struct outbuf *out, const char *dir, const char *name) {
+    if (output_format == FORMAT_NDJSON) {
+        outbuf_lit(out, "{\"dir\":");
+        put_json_string(out, dir, strlen(dir));
+        outbuf_lit(out, ",\"name\":");
+        put_json_string(out, name, strlen(name));
+        outbuf_lit(out, ",\"type\":\"removed\"}\n");
+    } else if (output_format == FORMAT_CSV) {
+        put_csv_field(out, dir, strlen(dir));
+        outbuf_putc(out, ',');
+        put_csv_field(out, name, strlen(name));
+        outbuf_lit(out, ",removed,,,,,,,,,,,,,\r\n");
+    }
+}
+
+void format_block_end(struct format_block *b, struct outbuf *out) {
+    struct format_bin_block header;
+    uint32_t dir;
+    size_t n64, n32, nx;
+
+    if (output_format != FORMAT_BIN || b->count == 0) {
+        return;
+    }
+
+    dir = strtab_add(b, b->dir, strlen(b->dir));
+    n64 = (size_t)b->count * 8;
+    n32 = pad8((size_t)b->count * 4);
+    nx = pad8((size_t)b->nxattrs * 4);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = FORMAT_BIN_BLOCK_MAGIC;
+    header.count = b->count;
+    header.nxattrs = b->nxattrs;
+    header.dir = dir;
+    header.strtab_size = b->strtab_len;
+    header.block_size = sizeof(header) + 4 * n64 + 11 * n32 + 3 * nx + pad8(b->strtab_len);
+    outbuf_write(out, (const char *)&header, sizeof(header));
+
+    put_column(out, b->atime_sec, n64);
+    put_column(out, b->mtime_sec, n64);
+    put_column(out, b->size, n64);
+    put_column(out, b->dev, n64);
+    put_column(out, b->atime_nsec, b->count * 4);
+    put_column(out, b->mtime_nsec, b->count * 4);
+    put_column(out, b->mode, b->count * 4);
+    put_column(out, b->nlink, b->count * 4);
+    put_column(out, b->uid, b->count * 4);
+    put_column(out, b->gid, b->count * 4);
+    put_column(out, b->name, b->count * 4);
+    put_column(out, b->user, b->count * 4);
+    put_column(out, b->group, b->count * 4);
+    put_column(out, b->xattr_first, b->count * 4);
+    put_column(out, b->xattr_count, b->count * 4);
+    put_column(out, b->xattr_key, b->nxattrs * 4);
+    put_column(out, b->xattr_value, b->nxattrs * 4);
+    put_column(out, b->xattr_len, b->nxattrs * 4);
+    put_column(out, b->strtab, b->strtab_len);
+
+    b->count = 0;
+}
+
+void format_block_free(struct format_block *b) {
+    free(b->atime_sec);
+    free(b->mtime_sec);
+    free(b->size);
+    free(b->dev);
+    free(b->atime_nsec);
+    free(b->mtime_nsec);
+    free(b->mode);
+    free(b->nlink);
+    free(b->uid);
+    free(b->gid);
+    free(b->name);
+    free(b->user);
+    free(b->group);
+    free(b->xattr_first);
+    free(b->xattr_count);
+    free(b->xattr_key);
+    free(b->xattr_value);
+    free(b->xattr_len);
+    free(b->strtab);
+    memset(b, 0, sizeof(*b));
+}
@@ -0,0 +1,127 @@
+/*
+ * format.h
+ *
+ * Koneluettavat tulostusmuodot: NDJSON (JSON-olio riviä kohden), CSV (RFC 4180) ja binäärinen
+ * sarakemuoto. Tiedostot käsitellään lohkoina (yksi tilatietoerä kerrallaan), ja jokainen lohko
+ * kirjoitetaan heti valmistuttuaan, joten muistinkäyttö ei riipu hakemistopuun koosta.
+ *
+ * Binäärimuoto (kaikki kentät koneen omassa tavujärjestyksessä, tiedoston otsake kertoo sen):
+ *
+ *   Tiedoston otsake (16 tavua):  struct format_bin_header
+ *   Lohkoja peräkkäin, jokainen:
+ *     struct format_bin_block (32 tavua)
+ *     Sarakkeet tässä järjestyksessä, kukin count alkiota ja täytetty 8 tavun monikertaan nollilla:
+ *       int64  atime_sec, mtime_sec
+ *       uint64 size, dev
+ *       uint32 atime_nsec, mtime_nsec, mode (st_mode), nlink, uid, gid,
+ *              name, user, group (merkkijonotaulun siirtymiä, FORMAT_BIN_NONE = ei nimeä),
+ *              xattr_first, xattr_count (tiedoston attribuutit xattr-sarakkeista)
+ *     Attribuuttisarakkeet, kukin nxattrs alkiota ja täytetty 8 tavun monikertaan:
+ *       uint32 xattr_key, xattr_value (merkkijonotaulun siirtymiä), xattr_len (arvon pituus)
+ *     Merkkijonotaulu (strtab_size tavua, täytetty 8 tavun monikertaan). Jokaisen merkkijonon
+ *     perässä on nollamerkki; attribuuttien arvot voivat sisältää myös nollamerkkejä.
+ *
+ * Lohkon sarakkeet voi lukea suoraan mmap-muistista: sarakkeen siirtymä lohkon alusta saadaan
+ * laskemalla yhteen otsakkeen ja edeltävien sarakkeiden koot, ja block_size kertoo seuraavan lohkon kohdan.
+ *
+ * Seurantatilassa (--watch) poistettu tiedosto kirjoitetaan NDJSON- ja CSV-muodoissa rivinä, jossa on
+ * vain hakemisto, nimi ja tyyppi "removed".
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "outbuf.h"
+
+#define FORMAT_BIN_MAGIC "HKLSBIN"        // Tiedoston tunniste (8 tavua nollamerkin kanssa)
+#define FORMAT_BIN_VERSION 1             // Binäärimuodon versio
+#define FORMAT_BIN_BYTE_ORDER 0x01020304  // Tavujärjestyksen tunniste kirjoittajan järjestyksessä
+#define FORMAT_BIN_BLOCK_MAGIC 0x4b4f4c42  // Lohkon tunniste ("BLOK" little-endian-koneella)
+#define FORMAT_BIN_NONE UINT32_MAX        // Merkkijonon siirtymä, kun arvoa ei ole
+
+// Tulostusmuoto
+enum output_format {
+    FORMAT_TEXT,    // Suomenkielinen tekstimuoto (oletus)
+    FORMAT_NDJSON,  // JSON-olio riviä kohden
+    FORMAT_CSV,     // Pilkuin erotellut arvot otsakerivin kanssa
+    FORMAT_BIN,     // Binäärinen sarakemuoto
+};
+
+// Binäärimuodon tiedoston otsake
+struct format_bin_header {
+    char magic[8];        // FORMAT_BIN_MAGIC
+    uint32_t version;     // FORMAT_BIN_VERSION
+    uint32_t byte_order;  // FORMAT_BIN_BYTE_ORDER
+};
+
+// Binäärimuodon lohkon otsake
+struct format_bin_block {
+    uint32_t magic;        // FORMAT_BIN_BLOCK_MAGIC
+    uint32_t count;        // Tiedostojen määrä lohkossa
+    uint32_t nxattrs;      // Attribuuttien määrä lohkossa
+    uint32_t dir;          // Hakemiston polun siirtymä merkkijonotaulussa
+    uint32_t strtab_size;  // Merkkijonotaulun koko ilman täytettä
+    uint32_t reserved;     // Nolla
+    uint64_t block_size;   // Koko lohkon koko otsake mukaan lukien
+};
+
+// Säiekohtainen lohko, johon kerätään yhden erän tiedostot
+struct format_block {
+    const char *dir;       // Hakemiston polku
+    int dirfd;             // Hakemiston tiedostokuvaaja attribuuttien lukemista varten
+    uint32_t count;        // Tiedostojen määrä
+    uint32_t cap;          // Sarakkeiden tila
+    int64_t *atime_sec;    // Sarakkeet (binäärimuoto)
+    int64_t *mtime_sec;
+    uint64_t *size;
+    uint64_t *dev;
+    uint32_t *atime_nsec;
+    uint32_t *mtime_nsec;
+    uint32_t *mode;
+    uint32_t *nlink;
+    uint32_t *uid;
+    uint32_t *gid;
+    uint32_t *name;
+    uint32_t *user;
+    uint32_t *group;
+    uint32_t *xattr_first;
+    uint32_t *xattr_count;
+    uint32_t nxattrs;      // Attribuuttien määrä
+    uint32_t xattr_cap;    // Attribuuttisarakkeiden tila
+    uint32_t *xattr_key;   // Attribuuttisarakkeet
+    uint32_t *xattr_value;
+    uint32_t *xattr_len;
+    char *strtab;          // Merkkijonotaulu
+    size_t strtab_len;     // Merkkijonotaulun käytetty koko
+    size_t strtab_cap;     // Merkkijonotaulun varattu koko
+    uid_t last_uid;        // Edellisen tiedoston omistaja ja sen nimen siirtymä (nimet toistuvat lohkossa)
+    uint32_t last_user;
+    gid_t last_gid;        // Edellisen tiedoston ryhmä ja sen nimen siirtymä
+    uint32_t last_group;
+};
+
+// Valitsee tulostusmuodon. Kutsuttava ennen säikeiden luontia.
+void format_init(enum output_format format);
+
+// Kirjoittaa tulostuksen alkuun tulevan otsakkeen (CSV-otsakerivi tai binäärimuodon otsake)
+void format_write_header(struct outbuf *out);
+
+// Aloittaa uuden lohkon hakemiston dir tiedostoille
+void format_block_begin(struct format_block *b, const char *dir, int dirfd);
+
+// Lisää tiedoston lohkoon. Tekstimuodoissa rivi kirjoitetaan heti out-puskuriin.
+void format_entry(struct format_block *b, struct outbuf *out, const char *name, const struct statx *stx);
+
+// Kirjoittaa rivin poistetusta tiedostosta (NDJSON ja CSV)
+void format_removed(struct outbuf *out, const char *dir, const char *name);
+
+// Päättää lohkon ja kirjoittaa sen out-puskuriin (binäärimuoto)
+void format_block_end(struct format_block *b, struct outbuf *out);
+
+// Vapauttaa lohkon muistin
+void format_block_free(struct format_block *b);
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * idcache.c
+ *
+ * Avoimen osoituksen hajautustaulu (lineaarinen kokeilu) tunniste -> nimi. Haut tehdään lukulukon
+ * alla, joten säikeet eivät odota toisiaan. Puuttuva nimi haetaan säieturvallisella getpwuid_r- tai
+ * getgrgid_r-funktiolla lukon ulkopuolella ja lisätään kirjoituslukon alla. Myös tunnisteet, joille
+ * ei löydy nimeä, tallennetaan, jotta niitä ei kysytä uudelleen. Alkioita ei poisteta koskaan,
+ * joten palautetut nimet pysyvät voimassa.
+ */
+
+#define _GNU_SOURCE
+
+#include "idcache.h"
+
+#include <errno.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IDCACHE_INITIAL_CAP 64      // Taulun alkukoko (kahden potenssi)
+#define IDCACHE_MAX_BUFFER (1 << 20)  // Suurin NSS-puskuri, jota kasvatetaan ERANGE-virheen jälkeen
+
+struct idcache_slot {
+    uint32_t id;       // Käyttäjä- tai ryhmätunniste
+    bool used;         // Onko paikka käytössä
+    const char *name;  // Nimi tai NULL, jos tunnisteelle ei ole nimeä
+};
+
+struct idcache {
+    pthread_rwlock_t lock;       // Lukijat hakevat rinnakkain, lisäykset kirjoituslukon alla
+    struct idcache_slot *slots;  // Hajautustaulu
+    size_t cap;                  // Taulun koko (kahden potenssi)
+    size_t count;                // Käytössä olevat paikat
+    atomic_ulong hits;           // Osumat
+    atomic_ulong misses;         // Ohitukset
+};
+
+static struct idcache users = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+static struct idcache groups = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+
+// Sekoittaa tunnisteen bitit, koska peräkkäiset uid-arvot osuisivat muuten vierekkäisiin paikkoihin
+static size_t id_hash(uint32_t id) {
+    uint64_t h = id * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> 32);
+}
+
+// Etsii tunnisteen paikan tai ensimmäisen vapaan paikan (lukko oltava hallussa)
+static struct idcache_slot *find_slot(struct idcache_slot *slots, size_t cap, uint32_t id) {
+    size_t i = id_hash(id) & (cap - 1);
+
+    while (slots[i].used && slots[i].id != id) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &slots[i];
+}
+
+// Kasvattaa taulun kaksinkertaiseksi (kirjoituslukko oltava hallussa)
+static int grow(struct idcache *c) {
+    size_t cap = c->cap ? c->cap * 2 : IDCACHE_INITIAL_CAP;
+    struct idcache_slot *slots = calloc(cap, sizeof(*slots));
+
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < c->cap; i++) {
+        if (c->slots[i].used) {
+            *find_slot(slots, cap, c->slots[i].id) = c->slots[i];
+        }
+    }
+    free(c->slots);
+    c->slots = slots;
+    c->cap = cap;
+    return 0;
+}
+
+// Lisää tunnisteen ja nimen tauluun ja palauttaa tauluun tallennetun nimen. Jos toinen säie ehti
+// lisätä saman tunnisteen, palautetaan sen nimi.
+static const char *insert(struct idcache *c, uint32_t id, const char *name) {
+    struct idcache_slot *slot;
+    const char *stored = NULL;
+
+    pthread_rwlock_wrlock(&c->lock);
+
+    // Pidä täyttöaste alle puolen, jotta kokeiluketjut pysyvät lyhyinä
+    if ((c->count + 1) * 2 > c->cap && grow(c) == -1) {
+        pthread_rwlock_unlock(&c->lock);
+        return NULL;
+    }
+
+    slot = find_slot(c->slots, c->cap, id);
+    if (slot->used) {
+        stored = slot->name;
+    } else {
+        char *copy = name != NULL ? strdup(name) : NULL;
+        if (name == NULL || copy != NULL) {
+            slot->used = true;
+            slot->id = id;
+            slot->name = copy;
+            c->count++;
+        }
+        stored = copy;
+    }
+
+    pthread_rwlock_unlock(&c->lock);
+    return stored;
+}
+
+// Hakee tunnisteen nimen taulusta. Palauttaa true, jos tunniste löytyi.
+static bool lookup(struct idcache *c, uint32_t id, const char **name) {
+    bool found = false;
+
+    pthread_rwlock_rdlock(&c->lock);
+    if (c->cap > 0) {
+        struct idcache_slot *slot = find_slot(c->slots, c->cap, id);
+        if (slot->used) {
+            *name = slot->name;
+            found = true;
+        }
+    }
+    pthread_rwlock_unlock(&c->lock);
+    return found;
+}
+
+// Hakee käyttäjän nimen NSS:ltä säieturvallisesti ja lisää sen välimuistiin
+static const char *fetch_user(uid_t uid) {
+    struct passwd pwd, *result = NULL;
+    size_t size = 1024;
+    char *buf = NULL;
+    const char *name;
+    int err = 0;
+
+    // Kasvata puskuria, kunnes tietue mahtuu siihen
+    do {
+        char *bigger = realloc(buf, size);
+        if (bigger == NULL) {
+            err = ENOMEM;
+            break;
+        }
+        buf = bigger;
+        err = getpwuid_r(uid, &pwd, buf, size, &result);
+        size *= 2;
+    } while (err == ERANGE && size <= IDCACHE_MAX_BUFFER);
+
+    // Vain varmasti puuttuva tunniste tallennetaan välimuistiin ilman nimeä. Muistin loppuminen,
+    // liian suuri tietue tai NSS:n tilapäinen virhe (EIO, EMFILE, EAGAIN) yritetään seuraavalla kerralla uudelleen.
+    if (result == NULL && err != 0) {
+        free(buf);
+        return NULL;
+    }
+    name = insert(&users, uid, result != NULL ? result->pw_name : NULL);
+    free(buf);
+    return name;
+}
+
+// Hakee ryhmän nimen NSS:ltä säieturvallisesti ja lisää sen välimuistiin
+static const char *fetch_group(gid_t gid) {
+    struct group grp, *result = NULL;
+    size_t size = 1024;
+    char *buf = NULL;
+    const char *name;
+    int err = 0;
+
+    do {
+        char *bigger = realloc(buf, size);
+        if (bigger == NULL) {
+            err = ENOMEM;
+            break;
+        }
+        buf = bigger;
+        err = getgrgid_r(gid, &grp, buf, size, &result);
+        size *= 2;
+    } while (err == ERANGE && size <= IDCACHE_MAX_BUFFER);
+
+    // Virhettä ei tallenneta (ks. fetch_user)
+    if (result == NULL && err != 0) {
+        free(buf);
+        return NULL;
+    }
+    name = insert(&groups, gid, result != NULL ? result->gr_name : NULL);
+    free(buf);
+    return name;
+}
+
+const char *idcache_user_name(uid_t uid) {
+    const char *name;
+
+    if (lookup(&users, uid, &name)) {
+        atomic_fetch_add_explicit(&users.hits, 1, memory_order_relaxed);
+        return name;
+    }
+    atomic_fetch_add_explicit(&users.misses, 1, memory_order_relaxed);
+    return fetch_user(uid);
+}
+
+const char *idcache_group_name(gid_t gid) {
+    const char *name;
+
+    if (lookup(&groups, gid, &name)) {
+        atomic_fetch_add_explicit(&groups.hits, 1, memory_order_relaxed);
+        return name;
+    }
+    atomic_fetch_add_explicit(&groups.misses, 1, memory_order_relaxed);
+    return fetch_group(gid);
+}
+
+void idcache_preload(void) {
+    struct passwd pwd, *pwd_result;
+    struct group grp, *grp_result;
+    char buf[16384];  // Puskuri yhdelle tietueelle; liian suuret tietueet haetaan myöhemmin tarpeen mukaan
+
+    // Käy läpi kaikki käyttäjät. Ensimmäinen nimi jää voimaan, kuten getpwuid-funktiollakin.
+    setpwent();
+    while (getpwent_r(&pwd, buf, sizeof(buf), &pwd_result) == 0) {
+        insert(&users, pwd.pw_uid, pwd.pw_name);
+    }
+    endpwent();
+
+    // Käy läpi kaikki ryhmät
+    setgrent();
+    while (getgrent_r(&grp, buf, sizeof(buf), &grp_result) == 0) {
+        insert(&groups, grp.gr_gid, grp.gr_name);
+    }
+    endgrent();
+}
+
+// Kopioi yhden välimuistin tilaston
+static void get_stats(struct idcache *c, struct idcache_stats *stats) {
+    stats->hits = atomic_load(&c->hits);
+    stats->misses = atomic_load(&c->misses);
+    pthread_rwlock_rdlock(&c->lock);
+    stats->entries = c->count;
+    pthread_rwlock_unlock(&c->lock);
+}
+
+void idcache_get_stats(struct idcache_stats *user_stats, struct idcache_stats *group_stats) {
+    get_stats(&users, user_stats);
+    get_stats(&groups, group_stats);
+}
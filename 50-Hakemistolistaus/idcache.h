@@ -0,0 +1,33 @@
+/*
+ * idcache.h
+ *
+ * Käyttäjä- ja ryhmänimien välimuisti. Hakemiston tiedostoilla on yleensä vain muutama eri omistaja,
+ * joten jokaista tiedostoa varten ei tarvitse kysyä nimeä NSS:ltä (/etc/passwd, LDAP, ...).
+ * Välimuisti on säieturvallinen, joten rinnakkaisen läpikäynnin säikeet voivat jakaa sen.
+ */
+
+#ifndef IDCACHE_H
+#define IDCACHE_H
+
+#include <sys/types.h>
+
+// Välimuistin osumatilasto
+struct idcache_stats {
+    unsigned long hits;     // Välimuistista löytyneet haut
+    unsigned long misses;   // NSS:ltä haetut nimet
+    unsigned long entries;  // Välimuistissa olevat tunnisteet
+};
+
+// Palauttaa käyttäjän nimen tai NULL, jos uid:lle ei ole nimeä. Nimi pysyy voimassa ohjelman loppuun.
+const char *idcache_user_name(uid_t uid);
+
+// Palauttaa ryhmän nimen tai NULL, jos gid:lle ei ole nimeä. Nimi pysyy voimassa ohjelman loppuun.
+const char *idcache_group_name(gid_t gid);
+
+// Lataa kaikki käyttäjät ja ryhmät välimuistiin etukäteen (getpwent/getgrent)
+void idcache_preload(void);
+
+// Palauttaa käyttäjä- ja ryhmävälimuistien tilastot
+void idcache_get_stats(struct idcache_stats *users, struct idcache_stats *groups);
+
+#endif
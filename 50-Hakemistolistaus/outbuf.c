@@ -0,0 +1,271 @@
+/*
+ * outbuf.c
+ *
+ * Tulostuspuskurin lohkot ja kirjoitus. Suurimmat lohkot varataan mmap-kutsulla, jolloin ne voidaan
+ * antaa putkelle vmsplice-kutsulla: putki viittaa suoraan lohkon sivuihin, eikä dataa kopioida.
+ * Koska putki lukee sivuja vasta myöhemmin, vmsplice-kutsulla annettua lohkoa ei käytetä enää
+ * uudelleen, vaan sen muistikuvaus poistetaan (sivut vapautuvat, kun putki on luettu).
+ */
+
+#define _GNU_SOURCE
+
+#include "outbuf.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define CHUNK_SMALL (4 * 1024)     // Ensimmäisen lohkon koko
+#define CHUNK_MEDIUM (64 * 1024)   // Toisen lohkon koko
+#define CHUNK_LARGE (1024 * 1024)  // Seuraavien lohkojen koko (mmap-muistia)
+
+struct outchunk {
+    struct outchunk *next;  // Seuraava lohko
+    size_t len;             // Datan pituus (päivitetään, kun lohko täyttyy tai kirjoitetaan)
+    size_t alloc;           // Varauksen koko otsake mukaan lukien
+    bool mapped;            // Onko lohko varattu mmap-kutsulla
+    char data[];            // Data
+};
+
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;  // Sarjallistaa eri säikeiden kirjoitukset
+static int splice_fd = -1;                                      // Tiedostokuvaaja, jonka putkisuus on tarkistettu
+static bool splice_ok;                                          // Voiko splice_fd-kuvaajaan käyttää vmsplice-kutsua
+
+// Oikeusbittien kolmikot merkkijonoina (r = luku, w = kirjoitus, x = suoritus/haku)
+static const char rwx[8][3] = {
+    {'-', '-', '-'}, {'-', '-', 'x'}, {'-', 'w', '-'}, {'-', 'w', 'x'},
+    {'r', '-', '-'}, {'r', '-', 'x'}, {'r', 'w', '-'}, {'r', 'w', 'x'},
+};
+
+void outbuf_init(struct outbuf *ob) {
+    memset(ob, 0, sizeof(*ob));
+}
+
+static void chunk_free(struct outchunk *c) {
+    if (c->mapped) {
+        munmap(c, c->alloc);
+    } else {
+        free(c);
+    }
+}
+
+void outbuf_free(struct outbuf *ob) {
+    struct outchunk *c = ob->head;
+
+    while (c != NULL) {
+        struct outchunk *next = c->next;
+        chunk_free(c);
+        c = next;
+    }
+    outbuf_init(ob);
+}
+
+void outbuf_grow(struct outbuf *ob) {
+    size_t alloc = ob->nchunks == 0 ? CHUNK_SMALL : ob->nchunks == 1 ? CHUNK_MEDIUM : CHUNK_LARGE;
+    struct outchunk *c;
+
+    if (alloc >= CHUNK_LARGE) {
+        c = mmap(NULL, alloc, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (c == MAP_FAILED) {
+            c = NULL;
+        }
+    } else {
+        c = malloc(alloc);
+    }
+
+    // Tulostusta ei voi jatkaa ilman muistia
+    if (c == NULL) {
+        perror("Error allocating output buffer");
+        exit(EXIT_FAILURE);
+    }
+    c->next = NULL;
+    c->len = 0;
+    c->alloc = alloc;
+    c->mapped = alloc >= CHUNK_LARGE;
+
+    // Sulje edellinen lohko ja liitä uusi ketjun loppuun
+    if (ob->tail != NULL) {
+        ob->tail->len = ob->pos - ob->start;
+        ob->size += ob->tail->len;
+        ob->tail->next = c;
+    } else {
+        ob->head = c;
+    }
+    ob->tail = c;
+    ob->nchunks++;
+    ob->start = c->data;
+    ob->pos = c->data;
+    ob->end = (char *)c + alloc;
+}
+
+void outbuf_append(struct outbuf *dst, struct outbuf *src) {
+    if (src->tail == NULL) {
+        return;
+    }
+    if (dst->tail == NULL) {
+        *dst = *src;
+        outbuf_init(src);
+        return;
+    }
+
+    // Sulje dst-puskurin viimeinen lohko ja jatka kirjoitusta src-puskurin viimeiseen lohkoon
+    dst->tail->len = dst->pos - dst->start;
+    dst->size += dst->tail->len + src->size;
+    dst->tail->next = src->head;
+    dst->tail = src->tail;
+    dst->start = src->start;
+    dst->pos = src->pos;
+    dst->end = src->end;
+    dst->nchunks += src->nchunks;
+    outbuf_init(src);
+}
+
+// Kirjoittaa iovec-taulukon kokonaan writev- tai vmsplice-kutsuilla osittaiset kirjoitukset huomioiden
+static int write_all(int fd, struct iovec *iov, int count, bool splice) {
+    while (count > 0) {
+        ssize_t n = splice ? vmsplice(fd, iov, count, 0) : writev(fd, iov, count);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // vmsplice ei onnistunut (esim. ei tuettu): kirjoita loput tavallisesti
+            if (splice && (errno == EINVAL || errno == ENOSYS)) {
+                splice_ok = false;
+                splice = false;
+                continue;
+            }
+            return -1;
+        }
+
+        // Ohita kokonaan kirjoitetut palat ja siirrä osittain kirjoitetun alkua
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int outbuf_flush(struct outbuf *ob, int fd) {
+    struct iovec iov[64];  // Kerralla kirjoitettavat lohkot
+    struct outchunk *c;
+    int count = 0;
+    bool group_mapped = false;  // Ovatko kerätyt lohkot mmap-lohkoja
+    int ret = 0;
+
+    if (ob->tail == NULL) {
+        return 0;
+    }
+    ob->tail->len = ob->pos - ob->start;
+
+    pthread_mutex_lock(&write_lock);
+
+    // Tarkista kerran, onko kohde putki
+    if (splice_fd != fd) {
+        struct stat st;
+        splice_fd = fd;
+        splice_ok = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    }
+
+    // Kerää peräkkäiset samanlaiset lohkot yhteen kirjoitukseen: mmap-lohkot putkeen vmsplice-kutsulla,
+    // muut writev-kutsulla
+    for (c = ob->head; c != NULL && ret == 0; c = c->next) {
+        bool mapped = c->mapped && splice_ok;
+
+        if (c->len == 0) {
+            continue;
+        }
+        if (count > 0 && (mapped != group_mapped || count == (int)(sizeof(iov) / sizeof(iov[0])))) {
+            ret = write_all(fd, iov, count, group_mapped);
+            count = 0;
+        }
+        group_mapped = mapped;
+        iov[count].iov_base = c->data;
+        iov[count].iov_len = c->len;
+        count++;
+    }
+    if (count > 0 && ret == 0) {
+        ret = write_all(fd, iov, count, group_mapped);
+    }
+
+    pthread_mutex_unlock(&write_lock);
+
+    outbuf_free(ob);
+    return ret;
+}
+
+size_t outbuf_fmt_u64(char *buf, uint64_t value) {
+    char tmp[20];
+    size_t len = 0;
+
+    // Muodosta numerot lopusta alkaen ja käännä ne oikeaan järjestykseen
+    do {
+        tmp[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = tmp[len - 1 - i];
+    }
+    return len;
+}
+
+void outbuf_put_u64(struct outbuf *ob, uint64_t value) {
+    char buf[20];
+
+    outbuf_write(ob, buf, outbuf_fmt_u64(buf, value));
+}
+
+void outbuf_put_i64(struct outbuf *ob, int64_t value) {
+    if (value < 0) {
+        outbuf_putc(ob, '-');
+        outbuf_put_u64(ob, -(uint64_t)value);
+    } else {
+        outbuf_put_u64(ob, value);
+    }
+}
+
+void outbuf_put_padded(struct outbuf *ob, const char *s, size_t width, size_t max) {
+    size_t len = strnlen(s, max);
+
+    outbuf_write(ob, s, len);
+    while (len++ < width) {
+        outbuf_putc(ob, ' ');
+    }
+}
+
+void outbuf_put_u64_padded(struct outbuf *ob, uint64_t value, size_t width) {
+    char buf[20];
+    size_t len = outbuf_fmt_u64(buf, value);
+
+    outbuf_write(ob, buf, len);
+    while (len++ < width) {
+        outbuf_putc(ob, ' ');
+    }
+}
+
+void outbuf_put_permissions(struct outbuf *ob, mode_t mode) {
+    char buf[11];
+
+    // Omistajan, ryhmän ja muiden oikeudet taulukosta välilyönnein eroteltuina
+    memcpy(buf, rwx[(mode >> 6) & 7], 3);
+    buf[3] = ' ';
+    memcpy(buf + 4, rwx[(mode >> 3) & 7], 3);
+    buf[7] = ' ';
+    memcpy(buf + 8, rwx[mode & 7], 3);
+    outbuf_write(ob, buf, 11);
+}
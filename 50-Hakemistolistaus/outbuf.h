@@ -0,0 +1,104 @@
+/*
+ * outbuf.h
+ *
+ * Tulostuspuskuri, joka korvaa printf-kutsut. Teksti kirjoitetaan suoraan muistiin ketjuun
+ * kasvavia lohkoja, ja luvut ja oikeusmerkkijonot muotoillaan käsin ilman muotoilumerkkijonojen
+ * tulkintaa. Valmis tulostus kirjoitetaan tiedostokuvaajaan suurina paloina writev-kutsulla, tai
+ * putkeen vmsplice-kutsulla kopioimatta.
+ */
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define OUTBUF_FLUSH_THRESHOLD (1024 * 1024)  // Suoratulostuksessa kirjoitetaan, kun puskurissa on näin paljon
+
+struct outchunk;
+
+struct outbuf {
+    struct outchunk *head;  // Ensimmäinen lohko
+    struct outchunk *tail;  // Viimeinen (kirjoitettava) lohko
+    char *start;            // Viimeisen lohkon datan alku
+    char *pos;              // Kirjoituskohta viimeisessä lohkossa
+    char *end;              // Viimeisen lohkon loppu
+    size_t size;            // Aiempien lohkojen tavujen määrä (ilman viimeistä lohkoa)
+    int nchunks;            // Lohkojen määrä
+};
+
+// Alustaa tyhjän puskurin
+void outbuf_init(struct outbuf *ob);
+
+// Vapauttaa puskurin kirjoittamatta sitä
+void outbuf_free(struct outbuf *ob);
+
+// Aloittaa uuden lohkon, kun viimeinen on täynnä (sisäinen apufunktio). Lohkot kasvavat 4 KiB:stä
+// 1 MiB:hen, jotta pienten hakemistojen tulostus ei vie turhaa muistia odottaessaan tulostusvuoroaan.
+void outbuf_grow(struct outbuf *ob);
+
+// Siirtää src-puskurin lohkot dst-puskurin loppuun kopioimatta ja tyhjentää src-puskurin
+void outbuf_append(struct outbuf *dst, struct outbuf *src);
+
+// Kirjoittaa puskurin sisällön tiedostokuvaajaan ja tyhjentää puskurin. Kirjoitukset eri säikeistä
+// samaan aikaan sarjallistetaan, joten yhden kutsun tulostus ei sekoitu muiden kanssa.
+// Palauttaa 0 tai -1 (errno asetettu).
+int outbuf_flush(struct outbuf *ob, int fd);
+
+// Palauttaa puskuroitujen tavujen määrän
+static inline size_t outbuf_size(const struct outbuf *ob) {
+    return ob->size + (size_t)(ob->pos - ob->start);
+}
+
+// Lisää tavut puskuriin
+static inline void outbuf_write(struct outbuf *ob, const char *data, size_t len) {
+    while ((size_t)(ob->end - ob->pos) < len) {
+        size_t avail = ob->end - ob->pos;
+        memcpy(ob->pos, data, avail);
+        ob->pos += avail;
+        data += avail;
+        len -= avail;
+        outbuf_grow(ob);
+    }
+    memcpy(ob->pos, data, len);
+    ob->pos += len;
+}
+
+// Lisää merkin puskuriin
+static inline void outbuf_putc(struct outbuf *ob, char c) {
+    if (ob->pos == ob->end) {
+        outbuf_grow(ob);
+    }
+    *ob->pos++ = c;
+}
+
+// Lisää nollaan päättyvän merkkijonon puskuriin
+static inline void outbuf_puts(struct outbuf *ob, const char *s) {
+    outbuf_write(ob, s, strlen(s));
+}
+
+// Lisää merkkijonovakion puskuriin (pituus lasketaan käännösaikana)
+#define outbuf_lit(ob, s) outbuf_write((ob), (s), sizeof(s) - 1)
+
+// Muotoilee etumerkittömän luvun puskuriin ja palauttaa sen pituuden (enintään 20 merkkiä)
+size_t outbuf_fmt_u64(char *buf, uint64_t value);
+
+// Lisää etumerkittömän luvun puskuriin
+void outbuf_put_u64(struct outbuf *ob, uint64_t value);
+
+// Lisää etumerkillisen luvun puskuriin
+void outbuf_put_i64(struct outbuf *ob, int64_t value);
+
+// Lisää merkkijonon vasemmalle tasattuna width merkin levyiseen kenttään ja katkaisee sen
+// enintään max merkkiin (vastaa printf-muotoilua %-width.maxs)
+void outbuf_put_padded(struct outbuf *ob, const char *s, size_t width, size_t max);
+
+// Lisää luvun vasemmalle tasattuna width merkin levyiseen kenttään (vastaa printf-muotoilua %-widthd)
+void outbuf_put_u64_padded(struct outbuf *ob, uint64_t value, size_t width);
+
+// Lisää tiedoston oikeudet muodossa "rwx rwx rwx" ilman tyyppimerkkiä
+void outbuf_put_permissions(struct outbuf *ob, mode_t mode);
+
+#endif
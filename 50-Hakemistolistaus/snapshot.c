@@ -0,0 +1,498 @@
+/*
+ * snapshot.c
+ *
+ * Tilannevedoksen luku ja kirjoitus. Vedos kuvataan muistiin mmap-kutsulla, ja hakemistot ja
+ * tiedostot haetaan siitä binäärihaulla, joten vanhaa vedosta ei tarvitse lukea kokonaan muistiin.
+ * Uuden vedoksen hakemistot kerätään säikeistä muistiin ja järjestetään vasta kirjoitettaessa,
+ * koska rinnakkainen läpikäynti valmistuu hakemistoihin satunnaisessa järjestyksessä.
+ */
+
+#define _GNU_SOURCE
+
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+#include "xattrat.h"
+
+// Vedokseen lisätty hakemisto ennen kirjoitusta (tiedostot ja nimet samassa varauksessa)
+struct pending_dir {
+    const char *path;                // Hakemiston polku
+    struct snapshot_dir dir;         // Hakemiston tiedot (siirtymät lasketaan kirjoitettaessa)
+    struct snapshot_entry *entries;  // Tiedostot nimen mukaan järjestettynä
+    const char *names;               // Tiedostojen nimet
+    size_t names_len;                // Nimien yhteispituus
+    uint64_t names_off;              // Nimien alku merkkijonotaulussa (lasketaan kirjoitettaessa)
+};
+
+// Kerättävä vedos
+static struct {
+    pthread_mutex_t lock;         // Suojaa hakemistotaulukon
+    struct pending_dir **dirs;    // Valmiit hakemistot
+    size_t count;                 // Hakemistojen määrä
+    size_t cap;                   // Taulukon koko
+    const char *root;             // Juurihakemiston polku
+    int64_t started;              // Aloitusaika
+} writer = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Palauttaa n pyöristettynä ylöspäin 8:n monikertaan
+static size_t pad8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+int snapshot_open(struct snapshot *snap, const char *file) {
+    const struct snapshot_header *h;
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(snap, 0, sizeof(*snap));
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("Error opening snapshot");
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        perror("Error reading snapshot");
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct snapshot_header)) {
+        fprintf(stderr, "%s: ei ole tilannevedos\n", file);
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping snapshot");
+        return -1;
+    }
+    snap->size = st.st_size;
+    snap->header = h = map;
+
+    // Tarkista otsake ja taulukoiden rajat, jotta rikkinäinen tiedosto ei johda lukemaan muistin ohi
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 || h->version != SNAPSHOT_VERSION ||
+        h->byte_order != SNAPSHOT_BYTE_ORDER || h->dirs_off > snap->size ||
+        h->ndirs > (snap->size - h->dirs_off) / sizeof(struct snapshot_dir) || h->entries_off > snap->size ||
+        h->nentries > (snap->size - h->entries_off) / sizeof(struct snapshot_entry) || h->strtab_off > snap->size ||
+        h->strtab_size == 0 || h->strtab_size > snap->size - h->strtab_off || h->root >= h->strtab_size ||
+        h->dirs_off % 8 != 0 || h->entries_off % 8 != 0) {
+        fprintf(stderr, "%s: virheellinen tai eri koneella tehty tilannevedos\n", file);
+        snapshot_close(snap);
+        return -1;
+    }
+    snap->dirs = (const void *)((const char *)map + h->dirs_off);
+    snap->entries = (const void *)((const char *)map + h->entries_off);
+    snap->strtab = (const char *)map + h->strtab_off;
+    if (snap->strtab[h->strtab_size - 1] != '\0') {
+        fprintf(stderr, "%s: virheellinen tilannevedos\n", file);
+        snapshot_close(snap);
+        return -1;
+    }
+    for (uint64_t i = 0; i < h->ndirs; i++) {
+        const struct snapshot_dir *d = &snap->dirs[i];
+        if (d->path >= h->strtab_size || d->first > h->nentries || d->count > h->nentries - d->first) {
+            fprintf(stderr, "%s: virheellinen tilannevedos\n", file);
+            snapshot_close(snap);
+            return -1;
+        }
+    }
+
+    // Tiedostotaulua luetaan hakemisto kerrallaan, ei järjestyksessä alusta loppuun
+    madvise(map, snap->size, MADV_RANDOM);
+    return 0;
+}
+
+void snapshot_close(struct snapshot *snap) {
+    if (snap->header != NULL) {
+        munmap((void *)snap->header, snap->size);
+    }
+    memset(snap, 0, sizeof(*snap));
+}
+
+// Palauttaa ensimmäisen hakemiston, jonka polku ei ole pienempi kuin path
+static size_t lower_bound(const struct snapshot *snap, const char *path) {
+    size_t lo = 0, hi = snap->header->ndirs;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(snapshot_str(snap, snap->dirs[mid].path), path) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const struct snapshot_dir *snapshot_find_dir(const struct snapshot *snap, const char *path) {
+    size_t i = lower_bound(snap, path);
+
+    if (i < snap->header->ndirs && strcmp(snapshot_str(snap, snap->dirs[i].path), path) == 0) {
+        return &snap->dirs[i];
+    }
+    return NULL;
+}
+
+const struct snapshot_entry *snapshot_find_entry(const struct snapshot *snap, const struct snapshot_dir *dir, const char *name) {
+    const struct snapshot_entry *entries = snap->entries + dir->first;
+    size_t lo = 0, hi = dir->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(snapshot_str(snap, entries[mid].name), name);
+        if (cmp == 0) {
+            return &entries[mid];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+void snapshot_subdirs(const struct snapshot *snap, const char *path, size_t *first, size_t *last) {
+    size_t len = strlen(path);
+    char *prefix = malloc(len + 2);
+    size_t i;
+
+    if (prefix == NULL) {
+        *first = *last = 0;
+        return;
+    }
+
+    // Saman etuliitteen polut ovat järjestyksessä peräkkäin
+    memcpy(prefix, path, len);
+    if (len == 0 || path[len - 1] != '/') {
+        prefix[len++] = '/';
+    }
+    prefix[len] = '\0';
+
+    i = *first = lower_bound(snap, prefix);
+    while (i < snap->header->ndirs && strncmp(snapshot_str(snap, snap->dirs[i].path), prefix, len) == 0) {
+        i++;
+    }
+    *last = i;
+    free(prefix);
+}
+
+// Sekoittaa 64-bittisen arvon (splitmix64:n viimeistely)
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Lisää attribuutin tiivisteeseen. Attribuuttien tiivisteet lasketaan yhteen, jolloin listan
+// järjestyksellä ei ole väliä.
+static void digest_xattr(void *arg, const char *key, const char *value, ssize_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;  // FNV-1a
+
+    if (len == -1) {
+        perror("Error getting extended attribute value");
+        return;
+    }
+    for (const char *p = key;; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
+        if (*p == '\0') {
+            break;
+        }
+    }
+    for (ssize_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)value[i]) * 0x100000001b3ULL;
+    }
+    *(uint64_t *)arg += mix64(h ^ (uint64_t)len);
+}
+
+uint64_t snapshot_xattr_digest(int dirfd, const char *name, mode_t mode) {
+    struct xattr_target target;
+    uint64_t digest = 0;
+
+    xattr_target_init(&target, dirfd, name, mode);
+    if (xattr_target_foreach(&target, digest_xattr, &digest) == -1 && errno != ENOTSUP) {
+        perror("Error getting extended attributes list");
+    }
+    xattr_target_close(&target);
+    return digest;
+}
+
+void snapshot_entry_set_stat(struct snapshot_entry *e, const struct statx *stx) {
+    e->ino = stx->stx_ino;
+    e->size = stx->stx_size;
+    e->mtime_sec = stx->stx_mtime.tv_sec;
+    e->mtime_nsec = stx->stx_mtime.tv_nsec;
+    e->ctime_sec = stx->stx_ctime.tv_sec;
+    e->ctime_nsec = stx->stx_ctime.tv_nsec;
+    e->mode = stx->stx_mode;
+    e->nlink = stx->stx_nlink;
+    e->uid = stx->stx_uid;
+    e->gid = stx->stx_gid;
+    e->reserved = 0;
+}
+
+bool snapshot_entry_changed(const struct snapshot_entry *a, const struct snapshot_entry *b) {
+    if (a->ino != b->ino || a->mode != b->mode || a->type != b->type || a->uid != b->uid || a->gid != b->gid ||
+        a->xattr_digest != b->xattr_digest) {
+        return true;
+    }
+    if (S_ISDIR(a->mode)) {
+        return false;
+    }
+    return a->size != b->size || a->nlink != b->nlink || a->mtime_sec != b->mtime_sec || a->mtime_nsec != b->mtime_nsec;
+}
+
+void snapshot_builder_reset(struct snapshot_builder *b) {
+    b->count = 0;
+    b->names_len = 0;
+}
+
+// Varaa taulukolle uuden koon. Vedosta ei voi jatkaa ilman muistia.
+static void *grow_array(void *array, size_t count, size_t elem) {
+    array = realloc(array, count * elem);
+    if (array == NULL) {
+        perror("Error allocating snapshot buffers");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+struct snapshot_entry *snapshot_builder_add(struct snapshot_builder *b, const char *name) {
+    size_t len = strlen(name) + 1;
+    struct snapshot_entry *e;
+
+    if (b->count == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 256;
+        b->entries = grow_array(b->entries, b->cap, sizeof(*b->entries));
+    }
+    if (b->names_len + len > b->names_cap) {
+        while (b->names_len + len > b->names_cap) {
+            b->names_cap = b->names_cap ? b->names_cap * 2 : 8192;
+        }
+        b->names = grow_array(b->names, b->names_cap, 1);
+    }
+
+    e = &b->entries[b->count++];
+    memset(e, 0, sizeof(*e));
+    e->name = b->names_len;
+    memcpy(b->names + b->names_len, name, len);
+    b->names_len += len;
+    return e;
+}
+
+struct snapshot_entry *snapshot_builder_copy(struct snapshot_builder *b, const struct snapshot_entry *e, const char *name) {
+    struct snapshot_entry *copy = snapshot_builder_add(b, name);
+    uint64_t name_off = copy->name;
+
+    *copy = *e;
+    copy->name = name_off;
+    return copy;
+}
+
+const struct snapshot_entry *snapshot_builder_find(const struct snapshot_builder *b, const char *name) {
+    size_t lo = 0, hi = b->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(b->names + b->entries[mid].name, name);
+        if (cmp == 0) {
+            return &b->entries[mid];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Vertaa kahden tiedoston nimiä (names on kerääjän nimipuskuri)
+static int compare_entries(const void *a, const void *b, void *names) {
+    return strcmp((const char *)names + ((const struct snapshot_entry *)a)->name,
+                  (const char *)names + ((const struct snapshot_entry *)b)->name);
+}
+
+void snapshot_builder_sort(struct snapshot_builder *b) {
+    qsort_r(b->entries, b->count, sizeof(*b->entries), compare_entries, b->names);
+}
+
+void snapshot_builder_free(struct snapshot_builder *b) {
+    free(b->entries);
+    free(b->names);
+    memset(b, 0, sizeof(*b));
+}
+
+void snapshot_writer_init(const char *root) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    writer.root = root;
+    writer.started = now.tv_sec;
+}
+
+void snapshot_writer_add_dir(const char *path, const struct statx *stx, const struct snapshot_builder *b) {
+    size_t plen = strlen(path) + 1;
+    size_t esize = b->count * sizeof(struct snapshot_entry);
+    struct pending_dir *d;
+    char *p;
+
+    // Yksi varaus hakemistoa kohden: otsake, tiedostot, nimet ja polku
+    d = malloc(sizeof(*d) + esize + b->names_len + plen);
+    if (d == NULL) {
+        perror("Error allocating snapshot buffers");
+        exit(EXIT_FAILURE);
+    }
+    p = (char *)(d + 1);
+    d->entries = (struct snapshot_entry *)p;
+    memcpy(d->entries, b->entries, esize);
+    p += esize;
+    memcpy(p, b->names, b->names_len);
+    d->names = p;
+    d->names_len = b->names_len;
+    p += b->names_len;
+    memcpy(p, path, plen);
+    d->path = p;
+
+    memset(&d->dir, 0, sizeof(d->dir));
+    d->dir.ino = stx->stx_ino;
+    d->dir.dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    d->dir.mtime_sec = stx->stx_mtime.tv_sec;
+    d->dir.mtime_nsec = stx->stx_mtime.tv_nsec;
+    d->dir.count = b->count;
+
+    pthread_mutex_lock(&writer.lock);
+    if (writer.count == writer.cap) {
+        writer.cap = writer.cap ? writer.cap * 2 : 1024;
+        writer.dirs = grow_array(writer.dirs, writer.cap, sizeof(*writer.dirs));
+    }
+    writer.dirs[writer.count++] = d;
+    pthread_mutex_unlock(&writer.lock);
+}
+
+static int compare_dirs(const void *a, const void *b) {
+    return strcmp((*(struct pending_dir *const *)a)->path, (*(struct pending_dir *const *)b)->path);
+}
+
+// Kirjoittaa puskurin tiedostoon, kun siihen on kertynyt tarpeeksi
+static int flush_if_full(struct outbuf *out, int fd) {
+    return outbuf_size(out) >= OUTBUF_FLUSH_THRESHOLD ? outbuf_flush(out, fd) : 0;
+}
+
+int snapshot_writer_finish(const char *file) {
+    static const char zeros[8];
+    struct snapshot_header header;
+    struct outbuf out;
+    uint64_t strtab = 0;   // Merkkijonotaulun koko
+    uint64_t nentries = 0;
+    size_t rootlen = strlen(writer.root) + 1;
+    char *tmp;
+    int ret = 0;
+    int fd;
+
+    qsort(writer.dirs, writer.count, sizeof(*writer.dirs), compare_dirs);
+
+    // Laske merkkijonojen ja tiedostojen siirtymät: ensin juuri, sitten jokaisen hakemiston polku ja nimet
+    strtab = rootlen;
+    for (size_t i = 0; i < writer.count; i++) {
+        struct pending_dir *d = writer.dirs[i];
+        d->dir.path = strtab;
+        strtab += strlen(d->path) + 1;
+        d->names_off = strtab;
+        strtab += d->names_len;
+        d->dir.first = nentries;
+        nentries += d->dir.count;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.started = writer.started;
+    header.root = 0;
+    header.ndirs = writer.count;
+    header.nentries = nentries;
+    header.dirs_off = pad8(sizeof(header));
+    header.entries_off = header.dirs_off + writer.count * sizeof(struct snapshot_dir);
+    header.strtab_off = header.entries_off + nentries * sizeof(struct snapshot_entry);
+    header.strtab_size = strtab;
+
+    if (asprintf(&tmp, "%s.tmp.%d", file, (int)getpid()) == -1) {
+        perror("Error allocating snapshot buffers");
+        return -1;
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Error creating snapshot");
+        free(tmp);
+        return -1;
+    }
+
+    outbuf_init(&out);
+    outbuf_write(&out, (const char *)&header, sizeof(header));
+    outbuf_write(&out, zeros, header.dirs_off - sizeof(header));
+    for (size_t i = 0; i < writer.count && ret == 0; i++) {
+        outbuf_write(&out, (const char *)&writer.dirs[i]->dir, sizeof(struct snapshot_dir));
+        ret = flush_if_full(&out, fd);
+    }
+    for (size_t i = 0; i < writer.count && ret == 0; i++) {
+        struct pending_dir *d = writer.dirs[i];
+        for (uint32_t j = 0; j < d->dir.count; j++) {
+            struct snapshot_entry e = d->entries[j];
+            e.name += d->names_off;
+            outbuf_write(&out, (const char *)&e, sizeof(e));
+        }
+        ret = flush_if_full(&out, fd);
+    }
+    outbuf_write(&out, writer.root, rootlen);
+    for (size_t i = 0; i < writer.count && ret == 0; i++) {
+        struct pending_dir *d = writer.dirs[i];
+        outbuf_puts(&out, d->path);
+        outbuf_putc(&out, '\0');
+        outbuf_write(&out, d->names, d->names_len);
+        ret = flush_if_full(&out, fd);
+    }
+    if (ret == 0) {
+        ret = outbuf_flush(&out, fd);
+    } else {
+        outbuf_free(&out);
+    }
+
+    // Varmista, että vedos on levyllä ennen kuin se korvaa edellisen
+    if (ret == 0 && fsync(fd) == -1) {
+        ret = -1;
+    }
+    if (close(fd) == -1) {
+        ret = -1;
+    }
+    if (ret == 0 && rename(tmp, file) == -1) {
+        ret = -1;
+    }
+    if (ret == -1) {
+        perror("Error writing snapshot");
+        unlink(tmp);
+    }
+    free(tmp);
+
+    for (size_t i = 0; i < writer.count; i++) {
+        free(writer.dirs[i]);
+    }
+    free(writer.dirs);
+    writer.dirs = NULL;
+    writer.count = writer.cap = 0;
+    return ret;
+}
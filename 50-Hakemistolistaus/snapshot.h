@@ -0,0 +1,155 @@
+/*
+ * snapshot.h
+ *
+ * Hakemistopuun tilannevedos: levylle tallennettava, mmap-kutsulla suoraan käytettävä hakemisto,
+ * jossa on jokaisen tiedoston tilatiedot ja laajennettujen attribuuttien tiiviste. Seuraava ajo
+ * vertaa hakemistojen muokkausaikoja vedokseen ja lukee uudelleen vain muuttuneet hakemistot.
+ *
+ * Tiedoston rakenne (koneen omassa tavujärjestyksessä):
+ *   struct snapshot_header
+ *   struct snapshot_dir[ndirs]        polun mukaan järjestettynä (strcmp)
+ *   struct snapshot_entry[nentries]   hakemistoittain hakemistojen järjestyksessä, hakemiston sisällä
+ *                                     nimen mukaan järjestettynä
+ *   merkkijonotaulu                    polut ja nimet nollamerkkiin päättyvinä
+ * Taulukot alkavat 8 tavun rajalta, joten niitä voi käyttää suoraan muistikuvauksesta.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "HKLSSNAP"         // Tiedoston tunniste (8 tavua)
+#define SNAPSHOT_VERSION 1                // Tiedostomuodon versio
+#define SNAPSHOT_BYTE_ORDER 0x01020304  // Tavujärjestyksen tunniste kirjoittajan järjestyksessä
+
+// Tiedoston otsake
+struct snapshot_header {
+    char magic[8];         // SNAPSHOT_MAGIC (ilman nollamerkkiä)
+    uint32_t version;      // SNAPSHOT_VERSION
+    uint32_t byte_order;   // SNAPSHOT_BYTE_ORDER
+    int64_t started;       // Vedoksen ottamisen aloitusaika (sekunnit vuoden 1970 alusta)
+    uint64_t root;         // Juurihakemiston polun siirtymä merkkijonotaulussa
+    uint64_t ndirs;        // Hakemistojen määrä
+    uint64_t nentries;     // Tiedostojen määrä
+    uint64_t dirs_off;     // Hakemistotaulun siirtymä tiedoston alusta
+    uint64_t entries_off;  // Tiedostotaulun siirtymä tiedoston alusta
+    uint64_t strtab_off;   // Merkkijonotaulun siirtymä tiedoston alusta
+    uint64_t strtab_size;  // Merkkijonotaulun koko
+};
+
+// Luettu hakemisto
+struct snapshot_dir {
+    uint64_t path;       // Polun siirtymä merkkijonotaulussa
+    uint64_t first;      // Ensimmäisen tiedoston indeksi tiedostotaulussa
+    uint64_t ino;        // Hakemiston i-solmu
+    uint64_t dev;        // Hakemiston laite
+    int64_t mtime_sec;   // Hakemiston muokkausaika (muuttuu, kun tiedostoja lisätään tai poistetaan)
+    uint32_t mtime_nsec;
+    uint32_t count;      // Tiedostojen määrä
+};
+
+// Hakemiston tiedosto
+struct snapshot_entry {
+    uint64_t name;          // Nimen siirtymä merkkijonotaulussa
+    uint64_t ino;           // Tilatiedot
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t ctime_sec;
+    uint64_t xattr_digest;  // Laajennettujen attribuuttien tiiviste (0, jos attribuutteja ei ole)
+    uint32_t mtime_nsec;
+    uint32_t ctime_nsec;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t type;          // Tyyppi hakemistosta (d_type), symbolisia linkkejä ei seurata
+    uint32_t reserved;      // Nolla
+};
+
+// Avattu (muistiin kuvattu) vedos
+struct snapshot {
+    const struct snapshot_header *header;
+    const struct snapshot_dir *dirs;
+    const struct snapshot_entry *entries;
+    const char *strtab;
+    size_t size;  // Muistikuvauksen koko
+};
+
+// Yhden hakemiston tiedostot, jotka kerätään ennen vertailua ja tallennusta (säiekohtainen)
+struct snapshot_builder {
+    struct snapshot_entry *entries;  // Tiedostot (name on siirtymä names-puskurissa)
+    size_t count;
+    size_t cap;
+    char *names;                     // Nimet nollamerkkiin päättyvinä
+    size_t names_len;
+    size_t names_cap;
+};
+
+// Avaa vedoksen ja tarkistaa sen otsakkeen. Palauttaa 0 tai -1 (virheilmoitus tulostettu).
+int snapshot_open(struct snapshot *snap, const char *file);
+
+// Sulkee vedoksen
+void snapshot_close(struct snapshot *snap);
+
+// Palauttaa merkkijonon vedoksen merkkijonotaulusta (rikkinäisen siirtymän tilalla tyhjän merkkijonon)
+static inline const char *snapshot_str(const struct snapshot *snap, uint64_t off) {
+    return off < snap->header->strtab_size ? snap->strtab + off : "";
+}
+
+// Hakee hakemiston polun perusteella. Palauttaa NULL, jos hakemistoa ei ole vedoksessa.
+const struct snapshot_dir *snapshot_find_dir(const struct snapshot *snap, const char *path);
+
+// Hakee hakemiston tiedoston nimen perusteella. Palauttaa NULL, jos tiedostoa ei ole vedoksessa.
+const struct snapshot_entry *snapshot_find_entry(const struct snapshot *snap, const struct snapshot_dir *dir, const char *name);
+
+// Palauttaa hakemiston alihakemistojen (polku alkaa "path/") indeksivälin [*first, *last) hakemistotaulussa
+void snapshot_subdirs(const struct snapshot *snap, const char *path, size_t *first, size_t *last);
+
+// Laskee tiedoston laajennettujen attribuuttien tiivisteen. Tulos ei riipu attribuuttien järjestyksestä.
+uint64_t snapshot_xattr_digest(int dirfd, const char *name, mode_t mode);
+
+// Täyttää tiedoston tilatiedot statx-rakenteesta (nimi, tyyppi ja tiiviste jätetään ennalleen)
+void snapshot_entry_set_stat(struct snapshot_entry *e, const struct statx *stx);
+
+// Vertaa tiedoston tilatietoja ja tiivistettä. Hakemistoista ei verrata kokoa, linkkejä eikä
+// muokkausaikaa, koska ne muuttuvat sisällön mukana, ja sisällön muutokset raportoidaan erikseen.
+bool snapshot_entry_changed(const struct snapshot_entry *a, const struct snapshot_entry *b);
+
+// Tyhjentää kerääjän uutta hakemistoa varten
+void snapshot_builder_reset(struct snapshot_builder *b);
+
+// Lisää tiedoston kerääjään ja palauttaa sen tietueen täytettäväksi (nimi kopioidaan)
+struct snapshot_entry *snapshot_builder_add(struct snapshot_builder *b, const char *name);
+
+// Lisää kopion toisen kerääjän tai vedoksen tiedostosta (nimi annetaan erikseen, koska se on lähteen puskurissa)
+struct snapshot_entry *snapshot_builder_copy(struct snapshot_builder *b, const struct snapshot_entry *e, const char *name);
+
+// Palauttaa kerätyn tiedoston nimen
+static inline const char *snapshot_builder_name(const struct snapshot_builder *b, const struct snapshot_entry *e) {
+    return b->names + e->name;
+}
+
+// Järjestää kerätyt tiedostot nimen mukaan
+void snapshot_builder_sort(struct snapshot_builder *b);
+
+// Hakee järjestetystä kerääjästä tiedoston nimen perusteella. Palauttaa NULL, jos tiedostoa ei ole.
+const struct snapshot_entry *snapshot_builder_find(const struct snapshot_builder *b, const char *name);
+
+// Vapauttaa kerääjän muistin
+void snapshot_builder_free(struct snapshot_builder *b);
+
+// Aloittaa uuden vedoksen keräämisen juurihakemistosta root. Kutsuttava ennen säikeiden luontia.
+void snapshot_writer_init(const char *root);
+
+// Lisää valmiin hakemiston vedokseen (kopioi kerääjän sisällön). Säieturvallinen.
+void snapshot_writer_add_dir(const char *path, const struct statx *stx, const struct snapshot_builder *b);
+
+// Kirjoittaa vedoksen tiedostoon. Tiedosto kirjoitetaan ensin väliaikaiseen tiedostoon ja nimetään
+// lopuksi uudelleen, joten keskeytynyt ajo ei riko edellistä vedosta. Palauttaa 0 tai -1.
+int snapshot_writer_finish(const char *file);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * timefmt.c
+ *
+ * Paikallisen ajan välimuisti: jokaiselle minuutille muotoillaan merkkijono kerran localtime_r- ja
+ * strftime-funktioilla. Sekuntien sijainti merkkijonossa selvitetään muotoilemalla sama minuutti
+ * kahdella eri sekuntiarvolla ja vertaamalla tuloksia. Jos sijaintia ei voida päätellä (esim. muoto
+ * sisältää %s-kentän), minuutin aikaleimat muotoillaan aina kokonaan.
+ */
+
+#define _GNU_SOURCE
+
+#include "timefmt.h"
+
+#include <langinfo.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#define TIME_CACHE_SLOTS 64  // Välimuistin paikat säiettä kohden (kahden potenssi)
+#define TIME_MAX 128         // Muotoillun paikallisen ajan enimmäispituus
+
+// Yhden minuutin muotoilu
+struct minute_slot {
+    int64_t minute;      // Minuutti vuoden 1970 alusta (INT64_MIN = tyhjä paikka)
+    int seconds_offset;  // Sekuntien sijainti merkkijonossa, -1 = ei sekunteja, -2 = muotoile aina
+    size_t len;          // Merkkijonon pituus
+    char text[TIME_MAX];  // Minuutin alun muotoilu
+};
+
+static enum time_style time_style;  // Valittu muoto
+static char date_format[TIME_MAX];  // Lokaalin D_T_FMT-muoto kopioituna kerran
+
+static __thread struct minute_slot cache[TIME_CACHE_SLOTS];  // Säiekohtainen välimuisti
+static __thread bool cache_ready;                            // Onko välimuisti alustettu
+
+// Kaksinumeroiset luvut 00-99 valmiina merkkipareina
+static const char two_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+void timefmt_init(enum time_style style) {
+    time_style = style;
+
+    // Aikavyöhyke luetaan kerran; localtime_r ei tämän jälkeen tarkista TZ-muuttujaa uudelleen
+    tzset();
+    strncpy(date_format, nl_langinfo(D_T_FMT), sizeof(date_format) - 1);
+}
+
+// Kirjoittaa luvun puskuriin vähintään width numerolla ja palauttaa kirjoitettujen merkkien määrän
+static size_t put_uint(char *buf, uint64_t value, int width) {
+    char tmp[24];
+    int len = 0;
+
+    do {
+        tmp[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0 || len < width);
+
+    for (int i = 0; i < len; i++) {
+        buf[i] = tmp[len - 1 - i];
+    }
+    return len;
+}
+
+// Muuntaa päivän numeron (vuoden 1970 alusta) kalenteripäiväksi (Howard Hinnantin civil_from_days)
+static void civil_from_days(int64_t days, int64_t *year, unsigned *month, unsigned *day) {
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);                          // Päivä 400 vuoden jaksossa
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;  // Vuosi jaksossa
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);                // Päivä maaliskuusta alkavassa vuodessa
+    unsigned mp = (5 * doy + 2) / 153;                                     // Kuukausi maaliskuusta alkaen
+
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+// Muotoilee ISO-8601-aikaleiman UTC-aikana ilman lokaalia ja aikavyöhyketietoja
+static size_t format_iso(char *buf, int64_t sec, uint32_t nsec) {
+    int64_t days = (sec >= 0 ? sec : sec - 86399) / 86400;  // Pyöristys alaspäin myös negatiivisille
+    int64_t rem = sec - days * 86400;
+    int64_t year;
+    unsigned month, day;
+    size_t len = 0;
+
+    civil_from_days(days, &year, &month, &day);
+    if (year < 0) {
+        buf[len++] = '-';
+        year = -year;
+    }
+    len += put_uint(buf + len, year, 4);
+    buf[len++] = '-';
+    memcpy(buf + len, &two_digits[month * 2], 2);
+    buf[len + 2] = '-';
+    memcpy(buf + len + 3, &two_digits[day * 2], 2);
+    buf[len + 5] = 'T';
+    memcpy(buf + len + 6, &two_digits[rem / 3600 * 2], 2);
+    buf[len + 8] = ':';
+    memcpy(buf + len + 9, &two_digits[rem / 60 % 60 * 2], 2);
+    buf[len + 11] = ':';
+    memcpy(buf + len + 12, &two_digits[rem % 60 * 2], 2);
+    buf[len + 14] = '.';
+    len += 15;
+    len += put_uint(buf + len, nsec, 9);
+    buf[len++] = 'Z';
+    return len;
+}
+
+// Muotoilee aikaleiman sekunteina ja nanosekunteina vuoden 1970 alusta
+static size_t format_epoch(char *buf, int64_t sec, uint32_t nsec) {
+    size_t len = 0;
+
+    // Negatiivinen aikaleima esitetään tarkkana desimaalilukuna (esim. -1.5 eikä -2.500000000)
+    if (sec < 0) {
+        buf[len++] = '-';
+        if (nsec > 0) {
+            sec++;
+            nsec = 1000000000 - nsec;
+        }
+        len += put_uint(buf + len, -(uint64_t)sec, 1);
+    } else {
+        len += put_uint(buf + len, sec, 1);
+    }
+    buf[len++] = '.';
+    len += put_uint(buf + len, nsec, 9);
+    return len;
+}
+
+// Muotoilee minuutin alun paikallisena aikana ja selvittää sekuntien sijainnin
+static void fill_slot(struct minute_slot *slot, int64_t minute) {
+    time_t base = minute * 60;
+    struct tm tm;
+    char other[TIME_MAX];
+    size_t other_len;
+    int diffs = 0;
+
+    slot->minute = minute;
+    slot->seconds_offset = -2;
+    localtime_r(&base, &tm);
+    slot->len = strftime(slot->text, sizeof(slot->text), date_format, &tm);
+
+    // Karkaussekunteja käyttävissä vyöhykkeissä minuutti ei ala sekunnista 0, joten ei välimuistia
+    if (tm.tm_sec != 0 || slot->len == 0) {
+        return;
+    }
+
+    // Muotoile sama minuutti sekunnilla 37 ja etsi kohta, jossa "00" vaihtui "37":ksi
+    tm.tm_sec = 37;
+    other_len = strftime(other, sizeof(other), date_format, &tm);
+    if (other_len != slot->len) {
+        return;
+    }
+    slot->seconds_offset = -1;
+    for (size_t i = 0; i < slot->len; i++) {
+        if (slot->text[i] != other[i]) {
+            diffs++;
+            if (diffs == 1 && i + 1 < slot->len && memcmp(&slot->text[i], "00", 2) == 0 && memcmp(&other[i], "37", 2) == 0) {
+                slot->seconds_offset = i;
+            }
+        }
+    }
+
+    // Sekunnit löytyivät täsmälleen yhdestä kahden merkin kentästä
+    if (diffs != 0 && (diffs != 2 || slot->seconds_offset < 0)) {
+        slot->seconds_offset = -2;
+    }
+}
+
+// Muotoilee paikallisen ajan välimuistin avulla
+static size_t format_locale(char *buf, size_t size, int64_t sec) {
+    int64_t minute = (sec >= 0 ? sec : sec - 59) / 60;
+    struct minute_slot *slot = &cache[(uint64_t)minute & (TIME_CACHE_SLOTS - 1)];
+
+    if (!cache_ready) {
+        for (int i = 0; i < TIME_CACHE_SLOTS; i++) {
+            cache[i].minute = INT64_MIN;
+        }
+        cache_ready = true;
+    }
+
+    if (slot->minute != minute) {
+        fill_slot(slot, minute);
+    }
+
+    // Muotoa ei voida päivittää pelkillä sekunneilla: muotoile kokonaan
+    if (slot->seconds_offset == -2 || slot->len >= size) {
+        time_t t = sec;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        return strftime(buf, size, date_format, &tm);
+    }
+
+    memcpy(buf, slot->text, slot->len + 1);
+    if (slot->seconds_offset >= 0) {
+        memcpy(buf + slot->seconds_offset, &two_digits[(sec - minute * 60) * 2], 2);
+    }
+    return slot->len;
+}
+
+size_t timefmt_format(char *buf, size_t size, int64_t sec, uint32_t nsec) {
+    size_t len;
+
+    switch (time_style) {
+        case TIME_ISO:
+        case TIME_EPOCH:
+            // Pisimmätkin muodot (32 merkkiä) mahtuvat tähän; lyhyempi puskuri jää tyhjäksi
+            if (size < 40) {
+                if (size > 0) {
+                    buf[0] = '\0';
+                }
+                return 0;
+            }
+            len = time_style == TIME_ISO ? format_iso(buf, sec, nsec) : format_epoch(buf, sec, nsec);
+            buf[len] = '\0';
+            return len;
+        case TIME_LOCALE:
+        default:
+            return format_locale(buf, size, sec);
+    }
+}
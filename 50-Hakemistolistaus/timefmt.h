@@ -0,0 +1,29 @@
+/*
+ * timefmt.h
+ *
+ * Aikaleimojen nopea muotoilu. Aikavyöhyke ja lokaalin päiväysformaatti selvitetään kerran, ja
+ * paikallisen ajan muotoilut tallennetaan säiekohtaiseen välimuistiin minuutin tarkkuudella, joten
+ * saman minuutin aikaleimoille vaihdetaan vain sekunnit. ISO-8601- ja epoch-muodot eivät käytä
+ * lokaalia eikä aikavyöhyketietoja lainkaan.
+ */
+
+#ifndef TIMEFMT_H
+#define TIMEFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Aikaleimojen tulostusmuoto
+enum time_style {
+    TIME_LOCALE,  // Paikallinen aika lokaalin D_T_FMT-muodossa (oletus)
+    TIME_ISO,     // ISO-8601 UTC-aikana nanosekunnein, esim. 2024-05-01T12:30:45.123456789Z
+    TIME_EPOCH,   // Sekunnit ja nanosekunnit vuoden 1970 alusta, esim. 1714566645.123456789
+};
+
+// Valitsee muodon ja selvittää aikavyöhykkeen ja lokaalin muodon. Kutsuttava ennen säikeiden luontia.
+void timefmt_init(enum time_style style);
+
+// Muotoilee aikaleiman puskuriin ja palauttaa merkkijonon pituuden. Säieturvallinen.
+size_t timefmt_format(char *buf, size_t size, int64_t sec, uint32_t nsec);
+
+#endif
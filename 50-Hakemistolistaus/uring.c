@@ -0,0 +1,142 @@
+/*
+ * uring.c
+ *
+ * io_uring-renkaan luonti, muistikuvaus ja pyyntöjen lähetys/vastaanotto. Jonojen indeksit ovat
+ * jaettua muistia ytimen kanssa, joten niitä luetaan ja kirjoitetaan acquire/release-järjestyksellä.
+ */
+
+#define _GNU_SOURCE
+
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int uring_init(struct uring *r, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(r, 0, sizeof(*r));
+    memset(&params, 0, sizeof(params));
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (r->fd < 0) {
+        r->fd = -1;
+        return -1;
+    }
+    r->entries = params.sq_entries;
+
+    // Jonojen muistikuvausten koot; uudemmat ytimet kuvaavat molemmat jonot yhdellä mmap-kutsulla
+    r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size) {
+            r->sq_ring_size = r->cq_ring_size;
+        }
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        r->sq_ring = NULL;
+        uring_free(r);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            r->cq_ring = NULL;
+            uring_free(r);
+            return -1;
+        }
+    }
+
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        uring_free(r);
+        return -1;
+    }
+
+    // Jonojen kentät sijaitsevat muistikuvauksissa ytimen ilmoittamissa kohdissa
+    r->sq_head = (unsigned *)((char *)r->sq_ring + params.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ring + params.sq_off.tail);
+    r->sq_mask = *(unsigned *)((char *)r->sq_ring + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ring + params.sq_off.array);
+    r->sq_local_tail = *r->sq_tail;
+    r->sq_submitted = r->sq_local_tail;
+    r->cq_head = (unsigned *)((char *)r->cq_ring + params.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ring + params.cq_off.tail);
+    r->cq_mask = *(unsigned *)((char *)r->cq_ring + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + params.cq_off.cqes);
+    return 0;
+}
+
+void uring_free(struct uring *r) {
+    int saved = errno;  // Säilytä alkuperäinen virhe virhepoluilla
+
+    if (r->sqes != NULL) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->cq_ring != NULL && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    if (r->sq_ring != NULL) {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+    if (r->fd != -1) {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    errno = saved;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+
+    if (r->sq_local_tail - head >= r->entries) {
+        return NULL;
+    }
+    sqe = &r->sqes[r->sq_local_tail & r->sq_mask];
+    r->sq_array[r->sq_local_tail & r->sq_mask] = r->sq_local_tail & r->sq_mask;
+    r->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(struct uring *r, unsigned wait_nr) {
+    unsigned to_submit = r->sq_local_tail - r->sq_submitted;  // Myös aiemmin epäonnistuneen kutsun pyynnöt
+    int ret;
+
+    // Julkaise täytetyt pyynnöt ytimelle ennen io_uring_enter-kutsua
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+
+    do {
+        ret = syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret > 0) {
+        r->sq_submitted += ret;
+    }
+    return ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *r) {
+    unsigned head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &r->cqes[head & r->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,56 @@
+/*
+ * uring.h
+ *
+ * Pieni io_uring-kääre suoraan systeemikutsujen päälle (ei liburing-riippuvuutta).
+ * Rengas on tarkoitettu yhden säikeen käyttöön.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+struct uring {
+    int fd;                     // io_uring-tiedostokuvaaja tai -1
+    unsigned entries;           // Lähetysjonon koko
+    unsigned *sq_head;          // Lähetysjonon alku (ydin päivittää)
+    unsigned *sq_tail;          // Lähetysjonon loppu (sovellus päivittää)
+    unsigned sq_mask;           // Lähetysjonon indeksimaski
+    unsigned *sq_array;         // Lähetysjonon indeksitaulukko
+    unsigned sq_local_tail;     // Täytetyt, mutta vielä julkaisemattomat pyynnöt
+    unsigned sq_submitted;      // Pyynnöt, jotka io_uring_enter on ottanut vastaan
+    struct io_uring_sqe *sqes;  // Pyyntötaulukko
+    unsigned *cq_head;          // Valmistumisjonon alku (sovellus päivittää)
+    unsigned *cq_tail;          // Valmistumisjonon loppu (ydin päivittää)
+    unsigned cq_mask;           // Valmistumisjonon indeksimaski
+    struct io_uring_cqe *cqes;  // Valmistumistaulukko
+    void *sq_ring;              // Lähetysjonon muistikuvaus
+    void *cq_ring;              // Valmistumisjonon muistikuvaus (voi olla sama kuin sq_ring)
+    size_t sq_ring_size;        // Lähetysjonon muistikuvauksen koko
+    size_t cq_ring_size;        // Valmistumisjonon muistikuvauksen koko
+    size_t sqes_size;           // Pyyntötaulukon koko
+};
+
+// Luo renkaan, jossa on vähintään entries paikkaa. Palauttaa 0 tai -1 (errno asetettu), jos ydin
+// ei tue io_uringia tai sen käyttö on estetty.
+int uring_init(struct uring *r, unsigned entries);
+
+// Vapauttaa renkaan
+void uring_free(struct uring *r);
+
+// Palauttaa seuraavan vapaan pyyntöpaikan nollattuna tai NULL, jos jono on täynnä
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+
+// Lähettää täytetyt pyynnöt ja odottaa, kunnes vähintään wait_nr pyyntöä on valmistunut.
+// Palauttaa lähetettyjen pyyntöjen määrän tai -1 (errno asetettu). Jos kutsu epäonnistuu (esim. EAGAIN
+// tai EBUSY), lähettämättä jääneet pyynnöt lähetetään seuraavalla kutsulla.
+int uring_submit_and_wait(struct uring *r, unsigned wait_nr);
+
+// Palauttaa seuraavan valmistuneen pyynnön tai NULL, jos valmistuneita ei ole
+struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+
+// Merkitsee uring_peek_cqe-funktion palauttaman pyynnön käsitellyksi
+void uring_cqe_seen(struct uring *r);
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * walk.c
+ *
+ * Työnvarastava säiepooli hakemistopuun rinnakkaiseen läpikäyntiin.
+ *
+ * Jokainen hakemisto on oma tehtävänsä. Säie ottaa tehtäviä oman jononsa lopusta (LIFO, jolloin
+ * läpikäynti etenee syvyyssuuntaisesti ja välimuisti pysyy lämpimänä) ja varastaa muiden säikeiden
+ * jonojen alusta (FIFO, jolloin varastetaan puun yläosasta isoja kokonaisuuksia).
+ *
+ * Järjestetyssä tilassa jokaisen hakemiston tulostus kerätään omaan puskuriinsa, ja pääsäie tulostaa
+ * hakemistot esijärjestyksessä sitä mukaa kun ne valmistuvat. Tulostus on siten täsmälleen sama
+ * säikeiden määrästä ja ajoituksesta riippumatta. Järjestämättömässä tilassa jokainen säie kirjoittaa
+ * omaan puskuriinsa ja tyhjentää sen hakemistojen välissä, kun puskuriin on kertynyt tarpeeksi.
+ */
+
+#include "walk.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct walk_dir {
+    char *path;                  // Hakemiston polku
+    struct walk_dir **children;  // Alihakemistot lisäysjärjestyksessä (vain järjestetyssä tilassa)
+    size_t nchildren;            // Alihakemistojen määrä
+    size_t children_cap;         // Alihakemistotaulukon koko
+    struct outbuf out;           // Hakemiston tulostus (vain järjestetyssä tilassa)
+    bool done;                   // Onko hakemisto käsitelty (suojattu emit_lock-lukolla)
+};
+
+// Säiekohtainen kaksipäinen jono (rengaspuskuri)
+struct deque {
+    pthread_mutex_t lock;     // Jonon lukko
+    struct walk_dir **items;  // Jonon alkiot
+    size_t head;              // Ensimmäisen alkion indeksi
+    size_t count;             // Alkioiden määrä
+    size_t cap;               // Rengaspuskurin koko
+};
+
+struct walker;
+
+struct worker {
+    struct walker *walker;  // Yhteinen tila
+    struct deque dq;        // Säikeen oma jono
+    struct outbuf out;      // Säikeen tulostuspuskuri (vain järjestämättömässä tilassa)
+    unsigned int seed;      // Satunnaisluvun siemen uhrin valintaan
+    pthread_t thread;       // Säikeen tunniste
+};
+
+struct walker {
+    struct worker *workers;      // Työsäikeet
+    int nworkers;                // Työsäikeiden määrä
+    bool ordered;                // Järjestetty tulostus
+    walk_visit_fn visit;         // Hakemistojen käsittelijä
+    atomic_long pending;         // Jonossa tai käsittelyssä olevien hakemistojen määrä
+    atomic_long queued;          // Jonoissa olevien hakemistojen määrä
+    atomic_int idle_waiters;     // Työtä odottavien säikeiden määrä
+    pthread_mutex_t idle_lock;   // Odottavien säikeiden lukko
+    pthread_cond_t idle_cond;    // Herätys uudesta työstä tai läpikäynnin päättymisestä
+    pthread_mutex_t emit_lock;   // Tulostusjärjestyksen lukko
+    pthread_cond_t emit_cond;    // Herätys pääsäikeelle hakemiston valmistuttua
+    struct walk_dir *emit_wait;  // Hakemisto, jota pääsäie odottaa
+};
+
+static __thread struct worker *current_worker;  // Kutsuvan säikeen työsäierakenne
+
+// Luo uuden hakemistotehtävän. Polku muodostetaan dynaamisesti, joten pituusrajaa ei ole.
+static struct walk_dir *walk_dir_new(const char *parent, const char *name) {
+    struct walk_dir *d = calloc(1, sizeof(*d));
+    if (d == NULL) {
+        return NULL;
+    }
+
+    if (parent == NULL) {
+        d->path = strdup(name);
+    } else {
+        size_t plen = strlen(parent);
+        size_t nlen = strlen(name);
+        bool slash = plen > 0 && parent[plen - 1] != '/';  // Lisää erotin vain tarvittaessa
+
+        d->path = malloc(plen + slash + nlen + 1);
+        if (d->path != NULL) {
+            memcpy(d->path, parent, plen);
+            if (slash) {
+                d->path[plen] = '/';
+            }
+            memcpy(d->path + plen + slash, name, nlen + 1);
+        }
+    }
+
+    if (d->path == NULL) {
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+static void walk_dir_free(struct walk_dir *d) {
+    free(d->children);
+    outbuf_free(&d->out);
+    free(d->path);
+    free(d);
+}
+
+// Lisää tehtävän jonon loppuun (vain jonon omistaja)
+static int deque_push(struct deque *dq, struct walk_dir *d) {
+    pthread_mutex_lock(&dq->lock);
+
+    // Kasvata rengaspuskuria tarvittaessa kaksinkertaiseksi
+    if (dq->count == dq->cap) {
+        size_t cap = dq->cap ? dq->cap * 2 : 64;
+        struct walk_dir **items = malloc(cap * sizeof(*items));
+        if (items == NULL) {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < dq->count; i++) {
+            items[i] = dq->items[(dq->head + i) % dq->cap];
+        }
+        free(dq->items);
+        dq->items = items;
+        dq->head = 0;
+        dq->cap = cap;
+    }
+
+    dq->items[(dq->head + dq->count) % dq->cap] = d;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+// Ottaa tehtävän jonon lopusta (vain jonon omistaja)
+static struct walk_dir *deque_pop(struct deque *dq) {
+    struct walk_dir *d = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        d = dq->items[(dq->head + dq->count) % dq->cap];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return d;
+}
+
+// Varastaa tehtävän toisen säikeen jonon alusta
+static struct walk_dir *deque_steal(struct deque *dq) {
+    struct walk_dir *d = NULL;
+
+    // Älä jää odottamaan kiireistä jonoa, vaan kokeile seuraavaa uhria
+    if (pthread_mutex_trylock(&dq->lock) != 0) {
+        return NULL;
+    }
+    if (dq->count > 0) {
+        d = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return d;
+}
+
+// Herättää työtä odottavat säikeet
+static void wake_idle(struct walker *w) {
+    if (atomic_load(&w->idle_waiters) > 0) {
+        pthread_mutex_lock(&w->idle_lock);
+        pthread_cond_broadcast(&w->idle_cond);
+        pthread_mutex_unlock(&w->idle_lock);
+    }
+}
+
+// Lisää tehtävän säikeen jonoon ja herättää odottavat säikeet
+static int submit(struct walker *w, struct worker *self, struct walk_dir *d) {
+    atomic_fetch_add(&w->pending, 1);
+    if (deque_push(&self->dq, d) == -1) {
+        atomic_fetch_sub(&w->pending, 1);
+        return -1;
+    }
+    atomic_fetch_add(&w->queued, 1);
+    wake_idle(w);
+    return 0;
+}
+
+// Hakee seuraavan tehtävän omasta jonosta tai varastamalla satunnaisesta uhrista alkaen
+static struct walk_dir *next_task(struct walker *w, struct worker *self) {
+    struct walk_dir *d = deque_pop(&self->dq);
+
+    if (d == NULL && w->nworkers > 1) {
+        int start = rand_r(&self->seed) % w->nworkers;
+        for (int i = 0; i < w->nworkers && d == NULL; i++) {
+            struct worker *victim = &w->workers[(start + i) % w->nworkers];
+            if (victim != self) {
+                d = deque_steal(&victim->dq);
+            }
+        }
+    }
+
+    if (d != NULL) {
+        atomic_fetch_sub(&w->queued, 1);
+    }
+    return d;
+}
+
+// Käsittelee yhden hakemiston ja luovuttaa sen tulostuksen
+static void process(struct walker *w, struct worker *self, struct walk_dir *d) {
+    if (w->ordered) {
+        // Tulostus kerätään hakemiston omaan puskuriin odottamaan tulostusvuoroaan
+        w->visit(d, &d->out);
+
+        // Merkitse hakemisto valmiiksi; pääsäie tulostaa ja vapauttaa sen
+        pthread_mutex_lock(&w->emit_lock);
+        d->done = true;
+        if (w->emit_wait == d) {
+            pthread_cond_signal(&w->emit_cond);
+        }
+        pthread_mutex_unlock(&w->emit_lock);
+    } else {
+        // Hakemisto kirjoitetaan säikeen puskuriin kokonaisena, joten tyhjennys hakemistojen välissä
+        // ei koskaan katkaise hakemiston tulostusta
+        w->visit(d, &self->out);
+        if (outbuf_size(&self->out) >= OUTBUF_FLUSH_THRESHOLD) {
+            outbuf_flush(&self->out, STDOUT_FILENO);
+        }
+        walk_dir_free(d);
+    }
+
+    // Viimeisen hakemiston valmistuttua herätä kaikki säikeet lopettamaan
+    if (atomic_fetch_sub(&w->pending, 1) == 1) {
+        pthread_mutex_lock(&w->idle_lock);
+        pthread_cond_broadcast(&w->idle_cond);
+        pthread_mutex_unlock(&w->idle_lock);
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct worker *self = arg;
+    struct walker *w = self->walker;
+
+    current_worker = self;
+
+    for (;;) {
+        struct walk_dir *d = next_task(w, self);
+
+        if (d == NULL) {
+            bool finished;
+
+            // Odota uutta työtä tai läpikäynnin päättymistä. Odottajien määrä kasvatetaan ennen
+            // jonojen tarkistamista, jotta submit-funktion herätys ei pääse katoamaan välistä.
+            pthread_mutex_lock(&w->idle_lock);
+            atomic_fetch_add(&w->idle_waiters, 1);
+            while (atomic_load(&w->queued) == 0 && atomic_load(&w->pending) > 0) {
+                pthread_cond_wait(&w->idle_cond, &w->idle_lock);
+            }
+            atomic_fetch_sub(&w->idle_waiters, 1);
+            finished = atomic_load(&w->pending) == 0;
+            pthread_mutex_unlock(&w->idle_lock);
+
+            if (finished) {
+                break;
+            }
+            continue;
+        }
+
+        process(w, self, d);
+    }
+
+    // Kirjoita säikeen puskuriin jäänyt tulostus
+    outbuf_flush(&self->out, STDOUT_FILENO);
+    return NULL;
+}
+
+// Tulostaa hakemiston ja sen alihakemistot esijärjestyksessä odottaen niiden valmistumista. Hakemistojen
+// puskurit liitetään out-puskuriin kopioimatta ja kirjoitetaan kerralla, kun niitä on kertynyt tarpeeksi.
+static void emit(struct walker *w, struct walk_dir *d, struct outbuf *out) {
+    pthread_mutex_lock(&w->emit_lock);
+    while (!d->done) {
+        w->emit_wait = d;
+        pthread_cond_wait(&w->emit_cond, &w->emit_lock);
+    }
+    w->emit_wait = NULL;
+    pthread_mutex_unlock(&w->emit_lock);
+
+    outbuf_append(out, &d->out);
+    if (outbuf_size(out) >= OUTBUF_FLUSH_THRESHOLD) {
+        outbuf_flush(out, STDOUT_FILENO);  // Kirjoita heti, jotta muistinkäyttö pysyy pienenä
+    }
+
+    for (size_t i = 0; i < d->nchildren; i++) {
+        emit(w, d->children[i], out);
+    }
+    walk_dir_free(d);
+}
+
+const char *walk_dir_path(const struct walk_dir *dir) {
+    return dir->path;
+}
+
+void walk_add_child(struct walk_dir *dir, const char *name) {
+    struct worker *self = current_worker;
+    struct walker *w = self->walker;
+    struct walk_dir *child = walk_dir_new(dir->path, name);
+
+    if (child == NULL) {
+        perror("Error allocating directory task");
+        return;
+    }
+
+    // Järjestetyssä tilassa alihakemisto liitetään vanhempaansa tulostusjärjestyksen säilyttämiseksi
+    if (w->ordered) {
+        if (dir->nchildren == dir->children_cap) {
+            size_t cap = dir->children_cap ? dir->children_cap * 2 : 8;
+            struct walk_dir **children = realloc(dir->children, cap * sizeof(*children));
+            if (children == NULL) {
+                perror("Error allocating directory task");
+                walk_dir_free(child);
+                return;
+            }
+            dir->children = children;
+            dir->children_cap = cap;
+        }
+        dir->children[dir->nchildren++] = child;
+    }
+
+    if (submit(w, self, child) == -1) {
+        perror("Error queueing directory task");
+        if (w->ordered) {
+            // Tyhjä valmis hakemisto, jotta tulostus ei jää odottamaan sitä
+            pthread_mutex_lock(&w->emit_lock);
+            child->done = true;
+            pthread_mutex_unlock(&w->emit_lock);
+        } else {
+            walk_dir_free(child);
+        }
+    }
+}
+
+int walk_tree(const char *root, int threads, bool ordered, walk_visit_fn visit) {
+    struct walker w = {0};
+    struct walk_dir *top;
+    int started = 0;
+
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    w.nworkers = threads;
+    w.ordered = ordered;
+    w.visit = visit;
+    atomic_init(&w.pending, 0);
+    atomic_init(&w.queued, 0);
+    atomic_init(&w.idle_waiters, 0);
+    pthread_mutex_init(&w.idle_lock, NULL);
+    pthread_cond_init(&w.idle_cond, NULL);
+    pthread_mutex_init(&w.emit_lock, NULL);
+    pthread_cond_init(&w.emit_cond, NULL);
+
+    w.workers = calloc(threads, sizeof(*w.workers));
+    top = walk_dir_new(NULL, root);
+    if (w.workers == NULL || top == NULL) {
+        perror("Error allocating walker");
+        free(w.workers);
+        free(top);
+        return -1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        w.workers[i].walker = &w;
+        w.workers[i].seed = i + 1;
+        pthread_mutex_init(&w.workers[i].dq.lock, NULL);
+    }
+
+    // Juurihakemisto ensimmäisen säikeen jonoon ennen säikeiden käynnistämistä
+    submit(&w, &w.workers[0], top);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&w.workers[i].thread, NULL, worker_main, &w.workers[i]) != 0) {
+            perror("Error creating worker thread");
+            break;
+        }
+        started++;
+    }
+
+    // Jos yhtään säiettä ei saatu käyntiin, käsitellään puu pääsäikeessä
+    if (started == 0) {
+        worker_main(&w.workers[0]);
+    }
+
+    if (ordered) {
+        struct outbuf out;
+
+        outbuf_init(&out);
+        emit(&w, top, &out);
+        outbuf_flush(&out, STDOUT_FILENO);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(w.workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&w.workers[i].dq.lock);
+        free(w.workers[i].dq.items);
+    }
+    free(w.workers);
+    pthread_mutex_destroy(&w.idle_lock);
+    pthread_cond_destroy(&w.idle_cond);
+    pthread_mutex_destroy(&w.emit_lock);
+    pthread_cond_destroy(&w.emit_cond);
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * walk.h
+ *
+ * Rinnakkainen hakemistopuun läpikäynti työnvarastavalla (work-stealing) säiepoolilla.
+ * Jokaisella säikeellä on oma hakemistojononsa (deque), josta se ottaa työtä päästä
+ * ja josta muut säikeet varastavat työtä toisesta päästä, kun niiden oma jono tyhjenee.
+ */
+
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdbool.h>
+
+#include "outbuf.h"
+
+struct walk_dir;  // Yksi läpikäytävä hakemisto (määritelty walk.c:ssä)
+
+// Käsittelijä, jota kutsutaan jokaiselle hakemistolle. Tulostus kirjoitetaan out-puskuriin,
+// ja alihakemistot lisätään läpikäytäviksi walk_add_child-funktiolla.
+typedef void (*walk_visit_fn)(struct walk_dir *dir, struct outbuf *out);
+
+// Palauttaa hakemiston polun
+const char *walk_dir_path(const struct walk_dir *dir);
+
+// Lisää hakemiston alihakemiston läpikäytäväksi. Alihakemistot tulostetaan lisäysjärjestyksessä.
+void walk_add_child(struct walk_dir *dir, const char *name);
+
+// Käy läpi hakemistopuun juuresta alkaen threads säikeellä. Jos ordered on tosi, tulostus
+// on aina sama kuin yhdellä säikeellä (hakemistot esijärjestyksessä), muuten hakemistot
+// tulostetaan siinä järjestyksessä, jossa ne valmistuvat. Palauttaa 0 tai -1 virheen sattuessa.
+int walk_tree(const char *root, int threads, bool ordered, walk_visit_fn visit);
+
+#endif
@@ -0,0 +1,680 @@
+/*
+ * watch.c
+ *
+ * Muutosten seuranta fanotify- tai inotify-kutsuilla. Hakemistot löytyvät tapahtuman tunnisteen
+ * perusteella hajautustaulusta: fanotify kertoo hakemiston tiedostojärjestelmän tunnisteen (fsid) ja
+ * tiedostotunnisteen (file handle), inotify watch-numeron. Tapahtumista otetaan talteen vain
+ * hakemisto ja nimi; tilatiedot haetaan vasta, kun tapahtumat ovat hetkeksi tauonneet.
+ */
+
+#define _GNU_SOURCE
+
+#include "watch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_EVENT_BUF (64 * 1024)  // Tapahtumien lukupuskurin koko
+#define WATCH_MIN_NAMES 256          // Näin monen muuttuneen nimen jälkeen harkitaan koko hakemiston lukemista
+#define WATCH_MAX_NAMES 65536        // Tätä useammat nimet luetaan aina koko hakemistona (muisti pysyy rajattuna)
+
+// fanotify-tapahtumat: tiedostojen luonti, poisto, siirto, tilatietojen ja sisällön muutos
+#define WATCH_FAN_MASK \
+    (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ATTRIB | FAN_MODIFY | FAN_ONDIR | FAN_EVENT_ON_CHILD)
+
+// Vastaavat inotify-tapahtumat
+#define WATCH_IN_MASK \
+    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+// Seurannan tila
+static struct {
+    pthread_mutex_t lock;           // Suojaa hajautustaulut (hakemistoja lisätään läpikäynnin säikeistä)
+    enum watch_backend backend;     // Käytössä oleva tapa (WATCH_FANOTIFY tai WATCH_INOTIFY)
+    bool fallback;                  // Saako fanotifysta vaihtaa inotifyyn
+    int fd;                         // fanotify- tai inotify-kuvaaja
+    struct watch_dir **by_path;     // Hakemistot polun mukaan
+    struct watch_dir **by_key;      // Hakemistot tunnisteen mukaan
+    size_t buckets;                 // Hajautustaulujen koko
+    size_t count;                   // Hakemistojen määrä
+    struct watch_dir *dirty_head;   // Muuttuneiden hakemistojen jono
+    struct watch_dir *dirty_tail;
+    struct timespec dirty_since;    // Milloin jonoon tuli ensimmäinen hakemisto
+    char **names;                   // Viimeksi annetut nimet (vapautetaan seuraavalla kierroksella)
+    size_t nnames;
+} watch = {.lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1};
+
+// FNV-1a-hajautus
+static size_t hash_bytes(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static size_t path_bucket(const char *path) {
+    return hash_bytes(path, strlen(path)) & (watch.buckets - 1);
+}
+
+static size_t key_bucket(const unsigned char *key, size_t len) {
+    return hash_bytes(key, len) & (watch.buckets - 1);
+}
+
+// Poistaa hakemiston tunnistetaulusta
+static void key_unlink(struct watch_dir *d) {
+    struct watch_dir **p;
+
+    if (d->key_len == 0) {
+        return;
+    }
+    for (p = &watch.by_key[key_bucket(d->key, d->key_len)]; *p != NULL; p = &(*p)->key_next) {
+        if (*p == d) {
+            *p = d->key_next;
+            break;
+        }
+    }
+    d->key_len = 0;
+}
+
+// Hakee hakemiston tunnisteen perusteella
+static struct watch_dir *key_find(const unsigned char *key, size_t len) {
+    struct watch_dir *d;
+
+    for (d = watch.by_key[key_bucket(key, len)]; d != NULL; d = d->key_next) {
+        if (d->key_len == len && memcmp(d->key, key, len) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+// Lisää hakemiston tunnistetauluun. Sama i-solmu antaa saman tunnisteen, joten siirretty hakemisto
+// vie tunnisteen vanhalta polultaan.
+static void key_insert(struct watch_dir *d, const unsigned char *key, size_t len) {
+    struct watch_dir *old = key_find(key, len);
+    size_t b;
+
+    if (old != NULL) {
+        key_unlink(old);
+    }
+    memcpy(d->key, key, len);
+    d->key_len = len;
+    b = key_bucket(key, len);
+    d->key_next = watch.by_key[b];
+    watch.by_key[b] = d;
+}
+
+// Kasvattaa hajautustaulut, kun hakemistoja on enemmän kuin lokeroita
+static int grow_tables(void) {
+    size_t buckets = watch.buckets ? watch.buckets * 2 : 1024;
+    struct watch_dir **by_path = calloc(buckets, sizeof(*by_path));
+    struct watch_dir **by_key = calloc(buckets, sizeof(*by_key));
+    size_t old_buckets = watch.buckets;
+    struct watch_dir **old_path = watch.by_path;
+
+    if (by_path == NULL || by_key == NULL) {
+        free(by_path);
+        free(by_key);
+        return -1;
+    }
+    free(watch.by_key);
+    watch.by_path = by_path;
+    watch.by_key = by_key;
+    watch.buckets = buckets;
+
+    for (size_t i = 0; i < old_buckets; i++) {
+        struct watch_dir *d = old_path[i];
+        while (d != NULL) {
+            struct watch_dir *next = d->path_next;
+            size_t b = path_bucket(d->path);
+            d->path_next = by_path[b];
+            by_path[b] = d;
+            if (d->key_len > 0) {
+                b = key_bucket(d->key, d->key_len);
+                d->key_next = by_key[b];
+                by_key[b] = d;
+            }
+            d = next;
+        }
+    }
+    free(old_path);
+    return 0;
+}
+
+// Tekee hakemistolle fanotify-merkinnän ja hakee sen tunnisteen. Merkintä ja tunniste haetaan
+// samasta avatusta kuvaajasta, joten ne koskevat varmasti samaa hakemistoa.
+static int mark_fanotify(struct watch_dir *d) {
+    unsigned char key[WATCH_KEY_MAX];
+    struct {
+        struct file_handle fh;
+        unsigned char data[MAX_HANDLE_SZ];
+    } handle;
+    struct statfs sfs;
+    int mount_id;
+    int fd;
+
+    fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    handle.fh.handle_bytes = MAX_HANDLE_SZ;
+    if (name_to_handle_at(fd, "", &handle.fh, &mount_id, AT_EMPTY_PATH) == -1 || fstatfs(fd, &sfs) == -1 ||
+        fanotify_mark(watch.fd, FAN_MARK_ADD | FAN_MARK_ONLYDIR, WATCH_FAN_MASK, fd, NULL) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    close(fd);
+
+    // Tunniste kuten tapahtumassa: fsid, tunnisteen tyyppi ja tunnisteen tavut
+    memcpy(key, &sfs.f_fsid, 8);
+    memcpy(key + 8, &handle.fh.handle_type, 4);
+    memcpy(key + 12, handle.fh.f_handle, handle.fh.handle_bytes);
+    key_insert(d, key, 12 + handle.fh.handle_bytes);
+    return 0;
+}
+
+// Tekee hakemistolle inotify-seurannan
+static int mark_inotify(struct watch_dir *d) {
+    int wd = inotify_add_watch(watch.fd, d->path, WATCH_IN_MASK);
+
+    if (wd == -1) {
+        return -1;
+    }
+    key_insert(d, (const unsigned char *)&wd, sizeof(wd));
+    return 0;
+}
+
+// Vaihtaa kaikki hakemistot inotify-seurantaan, kun fanotify ei toimi tiedostojärjestelmässä
+static int switch_to_inotify(void) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (fd == -1) {
+        return -1;
+    }
+    close(watch.fd);
+    watch.fd = fd;
+    watch.backend = WATCH_INOTIFY;
+    watch.fallback = false;
+    memset(watch.by_key, 0, watch.buckets * sizeof(*watch.by_key));
+
+    for (size_t i = 0; i < watch.buckets; i++) {
+        for (struct watch_dir *d = watch.by_path[i]; d != NULL; d = d->path_next) {
+            d->key_len = 0;
+            if (mark_inotify(d) == -1) {
+                perror("inotify_add_watch");
+            }
+        }
+    }
+    return 0;
+}
+
+// Tekee hakemistolle merkinnän valitulla tavalla
+static int mark_dir(struct watch_dir *d) {
+    if (watch.backend == WATCH_INOTIFY) {
+        return mark_inotify(d);
+    }
+    if (mark_fanotify(d) == 0) {
+        return 0;
+    }
+
+    // Tiedostojärjestelmä ei tue tiedostotunnisteita (esim. osa FUSE-järjestelmistä): käytä inotifya
+    if (watch.fallback && errno != ENOENT && errno != ENOTDIR && errno != EACCES) {
+        perror("fanotify not usable, falling back to inotify");
+        if (switch_to_inotify() == -1) {
+            return -1;
+        }
+        return mark_inotify(d);
+    }
+    return -1;
+}
+
+int watch_init(enum watch_backend backend) {
+    watch.backend = backend == WATCH_INOTIFY ? WATCH_INOTIFY : WATCH_FANOTIFY;
+    watch.fallback = backend == WATCH_AUTO;
+
+    if (watch.backend == WATCH_FANOTIFY) {
+        watch.fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+        if (watch.fd == -1) {
+            if (!watch.fallback) {
+                perror("fanotify_init");
+                return -1;
+            }
+            watch.backend = WATCH_INOTIFY;
+        }
+    }
+    if (watch.backend == WATCH_INOTIFY) {
+        watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watch.fd == -1) {
+            perror("inotify_init1");
+            return -1;
+        }
+    }
+    if (grow_tables() == -1) {
+        perror("Error allocating watch tables");
+        return -1;
+    }
+    return 0;
+}
+
+const char *watch_backend_name(void) {
+    return watch.backend == WATCH_FANOTIFY ? "fanotify" : "inotify";
+}
+
+// Hakee hakemiston polun perusteella (lukko pidettävä)
+static struct watch_dir *path_find(const char *path) {
+    for (struct watch_dir *d = watch.by_path[path_bucket(path)]; d != NULL; d = d->path_next) {
+        if (strcmp(d->path, path) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+struct watch_dir *watch_add_dir(const char *path) {
+    struct watch_dir *d;
+    size_t b;
+
+    pthread_mutex_lock(&watch.lock);
+    d = path_find(path);
+    if (d != NULL) {
+        pthread_mutex_unlock(&watch.lock);
+        return d;
+    }
+    if (watch.count >= watch.buckets && grow_tables() == -1) {
+        pthread_mutex_unlock(&watch.lock);
+        perror("Error allocating watch tables");
+        return NULL;
+    }
+
+    d = calloc(1, sizeof(*d));
+    if (d == NULL || (d->path = strdup(path)) == NULL) {
+        pthread_mutex_unlock(&watch.lock);
+        perror("Error allocating watch directory");
+        free(d);
+        return NULL;
+    }
+    if (mark_dir(d) == -1) {
+        pthread_mutex_unlock(&watch.lock);
+        if (errno == ENOSPC) {
+            perror("Error watching directory (see /proc/sys/fs/inotify/max_user_watches)");
+        } else if (errno != ENOENT) {
+            perror("Error watching directory");
+        }
+        free(d->path);
+        free(d);
+        return NULL;
+    }
+
+    b = path_bucket(path);
+    d->path_next = watch.by_path[b];
+    watch.by_path[b] = d;
+    watch.count++;
+    pthread_mutex_unlock(&watch.lock);
+    return d;
+}
+
+struct watch_dir *watch_find_dir(const char *path) {
+    struct watch_dir *d;
+
+    pthread_mutex_lock(&watch.lock);
+    d = path_find(path);
+    pthread_mutex_unlock(&watch.lock);
+    return d;
+}
+
+void watch_set_entries(struct watch_dir *d, struct snapshot_builder *b) {
+    struct snapshot_builder tmp = d->entries;
+
+    d->entries = *b;
+    *b = tmp;
+}
+
+// Vapauttaa hakemiston muuttuneet nimet
+static void free_names(char **names, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+// Lisää hakemiston muuttuneiden jonoon
+static void mark_dirty(struct watch_dir *d) {
+    if (d->dirty) {
+        return;
+    }
+    d->dirty = true;
+    d->dirty_next = NULL;
+    if (watch.dirty_tail != NULL) {
+        watch.dirty_tail->dirty_next = d;
+    } else {
+        watch.dirty_head = d;
+        clock_gettime(CLOCK_MONOTONIC, &watch.dirty_since);
+    }
+    watch.dirty_tail = d;
+}
+
+// Merkitsee hakemiston luettavaksi kokonaan
+static void mark_rescan(struct watch_dir *d) {
+    free_names(d->names, d->nnames);
+    d->names = NULL;
+    d->nnames = d->names_cap = 0;
+    d->rescan = true;
+    mark_dirty(d);
+}
+
+// Kirjaa muuttuneen nimen. Sama tiedosto tuottaa usein monta peräkkäistä tapahtumaa (luonti,
+// kirjoitukset, tilatiedot), joten peräkkäiset samat nimet yhdistetään heti.
+static void mark_name(struct watch_dir *d, const char *name) {
+    if (d->rescan || strcmp(name, ".") == 0) {
+        return;
+    }
+    if (d->nnames > 0 && strcmp(d->names[d->nnames - 1], name) == 0) {
+        return;
+    }
+
+    // Kun suuri osa hakemistosta on muuttunut, yksi getdents-luku ja erähaku on halvempi kuin nimikohtaiset haut
+    if (d->nnames >= WATCH_MAX_NAMES || (d->nnames >= WATCH_MIN_NAMES && d->nnames >= d->entries.count / 4)) {
+        mark_rescan(d);
+        return;
+    }
+
+    if (d->nnames == d->names_cap) {
+        size_t cap = d->names_cap ? d->names_cap * 2 : 16;
+        char **names = realloc(d->names, cap * sizeof(*names));
+        if (names == NULL) {
+            mark_rescan(d);
+            return;
+        }
+        d->names = names;
+        d->names_cap = cap;
+    }
+    d->names[d->nnames] = strdup(name);
+    if (d->names[d->nnames] == NULL) {
+        mark_rescan(d);
+        return;
+    }
+    d->nnames++;
+    mark_dirty(d);
+}
+
+// Tapahtumajonon ylivuoto: tapahtumia on kadonnut, joten kaikki hakemistot luetaan uudelleen
+static void mark_all_rescan(void) {
+    for (size_t i = 0; i < watch.buckets; i++) {
+        for (struct watch_dir *d = watch.by_path[i]; d != NULL; d = d->path_next) {
+            mark_rescan(d);
+        }
+    }
+}
+
+// Käsittelee luetut fanotify-tapahtumat
+static void handle_fanotify(const char *buf, ssize_t len) {
+    const struct fanotify_event_metadata *m;
+
+    for (m = (const void *)buf; FAN_EVENT_OK(m, len); m = FAN_EVENT_NEXT(m, len)) {
+        const char *p = (const char *)m + m->metadata_len;
+        const char *end = (const char *)m + m->event_len;
+
+        if (m->mask & FAN_Q_OVERFLOW) {
+            mark_all_rescan();
+            continue;
+        }
+
+        // Tapahtuman lisätiedoissa on hakemiston tunniste ja tiedoston nimi
+        while (p + sizeof(struct fanotify_event_info_header) <= end) {
+            const struct fanotify_event_info_fid *fid = (const void *)p;
+
+            if (fid->hdr.len == 0) {
+                break;
+            }
+            if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                const struct file_handle *fh = (const void *)fid->handle;
+                unsigned char key[WATCH_KEY_MAX];
+                struct watch_dir *d;
+
+                if (fh->handle_bytes <= WATCH_KEY_MAX - 12) {
+                    memcpy(key, &fid->fsid, 8);
+                    memcpy(key + 8, &fh->handle_type, 4);
+                    memcpy(key + 12, fh->f_handle, fh->handle_bytes);
+                    d = key_find(key, 12 + fh->handle_bytes);
+                    if (d != NULL) {
+                        mark_name(d, (const char *)fh->f_handle + fh->handle_bytes);
+                    }
+                }
+            }
+            p += fid->hdr.len;
+        }
+        if (m->fd >= 0) {
+            close(m->fd);
+        }
+    }
+}
+
+// Käsittelee luetut inotify-tapahtumat
+static void handle_inotify(const char *buf, ssize_t len) {
+    const char *p = buf;
+
+    while (p < buf + len) {
+        const struct inotify_event *ev = (const void *)p;
+        struct watch_dir *d;
+
+        p += sizeof(*ev) + ev->len;
+        if (ev->mask & IN_Q_OVERFLOW) {
+            mark_all_rescan();
+            continue;
+        }
+
+        // Tapahtumat ilman nimeä koskevat hakemistoa itseään; muutokset näkyvät sen ylähakemistossa
+        if (ev->len == 0) {
+            continue;
+        }
+        d = key_find((const unsigned char *)&ev->wd, sizeof(ev->wd));
+        if (d != NULL) {
+            mark_name(d, ev->name);
+        }
+    }
+}
+
+// Lukee kaikki odottavat tapahtumat. Palauttaa 0 tai -1.
+static int read_events(void) {
+    static char buf[WATCH_EVENT_BUF] __attribute__((aligned(8)));
+
+    for (;;) {
+        ssize_t len = read(watch.fd, buf, sizeof(buf));
+
+        if (len == -1) {
+            if (errno == EAGAIN) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error reading change events");
+            return -1;
+        }
+        pthread_mutex_lock(&watch.lock);
+        if (watch.backend == WATCH_FANOTIFY) {
+            handle_fanotify(buf, len);
+        } else {
+            handle_inotify(buf, len);
+        }
+        pthread_mutex_unlock(&watch.lock);
+    }
+}
+
+int watch_wait(int debounce_ms) {
+    struct pollfd pfd = {.fd = watch.fd, .events = POLLIN};
+
+    for (;;) {
+        int timeout = -1;
+        int n;
+
+        // Kun muutoksia on, odota enää hiljaista jaksoa, mutta ei loputtomiin jatkuvan kirjoituksen aikana
+        if (watch.dirty_head != NULL) {
+            struct timespec now;
+            long waited, left;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            waited = (now.tv_sec - watch.dirty_since.tv_sec) * 1000 + (now.tv_nsec - watch.dirty_since.tv_nsec) / 1000000;
+            left = 10L * debounce_ms - waited;
+            if (left <= 0) {
+                return 0;
+            }
+            timeout = left < debounce_ms ? left : debounce_ms;
+        }
+
+        n = poll(&pfd, 1, timeout);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (read_events() == -1) {
+            return -1;
+        }
+    }
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+struct watch_dir *watch_next_dirty(char ***names, size_t *count, bool *rescan) {
+    struct watch_dir *d;
+    size_t n = 0;
+
+    free_names(watch.names, watch.nnames);
+    watch.names = NULL;
+    watch.nnames = 0;
+
+    pthread_mutex_lock(&watch.lock);
+    d = watch.dirty_head;
+    if (d == NULL) {
+        pthread_mutex_unlock(&watch.lock);
+        return NULL;
+    }
+    watch.dirty_head = d->dirty_next;
+    if (watch.dirty_head == NULL) {
+        watch.dirty_tail = NULL;
+    }
+    d->dirty = false;
+
+    // Järjestä nimet ja poista toistot
+    qsort(d->names, d->nnames, sizeof(*d->names), compare_names);
+    for (size_t i = 0; i < d->nnames; i++) {
+        if (n > 0 && strcmp(d->names[n - 1], d->names[i]) == 0) {
+            free(d->names[i]);
+        } else {
+            d->names[n++] = d->names[i];
+        }
+    }
+    watch.names = *names = d->names;
+    watch.nnames = *count = n;
+    *rescan = d->rescan;
+    d->names = NULL;
+    d->nnames = d->names_cap = 0;
+    d->rescan = false;
+    pthread_mutex_unlock(&watch.lock);
+    return d;
+}
+
+static int compare_dirs(const void *a, const void *b) {
+    return strcmp((*(struct watch_dir *const *)a)->path, (*(struct watch_dir *const *)b)->path);
+}
+
+void watch_remove_tree(const char *path, void (*fn)(struct watch_dir *d, void *arg), void *arg) {
+    size_t len = strlen(path);
+    struct watch_dir **found = NULL;
+    size_t nfound = 0, cap = 0;
+
+    // Kerää hakemisto ja kaikki sen polun alla olevat hakemistot
+    pthread_mutex_lock(&watch.lock);
+    for (size_t i = 0; i < watch.buckets; i++) {
+        for (struct watch_dir *d = watch.by_path[i]; d != NULL; d = d->path_next) {
+            if (strncmp(d->path, path, len) != 0 || (d->path[len] != '\0' && d->path[len] != '/' && path[len - 1] != '/')) {
+                continue;
+            }
+            if (nfound == cap) {
+                struct watch_dir **tmp = realloc(found, (cap ? cap * 2 : 16) * sizeof(*found));
+                if (tmp == NULL) {
+                    // Keskeytä poisto: osittain poistettu puu jättäisi tauluihin vanhentuneita hakemistoja
+                    pthread_mutex_unlock(&watch.lock);
+                    perror("Error removing watched directory tree");
+                    free(found);
+                    return;
+                }
+                found = tmp;
+                cap = cap ? cap * 2 : 16;
+            }
+            found[nfound++] = d;
+        }
+    }
+
+    // Poista hakemistot tauluista ja jonosta
+    for (size_t i = 0; i < nfound; i++) {
+        struct watch_dir *d = found[i];
+        struct watch_dir **p;
+
+        for (p = &watch.by_path[path_bucket(d->path)]; *p != NULL; p = &(*p)->path_next) {
+            if (*p == d) {
+                *p = d->path_next;
+                break;
+            }
+        }
+        // inotify-seuranta poistetaan; fanotify-merkintä poistuu ytimestä hakemiston mukana, ja
+        // siirretyn hakemiston tapahtumat ohitetaan, koska sen tunnistetta ei enää löydy
+        if (watch.backend == WATCH_INOTIFY && d->key_len == sizeof(int)) {
+            int wd;
+            memcpy(&wd, d->key, sizeof(wd));
+            inotify_rm_watch(watch.fd, wd);
+        }
+        key_unlink(d);
+        if (d->dirty) {
+            for (p = &watch.dirty_head; *p != NULL; p = &(*p)->dirty_next) {
+                if (*p == d) {
+                    *p = d->dirty_next;
+                    break;
+                }
+            }
+            watch.dirty_tail = NULL;
+            for (struct watch_dir *t = watch.dirty_head; t != NULL; t = t->dirty_next) {
+                watch.dirty_tail = t;
+            }
+        }
+        watch.count--;
+    }
+    pthread_mutex_unlock(&watch.lock);
+
+    qsort(found, nfound, sizeof(*found), compare_dirs);
+    for (size_t i = 0; i < nfound; i++) {
+        struct watch_dir *d = found[i];
+
+        if (fn != NULL) {
+            fn(d, arg);
+        }
+        snapshot_builder_free(&d->entries);
+        free_names(d->names, d->nnames);
+        free(d->path);
+        free(d);
+    }
+    free(found);
+}
@@ -0,0 +1,79 @@
+/*
+ * watch.h
+ *
+ * Hakemistopuun muutosten seuranta. Jokaiselle hakemistolle tehdään fanotify-merkintä
+ * (FAN_REPORT_DFID_NAME), jolloin tapahtuma kertoo hakemiston tunnisteen ja tiedoston nimen. Jos
+ * fanotify ei ole käytettävissä (oikeudet, vanha ydin tai tiedostojärjestelmä ilman tiedostotunnisteita),
+ * käytetään inotify-kutsua hakemisto kerrallaan.
+ *
+ * Tapahtumia ei käsitellä yksitellen: muuttuneet nimet kerätään hakemistoittain ja yhdistetään, ja
+ * hakemistot annetaan käsiteltäviksi vasta, kun tapahtumia ei ole tullut hetkeen. Jos hakemistossa
+ * muuttuu paljon tiedostoja, se luetaan kokonaan uudelleen nimikohtaisten hakujen sijaan.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "snapshot.h"
+
+#define WATCH_KEY_MAX 140  // Tunnisteen enimmäiskoko (fsid, käsittelijän tyyppi ja MAX_HANDLE_SZ)
+
+// Seurantatapa
+enum watch_backend {
+    WATCH_AUTO,      // fanotify, jos mahdollista, muuten inotify
+    WATCH_FANOTIFY,  // Vain fanotify
+    WATCH_INOTIFY,   // Vain inotify
+};
+
+// Seurattava hakemisto ja sen tiedostot muistissa
+struct watch_dir {
+    char *path;                        // Hakemiston polku
+    struct snapshot_builder entries;   // Tiedostojen viimeksi nähdyt tiedot nimen mukaan järjestettynä
+
+    // Seurannan sisäiset kentät
+    struct watch_dir *path_next;       // Seuraava samassa polkutaulun ketjussa
+    struct watch_dir *key_next;        // Seuraava samassa tunnistetaulun ketjussa
+    struct watch_dir *dirty_next;      // Seuraava muuttunut hakemisto
+    unsigned char key[WATCH_KEY_MAX];  // Merkinnän tunniste (inotify wd tai fanotify fsid ja tiedostotunniste)
+    unsigned key_len;                  // Tunnisteen pituus (0 = ei merkintää)
+    bool dirty;                        // Onko hakemisto muuttuneiden jonossa
+    bool rescan;                       // Luetaanko hakemisto kokonaan
+    char **names;                      // Muuttuneet nimet
+    size_t nnames;                     // Nimien määrä
+    size_t names_cap;                  // Nimitaulukon koko
+};
+
+// Avaa seurannan. Palauttaa 0 tai -1 (virheilmoitus tulostettu).
+int watch_init(enum watch_backend backend);
+
+// Palauttaa käytössä olevan seurantatavan nimen
+const char *watch_backend_name(void);
+
+// Lisää hakemiston seurantaan. Merkintä tehdään heti, joten hakemisto kannattaa lisätä ennen sen
+// lukemista. Säieturvallinen. Palauttaa hakemiston tai NULL virheen sattuessa.
+struct watch_dir *watch_add_dir(const char *path);
+
+// Hakee seurattavan hakemiston polun perusteella
+struct watch_dir *watch_find_dir(const char *path);
+
+// Vaihtaa hakemiston tiedostot (b:n sisältö siirtyy hakemistolle ja vanhat b:hen). Säieturvallinen.
+void watch_set_entries(struct watch_dir *d, struct snapshot_builder *b);
+
+// Poistaa hakemiston ja kaikki sen alihakemistot seurannasta. Kutsuu fn-funktiota jokaiselle
+// poistettavalle hakemistolle polun mukaan järjestyksessä ennen sen vapauttamista. Jos muisti loppuu,
+// virhe tulostetaan eikä mitään poisteta.
+void watch_remove_tree(const char *path, void (*fn)(struct watch_dir *d, void *arg), void *arg);
+
+// Odottaa muutoksia. Palaa, kun muuttuneita hakemistoja on ja tapahtumia ei ole tullut debounce_ms
+// millisekuntiin (tai viimeistään kymmenen kertaa sen ajan kuluttua ensimmäisestä). Palauttaa 0 tai -1.
+int watch_wait(int debounce_ms);
+
+// Ottaa seuraavan muuttuneen hakemiston jonosta. Nimet ovat järjestyksessä ja kukin vain kerran, ja
+// ne ovat voimassa seuraavaan kutsuun asti. Jos *rescan on tosi, hakemisto on luettava kokonaan.
+// Palauttaa NULL, kun jono on tyhjä.
+struct watch_dir *watch_next_dirty(char ***names, size_t *count, bool *rescan);
+
+#endif
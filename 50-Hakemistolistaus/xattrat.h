@@ -0,0 +1,43 @@
+/*
+ * xattrat.h
+ *
+ * Laajennettujen attribuuttien haku hakemiston tiedostokuvaajan suhteen. Tiedoston polkua ei
+ * tarvitse muodostaa eikä ratkaista uudelleen jokaista listxattr/getxattr-kutsua varten.
+ */
+
+#ifndef XATTRAT_H
+#define XATTRAT_H
+
+#include <sys/types.h>
+
+// Tiedosto, jonka attribuutteja luetaan: hakemiston kuvaaja ja nimi, tai tarvittaessa avattu kuvaaja
+struct xattr_target {
+    int dirfd;         // Hakemiston tiedostokuvaaja
+    const char *name;  // Tiedoston nimi hakemistossa
+    mode_t mode;       // Tiedoston tyyppi (laitetiedostoja ei avata lukemista varten)
+    int fd;            // Avattu tiedostokuvaaja varareittiä varten tai -1
+    int path_only;     // Onko fd avattu O_PATH-lipulla
+};
+
+// Alustaa kohteen. Tiedostoa ei avata vielä.
+void xattr_target_init(struct xattr_target *t, int dirfd, const char *name, mode_t mode);
+
+// Vapauttaa kohteen mahdollisesti avaaman tiedostokuvaajan
+void xattr_target_close(struct xattr_target *t);
+
+// Kuten listxattr(2), mutta hakemiston kuvaajan suhteen
+ssize_t xattr_target_list(struct xattr_target *t, char *list, size_t size);
+
+// Kuten getxattr(2), mutta hakemiston kuvaajan suhteen
+ssize_t xattr_target_get(struct xattr_target *t, const char *key, void *value, size_t size);
+
+// Hakee koko attribuuttilistan. Lista luetaan ensin annettuun puskuriin ja vain, jos se ei riitä,
+// varataan isompi muisti. Palauttaa listan (stackbuf tai malloc-muisti) tai NULL virheen sattuessa.
+char *xattr_target_list_all(struct xattr_target *t, char *stackbuf, size_t stacksize, ssize_t *len);
+
+// Kutsuu fn-funktiota jokaiselle attribuutille. Jos arvon haku epäonnistuu, len on -1 ja errno asetettu.
+// Palauttaa 0 tai -1, jos attribuuttilistaa ei saatu (errno asetettu, ENOTSUP = ei tuettu).
+typedef void (*xattr_visit_fn)(void *arg, const char *key, const char *value, ssize_t len);
+int xattr_target_foreach(struct xattr_target *t, xattr_visit_fn fn, void *arg);
+
+#endif
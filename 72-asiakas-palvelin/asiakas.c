@@ -4,31 +4,278 @@
  * Tämä ohjelma toimii asiakasohjelmana UDP-pohjaisessa asiakas-palvelin-ohjelmassa.
  * Asiakas lähettää palvelimelle viestin ja odottaa palvelimelta vastauksena seitsemän satunnaista lottonumeroa, jotka palvelin arpoo.
  * Asiakas tulostaa lopuksi palvelimelta saadut lottonumerot ja lopettaa.
+ * Binääriprotokollalla (protocol.h) asiakas voi pyytää useita rivejä ja valita pelin; jos kaikki rivit
+ * eivät mahdu yhteen vastaukseen, loput pyydetään uusilla pyynnöillä.
+ * Kuormitustilassa asiakas lähettää pyyntöjä usealla säikeellä annetun ajan ja tulostaa läpäisyn,
+ * kadonneet pyynnöt ja viivejakauman.
  *
  * Ohjelman kääntäminen ja ajaminen:
  *  1. make
  *  2. ./palvelin
- *  3. ./asiakas
+ *  3. ./asiakas [valinnat]
+ *       --binary        käytä binääriprotokollaa (oletuksena tekstiviesti)
+ *       --rows N        pyydä N riviä (binääriprotokolla)
+ *       --pool N        numerot väliltä 1-N, enintään 255 (binääriprotokolla, oletus 40)
+ *       --pick N        N numeroa rivillä (binääriprotokolla, oletus 7)
+ *       --timeout MS    odota vastausta enintään MS millisekuntia (oletus 1000)
+ *       --tcp           käytä TCP-yhteyttä (viestit kehystetty pituuskentällä)
+ *       --shm PATH      käytä palvelimen jaetun muistin kanavaa, liittyminen Unix-socketissa PATH (palvelin --shm)
+ *     Kuormitustila (binääriprotokolla, ks. load.h):
+ *       --mode closed|open  suljettu silmukka (oletus) tai avoin silmukka tavoitetahdilla
+ *       --rate R        lähetä R pyyntöä sekunnissa kaikkiaan (avoin silmukka)
+ *       --inflight N    pyyntöjä matkalla säiettä kohden (avoimessa silmukassa yläraja, oletus 16 / 1024)
+ *       --duration S    mittauksen kesto sekunteina (oletus 5)
+ *       --threads N     kuormasäikeiden määrä (oletus prosessorien määrä)
+ *       --idle N        pidä mittauksen ajan auki N joutilasta TCP-yhteyttä
  *  4. make clean (lopuksi käännettyjen ohjelmien poistamiseen)
  */
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <unistd.h>
 
+#include "load.h"
+#include "protocol.h"
+#include "shm.h"
+
 #define PORT 6000         // Portti, jota palvelin kuuntelee
 #define BUFFER_SIZE 1024  // Maksimipituus viestille
 
-int main() {
-    int udp_socket;                            // Socketin tiedot
+static struct shm_channel shm = {.region = NULL, .sock = -1, .memfd = -1, .eventfd = -1};  // Jaetun muistin kanava (region = NULL, jos ei käytössä)
+static uint64_t shm_timeout_ns;                     // Vastauksen odotusaika jaetun muistin kanavassa
+
+// Lähettää viestin palvelimelle: UDP:llä datagrammina, TCP:llä pituuskentän kanssa ja jaetun muistin
+// kanavassa pyyntörenkaaseen. Palauttaa 0 tai -1.
+static int send_message(int sock, bool tcp, const struct sockaddr_in *server_addr, const char *msg, size_t len) {
+    char frame[PROTO_FRAME_HEADER + BUFFER_SIZE];
+
+    if (shm.region != NULL) {
+        return shm_send(&shm, msg, len);
+    }
+    if (!tcp) {
+        return sendto(sock, msg, len, 0, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0 ? -1 : 0;
+    }
+    frame[0] = len >> 8;
+    frame[1] = len & 0xff;
+    memcpy(frame + PROTO_FRAME_HEADER, msg, len);
+    return send(sock, frame, PROTO_FRAME_HEADER + len, MSG_NOSIGNAL) == (ssize_t)(PROTO_FRAME_HEADER + len) ? 0 : -1;
+}
+
+// Vastaanottaa palvelimen viestin puskuriin. Palauttaa viestin pituuden tai -1.
+static int receive_message(int sock, bool tcp, char *buf, size_t size) {
+    unsigned char header[PROTO_FRAME_HEADER];
+    size_t len;
+
+    if (shm.region != NULL) {
+        if (!shm_wait(&shm, shm_timeout_ns)) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return shm_receive(&shm, buf, size);
+    }
+    if (!tcp) {
+        return recvfrom(sock, buf, size, 0, NULL, NULL);
+    }
+    if (recv(sock, header, sizeof(header), MSG_WAITALL) != sizeof(header)) {
+        errno = errno ? errno : ECONNRESET;
+        return -1;
+    }
+    len = header[0] << 8 | header[1];
+    if (len > size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (recv(sock, buf, len, MSG_WAITALL) != (ssize_t)len) {
+        errno = errno ? errno : ECONNRESET;
+        return -1;
+    }
+    return len;
+}
+
+// Pyytää binääriprotokollalla rows riviä ja tulostaa ne. Palauttaa 0 tai -1.
+static int request_binary(int sock, bool tcp, const struct sockaddr_in *server_addr, unsigned rows, unsigned pool,
+                          unsigned pick) {
+    char request[PROTO_HEADER_SIZE];  // Pyyntö
+    char buffer[PROTO_MAX_DATAGRAM];  // Vastaus
+    unsigned received = 0;            // Saatujen rivien määrä
+    uint32_t id = 0;                  // Seuraavan pyynnön tunniste
+
+    while (received < rows) {
+        struct proto_header h = {PROTO_MAGIC, PROTO_VERSION, PROTO_REQUEST, PROTO_OK, ++id, rows - received, pool, pick};
+
+        proto_write_header(request, &h);
+        if (send_message(sock, tcp, server_addr, request, sizeof(request)) < 0) {
+            perror("Failed to send message");
+            return -1;
+        }
+        printf("Lähetettiin binääripyyntö %u: %u riviä, %u/%u\n", id, h.rows, pick, pool);
+
+        // Ohita vastaukset, jotka eivät ole tämän pyynnön vastauksia
+        do {
+            int len = receive_message(sock, tcp, buffer, sizeof(buffer));
+            if (len < 0) {
+                perror("Failed to receive response");  // Aikakatkaisu: EAGAIN
+                return -1;
+            }
+            if (proto_read_header(buffer, len, &h) < 0 || h.type != PROTO_RESPONSE ||
+                len < PROTO_HEADER_SIZE + h.rows * h.pick) {
+                fprintf(stderr, "Virheellinen vastaus palvelimelta\n");
+                return -1;
+            }
+        } while (h.id != id);
+
+        if (h.status != PROTO_OK || h.rows == 0) {
+            fprintf(stderr, "Palvelin hylkäsi pyynnön (tila %u, palvelimen protokollaversio %u)\n", h.status, h.version);
+            return -1;
+        }
+        printf("  -> Saatiin %u riviä:\n", h.rows);
+        for (unsigned i = 0; i < h.rows; i++) {
+            const uint8_t *row = (const uint8_t *)buffer + PROTO_HEADER_SIZE + i * h.pick;
+
+            printf("     %u:", received + i + 1);
+            for (unsigned j = 0; j < h.pick; j++) {
+                printf(j ? ", %u" : " %u", row[j]);
+            }
+            putchar('\n');
+        }
+        received += h.rows;
+    }
+    return 0;
+}
+
+// Tulostaa ohjelman käyttöohjeen
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Käyttö: %s [--binary] [--rows N] [--pool N] [--pick N] [--timeout MS] [--tcp | --shm PATH]\n"
+            "           [--mode closed|open] [--rate R] [--inflight N] [--duration S] [--threads N] [--idle N]\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    int udp_socket;                            // Socketin tiedot (UDP- tai TCP-socket)
     struct sockaddr_in server_addr;            // Palvelimen osoiterakenne
     char buffer[BUFFER_SIZE];                  // Puskuri palvelimelta tuleville tiedoille
     char *message = "Anna loton voittorivi!";  // Lähetettävä viesti
+    bool binary = false;                       // Käytetäänkö binääriprotokollaa
+    int rows = 1;                              // Pyydettävien rivien määrä
+    int pool = PROTO_DEFAULT_POOL;             // Numerot väliltä 1-pool
+    int pick = PROTO_DEFAULT_PICK;             // Numeroita rivillä
+    int timeout_ms = 1000;                     // Vastauksen odotusaika
+    bool tcp = false;                          // Käytetäänkö TCP-yhteyttä
+    const char *shm_path = NULL;               // Palvelimen jaetun muistin socket (NULL = ei käytössä)
+    bool load = false;                         // Kuormitustila
+    struct load_options load_options = {       // Kuormituksen asetukset
+        .mode = LOAD_CLOSED,
+        .duration = 5.0,
+        .threads = sysconf(_SC_NPROCESSORS_ONLN),
+    };
+    int opt;
 
-    // Luo UDP-socket: AF_INET (IPv4), SOCK_DGRAM tyyppi (tuki datagram paketeille), IPPROTO_UDP = UDP protokolla
-    if ((udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {  // Palauttaa -1, jos virhe
+    // Komentoriviltä luettavat valinnat getopt_long-funktiolle
+    static const struct option long_options[] = {
+        {"binary", no_argument, NULL, 'B'},
+        {"rows", required_argument, NULL, 'r'},
+        {"pool", required_argument, NULL, 'p'},
+        {"pick", required_argument, NULL, 'k'},
+        {"timeout", required_argument, NULL, 't'},
+        {"mode", required_argument, NULL, 'm'},
+        {"rate", required_argument, NULL, 'R'},
+        {"inflight", required_argument, NULL, 'i'},
+        {"duration", required_argument, NULL, 'd'},
+        {"threads", required_argument, NULL, 'T'},
+        {"tcp", no_argument, NULL, 'P'},
+        {"idle", required_argument, NULL, 'I'},
+        {"shm", required_argument, NULL, 'S'},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((opt = getopt_long(argc, argv, "Br:p:k:t:m:R:i:d:T:PI:S:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'B':
+                binary = true;
+                break;
+            case 'r':
+                rows = atoi(optarg);
+                binary = true;
+                break;
+            case 'p':
+                pool = atoi(optarg);
+                binary = true;
+                break;
+            case 'k':
+                pick = atoi(optarg);
+                binary = true;
+                break;
+            case 't':
+                timeout_ms = atoi(optarg);
+                break;
+            case 'm':
+                if (strcmp(optarg, "closed") == 0) {
+                    load_options.mode = LOAD_CLOSED;
+                } else if (strcmp(optarg, "open") == 0) {
+                    load_options.mode = LOAD_OPEN;
+                } else {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                load = true;
+                break;
+            case 'R':
+                load_options.rate = atof(optarg);
+                load_options.mode = LOAD_OPEN;
+                load = true;
+                break;
+            case 'i':
+                load_options.inflight = atoi(optarg);
+                load = true;
+                break;
+            case 'd':
+                load_options.duration = atof(optarg);
+                load = true;
+                break;
+            case 'T':
+                load_options.threads = atoi(optarg);
+                load = true;
+                break;
+            case 'P':
+                tcp = true;
+                break;
+            case 'I':
+                load_options.idle = atoi(optarg);
+                load = true;
+                break;
+            case 'S':
+                shm_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (rows < 1 || rows > UINT16_MAX || pool < 1 || pool > 255 || pick < 1 || pick > pool) {
+        fprintf(stderr, "Virheelliset parametrit: rivejä 1-%d, numeroita 1-255 ja rivillä enintään numeroiden määrä\n",
+                UINT16_MAX);
+        return EXIT_FAILURE;
+    }
+    if (timeout_ms < 1) {
+        fprintf(stderr, "Aikakatkaisun täytyy olla vähintään 1 ms\n");
+        return EXIT_FAILURE;
+    }
+    if (tcp && shm_path != NULL) {
+        fprintf(stderr, "Valitse joko --tcp tai --shm\n");
+        return EXIT_FAILURE;
+    }
+    shm_init();
+
+    // Luo socket: AF_INET (IPv4), SOCK_DGRAM tyyppi (tuki datagram paketeille) tai SOCK_STREAM (TCP)
+    if ((udp_socket = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0)) < 0) {  // Palauttaa -1, jos virhe
         perror("Socket creation failed");
         exit(EXIT_FAILURE);
     }
@@ -41,9 +288,72 @@ int main() {
     server_addr.sin_port = htons(PORT);                    // Portti (muutetaan lyhyt integer verkon tavujärjestykseen (16bit) htons-funktiolla)
     server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");  // muuta IP-osoite (localhost) verkkojärjestykseen inet_addr-funktiolla
 
-    // Lähetä viesti palvelimelle sendto-funktiolla (viesti, viestin pituus, 0 (ei lippuja), palvelimen osoiterakenne, osoiterakenteen koko)
+    if (load) {
+        if (load_options.inflight == 0) {
+            load_options.inflight = load_options.mode == LOAD_OPEN ? 1024 : 16;
+        }
+        if (shm_path != NULL && load_options.inflight > SHM_SLOTS) {
+            load_options.inflight = SHM_SLOTS;  // Renkaaseen mahtuu enintään SHM_SLOTS pyyntöä
+        }
+        if (load_options.mode == LOAD_OPEN && load_options.rate <= 0) {
+            fprintf(stderr, "Avoin silmukka vaatii valinnan --rate\n");
+            return EXIT_FAILURE;
+        }
+        if (load_options.threads < 1 || load_options.duration <= 0 || (unsigned)rows > proto_max_rows(pick)) {
+            fprintf(stderr, "Virheelliset parametrit: säikeitä vähintään 1, kesto yli 0 ja rivejä enintään %u\n",
+                    proto_max_rows(pick));
+            return EXIT_FAILURE;
+        }
+        if (load_options.mode == LOAD_OPEN && load_options.rate > 1e9 * load_options.threads) {
+            fprintf(stderr, "Liian suuri --rate: säikeen lähetysväli olisi alle nanosekunnin\n");
+            return EXIT_FAILURE;
+        }
+        close(udp_socket);
+
+        // Jokainen joutilas TCP-yhteys vie tiedostokuvaajan: nosta raja sallittuun enimmäismäärään
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+        load_options.tcp = tcp;
+        load_options.shm_path = shm_path;
+        load_options.server = server_addr;
+        load_options.timeout_ms = timeout_ms;
+        load_options.rows = rows;
+        load_options.pool = pool;
+        load_options.pick = pick;
+        return load_run(&load_options) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // Älä odota vastausta loputtomiin, jos paketti katoaa
+    struct timeval timeout = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+    setsockopt(udp_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Jaettu muisti: pyydä palvelimelta muistialue (socketia ei silloin käytetä)
+    if (shm_path != NULL && shm_connect(&shm, shm_path) < 0) {
+        close(udp_socket);
+        exit(EXIT_FAILURE);
+    }
+    shm_timeout_ns = (uint64_t)timeout_ms * 1000000;
+
+    // TCP: muodosta yhteys palvelimeen
+    if (tcp && connect(udp_socket, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Failed to connect");
+        close(udp_socket);
+        exit(EXIT_FAILURE);
+    }
+
+    if (binary) {
+        int result = request_binary(udp_socket, tcp, &server_addr, rows, pool, pick);
+        shm_close(&shm);
+        close(udp_socket);
+        return result < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // Lähetä viesti palvelimelle (UDP: sendto-funktiolla, parametreina viesti, viestin pituus, 0 (ei lippuja), palvelimen osoiterakenne, osoiterakenteen koko)
     // UDP:ssä ei tarvita erillistä yhteyden muodostamista, joten ei tarvitse kutsua connect-funktiota
-    if (sendto(udp_socket, message, strlen(message), 0, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    if (send_message(udp_socket, tcp, &server_addr, message, strlen(message)) < 0) {
         perror("Failed to send message");
         close(udp_socket);  // Sulje socket
         exit(EXIT_FAILURE);
@@ -51,9 +361,9 @@ int main() {
 
     printf("Lähetettiin viesti palvelimelle: %s\n", message);
 
-    // Vastaanota palvelimen vastaus recvfrom-funktiolla
+    // Vastaanota palvelimen vastaus (UDP: recvfrom-funktiolla)
     // Parametreina socket, puskuri, puskurin maksimipituus, 0 (ei lippuja), NULL (ei tallenneta lähettävää osoitetta), NULL (ei tallenneta osoitteen kokoa)
-    int len = recvfrom(udp_socket, buffer, BUFFER_SIZE - 1, 0, (struct sockaddr *)NULL, NULL);
+    int len = receive_message(udp_socket, tcp, buffer, BUFFER_SIZE - 1);
     if (len < 0) {
         perror("Failed to receive response");
         close(udp_socket);  // Sulje socket
@@ -64,6 +374,7 @@ int main() {
     printf("  -> Saatiin vastaus palvelimelta: %s\n", buffer);
 
     // Sulje socket
+    shm_close(&shm);
     close(udp_socket);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,196 @@
+/*
+ * bench_lotto
+ *
+ * Mikrobenchmark ja tasajakaumatesti lottoarvonnalle. Vertaa palvelimen aiempaa arvontaa
+ * (rand() % 40 + 1, toistojen etsintä taulukosta ja vastaus sprintf/strcat-kutsuilla) lotto.c:n
+ * arvontaan (xoshiro256**, Lemiren välinarvonta usealle välille kerralla, osittainen Fisher-Yates ja kaksinumeroinen hakutaulu).
+ *
+ * Tasajakaumatesti laskee khiin neliön numeroiden kokonaisfrekvensseistä ja jokaisen arvontapaikan
+ * frekvensseistä 7/40- ja 7/70-arvonnoille. Lisäksi tarkistetaan,
+ * ettei rivissä ole toistoja. Ohjelma palauttaa virhekoodin, jos jokin testi hylätään.
+ *
+ * Käyttö: ./bench_lotto [arvontojen määrä miljoonina]
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lotto.h"
+
+#define PICK 7  // Numeroita rivissä
+
+static volatile unsigned long sink;  // Tulosten summa, ettei kääntäjä poista mitattavaa työtä
+
+// Nykyinen aika sekunteina
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Palvelimen aiempi arvonta: rand()-funktio, modulo ja toistojen etsintä taulukosta
+static void draw_old(int *numbers) {
+    for (int i = 0; i < PICK; i++) {
+        bool unique;
+        int num;
+        do {
+            num = rand() % 40 + 1;
+            unique = true;
+            for (int j = 0; j < i; j++) {
+                if (numbers[j] == num) {
+                    unique = false;
+                    break;
+                }
+            }
+        } while (!unique);
+        numbers[i] = num;
+    }
+}
+
+// Palvelimen aiempi vastauksen muotoilu sprintf- ja strcat-kutsuilla
+static void format_old(int *numbers, char *buffer) {
+    for (int i = 0; i < PICK; i++) {
+        char num[5];
+        if (i == PICK - 1) {
+            sprintf(num, "%d", numbers[i]);
+        } else {
+            sprintf(num, "%d, ", numbers[i]);
+        }
+        strcat(buffer, num);
+    }
+}
+
+// Mittaa aiemman arvonnan (ja muotoilun) nopeuden; palauttaa arvontoja sekunnissa
+static double bench_old(long draws, bool format) {
+    int numbers[PICK];
+    char buffer[64];
+    double start = now();
+
+    for (long i = 0; i < draws; i++) {
+        draw_old(numbers);
+        if (format) {
+            buffer[0] = '\0';
+            format_old(numbers, buffer);
+            sink += buffer[1];
+        } else {
+            sink += numbers[0];
+        }
+    }
+    return draws / (now() - start);
+}
+
+// Mittaa uuden arvonnan (ja muotoilun) nopeuden; palauttaa arvontoja sekunnissa
+static double bench_new(long draws, bool format) {
+    struct lotto_rng rng;
+    uint8_t numbers[PICK];
+    char buffer[64];
+    double start;
+
+    lotto_rng_seed(&rng, 12345);
+    start = now();
+    for (long i = 0; i < draws; i++) {
+        lotto_draw(&rng, 40, PICK, numbers);
+        if (format) {
+            sink += lotto_format(numbers, PICK, buffer) + buffer[1];
+        } else {
+            sink += numbers[0];
+        }
+    }
+    return draws / (now() - start);
+}
+
+// Khiin neliön jakauman häntätodennäköisyys P(X >= x) k vapausasteella (Wilson-Hilfertyn approksimaatio)
+static double chi2_p(double x, int k) {
+    double z = (cbrt(x / k) - (1 - 2.0 / (9 * k))) / sqrt(2.0 / (9 * k));
+
+    return 0.5 * erfc(z / sqrt(2));
+}
+
+// Khiin neliö havainnoista, kun jokaisen luokan odotusarvo on expected
+static double chi2(const unsigned long *counts, int n, double expected) {
+    double x = 0;
+
+    for (int i = 0; i < n; i++) {
+        double d = counts[i] - expected;
+        x += d * d / expected;
+    }
+    return x;
+}
+
+// Tulostaa testin tuloksen ja palauttaa, hyväksyttiinkö se (p >= 0,001)
+static bool report(const char *name, double x, int k) {
+    double p = chi2_p(x, k);
+
+    printf("  %-34s khii2 = %9.1f (df %3d), p = %.4f  %s\n", name, x, k, p, p >= 0.001 ? "OK" : "HYLÄTTY");
+    return p >= 0.001;
+}
+
+// Tasajakaumatesti pick/pool-arvonnalle
+static bool test_uniformity(unsigned pool, long draws) {
+    unsigned long *total = calloc(pool, sizeof(*total));
+    unsigned long *position = calloc(PICK * pool, sizeof(*position));
+    struct lotto_rng rng;
+    uint8_t numbers[PICK];
+    bool ok = true;
+    char name[64];
+
+    if (total == NULL || position == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    lotto_rng_seed(&rng, 0x5eed + pool);
+    for (long d = 0; d < draws; d++) {
+        uint64_t seen[4] = {0};
+
+        lotto_draw(&rng, pool, PICK, numbers);
+        for (int i = 0; i < PICK; i++) {
+            unsigned n = numbers[i];
+            if (n < 1 || n > pool || (seen[n / 64] & (1ULL << (n % 64)))) {
+                printf("  Virheellinen rivi: numero %u\n", n);
+                ok = false;
+            }
+            seen[n / 64] |= 1ULL << (n % 64);
+            total[n - 1]++;
+            position[i * pool + n - 1]++;
+        }
+    }
+
+    snprintf(name, sizeof(name), "%u/%u numerot yhteensä", PICK, pool);
+    ok &= report(name, chi2(total, pool, (double)draws * PICK / pool), pool - 1);
+    for (int i = 0; i < PICK; i++) {
+        snprintf(name, sizeof(name), "%u/%u arvontapaikka %d", PICK, pool, i + 1);
+        ok &= report(name, chi2(position + i * pool, pool, (double)draws / pool), pool - 1);
+    }
+    free(total);
+    free(position);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    long draws = (argc > 1 ? atof(argv[1]) : 20) * 1e6;
+    bool ok = true;
+
+    if (draws < 1000) {
+        fprintf(stderr, "Käyttö: %s [arvontojen määrä miljoonina]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(time(NULL));
+    printf("Arvontanopeus (%ld arvontaa, 7/40):\n", draws);
+    printf("  %-34s %10.1f M arvontaa/s\n", "rand() ja toistojen etsintä", bench_old(draws / 10, false) / 1e6);
+    printf("  %-34s %10.1f M arvontaa/s\n", "  + sprintf/strcat", bench_old(draws / 10, true) / 1e6);
+    printf("  %-34s %10.1f M arvontaa/s\n", "xoshiro256** ja Fisher-Yates", bench_new(draws, false) / 1e6);
+    printf("  %-34s %10.1f M arvontaa/s\n", "  + hakutaulumuotoilu", bench_new(draws, true) / 1e6);
+
+    printf("Tasajakaumatesti (%ld riviä):\n", draws / 4);
+    ok &= test_uniformity(40, draws / 4);
+    ok &= test_uniformity(70, draws / 10);
+    printf("%s\n", ok ? "Kaikki testit hyväksytty" : "Jokin testi hylättiin");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# bench_shm.sh
+#
+# Vertaa saman koneen asiakkaan viivettä ja läpäisyä UDP:llä ja jaetun muistin kanavalla (--shm).
+# Asiakas ajaa suljettua silmukkaa yhdellä säikeellä eri määrillä pyyntöjä matkalla.
+#
+# Käyttö: ./bench_shm.sh [sekunnit] [ikkunat]
+
+set -e
+
+SECONDS_PER_RUN=${1:-2}
+WINDOWS=${2:-"1 16 64"}
+SHM_PATH=/tmp/bench_shm.$$
+
+./palvelin --quiet --shm "$SHM_PATH" > /dev/null 2>&1 &
+pid=$!
+trap 'kill "$pid" 2> /dev/null || true' EXIT
+sleep 0.3
+
+# Ajaa asiakkaan annetuilla valinnoilla ja tulostaa pyynnöt sekunnissa, p50 ja p99 (µs)
+run() {
+    ./asiakas --threads 1 --duration "$SECONDS_PER_RUN" "$@" | awk '
+        /^Lähetetty/ { sub(/\(/, "", $5); rate = $5 }
+        $1 == "p50" { p50 = $2 }
+        $1 == "p99" { p99 = $2 }
+        END { print rate, p50, p99 }'
+}
+
+printf '%-8s %-14s %12s %10s %10s\n' ikkuna kanava pyyntöä/s p50/µs p99/µs
+for window in $WINDOWS; do
+    set -- $(run --inflight "$window")
+    printf '%-8s %-14s %12s %10s %10s\n' "$window" UDP "$1" "$2" "$3"
+    set -- $(run --inflight "$window" --shm "$SHM_PATH")
+    printf '%-8s %-14s %12s %10s %10s\n' "$window" "jaettu muisti" "$1" "$2" "$3"
+done
@@ -0,0 +1,110 @@
+/*
+ * bench_udp
+ *
+ * Yksinkertainen kuormageneraattori palvelimen läpäisykyvyn mittaamiseen. Jokainen säie lähettää
+ * omasta socketistaan pyyntöjä niin, että ikkunallinen pyyntöjä on koko ajan matkalla, ja laskee
+ * saadut vastaukset. Kadonneet pyynnöt korvataan uusilla lyhyen odotuksen jälkeen.
+ *
+ * Käyttö: ./bench_udp [säikeet] [sekunnit] [ikkuna]
+ */
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PORT 6000         // Palvelimen portti
+#define BUFFER_SIZE 1024  // Vastauspuskurin koko
+
+static const char message[] = "Anna loton voittorivi!";  // Lähetettävä viesti
+static double deadline;                                  // Mittauksen päättymisaika
+static int window;                                       // Matkalla olevien pyyntöjen määrä säiettä kohden
+
+// Kuormasäikeen tulokset
+struct load_thread {
+    pthread_t thread;
+    unsigned long responses;  // Saadut vastaukset
+    unsigned long timeouts;   // Vastausten odotuksen aikakatkaisut
+};
+
+// Nykyinen aika sekunteina
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Lähettää pyyntöjä ja vastaanottaa vastauksia mittauksen loppuun asti
+static void *load(void *arg) {
+    struct load_thread *t = arg;
+    struct sockaddr_in server_addr = {.sin_family = AF_INET, .sin_port = htons(PORT)};
+    struct timeval timeout = {0, 100000};  // Kadonneen pyynnön odotus (100 ms)
+    char buffer[BUFFER_SIZE];
+    int udp_socket;
+
+    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udp_socket < 0 || connect(udp_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Socket creation failed");
+        return NULL;
+    }
+    setsockopt(udp_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Täytä ikkuna ja lähetä uusi pyyntö jokaista vastausta kohden
+    for (int i = 0; i < window; i++) {
+        send(udp_socket, message, sizeof(message) - 1, 0);
+    }
+    while (now() < deadline) {
+        if (recv(udp_socket, buffer, sizeof(buffer), 0) < 0) {
+            // Pyyntöjä on kadonnut: täytä ikkuna uudelleen
+            t->timeouts++;
+            for (int i = 0; i < window; i++) {
+                send(udp_socket, message, sizeof(message) - 1, 0);
+            }
+            continue;
+        }
+        t->responses++;
+        send(udp_socket, message, sizeof(message) - 1, 0);
+    }
+    close(udp_socket);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+    struct load_thread *threads;
+    unsigned long responses = 0, timeouts = 0;
+    double start;
+
+    window = argc > 3 ? atoi(argv[3]) : 16;
+    if (nthreads < 1 || seconds <= 0 || window < 1) {
+        fprintf(stderr, "Käyttö: %s [säikeet] [sekunnit] [ikkuna]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    threads = calloc(nthreads, sizeof(*threads));
+    if (threads == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    start = now();
+    deadline = start + seconds;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i].thread, NULL, load, &threads[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        responses += threads[i].responses;
+        timeouts += threads[i].timeouts;
+    }
+
+    printf("%.0f %lu\n", responses / (now() - start), timeouts);
+    free(threads);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# bench_workers.sh
+#
+# Mittaa palvelimen läpäisykyvyn (pyyntöä sekunnissa) eri palvelusäikeiden määrillä
+# SO_REUSEPORT-tilassa ilman pakettien ohjausta, prosessorin mukaan ohjattuna ja eräkäsittelyllä.
+#
+# Käyttö: ./bench_workers.sh [sekunnit] [asiakassäikeet] [ikkuna]
+
+set -e
+
+SECONDS_PER_RUN=${1:-2}
+CLIENTS=${2:-$(nproc)}
+WINDOW=${3:-16}
+MAXWORKERS=$(nproc)
+
+# Mittaa yhden palvelinasetuksen; parametrit välitetään palvelimelle
+run() {
+    ./palvelin --quiet "$@" > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.3
+    result=$(./bench_udp "$CLIENTS" "$SECONDS_PER_RUN" "$WINDOW")
+    kill "$pid"
+    wait "$pid" 2> /dev/null || true
+    echo "$result"
+}
+
+echo "Prosessoreita: $MAXWORKERS, asiakassäikeitä: $CLIENTS, ikkuna: $WINDOW"
+printf '%-28s %12s %10s\n' tila pyyntöä/s aikakatk.
+
+set -- $(run)
+printf '%-28s %12s %10s\n' "yksi socket" "$1" "$2"
+set -- $(run --batch 64)
+printf '%-28s %12s %10s\n' "yksi socket --batch 64" "$1" "$2"
+
+# Säikeiden määrät 1, 2, 4, ... prosessorien määrään asti
+workers=1
+while [ "$workers" -le "$MAXWORKERS" ]; do
+    set -- $(run --workers "$workers")
+    printf '%-28s %12s %10s\n' "--workers $workers" "$1" "$2"
+    set -- $(run --workers "$workers" --cpu-steering)
+    printf '%-28s %12s %10s\n' "--workers $workers (bpf)" "$1" "$2"
+    set -- $(run --workers "$workers" --batch 64)
+    printf '%-28s %12s %10s\n' "--workers $workers --batch 64" "$1" "$2"
+    workers=$((workers * 2))
+done
@@ -0,0 +1,463 @@
+/*
+ * event.c
+ *
+ * Palvelusäikeen tapahtumasilmukka (ks. event.h). io_uring-rengasta käytetään suoraan
+ * järjestelmäkutsuilla ilman liburing-kirjastoa.
+ */
+
+#define _GNU_SOURCE
+
+#include "event.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define EPOLL_EVENTS 256     // Yhdellä epoll_wait-kutsulla haettavat tapahtumat
+#define RING_ENTRIES 1024    // io_uring-renkaan pyyntöpaikat
+#define RECV_BUFFERS 1024    // Vastaanoton puskureiden määrä (kahden potenssi)
+#define RECV_BUFFER_SIZE 2048  // Vastaanottopuskurin koko (io_uring_recvmsg_out, osoite ja datagrammi)
+#define RECV_GROUP 0         // Puskuriryhmän tunniste
+#define USER_DATA_IGNORE UINT64_MAX  // Peruutuspyyntöjen tunniste, jonka valmistumista ei käsitellä
+
+// Rekisteröity kuvaaja
+struct event_reg {
+    event_handler handler;  // Käsittelijä
+    void *arg;              // Käsittelijän argumentti
+    uint32_t gen;           // Rekisteröinnin sukupolvi (vanhentuneet io_uring-valmistumiset ohitetaan)
+    bool active;            // Onko kuvaaja seurannassa
+    bool datagrams;         // Toistuva vastaanotto poll-pyynnön sijaan
+};
+
+struct event_loop {
+    enum event_backend backend;
+    unsigned long syscalls;       // Järjestelmäkutsujen määrä
+    struct event_reg *regs;       // Rekisteröinnit kuvaajan mukaan
+    size_t nregs;                 // Rekisteröintitaulukon koko
+    int epoll_fd;                 // epoll-kuvaaja
+
+    // io_uring
+    int ring_fd;                  // Renkaan kuvaaja
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_sqe *sqes;    // Pyyntöpaikat
+    struct io_uring_cqe *cqes;    // Valmistumiset
+    unsigned to_submit;           // Lähettämättömät pyynnöt
+    struct io_uring_buf_ring *buf_ring;  // Vastaanoton puskurirengas
+    char *buffers;                // Vastaanoton puskurit
+    struct msghdr recv_msg;       // Toistuvan vastaanoton malli (osoitteen pituus)
+};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t size) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+const char *event_backend_name(enum event_backend backend) {
+    return backend == EVENT_IO_URING ? "io_uring" : "epoll";
+}
+
+// Hakee kuvaajan rekisteröinnin ja kasvattaa taulukkoa tarvittaessa. Palauttaa NULL, jos muisti loppuu.
+static struct event_reg *get_reg(struct event_loop *l, int fd) {
+    if ((size_t)fd >= l->nregs) {
+        size_t n = l->nregs ? l->nregs : 64;
+        struct event_reg *regs;
+
+        while (n <= (size_t)fd) {
+            n *= 2;
+        }
+        regs = realloc(l->regs, n * sizeof(*regs));
+        if (regs == NULL) {
+            perror("Failed to allocate event registrations");
+            return NULL;
+        }
+        memset(regs + l->nregs, 0, (n - l->nregs) * sizeof(*regs));
+        l->regs = regs;
+        l->nregs = n;
+    }
+    return &l->regs[fd];
+}
+
+// Lähettää jonossa olevat pyynnöt renkaalle. Palauttaa 0, 1, jos ydin on tilapäisesti varattu (EBUSY tai
+// EAGAIN, esimerkiksi valmistumisjonon ylivuodon aikana; valmistumiset on käsiteltävä ja lähetystä
+// yritettävä uudelleen), tai -1.
+static int ring_submit(struct event_loop *l, unsigned min_complete, unsigned flags, void *arg, size_t size) {
+    int r;
+
+    l->syscalls++;
+    r = io_uring_enter(l->ring_fd, l->to_submit, min_complete, flags, arg, size);
+    if (r < 0) {
+        if (errno == EBUSY || errno == EAGAIN) {
+            return 1;
+        }
+        return errno == EINTR || errno == ETIME ? 0 : -1;
+    }
+    l->to_submit -= (unsigned)r < l->to_submit ? (unsigned)r : l->to_submit;
+    return 0;
+}
+
+// Antaa vapaan pyyntöpaikan (lähettää jonon, jos rengas on täynnä)
+static struct io_uring_sqe *ring_get_sqe(struct event_loop *l) {
+    unsigned tail = *l->sq_tail;
+    unsigned index;
+    struct io_uring_sqe *sqe;
+
+    while (tail - atomic_load_explicit((_Atomic unsigned *)l->sq_head, memory_order_acquire) >= l->sq_entries) {
+        // Varattua rengasta ei voi tyhjentää käsittelijän sisältä, joten pyyntö jää tekemättä
+        if (ring_submit(l, 0, 0, NULL, 0) != 0) {
+            perror("io_uring_enter");
+            return NULL;
+        }
+    }
+    index = tail & l->sq_mask;
+    sqe = &l->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    l->sq_array[index] = index;
+    return sqe;
+}
+
+// Julkaisee täytetyn pyyntöpaikan ytimelle
+static void ring_push_sqe(struct event_loop *l) {
+    atomic_store_explicit((_Atomic unsigned *)l->sq_tail, *l->sq_tail + 1, memory_order_release);
+    l->to_submit++;
+}
+
+// Palauttaa vastaanottopuskurin renkaaseen
+static void ring_recycle_buffer(struct event_loop *l, unsigned bid) {
+    unsigned short tail = l->buf_ring->tail;
+    struct io_uring_buf *buf = &l->buf_ring->bufs[tail & (RECV_BUFFERS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(l->buffers + (size_t)bid * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    atomic_store_explicit((_Atomic unsigned short *)&l->buf_ring->tail, tail + 1, memory_order_release);
+}
+
+// Lähettää kuvaajalle toistuvan poll- tai vastaanottopyynnön
+static int ring_arm(struct event_loop *l, int fd) {
+    struct event_reg *reg = &l->regs[fd];
+    struct io_uring_sqe *sqe = ring_get_sqe(l);
+
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)reg->gen << 32 | (uint32_t)fd;
+    if (reg->datagrams) {
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = (uint64_t)(uintptr_t)&l->recv_msg;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RECV_GROUP;
+    } else {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN | POLLOUT | POLLRDHUP;
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    ring_push_sqe(l);
+    return 0;
+}
+
+// Alustaa io_uring-renkaan ja vastaanoton puskurirenkaan. Palauttaa 0 tai -1.
+static int ring_init(struct event_loop *l) {
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    size_t sq_size, cq_size, ring_size;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    l->ring_fd = io_uring_setup(RING_ENTRIES, &p);
+    if (l->ring_fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        fprintf(stderr, "io_uring: ydin on liian vanha (vaaditaan IORING_FEAT_SINGLE_MMAP ja IORING_FEAT_EXT_ARG)\n");
+        return -1;
+    }
+
+    // Pyyntö- ja valmistumisrengas ovat samassa muistialueessa
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring_size = sq_size > cq_size ? sq_size : cq_size;
+    sq = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, l->ring_fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        perror("Failed to map io_uring");
+        return -1;
+    }
+    cq = sq;
+    l->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   l->ring_fd, IORING_OFF_SQES);
+    if (l->sqes == MAP_FAILED) {
+        perror("Failed to map io_uring");
+        return -1;
+    }
+    l->sq_head = (unsigned *)(sq + p.sq_off.head);
+    l->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    l->sq_array = (unsigned *)(sq + p.sq_off.array);
+    l->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    l->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    l->cq_head = (unsigned *)(cq + p.cq_off.head);
+    l->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    l->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    l->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Vastaanoton puskurit: ydin valitsee vapaan puskurin renkaasta jokaiselle datagrammille
+    l->buf_ring = mmap(NULL, RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    l->buffers = malloc((size_t)RECV_BUFFERS * RECV_BUFFER_SIZE);
+    if (l->buf_ring == MAP_FAILED || l->buffers == NULL) {
+        perror("Failed to allocate receive buffers");
+        return -1;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)l->buf_ring;
+    reg.ring_entries = RECV_BUFFERS;
+    reg.bgid = RECV_GROUP;
+    l->syscalls++;
+    if (io_uring_register(l->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("Registering io_uring buffer ring failed");
+        return -1;
+    }
+    l->buf_ring->tail = 0;
+    for (unsigned i = 0; i < RECV_BUFFERS; i++) {
+        ring_recycle_buffer(l, i);
+    }
+    l->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    return 0;
+}
+
+struct event_loop *event_loop_create(enum event_backend backend) {
+    struct event_loop *l = calloc(1, sizeof(*l));
+
+    if (l == NULL) {
+        perror("Failed to allocate event loop");
+        return NULL;
+    }
+    l->backend = backend;
+    l->epoll_fd = -1;
+    l->ring_fd = -1;
+    if (backend == EVENT_EPOLL) {
+        l->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (l->epoll_fd < 0) {
+            perror("epoll_create1");
+            free(l);
+            return NULL;
+        }
+    } else if (ring_init(l) < 0) {
+        free(l);  // Kuvaajat ja kuvaukset jäävät; ohjelma lopettaa virheeseen
+        return NULL;
+    }
+    return l;
+}
+
+// Rekisteröi kuvaajan. Palauttaa 0 tai -1.
+static int add(struct event_loop *l, int fd, event_handler handler, void *arg, bool datagrams) {
+    struct event_reg *reg = get_reg(l, fd);
+
+    if (reg == NULL) {
+        return -1;
+    }
+    reg->handler = handler;
+    reg->arg = arg;
+    reg->active = true;
+    reg->datagrams = datagrams;
+    reg->gen++;
+
+    if (l->backend == EVENT_EPOLL) {
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.fd = fd};
+
+        if (!datagrams) {
+            ev.events |= EPOLLOUT | EPOLLRDHUP;
+        }
+        l->syscalls++;
+        if (epoll_ctl(l->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            reg->active = false;
+            return -1;
+        }
+        return 0;
+    }
+    return ring_arm(l, fd);
+}
+
+int event_add(struct event_loop *l, int fd, event_handler handler, void *arg) {
+    return add(l, fd, handler, arg, false);
+}
+
+int event_add_datagrams(struct event_loop *l, int fd, event_handler handler, void *arg) {
+    return add(l, fd, handler, arg, true);
+}
+
+void event_del(struct event_loop *l, int fd) {
+    struct event_reg *reg = &l->regs[fd];
+
+    if (l->backend == EVENT_EPOLL) {
+        // Suljettu kuvaaja poistuisi epoll-joukosta itsestäänkin, mutta kuvaaja voi olla kopioitu
+        l->syscalls++;
+        epoll_ctl(l->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    } else {
+        // Peruuta toistuva pyyntö; sen valmistumiset tunnistetaan vanhentuneiksi sukupolvesta
+        struct io_uring_sqe *sqe = ring_get_sqe(l);
+
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t)reg->gen << 32 | (uint32_t)fd;
+            sqe->user_data = USER_DATA_IGNORE;
+            ring_push_sqe(l);
+        }
+    }
+    reg->active = false;
+    reg->gen++;
+}
+
+// Odottaa ja käsittelee epoll-tapahtumat
+static int run_epoll(struct event_loop *l, int timeout_ms) {
+    struct epoll_event events[EPOLL_EVENTS];
+    int n;
+
+    l->syscalls++;
+    n = epoll_wait(l->epoll_fd, events, EPOLL_EVENTS, timeout_ms);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        struct event_reg *reg = &l->regs[fd];
+        struct event ev = {.fd = fd};
+
+        // Aiempi käsittelijä on voinut poistaa kuvaajan
+        if (!reg->active) {
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            ev.flags |= EVENT_READ;
+        }
+        if (events[i].events & EPOLLOUT) {
+            ev.flags |= EVENT_WRITE;
+        }
+        if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+            ev.flags |= EVENT_ERROR;
+        }
+        reg->handler(reg->arg, &ev);
+    }
+    return n;
+}
+
+// Käsittelee yhden io_uring-valmistumisen
+static void handle_cqe(struct event_loop *l, const struct io_uring_cqe *cqe) {
+    int fd = (uint32_t)cqe->user_data;
+    uint32_t gen = cqe->user_data >> 32;
+    struct event_reg *reg;
+    struct event ev = {.fd = fd};
+
+    if (cqe->user_data == USER_DATA_IGNORE) {
+        return;
+    }
+    reg = &l->regs[fd];
+    if (!reg->active || reg->gen != gen) {
+        // Peruutetun rekisteröinnin valmistuminen: palauta mahdollinen puskuri
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            ring_recycle_buffer(l, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        return;
+    }
+
+    if (reg->datagrams) {
+        if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            char *buf = l->buffers + (size_t)bid * RECV_BUFFER_SIZE;
+            struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+            char *name = buf + sizeof(*out);
+
+            ev.flags = EVENT_DATAGRAM;
+            ev.addr = (struct sockaddr_in *)name;
+            ev.addrlen = out->namelen < sizeof(struct sockaddr_in) ? out->namelen : sizeof(struct sockaddr_in);
+            ev.data = name + l->recv_msg.msg_namelen + l->recv_msg.msg_controllen;
+            ev.len = out->payloadlen;
+            if (!(out->flags & MSG_TRUNC)) {  // Liian pitkät datagrammit ohitetaan
+                reg->handler(reg->arg, &ev);
+            }
+            ring_recycle_buffer(l, bid);
+        } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+            errno = -cqe->res;
+            perror("io_uring recvmsg");
+        }
+    } else if (cqe->res >= 0) {
+        if (cqe->res & (POLLIN | POLLRDHUP | POLLHUP | POLLERR)) {
+            ev.flags |= EVENT_READ;
+        }
+        if (cqe->res & POLLOUT) {
+            ev.flags |= EVENT_WRITE;
+        }
+        if (cqe->res & (POLLHUP | POLLERR)) {
+            ev.flags |= EVENT_ERROR;
+        }
+        reg->handler(reg->arg, &ev);
+    }
+
+    // Toistuva pyyntö päättyy esimerkiksi puskureiden loppuessa; käynnistä se uudelleen. Käsittelijä on
+    // voinut lisätä kuvaajia, jolloin taulukko on voinut siirtyä.
+    reg = &l->regs[fd];
+    if (!(cqe->flags & IORING_CQE_F_MORE) && reg->active && reg->gen == gen) {
+        ring_arm(l, fd);
+    }
+}
+
+// Odottaa ja käsittelee io_uring-valmistumiset
+static int run_ring(struct event_loop *l, int timeout_ms) {
+    unsigned head = *l->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)l->cq_tail, memory_order_acquire);
+    int n = 0;
+
+    // Lähetä uudet pyynnöt ja odota, jos valmistumisia ei ole valmiina
+    if (head == tail || l->to_submit > 0) {
+        struct __kernel_timespec ts = {timeout_ms / 1000, timeout_ms % 1000 * 1000000L};
+        struct io_uring_getevents_arg arg = {.ts = (uint64_t)(uintptr_t)&ts};
+        unsigned wait = head == tail && timeout_ms != 0;
+
+        if (timeout_ms < 0) {
+            arg.ts = 0;
+        }
+        // Varatussa renkaassa käsitellään valmiit valmistumiset, ja lähettämättömät pyynnöt lähetetään
+        // seuraavalla kierroksella
+        if (ring_submit(l, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0) {
+            return -1;
+        }
+        tail = atomic_load_explicit((_Atomic unsigned *)l->cq_tail, memory_order_acquire);
+    }
+
+    for (; head != tail; head++, n++) {
+        struct io_uring_cqe cqe = l->cqes[head & l->cq_mask];
+
+        // Vapauta valmistumispaikka ennen käsittelyä, jotta käsittelijän pyynnöille on tilaa
+        atomic_store_explicit((_Atomic unsigned *)l->cq_head, head + 1, memory_order_release);
+        handle_cqe(l, &cqe);
+    }
+    return n;
+}
+
+int event_run_once(struct event_loop *l, int timeout_ms) {
+    return l->backend == EVENT_EPOLL ? run_epoll(l, timeout_ms) : run_ring(l, timeout_ms);
+}
+
+unsigned long event_syscalls(const struct event_loop *l) {
+    return l->syscalls;
+}
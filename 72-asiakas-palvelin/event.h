@@ -0,0 +1,71 @@
+/*
+ * event.h
+ *
+ * Palvelusäikeen tapahtumasilmukka. Tiedostokuvaajat rekisteröidään reunaliipaistuina: tapahtuma
+ * tulee, kun kuvaajan tila muuttuu, ja käsittelijän on luettava tai kirjoitettava, kunnes kutsu
+ * palauttaa EAGAIN. Tapahtumat odotetaan joko epoll-kutsulla (EPOLLET) tai io_uring-renkaalla, jossa
+ * tiedostokuvaajia seurataan toistuvalla poll-pyynnöllä (IORING_POLL_ADD_MULTI).
+ *
+ * Datagrammisocketille io_uring-taustaosa tekee lisäksi toistuvan vastaanoton (IORING_RECV_MULTISHOT):
+ * ydin kirjoittaa jokaisen datagrammin suoraan rekisteröityyn puskuriin, ja tapahtuma kertoo
+ * valmiin datagrammin, joten vastaanotto ei tarvitse järjestelmäkutsua. epoll-taustaosalla
+ * datagrammisocket on tavallinen luettava kuvaaja.
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+
+#define EVENT_READ 1      // Kuvaajasta voi lukea (tai yhteys on suljettu)
+#define EVENT_WRITE 2     // Kuvaajaan voi kirjoittaa
+#define EVENT_ERROR 4     // Virhe tai yhteyden katkeaminen
+#define EVENT_DATAGRAM 8  // Vastaanotettu datagrammi (io_uring)
+
+// Tapahtumien odotustapa
+enum event_backend {
+    EVENT_EPOLL,     // epoll (reunaliipaisu)
+    EVENT_IO_URING,  // io_uring (toistuva poll ja toistuva vastaanotto)
+};
+
+// Tapahtuma
+struct event {
+    int fd;                     // Kuvaaja
+    unsigned flags;             // EVENT_*-liput
+    const char *data;           // Datagrammin sisältö (EVENT_DATAGRAM)
+    size_t len;                 // Datagrammin pituus
+    struct sockaddr_in *addr;   // Datagrammin lähettäjä
+    socklen_t addrlen;          // Lähettäjän osoitteen pituus
+};
+
+// Tapahtuman käsittelijä; arg on kuvaajan rekisteröinnissä annettu arvo. Datagrammin puskuri on
+// voimassa vain käsittelijän ajan.
+typedef void (*event_handler)(void *arg, struct event *ev);
+
+struct event_loop;
+
+// Luo tapahtumasilmukan. Palauttaa NULL virheen sattuessa (virheilmoitus tulostettu).
+struct event_loop *event_loop_create(enum event_backend backend);
+
+// Palauttaa taustaosan nimen
+const char *event_backend_name(enum event_backend backend);
+
+// Lisää kuvaajan seurantaan luettavuuden ja kirjoitettavuuden osalta. Palauttaa 0 tai -1.
+int event_add(struct event_loop *l, int fd, event_handler handler, void *arg);
+
+// Lisää datagrammisocketin seurantaan (io_uring: toistuva vastaanotto). Palauttaa 0 tai -1.
+int event_add_datagrams(struct event_loop *l, int fd, event_handler handler, void *arg);
+
+// Poistaa kuvaajan seurannasta. Kutsuttava ennen kuvaajan sulkemista; kuvaajan myöhemmin tulevia
+// tapahtumia ei enää käsitellä.
+void event_del(struct event_loop *l, int fd);
+
+// Odottaa tapahtumia enintään timeout_ms millisekuntia (-1 = loputtomiin) ja käsittelee ne.
+// Palauttaa käsiteltyjen tapahtumien määrän tai -1 virheen sattuessa.
+int event_run_once(struct event_loop *l, int timeout_ms);
+
+// Palauttaa silmukan järjestelmäkutsujen määrän (tapahtumien odotus ja rekisteröinnit)
+unsigned long event_syscalls(const struct event_loop *l);
+
+#endif
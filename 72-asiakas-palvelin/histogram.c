@@ -0,0 +1,58 @@
+/*
+ * histogram.c
+ *
+ * HDR-tyyppinen viivehistogrammi (ks. histogram.h).
+ */
+
+#include "histogram.h"
+
+#include <string.h>
+
+// Palauttaa lokeron suurimman arvon
+static uint64_t bucket_upper(unsigned index) {
+    unsigned shift;
+
+    if (index < (1u << HIST_SUB_BITS)) {
+        return index;
+    }
+    shift = (index >> (HIST_SUB_BITS - 1)) - 1;
+    return ((uint64_t)(index - (shift << (HIST_SUB_BITS - 1))) << shift) + (1ULL << shift) - 1;
+}
+
+void histogram_init(struct histogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void histogram_merge(struct histogram *dst, const struct histogram *src) {
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+uint64_t histogram_percentile(const struct histogram *h, double percentile) {
+    double exact = percentile / 100.0 * h->count;  // Tarvittava arvojen määrä (pyöristetään ylöspäin)
+    uint64_t target = exact, seen = 0;
+
+    if (h->count == 0) {
+        return 0;
+    }
+    if (target < exact || target < 1) {
+        target++;
+    }
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t upper = bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
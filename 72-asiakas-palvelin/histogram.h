@@ -0,0 +1,64 @@
+/*
+ * histogram.h
+ *
+ * HDR-tyyppinen viivehistogrammi. Arvot alle 2^HIST_SUB_BITS tallennetaan tarkasti, ja sitä
+ * suuremmat lokeroidaan kahden potenssien väleihin, joista kukin on jaettu 2^(HIST_SUB_BITS-1)
+ * yhtä leveään lokeroon. Lokeron suhteellinen leveys on siis alle 1 %, muisti on kiinteä (noin
+ * 35 kt) ja kirjaus on pelkkä indeksin laskenta ja yhteenlasku. Säikeillä on omat histogramminsa,
+ * jotka yhdistetään lopuksi.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 8   // Tarkasti tallennettavien arvojen bitit (lokeroita kahden potenssia kohden 2^(HIST_SUB_BITS-1))
+#define HIST_MAX_BITS 40  // Suurimman tallennettavan arvon bitit (nanosekunteina noin 18 minuuttia)
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) << (HIST_SUB_BITS - 1))  // Lokeroiden määrä
+
+// Histogrammi
+struct histogram {
+    uint64_t count;                 // Arvojen määrä
+    uint64_t min;                   // Pienin arvo (UINT64_MAX, jos tyhjä)
+    uint64_t max;                   // Suurin arvo
+    uint64_t counts[HIST_BUCKETS];  // Arvojen määrät lokeroittain
+};
+
+// Palauttaa arvon lokeron. Liian suuret arvot menevät viimeiseen lokeroon.
+static inline unsigned histogram_index(uint64_t value) {
+    unsigned shift;
+
+    if (value < (1u << HIST_SUB_BITS)) {
+        return value;
+    }
+    if (value >> HIST_MAX_BITS) {
+        value = (1ULL << HIST_MAX_BITS) - 1;
+    }
+    shift = 63 - __builtin_clzll(value) - (HIST_SUB_BITS - 1);  // value >> shift on välillä 2^(HIST_SUB_BITS-1)..2^HIST_SUB_BITS-1
+    return (shift << (HIST_SUB_BITS - 1)) + (value >> shift);
+}
+
+// Kirjaa arvon histogrammiin
+static inline void histogram_record(struct histogram *h, uint64_t value) {
+    h->counts[histogram_index(value)]++;
+    h->count++;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+// Tyhjentää histogrammin
+void histogram_init(struct histogram *h);
+
+// Lisää histogrammin src arvot histogrammiin dst
+void histogram_merge(struct histogram *dst, const struct histogram *src);
+
+// Palauttaa arvon, jota pienempiä tai yhtä suuria on vähintään percentile prosenttia arvoista
+// (lokeron yläraja, kuitenkin enintään suurin arvo). Palauttaa 0, jos histogrammi on tyhjä.
+uint64_t histogram_percentile(const struct histogram *h, double percentile);
+
+#endif
@@ -0,0 +1,443 @@
+/*
+ * load.c
+ *
+ * Asiakkaan kuormitustila (ks. load.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "load.h"
+
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "histogram.h"
+#include "protocol.h"
+#include "shm.h"
+
+#define MIN_SLOTS 65536             // Pyyntötaulukon vähimmäiskoko säiettä kohden
+#define RECEIVE_BUFFER (4 << 20)    // Socketin vastaanottopuskurin koko (tasoittaa avoimen silmukan purskeita)
+#define STREAM_BUFFER (64 << 10)    // TCP-yhteyden lukupuskurin koko
+
+// Matkalla oleva pyyntö
+struct load_slot {
+    uint32_t id;    // Pyynnön tunniste
+    bool active;    // Odottaako pyyntö vastausta
+    uint64_t sent;  // Lähetysaika (avoimessa silmukassa suunniteltu lähetysaika) nanosekunteina
+};
+
+// Kuormasäikeen tila ja tulokset
+struct load_thread {
+    const struct load_options *options;
+    int index;                   // Säikeen numero
+    int udp_socket;              // Säikeen oma socket (UDP tai TCP)
+    char *stream;                // TCP: vastaanotettu, vielä käsittelemätön data
+    size_t stream_len;           // Käsittelemättömän datan määrä
+    bool closed;                 // TCP: palvelin on sulkenut yhteyden
+    struct shm_channel shm;      // Säikeen oma jaetun muistin kanava (region = NULL, jos ei käytössä)
+    pthread_t thread;            // Säikeen tunniste
+    struct load_slot *slots;     // Pyynnöt tunnisteen mukaan (paikka = tunniste & mask)
+    uint32_t mask;               // Pyyntötaulukon koko - 1
+    uint32_t next_id;            // Seuraavan pyynnön tunniste
+    uint32_t oldest;             // Vanhimman mahdollisesti matkalla olevan pyynnön tunniste
+    unsigned outstanding;        // Vastausta odottavien pyyntöjen määrä
+    unsigned long sent;          // Lähetetyt pyynnöt
+    unsigned long received;      // Ajoissa saadut vastaukset
+    unsigned long timeouts;      // Aikakatkaistut (kadonneet) pyynnöt
+    unsigned long late;          // Aikakatkaisun jälkeen tulleet tai tuntemattomat vastaukset
+    unsigned long errors;        // Virhevastaukset ja lähetysvirheet
+    unsigned long skipped;       // Avoimessa silmukassa lähettämättä jääneet pyynnöt
+    uint64_t elapsed;            // Lähetysvaiheen kesto nanosekunteina
+    struct histogram latency;    // Vastausten viiveet nanosekunteina
+};
+
+// Nykyinen aika nanosekunteina
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Lähettää uuden pyynnön. sent on pyynnön lähetysaika viiveen laskemista varten. Palauttaa 0 tai -1.
+static int send_request(struct load_thread *t, uint64_t sent) {
+    const struct load_options *o = t->options;
+    struct load_slot *slot = &t->slots[t->next_id & t->mask];
+    struct proto_header h = {PROTO_MAGIC, PROTO_VERSION, PROTO_REQUEST, PROTO_OK, t->next_id, o->rows, o->pool, o->pick};
+    char frame[PROTO_FRAME_HEADER + PROTO_HEADER_SIZE] = {0, PROTO_HEADER_SIZE};
+    char *request = o->tcp ? frame : frame + PROTO_FRAME_HEADER;
+    size_t len = o->tcp ? sizeof(frame) : PROTO_HEADER_SIZE;
+
+    proto_write_header(frame + PROTO_FRAME_HEADER, &h);
+    if (t->shm.region != NULL) {
+        if (shm_send(&t->shm, request, len) < 0) {
+            t->errors++;
+            return -1;
+        }
+    } else if (t->closed || send(t->udp_socket, request, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        t->errors++;
+        return -1;
+    }
+    slot->id = t->next_id++;
+    slot->active = true;
+    slot->sent = sent;
+    t->outstanding++;
+    t->sent++;
+    return 0;
+}
+
+// Käsittelee yhden vastauksen ja kirjaa sen viiveen
+static void handle_response(struct load_thread *t, const char *buffer, size_t len, uint64_t now) {
+    struct proto_header h;
+    struct load_slot *slot;
+
+    if (proto_read_header(buffer, len, &h) < 0 || h.type != PROTO_RESPONSE) {
+        t->errors++;
+        return;
+    }
+    slot = &t->slots[h.id & t->mask];
+    if (!slot->active || slot->id != h.id) {
+        t->late++;
+        return;
+    }
+    slot->active = false;
+    t->outstanding--;
+    if (h.status != PROTO_OK) {
+        t->errors++;
+        return;
+    }
+    histogram_record(&t->latency, now - slot->sent);
+    t->received++;
+}
+
+// Lukee TCP-yhteydeltä kaiken saatavilla olevan datan ja käsittelee siinä olevat kokonaiset vastaukset
+static void receive_stream(struct load_thread *t) {
+    ssize_t len;
+
+    while (!t->closed &&
+           (len = recv(t->udp_socket, t->stream + t->stream_len, STREAM_BUFFER - t->stream_len, MSG_DONTWAIT)) != 0) {
+        uint64_t now = now_ns();
+        size_t off = 0;
+
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                t->closed = true;
+                t->errors++;
+            }
+            return;
+        }
+        t->stream_len += len;
+
+        // Pura kehykset: kaksi tavua pituutta ja viesti
+        while (t->stream_len - off >= PROTO_FRAME_HEADER) {
+            const unsigned char *p = (const unsigned char *)t->stream + off;
+            size_t msg_len = p[0] << 8 | p[1];
+
+            if (t->stream_len - off < PROTO_FRAME_HEADER + msg_len) {
+                break;
+            }
+            handle_response(t, t->stream + off + PROTO_FRAME_HEADER, msg_len, now);
+            off += PROTO_FRAME_HEADER + msg_len;
+        }
+        memmove(t->stream, t->stream + off, t->stream_len - off);
+        t->stream_len -= off;
+    }
+    if (!t->closed) {
+        // Palvelin sulki yhteyden: matkalla olevat pyynnöt aikakatkaistaan
+        t->closed = true;
+        t->errors++;
+    }
+}
+
+// Vastaanottaa kaikki jonossa olevat vastaukset ja kirjaa niiden viiveet
+static void receive_responses(struct load_thread *t) {
+    char buffer[PROTO_MAX_DATAGRAM];
+    ssize_t len;
+
+    if (t->options->tcp) {
+        receive_stream(t);
+        return;
+    }
+    if (t->shm.region != NULL) {
+        while ((len = shm_receive(&t->shm, buffer, sizeof(buffer))) >= 0) {
+            handle_response(t, buffer, len, now_ns());
+        }
+        return;
+    }
+    while ((len = recv(t->udp_socket, buffer, sizeof(buffer), MSG_DONTWAIT)) >= 0) {
+        handle_response(t, buffer, len, now_ns());
+    }
+}
+
+// Siirtää vanhimman pyynnön osoittimen vastattujen ohi ja aikakatkaisee pyynnöt, joiden odotusaika on
+// kulunut. Palauttaa vanhimman odottavan pyynnön aikakatkaisuhetken tai UINT64_MAX, jos pyyntöjä ei ole.
+static uint64_t expire_requests(struct load_thread *t, uint64_t now) {
+    uint64_t timeout = t->options->timeout_ms * 1000000ULL;
+
+    while (t->oldest != t->next_id) {
+        struct load_slot *slot = &t->slots[t->oldest & t->mask];
+
+        if (slot->active) {
+            if (now - slot->sent < timeout) {
+                return slot->sent + timeout;
+            }
+            slot->active = false;
+            t->outstanding--;
+            t->timeouts++;
+        }
+        t->oldest++;
+    }
+    return UINT64_MAX;
+}
+
+// Odottaa vastauksia enintään hetkeen until asti
+static void wait_responses(struct load_thread *t, uint64_t until) {
+    struct pollfd pfd = {t->closed ? -1 : t->udp_socket, POLLIN, 0};
+    uint64_t now = now_ns();
+    struct timespec ts = {0, 0};
+
+    if (t->shm.region != NULL) {
+        shm_wait(&t->shm, until > now ? until - now : 0);
+        return;
+    }
+    if (until > now) {
+        ts.tv_sec = (until - now) / 1000000000ULL;
+        ts.tv_nsec = (until - now) % 1000000000ULL;
+    }
+    if (ppoll(&pfd, 1, &ts, NULL) < 0 && errno != EINTR) {
+        perror("ppoll");
+    }
+}
+
+// Kuormasäikeen pääfunktio
+static void *load_thread_main(void *arg) {
+    struct load_thread *t = arg;
+    const struct load_options *o = t->options;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(o->duration * 1e9);
+    uint64_t slot = t->index;   // Avoimen silmukan seuraava lähetysvuoro kaikkien säikeiden yhteisessä tahdissa
+    uint64_t next_send = start;  // Seuraava lähetysaika
+
+    // Lähetysaika lasketaan vuoron numerosta eikä katkaistua väliä lisäämällä, joten pyöristysvirhe
+    // ei kasaannu. Säie käyttää vuorot index, index + threads, ..., joten säikeiden lähetykset porrastuvat.
+    if (o->mode == LOAD_OPEN) {
+        next_send = start + (uint64_t)(slot * 1e9 / o->rate);
+    }
+
+    // Lähetysvaihe
+    while (true) {
+        uint64_t now = now_ns();
+        uint64_t deadline;
+        uint64_t until = end;
+
+        if (now >= end) {
+            break;
+        }
+        receive_responses(t);
+        expire_requests(t, now);
+
+        if (o->mode == LOAD_CLOSED) {
+            // Täytä ikkuna (taulukon täytyttyä odotetaan, että vanhin pyyntö vastataan tai aikakatkaistaan).
+            // Jos lähetys epäonnistuu (esimerkiksi palvelin ei ole käynnissä), yritetään uudelleen aikakatkaisun kuluttua.
+            while (t->outstanding < o->inflight && t->next_id - t->oldest <= t->mask) {
+                if (send_request(t, now_ns()) < 0) {
+                    until = now + o->timeout_ms * 1000000ULL < end ? now + o->timeout_ms * 1000000ULL : end;
+                    break;
+                }
+            }
+        } else {
+            // Lähetä kaikki pyynnöt, joiden aika on tullut
+            while (next_send <= now) {
+                if (t->outstanding >= o->inflight || t->next_id - t->oldest > t->mask) {
+                    t->skipped++;
+                } else {
+                    send_request(t, next_send);
+                }
+                slot += o->threads;
+                next_send = start + (uint64_t)(slot * 1e9 / o->rate);
+            }
+            if (next_send < until) {
+                until = next_send;
+            }
+        }
+        // Odota seuraavaa vastausta, lähetysaikaa tai aikakatkaisua
+        deadline = expire_requests(t, now_ns());
+        if (deadline < until) {
+            until = deadline;
+        }
+        wait_responses(t, until);
+    }
+    t->elapsed = now_ns() - start;
+
+    // Odota matkalla olevat vastaukset tai niiden aikakatkaisu
+    while (t->outstanding > 0) {
+        uint64_t deadline;
+
+        receive_responses(t);
+        deadline = expire_requests(t, now_ns());
+        if (t->outstanding > 0) {
+            wait_responses(t, deadline);
+        }
+    }
+    return NULL;
+}
+
+// Avaa socketin palvelimeen. Palauttaa socketin tai -1.
+static int open_socket(const struct load_options *o, bool tcp) {
+    int size = RECEIVE_BUFFER, one = 1;
+    int sock = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+
+    if (sock < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+
+    // UDP: connect rajaa vastaanoton palvelimen paketteihin, ja send ei tarvitse osoitetta
+    if (connect(sock, (const struct sockaddr *)&o->server, sizeof(o->server)) < 0) {
+        perror("Failed to connect socket");
+        close(sock);
+        return -1;
+    }
+    if (tcp) {
+        // Pienet pyynnöt lähtevät heti eivätkä jää odottamaan Naglen algoritmia
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));  // Ei haittaa, jos ei onnistu
+    }
+    return sock;
+}
+
+// Tulostaa viiveen mikrosekunteina
+static void print_latency(const char *label, uint64_t ns) {
+    printf("  %-6s %10.1f µs\n", label, ns / 1000.0);
+}
+
+int load_run(const struct load_options *options) {
+    struct load_thread *threads = calloc(options->threads, sizeof(*threads));
+    struct histogram *latency = malloc(sizeof(*latency));
+    unsigned long sent = 0, received = 0, timeouts = 0, late = 0, errors = 0, skipped = 0;
+    uint64_t elapsed = 0;
+    uint32_t slots = MIN_SLOTS;
+    int *idle = calloc(options->idle, sizeof(*idle));
+
+    if (threads == NULL || latency == NULL || (options->idle > 0 && idle == NULL)) {
+        perror("Failed to allocate load threads");
+        return -1;
+    }
+    while (slots < 2 * options->inflight) {
+        slots *= 2;
+    }
+    histogram_init(latency);
+
+    for (unsigned i = 0; i < options->threads; i++) {
+        struct load_thread *t = &threads[i];
+
+        t->options = options;
+        t->index = i;
+        t->mask = slots - 1;
+        t->slots = calloc(slots, sizeof(*t->slots));
+        if (t->slots == NULL) {
+            perror("Failed to allocate request table");
+            return -1;
+        }
+        histogram_init(&t->latency);
+        if (options->tcp && (t->stream = malloc(STREAM_BUFFER)) == NULL) {
+            perror("Failed to allocate stream buffer");
+            return -1;
+        }
+        if (options->shm_path != NULL) {
+            t->udp_socket = -1;
+            if (shm_connect(&t->shm, options->shm_path) < 0) {
+                return -1;
+            }
+        } else if ((t->udp_socket = open_socket(options, options->tcp)) < 0) {
+            return -1;
+        }
+    }
+
+    // Joutilaat yhteydet kuormittavat palvelimen tapahtumasilmukkaa, vaikka niissä ei liikennöidä
+    for (unsigned i = 0; i < options->idle; i++) {
+        if ((idle[i] = open_socket(options, true)) < 0) {
+            fprintf(stderr, "Avattiin %u joutilasta yhteyttä\n", i);
+            return -1;
+        }
+    }
+
+    if (options->mode == LOAD_CLOSED) {
+        printf("Suljettu silmukka: %u säiettä, %u pyyntöä matkalla säiettä kohden, %.1f s\n", options->threads,
+               options->inflight, options->duration);
+    } else {
+        printf("Avoin silmukka: %.0f pyyntöä/s, %u säiettä, enintään %u pyyntöä matkalla säiettä kohden, %.1f s\n",
+               options->rate, options->threads, options->inflight, options->duration);
+    }
+    printf("Pyyntö: %u riviä, %u/%u, aikakatkaisu %u ms, %s", options->rows, options->pick, options->pool,
+           options->timeout_ms, options->tcp ? "TCP" : options->shm_path != NULL ? "jaettu muisti" : "UDP");
+    if (options->idle > 0) {
+        printf(", %u joutilasta TCP-yhteyttä", options->idle);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    for (unsigned i = 0; i < options->threads; i++) {
+        if (pthread_create(&threads[i].thread, NULL, load_thread_main, &threads[i]) != 0) {
+            fprintf(stderr, "Säikeen luonti epäonnistui\n");
+            return -1;
+        }
+    }
+
+    // Yhdistä säikeiden tulokset
+    for (unsigned i = 0; i < options->threads; i++) {
+        struct load_thread *t = &threads[i];
+
+        pthread_join(t->thread, NULL);
+        sent += t->sent;
+        received += t->received;
+        timeouts += t->timeouts;
+        late += t->late;
+        errors += t->errors;
+        skipped += t->skipped;
+        if (t->elapsed > elapsed) {
+            elapsed = t->elapsed;
+        }
+        histogram_merge(latency, &t->latency);
+        if (t->shm.region != NULL) {
+            shm_close(&t->shm);
+        } else {
+            close(t->udp_socket);
+        }
+        free(t->stream);
+        free(t->slots);
+    }
+    for (unsigned i = 0; i < options->idle; i++) {
+        close(idle[i]);
+    }
+
+    printf("Lähetetty %lu pyyntöä, vastauksia %lu (%.0f/s, %.0f riviä/s)\n", sent, received, received / (elapsed / 1e9),
+           received * options->rows / (elapsed / 1e9));
+    printf("Kadonneita %lu (%.3f %%), myöhästyneitä %lu, virheitä %lu", timeouts, sent ? 100.0 * timeouts / sent : 0.0,
+           late, errors);
+    if (options->mode == LOAD_OPEN) {
+        printf(", ohitettuja %lu", skipped);
+    }
+    printf("\nViive:\n");
+    print_latency("min", latency->count ? latency->min : 0);
+    print_latency("p50", histogram_percentile(latency, 50));
+    print_latency("p90", histogram_percentile(latency, 90));
+    print_latency("p99", histogram_percentile(latency, 99));
+    print_latency("p99.9", histogram_percentile(latency, 99.9));
+    print_latency("max", latency->max);
+
+    free(idle);
+    free(latency);
+    free(threads);
+    return 0;
+}
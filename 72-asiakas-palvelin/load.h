@@ -0,0 +1,52 @@
+/*
+ * load.h
+ *
+ * Asiakkaan kuormitustila. Jokaisella säikeellä on oma socketinsa (UDP tai yksi TCP-yhteys) tai oma
+ * jaetun muistin kanavansa (shm.h), ja
+ * pyynnöt lähetetään binääriprotokollalla, jotta vastaukset voidaan yhdistää pyyntöihin tunnisteen
+ * perusteella.
+ *
+ * Suljetussa silmukassa (closed) jokaisella säikeellä on koko ajan inflight pyyntöä matkalla, ja uusi
+ * pyyntö lähetetään heti vastauksen tultua. Avoimessa silmukassa (open) pyynnöt lähetetään tasaisesti
+ * tavoitetahdilla vastauksista riippumatta, ja viive mitataan pyynnön suunnitellusta lähetysajasta,
+ * joten palvelimen hidastuminen näkyy viiveessä eikä piiloudu harventuneisiin pyyntöihin
+ * (coordinated omission). Jos säikeellä on jo inflight pyyntöä matkalla, pyyntö jätetään lähettämättä
+ * ja lasketaan ohitetuksi.
+ *
+ * Pyyntö, johon ei tule vastausta aikakatkaisun kuluessa, lasketaan kadonneeksi; sen jälkeen tuleva
+ * vastaus lasketaan myöhästyneeksi. Viiveet kirjataan HDR-tyyppisiin histogrammeihin.
+ */
+
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+
+// Kuormitustapa
+enum load_mode {
+    LOAD_CLOSED,  // Suljettu silmukka: kiinteä määrä pyyntöjä matkalla
+    LOAD_OPEN,    // Avoin silmukka: pyyntöjä tavoitetahdilla
+};
+
+// Kuormituksen asetukset
+struct load_options {
+    enum load_mode mode;            // Kuormitustapa
+    struct sockaddr_in server;      // Palvelimen osoite
+    double rate;                    // Pyyntöjä sekunnissa kaikkiaan (avoin silmukka)
+    unsigned inflight;              // Matkalla olevat pyynnöt säiettä kohden (avoimessa silmukassa yläraja)
+    double duration;                // Mittauksen kesto sekunteina
+    unsigned threads;               // Säikeiden määrä
+    unsigned timeout_ms;            // Vastauksen odotusaika millisekunteina
+    unsigned rows;                  // Rivejä pyyntöä kohden
+    unsigned pool;                  // Numerot väliltä 1..pool
+    unsigned pick;                  // Numeroita rivillä
+    bool tcp;                       // TCP-yhteys UDP:n sijaan
+    const char *shm_path;           // Palvelimen jaetun muistin socket UDP:n sijaan (NULL = ei käytössä)
+    unsigned idle;                  // Mittauksen ajan auki pidettävät joutilaat TCP-yhteydet
+};
+
+// Ajaa kuormituksen ja tulostaa tulokset. Palauttaa 0 tai -1 virheen sattuessa.
+int load_run(const struct load_options *options);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * log.c
+ *
+ * Palvelusäikeiden viestiloki (ks. log.h).
+ */
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_IDLE_NS 10000000  // Lokisäikeen odotus, kun renkaat ovat tyhjiä (10 ms)
+#define LOG_DROPPED_NS 1000000000ULL  // Pois jätetyt viestit ilmoitetaan enintään kerran sekunnissa
+
+static pthread_t log_thread;                 // Lokisäie
+static struct log_ring *const *log_rings;    // Tulostettavat renkaat
+static int log_nrings;                       // Renkaiden määrä
+static log_printer log_print;                // Viestin tulostusfunktio
+static atomic_bool log_stopping;             // Pyydetäänkö lokisäiettä lopettamaan
+static bool log_running;                     // Onko lokisäie käynnissä
+
+void log_ring_init(struct log_ring *r, double rate) {
+    memset(r, 0, sizeof(*r));
+    r->rate = rate;
+    r->tokens = rate;
+}
+
+void log_push(struct log_ring *r, unsigned kind, const char *msg, size_t len) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    struct log_entry *e;
+
+    // Täydennä kiintiötä kuluneen ajan mukaan (enintään sekunnin verran viestejä kerralla)
+    if (r->rate > 0) {
+        struct timespec ts;
+        uint64_t now;
+
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        r->tokens += (now - r->refilled) * r->rate / 1e9;
+        r->refilled = now;
+        if (r->tokens > r->rate) {
+            r->tokens = r->rate;
+        }
+        if (r->tokens < 1) {
+            atomic_store_explicit(&r->dropped, atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+                                  memory_order_relaxed);
+            return;
+        }
+    }
+
+    // Rengas täynnä: lukija ei ehdi tulostaa
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == LOG_RING_SIZE) {
+        atomic_store_explicit(&r->dropped, atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+    r->tokens -= 1;
+
+    e = &r->entries[head & (LOG_RING_SIZE - 1)];
+    e->kind = kind;
+    e->full_len = len;
+    e->len = len < LOG_DATA_SIZE ? len : LOG_DATA_SIZE;
+    memcpy(e->data, msg, e->len);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);  // Julkaise viesti lukijalle
+}
+
+// Tulostaa renkaissa olevat viestit. Pois jätettyjen viestien määrä tulostetaan, jos edellisestä
+// ilmoituksesta on kulunut tarpeeksi aikaa tai report_dropped on tosi. Palauttaa tulostettujen
+// viestien määrän.
+static unsigned log_drain(bool report_dropped) {
+    static uint64_t reported_at;  // Edellisen ilmoituksen aika
+    unsigned printed = 0;
+    struct timespec ts;
+    uint64_t now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (now - reported_at >= LOG_DROPPED_NS) {
+        report_dropped = true;
+        reported_at = now;
+    }
+
+    for (int i = 0; i < log_nrings; i++) {
+        struct log_ring *r = log_rings[i];
+        unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+        unsigned long dropped;
+
+        for (; tail != head; tail++) {
+            log_print(&r->entries[tail & (LOG_RING_SIZE - 1)]);
+            printed++;
+        }
+        atomic_store_explicit(&r->tail, tail, memory_order_release);  // Vapauta paikat kirjoittajalle
+        if (!report_dropped) {
+            continue;
+        }
+
+        dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        if (dropped != r->reported) {
+            printf("(säie %d: %lu viestiä jätettiin tulostamatta)\n", i, dropped - r->reported);
+            r->reported = dropped;
+            printed++;
+        }
+    }
+    if (printed > 0) {
+        fflush(stdout);
+    }
+    return printed;
+}
+
+// Lokisäikeen pääfunktio
+static void *log_main(void *arg) {
+    struct timespec idle = {0, LOG_IDLE_NS};
+
+    (void)arg;
+    while (!atomic_load(&log_stopping)) {
+        if (log_drain(false) == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    log_drain(true);
+    return NULL;
+}
+
+int log_start(struct log_ring *const *rings, int n, log_printer print) {
+    log_rings = rings;
+    log_nrings = n;
+    log_print = print;
+    if (pthread_create(&log_thread, NULL, log_main, NULL) != 0) {
+        fprintf(stderr, "Lokisäikeen luonti epäonnistui\n");
+        return -1;
+    }
+    log_running = true;
+    return 0;
+}
+
+void log_stop(void) {
+    if (log_running) {
+        atomic_store(&log_stopping, true);
+        pthread_join(log_thread, NULL);
+        log_running = false;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * log.h
+ *
+ * Palvelusäikeiden viestiloki. Palvelusäie ei tulosta itse, vaan kopioi viestin omaan
+ * rengaspuskuriinsa (yksi kirjoittaja ja yksi lukija, ei lukkoja), ja erillinen lokisäie muotoilee
+ * ja tulostaa viestit. Näin tulostus ei hidasta pyyntöjen käsittelyä eikä hidas pääte pysäytä
+ * palvelusäiettä.
+ *
+ * Kirjaus on rajoitettu: säie kirjaa enintään rate viestiä sekunnissa (token bucket), ja jos rengas
+ * on täynnä, viesti jätetään pois. Pois jätettyjen viestien määrä tulostetaan lokiin.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_RING_SIZE 1024  // Renkaan paikkojen määrä (kahden potenssi)
+#define LOG_DATA_SIZE 124   // Viestistä tallennettava alku (binääriviestistä riittää otsake)
+
+// Lokiin kirjattu viesti
+struct log_entry {
+    uint8_t kind;               // Viestin laji (tulostusfunktion tulkitsema)
+    uint8_t len;                // Tallennetun viestin pituus
+    uint16_t full_len;          // Alkuperäisen viestin pituus
+    char data[LOG_DATA_SIZE];   // Viestin alku
+};
+
+// Säikeen lokirengas. Kirjoittajan ja lukijan kentät ovat eri välimuistiriveillä.
+struct log_ring {
+    atomic_uint head __attribute__((aligned(64)));  // Seuraava kirjoitettava paikka (kirjoittaja)
+    double tokens;                                  // Kirjattavissa olevat viestit (kirjoittaja)
+    uint64_t refilled;                              // Edellisen täydennyksen aika nanosekunteina
+    double rate;                                    // Viestejä sekunnissa enintään (0 = ei rajaa)
+    atomic_ulong dropped;                           // Pois jätetyt viestit
+    atomic_uint tail __attribute__((aligned(64)));  // Seuraava luettava paikka (lukija)
+    unsigned long reported;                         // Lukijan jo ilmoittama dropped-arvo
+    struct log_entry entries[LOG_RING_SIZE];
+};
+
+// Tulostaa yhden viestin (kutsutaan lokisäikeessä)
+typedef void (*log_printer)(const struct log_entry *entry);
+
+// Alustaa renkaan; rate on viestejä sekunnissa enintään (0 = ei rajaa)
+void log_ring_init(struct log_ring *r, double rate);
+
+// Kirjaa viestin renkaaseen. Vain renkaan oma säie saa kutsua.
+void log_push(struct log_ring *r, unsigned kind, const char *msg, size_t len);
+
+// Käynnistää lokisäikeen, joka tulostaa n renkaan viestit. Palauttaa 0 tai -1.
+int log_start(struct log_ring *const *rings, int n, log_printer print);
+
+// Tulostaa renkaissa vielä olevat viestit ja pysäyttää lokisäikeen
+void log_stop(void);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * lotto.c
+ *
+ * Lottonumeroiden arvonta ja muotoilu (ks. lotto.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "lotto.h"
+
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+// Kaksinumeroiset luvut 00-99 merkkipareina, jotta luku muotoillaan ilman jakolaskuja ja sprintf-kutsua
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// splitmix64: laajentaa siemenen generaattorin tilaksi (xoshiron tekijöiden suositus)
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void lotto_rng_seed(struct lotto_rng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&seed);
+    }
+    for (int i = 0; i < LOTTO_MAX_POOL; i++) {
+        rng->deck[i] = i;
+    }
+}
+
+void lotto_rng_seed_random(struct lotto_rng *rng, uint64_t salt) {
+    uint64_t seed;
+
+    if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        seed = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    lotto_rng_seed(rng, seed ^ (salt * 0x9e3779b97f4a7c15ULL));
+}
+
+size_t lotto_format(const uint8_t *numbers, unsigned count, char *out) {
+    char *p = out;
+
+    for (unsigned i = 0; i < count; i++) {
+        unsigned n = numbers[i];
+
+        if (i > 0) {
+            *p++ = ',';
+            *p++ = ' ';
+        }
+        if (n >= 100) {
+            *p++ = '0' + n / 100;
+            n %= 100;
+            memcpy(p, &digit_pairs[n * 2], 2);
+            p += 2;
+        } else if (n >= 10) {
+            memcpy(p, &digit_pairs[n * 2], 2);
+            p += 2;
+        } else {
+            *p++ = '0' + n;
+        }
+    }
+    return p - out;
+}
@@ -0,0 +1,97 @@
+/*
+ * lotto.h
+ *
+ * Lottonumeroiden arvonta ja muotoilu. Jokaisella säikeellä on oma xoshiro256**-generaattorinsa,
+ * joten arvonta ei tarvitse lukkoja eikä jaa tilaa säikeiden kesken (toisin kuin rand()).
+ *
+ * Rivi arvotaan osittaisella Fisher-Yates-sekoituksella, joten toistoja ei tarvitse etsiä. Sekoituksen
+ * paikat (välit pool, pool-1, ...) arvotaan Lemiren kertolaskumenetelmällä 16 bitin paloista, joita
+ * yhdestä 64-bittisestä satunnaisluvusta saadaan neljä: pala kerrotaan välin pituudella ja tulon yläosa
+ * on arvottu paikka. Jos tulon alaosa osuu vinoumaa aiheuttavaan jäännösalueeseen, pala hylätään
+ * (7/40-rivillä todennäköisyys on alle 0,1 % palaa kohden), joten tulos on tarkasti tasajakautunut ilman
+ * modulo-vinoumaa ja jakolasku tehdään vain harvoin.
+ */
+
+#ifndef LOTTO_H
+#define LOTTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOTTO_MAX_POOL 255  // Suurin numeroiden joukko (numerot mahtuvat tavuun)
+
+// Säiekohtainen satunnaislukugeneraattori (xoshiro256**) ja arvonnan sekoitustaulukko
+struct lotto_rng {
+    uint64_t s[4];                 // Generaattorin tila
+    uint8_t deck[LOTTO_MAX_POOL];  // Numerot 0..LOTTO_MAX_POOL-1 (palautetaan järjestykseen jokaisen arvonnan jälkeen)
+};
+
+// Alustaa generaattorin 64-bittisestä siemenestä (splitmix64 laajentaa siemenen koko tilaan)
+void lotto_rng_seed(struct lotto_rng *rng, uint64_t seed);
+
+// Alustaa generaattorin käyttöjärjestelmän satunnaisluvuilla (getrandom), tai kellosta ja annetusta
+// lisäarvosta, jos niitä ei saada
+void lotto_rng_seed_random(struct lotto_rng *rng, uint64_t salt);
+
+static inline uint64_t lotto_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// Palauttaa seuraavan 64-bittisen satunnaisluvun
+static inline uint64_t lotto_rng_next(struct lotto_rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = lotto_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = lotto_rotl(s[3], 45);
+    return result;
+}
+
+// Arpoo pick eri numeroa väliltä 1..pool arvontajärjestyksessä (pick <= pool <= LOTTO_MAX_POOL).
+// Funktio on otsakkeessa, jotta vakioilla pool- ja pick-arvoilla kääntäjä voi purkaa silmukat.
+static inline void lotto_draw(struct lotto_rng *rng, unsigned pool, unsigned pick, uint8_t *numbers) {
+    uint8_t *deck = rng->deck;
+    uint8_t swap[LOTTO_MAX_POOL];  // Sekoituksen vaihtopaikat: paikka i vaihdetaan paikan swap[i] >= i kanssa
+    uint64_t r = 0;                // Käyttämättömät satunnaisbitit
+    unsigned left = 0;             // Käyttämättömien 16 bitin palojen määrä
+
+    // Arvo ensin kaikki vaihtopaikat, jotta generaattorin tila ja taulukko eivät vuorottele muistissa
+    for (unsigned i = 0; i < pick; i++) {
+        unsigned range = pool - i;
+        uint32_t m;
+
+        // Lemiren menetelmä 16 bitin paloilla: hylkää, jos alaosa osuu jäännösalueeseen 2^16 mod range
+        do {
+            if (left == 0) {
+                r = lotto_rng_next(rng);
+                left = 4;
+            }
+            m = (uint32_t)(r & 0xffff) * range;
+            r >>= 16;
+            left--;
+        } while ((m & 0xffff) < range && (m & 0xffff) < 65536 % range);
+        swap[i] = i + (m >> 16);
+    }
+
+    // Osittainen Fisher-Yates-sekoitus. Paikkaa i ei enää lueta, joten siihen ei tarvitse kirjoittaa.
+    for (unsigned i = 0; i < pick; i++) {
+        numbers[i] = deck[swap[i]] + 1;
+        deck[swap[i]] = deck[i];
+    }
+
+    // Vain vaihtopaikkoihin on kirjoitettu, joten taulukko palautuu järjestykseen ilman lukuja
+    for (unsigned i = 0; i < pick; i++) {
+        deck[swap[i]] = swap[i];
+    }
+}
+
+// Kirjoittaa numerot muodossa "13, 32, 21" puskuriin (ilman nollamerkkiä) ja palauttaa pituuden.
+// Puskurissa on oltava tilaa vähintään 5 * count tavua.
+size_t lotto_format(const uint8_t *numbers, unsigned count, char *out);
+
+#endif
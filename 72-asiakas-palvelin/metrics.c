@@ -0,0 +1,245 @@
+/*
+ * metrics.c
+ *
+ * Palvelusäikeiden mittarit ja tilastopalvelin (ks. metrics.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define REQUEST_WAIT_MS 100  // Kauanko tilastopyyntöä odotetaan ennen vastaamista
+#define COUNTERS 11          // Laskureiden määrä struct metrics -rakenteessa
+
+uint64_t metrics_tick_ns = 1ULL << 32;  // clock_gettime: yksi jakso on yksi nanosekunti
+int metrics_use_tsc = 0;
+
+// Tilastopalvelimen tiedot
+struct metrics_server {
+    int sock;                  // Kuunteleva Unix-socket
+    struct metrics *const *m;  // Säikeiden mittarit
+    int n;                     // Säikeiden määrä
+};
+
+// Säikeiden yhteenlasketut mittarit
+struct metrics_total {
+    unsigned long counters[COUNTERS];  // Laskurit samassa järjestyksessä kuin struct metrics -rakenteessa
+    unsigned long buckets[METRICS_STAGES][METRICS_BUCKETS];
+    unsigned long sum[METRICS_STAGES];
+};
+
+// Laskureiden nimet, tyypit ja kuvaukset Prometheukselle (järjestys kuin struct metrics -rakenteessa)
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} counter_info[COUNTERS] = {
+    {"lotto_requests_total", "counter", "Requests handled"},
+    {"lotto_tcp_requests_total", "counter", "Requests received over TCP"},
+    {"lotto_received_bytes_total", "counter", "Bytes received"},
+    {"lotto_sent_bytes_total", "counter", "Bytes sent"},
+    {"lotto_errors_total", "counter", "Invalid requests and receive or send errors"},
+    {"lotto_syscalls_total", "counter", "System calls made by the worker threads"},
+    {"lotto_messages_sent_total", "counter", "Messages sent (a GSO message carries several responses)"},
+    {"lotto_tcp_connections", "gauge", "Open TCP connections"},
+    {"lotto_shm_requests_total", "counter", "Requests received over shared memory rings"},
+    {"lotto_shm_clients", "gauge", "Attached shared memory clients"},
+    {"lotto_pregen_stalls_total", "counter", "Responses drawn inline because the pre-generated ring was empty"},
+};
+
+static const char *stage_names[METRICS_STAGES] = {"draw", "format", "send"};
+
+void metrics_init_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    struct timespec t0, t1, pause = {0, 20000000};
+    uint64_t c0, c1;
+
+    // Aikaleimalaskuri kelpaa vain, jos sen tahti ei riipu kellotaajuudesta eikä virransäästötilasta
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+        return;
+    }
+
+    // Kalibroi laskurin tahti vertaamalla sitä monotoniseen kelloon
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = __rdtsc();
+    nanosleep(&pause, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    c1 = __rdtsc();
+    if (c1 <= c0) {
+        return;
+    }
+    metrics_tick_ns = (((t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec) << 32) / (c1 - c0);
+    metrics_use_tsc = 1;
+#endif
+}
+
+const char *metrics_clock_name(void) {
+    return metrics_use_tsc ? "rdtsc" : "clock_gettime";
+}
+
+// Laskee säikeiden mittarit yhteen. Säikeet jatkavat kirjoittamista samaan aikaan, joten summa on
+// hetkellinen otos: jokainen luettu arvo on kokonainen, mutta arvot voivat olla eri hetkiltä.
+static void metrics_sum(struct metrics *const *m, int n, struct metrics_total *t) {
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i < n; i++) {
+        const atomic_ulong *counters[COUNTERS] = {&m[i]->requests, &m[i]->tcp_requests, &m[i]->bytes_in,
+                                                  &m[i]->bytes_out, &m[i]->errors, &m[i]->syscalls,
+                                                  &m[i]->messages, &m[i]->connections, &m[i]->shm_requests,
+                                                  &m[i]->shm_clients, &m[i]->pregen_stalls};
+
+        for (int c = 0; c < COUNTERS; c++) {
+            t->counters[c] += atomic_load_explicit(counters[c], memory_order_relaxed);
+        }
+        for (int s = 0; s < METRICS_STAGES; s++) {
+            for (int k = 0; k < METRICS_BUCKETS; k++) {
+                t->buckets[s][k] += atomic_load_explicit(&m[i]->stages[s].buckets[k], memory_order_relaxed);
+            }
+            t->sum[s] += atomic_load_explicit(&m[i]->stages[s].sum, memory_order_relaxed);
+        }
+    }
+}
+
+// Kirjoittaa mittarit Prometheuksen tekstimuodossa
+static void metrics_write(FILE *out, const struct metrics_total *t, int n) {
+    fprintf(out, "# HELP lotto_workers Worker threads\n# TYPE lotto_workers gauge\nlotto_workers %d\n", n);
+    for (int c = 0; c < COUNTERS; c++) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %lu\n", counter_info[c].name, counter_info[c].help,
+                counter_info[c].name, counter_info[c].type, counter_info[c].name, t->counters[c]);
+    }
+
+    // Histogrammin lokerot ovat kumulatiivisia: le on lokeron yläraja sekunteina
+    fprintf(out, "# HELP lotto_stage_duration_seconds Time spent drawing, formatting and sending a response\n"
+                 "# TYPE lotto_stage_duration_seconds histogram\n");
+    for (int s = 0; s < METRICS_STAGES; s++) {
+        unsigned long count = 0;
+
+        for (int k = 0; k < METRICS_BUCKETS; k++) {
+            count += t->buckets[s][k];
+            if (k < METRICS_BUCKETS - 1) {
+                fprintf(out, "lotto_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %lu\n", stage_names[s],
+                        (double)(1ULL << (k + 1)) / 1e9, count);
+            }
+        }
+        fprintf(out, "lotto_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n", stage_names[s], count);
+        fprintf(out, "lotto_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[s], t->sum[s] / 1e9);
+        fprintf(out, "lotto_stage_duration_seconds_count{stage=\"%s\"} %lu\n", stage_names[s], count);
+    }
+    fprintf(out, "# HELP lotto_clock_rdtsc Stage durations are measured with the time stamp counter\n"
+                 "# TYPE lotto_clock_rdtsc gauge\nlotto_clock_rdtsc %d\n", metrics_use_tsc);
+}
+
+// Vastaa yhteen tilastopyyntöön. HTTP-pyyntöön (esimerkiksi Prometheus tai curl --unix-socket)
+// vastataan HTTP-otsakkeiden kanssa, muuten (esimerkiksi socat) pelkillä mittareilla.
+static void metrics_reply(struct metrics_server *s, int fd) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    struct metrics_total *t = malloc(sizeof(*t));
+    char request[512] = "", *body = NULL, header[128];
+    size_t body_len = 0;
+    ssize_t n = 0;
+    FILE *out;
+
+    if (t == NULL) {
+        return;
+    }
+    if (poll(&pfd, 1, REQUEST_WAIT_MS) > 0) {
+        n = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT);
+    }
+
+    out = open_memstream(&body, &body_len);
+    if (out == NULL) {
+        free(t);
+        return;
+    }
+    metrics_sum(s->m, s->n, t);
+    metrics_write(out, t, s->n);
+    fclose(out);
+
+    if (n > 4 && strncmp(request, "GET ", 4) == 0) {
+        int len = snprintf(header, sizeof(header),
+                           "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                           body_len);
+        send(fd, header, len, MSG_NOSIGNAL);
+    }
+    for (size_t off = 0; off < body_len;) {
+        ssize_t r = send(fd, body + off, body_len - off, MSG_NOSIGNAL);
+        if (r < 0) {
+            break;
+        }
+        off += r;
+    }
+    free(body);
+    free(t);
+}
+
+// Tilastopalvelimen säie: vastaa yhteyksiin yksi kerrallaan
+static void *metrics_thread(void *arg) {
+    struct metrics_server *s = arg;
+
+    while (1) {
+        int fd = accept4(s->sock, NULL, NULL, SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("Failed to accept stats connection");
+            }
+            continue;
+        }
+        metrics_reply(s, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_serve(const char *path, struct metrics *const *m, int n) {
+    struct metrics_server *s = malloc(sizeof(*s));
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    pthread_t thread;
+
+    if (s == NULL) {
+        perror("Failed to allocate stats server");
+        return -1;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Tilastosocketin polku on liian pitkä: %s\n", path);
+        free(s);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    s->m = m;
+    s->n = n;
+
+    if ((s->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        perror("Stats socket creation failed");
+        free(s);
+        return -1;
+    }
+    unlink(path);  // Edellisen ajon jättämä socket
+    if (bind(s->sock, (const struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s->sock, 16) < 0) {
+        perror("Binding stats socket failed");
+        close(s->sock);
+        free(s);
+        return -1;
+    }
+    if (pthread_create(&thread, NULL, metrics_thread, s) != 0) {
+        fprintf(stderr, "Tilastosäikeen luonti epäonnistui\n");
+        close(s->sock);
+        free(s);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * metrics.h
+ *
+ * Palvelusäikeiden mittarit. Jokaisella säikeellä on oma välimuistirivin rajalle kohdistettu
+ * mittarirakenteensa, jonka histogrammit ovat omilla riveillään, joten säikeet eivät kirjoita samoille
+ * riveille. Vain oma säie kirjoittaa mittareihinsa, joten päivitys on tavallinen luku ja kirjoitus
+ * (atominen, mutta ilman lukittua käskyä), ja lukija saa aina kokonaisen arvon ilman lukkoja.
+ *
+ * Vaiheiden (arvonta, muotoilu, lähetys) kestot mitataan aikaleimalaskurilla (rdtsc), jos prosessorin
+ * laskuri on vakiotahtinen, ja muuten clock_gettime-kutsulla. Kestot kirjataan nanosekunteina
+ * kahden potenssin lokeroihin.
+ *
+ * Tilastopalvelin on oma säikeensä, joka kuuntelee Unix-socketia ja laskee jokaiselle yhteydelle
+ * säikeiden mittarit yhteen Prometheuksen tekstimuodossa.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define METRICS_BUCKETS 32  // Histogrammin lokerot: lokero k sisältää kestot 2^k..2^(k+1)-1 ns (viimeinen myös pidemmät)
+
+// Mitattava vaihe
+enum metrics_stage {
+    METRICS_DRAW,    // Numeroiden arvonta
+    METRICS_FORMAT,  // Vastauksen muotoilu
+    METRICS_SEND,    // Vastauksen lähetys (järjestelmäkutsu)
+    METRICS_STAGES,  // Vaiheiden määrä
+};
+
+// Kestojen histogrammi
+struct metrics_histogram {
+    atomic_ulong buckets[METRICS_BUCKETS];  // Kestojen määrät lokeroittain
+    atomic_ulong sum;                       // Kestojen summa nanosekunteina
+} __attribute__((aligned(64)));
+
+// Säikeen mittarit
+struct metrics {
+    atomic_ulong requests;      // Käsitellyt pyynnöt
+    atomic_ulong tcp_requests;  // TCP-yhteyksien pyynnöt (sisältyy requests-laskuriin)
+    atomic_ulong bytes_in;      // Vastaanotetut tavut
+    atomic_ulong bytes_out;     // Lähetetyt tavut
+    atomic_ulong errors;        // Virheet (virheelliset pyynnöt sekä vastaanotto- ja lähetysvirheet)
+    atomic_ulong syscalls;      // Järjestelmäkutsut (vastaanotto, lähetys ja tapahtumasilmukka)
+    atomic_ulong messages;      // Lähetetyt viestit (GSO-viesti sisältää useita vastauksia)
+    atomic_ulong connections;   // Avoinna olevat TCP-yhteydet
+    atomic_ulong shm_requests;  // Jaetun muistin kanavan pyynnöt (sisältyy requests-laskuriin)
+    atomic_ulong shm_clients;   // Liittyneet jaetun muistin asiakkaat
+    atomic_ulong pregen_stalls; // Vastaukset, joille valmiiden rivien rengas oli tyhjä (esituotanto)
+    struct metrics_histogram stages[METRICS_STAGES];  // Vaiheiden kestot
+} __attribute__((aligned(64)));
+
+extern uint64_t metrics_tick_ns;  // Aikaleiman jakson pituus nanosekunteina kerrottuna 2^32:lla
+extern int metrics_use_tsc;       // Käytetäänkö aikaleimalaskuria
+
+// Kasvattaa laskuria. Vain mittarin oma säie saa kutsua.
+static inline void metrics_add(atomic_ulong *counter, unsigned long n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// Pienentää laskuria. Vain mittarin oma säie saa kutsua.
+static inline void metrics_sub(atomic_ulong *counter, unsigned long n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) - n, memory_order_relaxed);
+}
+
+// Palauttaa aikaleiman (yksikkö metrics_tick_ns)
+static inline uint64_t metrics_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (metrics_use_tsc) {
+        return __rdtsc();
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Kirjaa vaiheen keston, joka alkoi aikaleimalla start ja päättyi aikaleimalla end
+static inline void metrics_record(struct metrics *m, enum metrics_stage stage, uint64_t start, uint64_t end) {
+    struct metrics_histogram *h = &m->stages[stage];
+    uint64_t ns = (uint64_t)(((unsigned __int128)(end - start) * metrics_tick_ns) >> 32);
+    unsigned k = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    if (k >= METRICS_BUCKETS) {
+        k = METRICS_BUCKETS - 1;
+    }
+    metrics_add(&h->buckets[k], 1);
+    metrics_add(&h->sum, ns);
+}
+
+// Valitsee ajanlähteen ja kalibroi aikaleimalaskurin. Kutsuttava ennen mittausten alkua.
+void metrics_init_clock(void);
+
+// Palauttaa ajanlähteen nimen
+const char *metrics_clock_name(void);
+
+// Käynnistää tilastopalvelimen Unix-socketiin path. Taulukossa m on n säikeen mittarit, ja
+// mittareiden täytyy pysyä voimassa ohjelman loppuun asti. Palauttaa 0 tai -1.
+int metrics_serve(const char *path, struct metrics *const *m, int n);
+
+#endif
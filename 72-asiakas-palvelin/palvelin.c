@@ -4,124 +4,1330 @@
  * Tämä on UDP-pohjainen asiakas-palvelin-ohjelma, jossa tässä toteutettu palvelin vastaanottaa
  * asiakkaalta paketin ja vastaa siihen satunnaisesti arvotuilla lottonumeroilla.
  * Asiakas lähettää palvelimelle viestin ja palvelin lähettää takaisin seitsemän arvottua lottonumeroa.
- * Palvelin kuuntelee saapuvia UDP-paketteja portissa 6000.
+ * Binääriprotokollalla (protocol.h) yhdellä pyynnöllä voi pyytää useita rivejä ja valita pelin.
+ * Palvelin kuuntelee saapuvia UDP-paketteja ja TCP-yhteyksiä portissa 6000. TCP-yhteydellä jokaisen
+ * viestin edellä on sen pituus kahtena tavuna (verkon tavujärjestyksessä), ja pyyntöjä voi lähettää
+ * useita vastauksia odottamatta. Jokainen palvelusäie käsittelee oman UDP-socketinsa, TCP-kuuntelijansa
+ * ja yhteytensä yhdessä tapahtumasilmukassa (event.h).
+ *
+ * Saman koneen asiakkaat voivat käyttää UDP:n sijaan jaetun muistin kanavaa (shm.h, --shm): asiakas
+ * saa Unix-socketin kautta oman muistialueensa, ja pyynnöt ja vastaukset kulkevat muistialueen
+ * renkaissa ilman järjestelmäkutsuja. Asiakkaan liittymisen hyväksyvä säie palvelee sitä samassa
+ * tapahtumasilmukassa UDP- ja TCP-asiakkaiden rinnalla. Säie kyselee asiakkaidensa renkaita hetken
+ * (SHM_SPIN_NS) viimeisen pyynnön jälkeen ja jää sitten odottamaan tapahtumia, jolloin asiakas
+ * herättää sen eventfd-kuvaajalla.
+ *
+ * Esituotannossa (pregen.h, --pregen) tuottajasäikeet arpovat oletuspelin rivit ja muotoilevat
+ * tekstivastaukset valmiiksi palvelusäikeiden renkaisiin, jolloin palvelusäie vain kopioi valmiin
+ * rivin vastaukseen.
+ *
+ * Säikeet kirjaavat pyynnöt, tavut, virheet ja vaiheiden kestot omiin mittareihinsa (metrics.h), ja
+ * viestien tulostus tapahtuu erillisessä lokisäikeessä (log.h), joten palvelusäie ei tulosta itse.
  *
  * Ohjelman kääntäminen ja ajaminen:
  *  1. make
- *  2. ./palvelin
+ *  2. ./palvelin [valinnat]
+ *       --workers N     palvele N säikeellä, joilla kullakin on oma SO_REUSEPORT-socket ja oma prosessori
+ *       --cpu-steering  ohjaa paketti BPF-ohjelmalla sille säikeelle, jonka prosessorilla paketti vastaanotettiin
+ *       --batch K       käsittele viestit erissä (recvmmsg/sendmmsg, UDP GSO), erän enimmäiskoko K
+ *       --backend B     tapahtumasilmukan taustaosa: epoll (oletus) tai io_uring
+ *       --stats PATH    tarjoa mittarit Prometheuksen tekstimuodossa Unix-socketissa PATH
+ *       --shm PATH      palvele saman koneen asiakkaita jaetun muistin renkailla, liittyminen Unix-socketissa PATH
+ *       --pregen N      arvo oletuspelin rivit valmiiksi N tuottajasäikeessä
+ *       --pregen-depth D  palvelusäikeen valmiiden rivien renkaan koko (kahden potenssi, oletus 1024)
+ *       --pregen-refill LOW:HIGH  tuottaja herätetään, kun renkaassa on LOW riviä, ja se täyttää HIGH riviin
+ *                       (oletus D/4:D-1)
+ *       --log-rate N    tulosta enintään N viestiä sekunnissa säiettä kohden (oletus 1000, 0 = ei rajaa)
+ *       --quiet         älä tulosta jokaista viestiä (suorituskykymittauksia varten)
  *  3. ./asiakas
  *  4. make clean (lopuksi käännettyjen ohjelmien poistamiseen)
  */
 
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/filter.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "event.h"
+#include "log.h"
+#include "lotto.h"
+#include "metrics.h"
+#include "pool.h"
+#include "pregen.h"
+#include "protocol.h"
+#include "shm.h"
+
 #define PORT 6000         // Portti, jota palvelin kuuntelee
 #define BUFFER_SIZE 1024  // Maksimipituus viestille
+#define MAX_WORKERS 1024  // Suurin sallittu säikeiden määrä
+#define MAX_BATCH 1024    // Suurin sallittu erän koko
+#define GSO_MAX_SEGMENTS 64     // Segmenttejä yhdessä GSO-viestissä enintään (ytimen UDP_MAX_SEGMENTS)
+#define GSO_MAX_BYTES 65000     // GSO-viestin enimmäiskoko (UDP-paketin hyötykuorma enintään 65507 tavua)
+#define CONN_BUFFER_SIZE 16384  // TCP-yhteyden luku- ja kirjoituspuskurin koko
+#define DEFAULT_LOG_RATE 1000   // Tulostettavia viestejä sekunnissa säiettä kohden oletuksena
+#define DEFAULT_PREGEN_DEPTH 1024  // Valmiiden rivien renkaan koko oletuksena
+#define MAX_PREGEN_DEPTH (1 << 20)  // Valmiiden rivien renkaan enimmäiskoko
+#define SHM_EVENTS_NS 20000     // Tapahtumat tarkistetaan renkaiden kyselyn aikana tämän välein (20 µs)
 
-// Arpoo 7 uniikkia lottonumeroa
-void draw_lottery_numbers(int *numbers) {
-    int i, num;
-    bool unique;
-
-    // Arvo 7 uniikkia lottonumeroa
-    for (i = 0; i < 7; i++) {
-        do {
-            // Arvo satunnainen numero väliltä 1-40
-            num = rand() % 40 + 1;
-
-            // Tarkista, ettei numero ole jo arvottu
-            unique = true;
-            for (int j = 0; j < i; j++) {
-                if (numbers[j] == num) {
-                    unique = false;  // Numero löytyy taulukosta, ei uniikki
-                    break;
-                }
-            }
-        } while (!unique);  // Jatketaan, kunnes saadaan uniikki numero
+// Säikeen eräkäsittelyn puskurit (--batch)
+struct batch {
+    unsigned max;                      // Erän enimmäiskoko
+    unsigned size;                     // Erän nykyinen koko (mukautuu kuormaan)
+    bool gso;                          // Tukeeko ydin UDP_SEGMENT-valintaa
+    struct mmsghdr *rx;                // Vastaanottoviestit
+    struct iovec *rx_iov;
+    struct sockaddr_in *addrs;         // Lähettäjien osoitteet
+    char (*requests)[BUFFER_SIZE];     // Vastaanotetut viestit
+    char (*responses)[PROTO_MAX_DATAGRAM];  // Vastaukset (binäärivastaus mahtuu yhteen kehykseen)
+    size_t *lengths;                   // Vastausten pituudet
+    int *order;                        // Vastaukset vastaanottajan ja pituuden mukaan järjestettynä
+    struct mmsghdr *tx;                // Lähetysviestit (GSO-viesti voi sisältää useita vastauksia)
+    struct iovec *tx_iov;
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];  // UDP_SEGMENT-ohjausviesti
+        struct cmsghdr align;
+    } *cmsgs;
+};
+
+// Palvelusäikeen tila. Jokaisella säikeellä on oma socket, satunnaislukugeneraattori, puskurit ja
+// mittarit, joten säikeet eivät jaa mitään vastaanoton ja lähetyksen välillä. Mittarit on kohdistettu
+// välimuistirivin rajalle, jotta eri säikeiden laskurit eivät ole samalla rivillä.
+struct worker {
+    int id;                       // Säikeen numero (sama kuin socketin paikka SO_REUSEPORT-ryhmässä)
+    int cpu;                      // Prosessori, jolle säie on sidottu (-1 = ei sidottu)
+    int udp_socket;               // Säikeen oma socket
+    int tcp_listener;             // Säikeen oma TCP-kuuntelija
+    struct lotto_rng rng;         // Säikeen oma satunnaislukugeneraattori
+    struct metrics metrics;       // Säikeen mittarit (luetaan tilastosäikeessä ja pääsäikeessä lopuksi)
+    struct log_ring *log;         // Säikeen lokirengas (NULL, jos viestejä ei tulosteta)
+    struct pregen_ring *pregen;   // Säikeen valmiiden rivien rengas (NULL, jos esituotanto ei ole käytössä)
+    struct event_loop *loop;      // Säikeen tapahtumasilmukka
+    struct pool conn_pool;        // TCP-yhteyksien rakenteet
+    struct pool buffer_pool;      // TCP-yhteyksien puskurit (vain yhteyksillä, joilla on kesken olevaa dataa)
+    struct batch batch;           // Eräkäsittelyn puskurit (max = 0, jos ei käytössä)
+    int shm_listener;             // Jaetun muistin asiakkaiden Unix-socket (kaikille säikeille yhteinen, -1 = ei käytössä)
+    struct shm_client *shm_clients;  // Säikeen palvelemat jaetun muistin asiakkaat
+    uint64_t shm_active;          // Milloin asiakkaiden renkaissa oli viimeksi pyyntöjä (ns)
+    char buffer[BUFFER_SIZE];     // Puskuri palvelimelle tuleville viesteille
+    char response[PROTO_MAX_DATAGRAM];  // Puskuri vastaukselle
+    pthread_t thread;             // Säikeen tunniste
+} __attribute__((aligned(64)));
+
+// TCP-yhteys. Puskurit otetaan säikeen varastosta vasta, kun niitä tarvitaan, ja palautetaan heti
+// tyhjennyttyään, joten joutilas yhteys vie muistia vain tämän rakenteen verran.
+struct conn {
+    int fd;                   // Yhteyden socket
+    struct worker *w;         // Yhteyttä palveleva säie
+    char *in;                 // Lukupuskuri (NULL, jos tyhjä)
+    size_t in_len;            // Lukupuskurissa olevan datan määrä
+    char *out;                // Kirjoituspuskuri (NULL, jos tyhjä)
+    size_t out_off;           // Jo lähetetyn datan määrä
+    size_t out_len;           // Kirjoituspuskurissa olevan datan määrä
+    bool blocked;             // Lukeminen keskeytetty, kunnes kirjoituspuskuri tyhjenee
+};
+
+// Jaetun muistin asiakas
+struct shm_client {
+    struct shm_channel channel;  // Asiakkaan kanava
+    struct worker *w;            // Asiakasta palveleva säie
+    struct shm_client *prev;     // Säikeen asiakaslistan edellinen
+    struct shm_client *next;     // Säikeen asiakaslistan seuraava
+};
 
-        // Lisää uniikki numero taulukkoon
-        numbers[i] = num;
+// Lokiin kirjattavan viestin laji
+enum message_kind {
+    MSG_RECEIVED,      // Vastaanotettu UDP-viesti
+    MSG_SENT,          // Lähetetty UDP-vastaus
+    MSG_RECEIVED_TCP,  // Vastaanotettu TCP-viesti
+    MSG_SENT_TCP,      // Lähetetty TCP-vastaus
+    MSG_RECEIVED_SHM,  // Vastaanotettu viesti jaetun muistin kanavasta
+    MSG_SENT_SHM,      // Jaetun muistin kanavaan kirjoitettu vastaus
+};
+
+static enum event_backend backend = EVENT_EPOLL;  // Tapahtumasilmukan taustaosa
+
+// Luo UDP-socketin (type = SOCK_DGRAM) tai TCP-kuuntelijan (SOCK_STREAM) ja liittää sen palvelimen
+// porttiin. Jos reuseport on tosi, samaan porttiin voi liittää useita socketteja (SO_REUSEPORT), ja
+// ydin jakaa saapuvat paketit ja yhteydet niiden kesken. Palauttaa socketin tai -1 virheen sattuessa.
+static int create_socket(int type, bool reuseport) {
+    struct sockaddr_in server_addr;  // Palvelimen osoiterakenne
+    int sock;
+    int one = 1;
+
+    // Luo socket: AF_INET (IPv4), SOCK_DGRAM (UDP) tai SOCK_STREAM (TCP), tapahtumasilmukkaa varten estämätön
+    if ((sock = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {  // Palauttaa -1, jos virhe
+        perror("Socket creation failed");
+        return -1;
     }
-}
 
-// Muuttaa lottonumerot merkkijonoksi ja lisää ne annettuun merkkijonoon
-void lottery_numbers_to_string(int *numbers, char *buffer) {
-    for (int i = 0; i < 7; i++) {
-        char num[5];
-        // Lisää pilkku numeron perään, paitsi viimeiseen numeroon
-        if (i == 6) {
-            sprintf(num, "%d", numbers[i]);
-        } else {
-            sprintf(num, "%d, ", numbers[i]);
-        }
-        strcat(buffer, num);  // Lisää numerot annettuun merkkijonoon
+    // TCP-kuuntelija: salli portin uudelleenkäyttö heti palvelimen uudelleenkäynnistyksen jälkeen
+    if (type == SOCK_STREAM && setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) {
+        perror("Setting SO_REUSEADDR failed");
+        close(sock);
+        return -1;
     }
-}
 
-int main() {
-    int udp_socket;                               // Socketin tiedot
-    struct sockaddr_in server_addr, client_addr;  // Palvelimen ja asiakkaan osoiterakenteet
-    socklen_t client_len = sizeof(client_addr);   // Asiakkaan osoiterakenteen koko
-    char buffer[BUFFER_SIZE];                     // Puskuri palvelimelle tuleville viesteille
-    int numbers[7];                               // Lottonumerotaulukko
+    // Salli useampi socket samassa portissa
+    if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("Setting SO_REUSEPORT failed");
+        close(sock);
+        return -1;
+    }
 
     // Nollaa palvelimen osoiterakenne bzero-funktiolla muistista
     bzero(&server_addr, sizeof(server_addr));
 
-    // Luo UDP-socket: AF_INET (IPv4), SOCK_DGRAM tyyppi (tuki datagram paketeille), IPPROTO_UDP = UDP protokolla
-    if ((udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {  // Palauttaa -1, jos virhe
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
-    }
-
     // Määritä palvelimen osoiterakenne
     server_addr.sin_family = AF_INET;                 // IPv4
     server_addr.sin_port = htons(PORT);               // Portti (muutetaan lyhyt integer verkon tavujärjestykseen (16bit) htons-funktiolla)
     server_addr.sin_addr.s_addr = htonl(INADDR_ANY);  // Hyväksy yhteydet kaikista osoitteista (INADDR_ANY) muutetaan integerit verkon tavujärjestykseen (32bit) htonl-funktiolla
 
     // Liitä palvelimen osoiterakenne sockettiin, parametreina socket, osoiterakenne ja osoiterakenteen koko
-    if (bind(udp_socket, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    if (bind(sock, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         perror("Binding failed");
-        close(udp_socket);  // Sulje socket
-        exit(EXIT_FAILURE);
+        close(sock);  // Sulje socket
+        return -1;
+    }
+    if (type == SOCK_STREAM && listen(sock, SOMAXCONN) < 0) {
+        perror("Listening failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Liittää SO_REUSEPORT-ryhmään BPF-ohjelman, joka valitsee paketille socketin sen prosessorin
+// mukaan, jolla paketti vastaanotettiin: socket = prosessori % säikeiden määrä. Säie i on sidottu
+// prosessorille i, joten paketti käsitellään samalla prosessorilla ilman siirtoa toiselle.
+static int attach_cpu_steering(int udp_socket, int nworkers) {
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU},  // A = nykyinen prosessori
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, nworkers},              // A = A % säikeiden määrä
+        {BPF_RET | BPF_A, 0, 0, 0},                               // Palauta socketin indeksi ryhmässä
+    };
+    struct sock_fprog prog = {sizeof(code) / sizeof(code[0]), code};
+
+    if (setsockopt(udp_socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("Attaching SO_REUSEPORT BPF program failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Arpoo lottonumerot ja kirjoittaa tekstivastauksen suoraan lähetyspuskuriin. Palauttaa vastauksen
+// pituuden (vastauksen perään kirjoitetaan nollamerkki tulostusta varten).
+static size_t build_text_response(struct worker *w, char *response) {
+    static const char prefix[] = "Lottonumeronne ovat ";
+    uint8_t numbers[PROTO_DEFAULT_PICK];  // Lottonumerotaulukko
+    uint64_t start, drawn, formatted;
+    size_t len;
+
+    // Esituotanto: kopioi valmis vastaus, tai arvo itse, jos tuottaja ei ole ehtinyt täyttää rengasta
+    if (w->pregen != NULL) {
+        const struct pregen_entry *e = pregen_take(w->pregen);
+
+        if (e != NULL) {
+            memcpy(response, e->text, e->text_len + 1);
+            return e->text_len;
+        }
+        metrics_add(&w->metrics.pregen_stalls, 1);
+    }
+
+    // Arvo 7 eri numeroa väliltä 1-40
+    start = metrics_now();
+    lotto_draw(&w->rng, PROTO_DEFAULT_POOL, PROTO_DEFAULT_PICK, numbers);
+    drawn = metrics_now();
+
+    // Muodosta vastaus lottonumeroista asiakkaalle
+    memcpy(response, prefix, sizeof(prefix) - 1);
+    len = sizeof(prefix) - 1 + lotto_format(numbers, PROTO_DEFAULT_PICK, response + sizeof(prefix) - 1);
+    response[len] = '\0';
+    formatted = metrics_now();
+    metrics_record(&w->metrics, METRICS_DRAW, start, drawn);
+    metrics_record(&w->metrics, METRICS_FORMAT, drawn, formatted);
+    return len;
+}
+
+// Arpoo binääripyynnön rivit suoraan vastauksen perään. Rivejä arvotaan enintään niin monta kuin
+// yhteen vastaukseen mahtuu. Palauttaa vastauksen pituuden.
+static size_t build_binary_response(struct worker *w, const struct proto_header *request, char *response) {
+    struct proto_header h = *request;
+    uint8_t *rows = (uint8_t *)response + PROTO_HEADER_SIZE;
+    uint64_t start, drawn;
+
+    h.type = PROTO_RESPONSE;
+    h.status = PROTO_OK;
+    h.pool = h.pool ? h.pool : PROTO_DEFAULT_POOL;
+    h.pick = h.pick ? h.pick : PROTO_DEFAULT_PICK;
+    if (h.version != PROTO_VERSION) {
+        h.version = PROTO_VERSION;
+        h.status = PROTO_BAD_VERSION;
+    } else if (request->type != PROTO_REQUEST || h.rows == 0 || h.pick > h.pool) {
+        h.status = PROTO_BAD_REQUEST;
+    }
+    if (h.status != PROTO_OK) {
+        h.rows = 0;
+        proto_write_header(response, &h);
+        metrics_add(&w->metrics.errors, 1);
+        return PROTO_HEADER_SIZE;
+    }
+
+    if (h.rows > proto_max_rows(h.pick)) {
+        h.rows = proto_max_rows(h.pick);
+    }
+    // Esituotanto: oletuspelin rivit kopioidaan renkaasta, kunnes se tyhjenee
+    unsigned taken = 0;
+    if (w->pregen != NULL && h.pool == PROTO_DEFAULT_POOL && h.pick == PROTO_DEFAULT_PICK) {
+        const struct pregen_entry *e;
+
+        while (taken < h.rows && (e = pregen_take(w->pregen)) != NULL) {
+            memcpy(rows + taken * PROTO_DEFAULT_PICK, e->numbers, PROTO_DEFAULT_PICK);
+            taken++;
+        }
+        if (taken < h.rows) {
+            metrics_add(&w->metrics.pregen_stalls, 1);
+        }
     }
+    start = metrics_now();
+    for (unsigned i = taken; i < h.rows; i++) {
+        lotto_draw(&w->rng, h.pool, h.pick, rows + i * h.pick);
+    }
+    drawn = metrics_now();
+    proto_write_header(response, &h);
+    metrics_record(&w->metrics, METRICS_DRAW, start, drawn);
+    metrics_record(&w->metrics, METRICS_FORMAT, drawn, metrics_now());
+    return PROTO_HEADER_SIZE + (size_t)h.rows * h.pick;
+}
 
-    printf("Palvelin on käynnissä ja kuuntelee portissa %d...\n", PORT);
+// Muodostaa vastauksen pyyntöön: binääripyyntöön binäärivastaus, muuhun viestiin tekstivastaus.
+// Palauttaa vastauksen pituuden.
+static size_t build_response(struct worker *w, const char *request, size_t len, char *response) {
+    struct proto_header h;
+
+    if (proto_read_header(request, len, &h) == 0) {
+        return build_binary_response(w, &h, response);
+    }
+    return build_text_response(w, response);
+}
+
+// Tulostaa vastaanotetun tai lähetetyn viestin: tekstiviestin sellaisenaan ja binääriviestistä otsakkeen.
+// full_len on viestin alkuperäinen pituus, jos lokiin tallennettiin vain viestin alku.
+static void print_message(const char *label, const char *msg, size_t len, size_t full_len) {
+    struct proto_header h;
+
+    if (proto_read_header(msg, len, &h) < 0) {
+        printf("%s%.*s%s\n", label, (int)len, msg, len < full_len ? "..." : "");
+    } else if (h.type == PROTO_REQUEST) {
+        printf("%sbinääripyyntö %u: %u riviä, %u/%u\n", label, h.id, h.rows, h.pick, h.pool);
+    } else {
+        printf("%sbinäärivastaus %u: %u riviä, %u/%u, tila %u\n", label, h.id, h.rows, h.pick, h.pool, h.status);
+    }
+}
+
+// Tulostaa lokisäikeessä yhden säikeen kirjaaman viestin
+static void print_log_entry(const struct log_entry *e) {
+    static const char *labels[] = {
+        [MSG_RECEIVED] = "Vastaanotettiin viesti asiakkaalta: ",
+        [MSG_SENT] = "  -> Lähetettiin vastaus asiakkaalle: ",
+        [MSG_RECEIVED_TCP] = "Vastaanotettiin viesti TCP-asiakkaalta: ",
+        [MSG_SENT_TCP] = "  -> Lähetettiin vastaus TCP-asiakkaalle: ",
+        [MSG_RECEIVED_SHM] = "Vastaanotettiin viesti jaetun muistin asiakkaalta: ",
+        [MSG_SENT_SHM] = "  -> Lähetettiin vastaus jaetun muistin asiakkaalle: ",
+    };
+
+    print_message(labels[e->kind], e->data, e->len, e->full_len);
+}
+
+// Kirjaa viestin säikeen lokiin, jos viestit tulostetaan
+static inline void log_message(struct worker *w, enum message_kind kind, const char *msg, size_t len) {
+    if (w->log != NULL) {
+        log_push(w->log, kind, msg, len);
+    }
+}
+
+// Vastaa yhteen UDP-viestiin: arpoo lottonumerot, muodostaa vastauksen säikeen omaan puskuriin ja
+// lähettää sen asiakkaalle
+static void reply_datagram(struct worker *w, const char *request, size_t len, const struct sockaddr_in *client_addr,
+                           socklen_t client_len) {
+    struct metrics *m = &w->metrics;
+    uint64_t start;
+    ssize_t sent;
+
+    log_message(w, MSG_RECEIVED, request, len);
+    metrics_add(&m->bytes_in, len);
+
+    // Arvo lottonumerot ja muodosta vastaus säikeen omaan puskuriin
+    size_t response_len = build_response(w, request, len, w->response);
+
+    // Lähetä vastaus asiakkaalle sendto-funktiolla, parametreina socket, vastaus, vastauksen koko, liput 0 (ei lippuja), asiakkaan osoiterakenne ja osoiterakenteen koko
+    start = metrics_now();
+    sent = sendto(w->udp_socket, w->response, response_len, 0, (const struct sockaddr *)client_addr, client_len);
+    metrics_record(m, METRICS_SEND, start, metrics_now());
+    if (sent < 0) {
+        perror("Failed to send response");
+        metrics_add(&m->errors, 1);
+    } else {
+        log_message(w, MSG_SENT, w->response, response_len);
+        metrics_add(&m->bytes_out, sent);
+        metrics_add(&m->messages, 1);
+    }
+    metrics_add(&m->syscalls, 1);
+    metrics_add(&m->requests, 1);
+}
+
+// Lukee säikeen socketiin saapuneet viestit yksi kerrallaan, kunnes jono on tyhjä, ja vastaa niihin
+static void serve_single(struct worker *w) {
+    struct sockaddr_in client_addr;  // Asiakkaan osoiterakenne
+    socklen_t client_len;            // Asiakkaan osoiterakenteen koko
 
-    // Kuuntele silmukassa palvelimelle saapuvia viestejä ja vastaa niihin
     while (true) {
-        // Vastaanota viesti asiakkaalta recvfrom-funktiolla, parametreina socket, puskuri, puskurin koko, liput 0 (ei lippuja), asiakkaan osoiterakenne ja osoiterakenteen koko
-        int len = recvfrom(udp_socket, buffer, BUFFER_SIZE - 1, 0, (struct sockaddr *)&client_addr, &client_len);
+        // Vastaanota viesti asiakkaalta recvfrom-funktiolla, parametreina socket, puskuri, puskurin koko, liput MSG_DONTWAIT (älä jää odottamaan), asiakkaan osoiterakenne ja osoiterakenteen koko
+        client_len = sizeof(client_addr);
+        int len = recvfrom(w->udp_socket, w->buffer, BUFFER_SIZE - 1, MSG_DONTWAIT, (struct sockaddr *)&client_addr, &client_len);
+        metrics_add(&w->metrics.syscalls, 1);
         if (len < 0) {
-            perror("Failed to receive message");
-            continue;  // Siirrytään odottamaan seuraavaa viestiä
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Failed to receive message");
+                metrics_add(&w->metrics.errors, 1);
+                continue;  // Yritetään seuraavaa viestiä
+            }
+            return;  // Jono on tyhjä: palataan odottamaan tapahtumia
+        }
+        reply_datagram(w, w->buffer, len, &client_addr, client_len);
+    }
+}
+
+// Varaa säikeen eräpuskurit. Palauttaa 0 tai -1.
+static int batch_init(struct batch *b, unsigned max, int udp_socket) {
+    int probe = 0;
+
+    b->max = max;
+    b->size = 1;
+    b->rx = calloc(max, sizeof(*b->rx));
+    b->rx_iov = calloc(max, sizeof(*b->rx_iov));
+    b->addrs = calloc(max, sizeof(*b->addrs));
+    b->requests = malloc(max * sizeof(*b->requests));
+    b->responses = malloc(max * sizeof(*b->responses));
+    b->lengths = calloc(max, sizeof(*b->lengths));
+    b->order = calloc(max, sizeof(*b->order));
+    b->tx = calloc(max, sizeof(*b->tx));
+    b->tx_iov = calloc(max, sizeof(*b->tx_iov));
+    b->cmsgs = calloc(max, sizeof(*b->cmsgs));
+    if (b->rx == NULL || b->rx_iov == NULL || b->addrs == NULL || b->requests == NULL || b->responses == NULL ||
+        b->lengths == NULL || b->order == NULL || b->tx == NULL || b->tx_iov == NULL || b->cmsgs == NULL) {
+        perror("Failed to allocate batch buffers");
+        return -1;
+    }
+
+    // Vastaanottoviestit osoittavat aina samoihin puskureihin
+    for (unsigned i = 0; i < max; i++) {
+        b->rx_iov[i].iov_base = b->requests[i];
+        b->rx_iov[i].iov_len = BUFFER_SIZE - 1;
+        b->rx[i].msg_hdr.msg_iov = &b->rx_iov[i];
+        b->rx[i].msg_hdr.msg_iovlen = 1;
+        b->rx[i].msg_hdr.msg_name = &b->addrs[i];
+    }
+
+    // UDP GSO (Linux 4.18+): kokeile, tunteeko ydin UDP_SEGMENT-valinnan (0 = ei oletussegmentointia)
+    b->gso = setsockopt(udp_socket, SOL_UDP, UDP_SEGMENT, &probe, sizeof(probe)) == 0;
+    return 0;
+}
+
+// Vertaa kahta vastausta vastaanottajan ja pituuden mukaan
+static int compare_responses(const struct batch *b, int x, int y) {
+    const struct sockaddr_in *ax = &b->addrs[x], *ay = &b->addrs[y];
+
+    if (ax->sin_addr.s_addr != ay->sin_addr.s_addr) {
+        return ax->sin_addr.s_addr < ay->sin_addr.s_addr ? -1 : 1;
+    }
+    if (ax->sin_port != ay->sin_port) {
+        return ax->sin_port < ay->sin_port ? -1 : 1;
+    }
+    return b->lengths[x] < b->lengths[y] ? -1 : b->lengths[x] > b->lengths[y];
+}
+
+// Kokoaa erän vastaukset lähetysviesteiksi. Samalle vastaanottajalle menevät samanpituiset vastaukset
+// yhdistetään yhdeksi GSO-viestiksi, jonka ydin pilkkoo UDP_SEGMENT-koon mukaisiksi paketeiksi
+// (vain viimeinen segmentti saa olla lyhyempi, joten ryhmissä on vain samanpituisia vastauksia).
+// Palauttaa lähetysviestien määrän.
+static unsigned batch_build_tx(struct batch *b, unsigned n) {
+    unsigned ntx = 0;
+
+    // Järjestä vastaukset vastaanottajan ja pituuden mukaan (erät ovat pieniä, lisäyslajittelu riittää)
+    for (unsigned i = 0; i < n; i++) {
+        int x = i;
+        unsigned j = i;
+        while (j > 0 && compare_responses(b, b->order[j - 1], x) > 0) {
+            b->order[j] = b->order[j - 1];
+            j--;
+        }
+        b->order[j] = x;
+    }
+
+    for (unsigned i = 0; i < n;) {
+        int first = b->order[i];
+        struct msghdr *msg = &b->tx[ntx].msg_hdr;
+        unsigned count = 0;
+
+        // Kerää ryhmä: sama vastaanottaja ja pituus, enintään GSO_MAX_SEGMENTS segmenttiä
+        while (i < n && count < (b->gso ? GSO_MAX_SEGMENTS : 1) && compare_responses(b, first, b->order[i]) == 0 &&
+               (count + 1) * b->lengths[first] <= GSO_MAX_BYTES) {
+            struct iovec *iov = &b->tx_iov[i];
+            iov->iov_base = b->responses[b->order[i]];
+            iov->iov_len = b->lengths[b->order[i]];
+            count++;
+            i++;
+        }
+
+        memset(msg, 0, sizeof(*msg));
+        msg->msg_name = &b->addrs[first];
+        msg->msg_namelen = b->rx[first].msg_hdr.msg_namelen;
+        msg->msg_iov = &b->tx_iov[i - count];
+        msg->msg_iovlen = count;
+        if (count > 1) {
+            struct cmsghdr *cm;
+
+            msg->msg_control = b->cmsgs[ntx].buf;
+            msg->msg_controllen = sizeof(b->cmsgs[ntx].buf);
+            cm = CMSG_FIRSTHDR(msg);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t *)CMSG_DATA(cm) = b->lengths[first];
+        }
+        ntx++;
+    }
+    return ntx;
+}
+
+// Lukee säikeen socketia erissä, kunnes jono on tyhjä: recvmmsg hakee kerralla kaikki jonossa olevat
+// viestit (enintään erän koon verran), ja kaikki vastaukset lähetetään yhdellä sendmmsg-kutsulla.
+// Kevyellä kuormalla erä on yhden viestin kokoinen. Erän kokoa kasvatetaan, kun erä täyttyy, ja
+// pienennetään, kun se jää selvästi vajaaksi, jotta yhden erän käsittely ei viivästytä ensimmäistä
+// vastausta kohtuuttomasti.
+static void serve_batch(struct worker *w) {
+    struct batch *b = &w->batch;
+    struct metrics *m = &w->metrics;
+
+    while (true) {
+        unsigned ntx, sent = 0;
+        size_t bytes_in = 0, bytes_out = 0;
+        int n;
+
+        // recvmmsg palauttaa osoitteiden todelliset pituudet, joten ne alustetaan joka kerta
+        for (unsigned i = 0; i < b->size; i++) {
+            b->rx[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+        }
+        n = recvmmsg(w->udp_socket, b->rx, b->size, MSG_DONTWAIT, NULL);
+
+        metrics_add(&m->syscalls, 1);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Failed to receive messages");
+                metrics_add(&m->errors, 1);
+                continue;
+            }
+            return;  // Jono on tyhjä
+        }
+
+        // Muodosta vastaukset
+        for (int i = 0; i < n; i++) {
+            log_message(w, MSG_RECEIVED, b->requests[i], b->rx[i].msg_len);
+            bytes_in += b->rx[i].msg_len;
+            b->lengths[i] = build_response(w, b->requests[i], b->rx[i].msg_len, b->responses[i]);
+            bytes_out += b->lengths[i];
+        }
+
+        // Lähetä kaikki vastaukset; sendmmsg voi lähettää osan, jolloin loput lähetetään uudelleen.
+        // Lähetyksen kesto kirjataan sendmmsg-kutsua kohden, ei vastausta kohden.
+        ntx = batch_build_tx(b, n);
+        while (sent < ntx) {
+            uint64_t start = metrics_now();
+            int r = sendmmsg(w->udp_socket, b->tx + sent, ntx - sent, 0);
+
+            metrics_record(m, METRICS_SEND, start, metrics_now());
+            metrics_add(&m->syscalls, 1);
+            if (r < 0) {
+                perror("Failed to send response");
+                metrics_add(&m->errors, 1);
+                sent++;  // Ohita epäonnistunut viesti
+                continue;
+            }
+            sent += r;
+        }
+        for (int i = 0; i < n; i++) {
+            log_message(w, MSG_SENT, b->responses[i], b->lengths[i]);
+        }
+        metrics_add(&m->requests, n);
+        metrics_add(&m->messages, ntx);
+        metrics_add(&m->bytes_in, bytes_in);
+        metrics_add(&m->bytes_out, bytes_out);
+
+        // Mukauta erän kokoa kuorman mukaan. Vajaa erä tarkoittaa, että jono tyhjeni.
+        if ((unsigned)n == b->size) {
+            b->size = b->size * 2 < b->max ? b->size * 2 : b->max;
+            continue;
+        }
+        if ((unsigned)n * 4 <= b->size && b->size > 1) {
+            b->size /= 2;
+        }
+        return;
+    }
+}
+
+// Sulkee TCP-yhteyden ja palauttaa sen puskurit ja rakenteen varastoon
+static void conn_close(struct conn *c) {
+    struct worker *w = c->w;
+
+    event_del(w->loop, c->fd);
+    close(c->fd);
+    if (c->in != NULL) {
+        pool_put(&w->buffer_pool, c->in);
+    }
+    if (c->out != NULL) {
+        pool_put(&w->buffer_pool, c->out);
+    }
+    pool_put(&w->conn_pool, c);
+    metrics_sub(&w->metrics.connections, 1);
+}
+
+// Lähettää kirjoituspuskurin sisällön. Palauttaa 1, jos puskuri tyhjeni, 0, jos socketin lähetyspuskuri
+// täyttyi (jatketaan, kun socket on taas kirjoitettava), tai -1, jos yhteys on katkennut.
+static int conn_flush(struct conn *c) {
+    struct metrics *m = &c->w->metrics;
+
+    while (c->out_off < c->out_len) {
+        uint64_t start = metrics_now();
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+
+        metrics_record(m, METRICS_SEND, start, metrics_now());
+        metrics_add(&m->syscalls, 1);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        metrics_add(&m->bytes_out, n);
+        metrics_add(&m->messages, 1);
+        c->out_off += n;
+    }
+    if (c->out != NULL) {
+        pool_put(&c->w->buffer_pool, c->out);
+        c->out = NULL;
+        c->out_off = c->out_len = 0;
+    }
+    return 1;
+}
+
+// Käsittelee lukupuskurin kokonaiset viestit ja kirjoittaa vastaukset kirjoituspuskuriin. Jos
+// kirjoituspuskuri täyttyy eikä sitä saa lähetettyä, käsittely keskeytetään (c->blocked). Palauttaa
+// 0 tai -1, jos yhteys on suljettava.
+static int conn_process(struct conn *c) {
+    struct worker *w = c->w;
+    size_t off = 0;
+    unsigned long requests = 0;
+    int result = 0;
+
+    c->blocked = false;
+    while (c->in_len - off >= PROTO_FRAME_HEADER) {
+        const unsigned char *frame = (const unsigned char *)c->in + off;
+        size_t len = frame[0] << 8 | frame[1];
+        uint16_t response_len;
+
+        if (len == 0 || len > BUFFER_SIZE - 1) {
+            metrics_add(&w->metrics.errors, 1);
+            result = -1;  // Virheellinen viesti: yhteyden tila on tuntematon
+            break;
+        }
+        if (c->in_len - off < PROTO_FRAME_HEADER + len) {
+            break;  // Viesti on vielä kesken
+        }
+
+        // Varmista, että vastaukselle on tilaa (pituuskenttä, vastaus ja tekstivastauksen nollamerkki)
+        if (c->out != NULL && c->out_len + PROTO_FRAME_HEADER + PROTO_MAX_DATAGRAM + 1 > CONN_BUFFER_SIZE) {
+            int r = conn_flush(c);
+            if (r < 0) {
+                result = -1;
+                break;
+            }
+            if (r == 0 && c->out_len + PROTO_FRAME_HEADER + PROTO_MAX_DATAGRAM + 1 > CONN_BUFFER_SIZE) {
+                c->blocked = true;
+                break;
+            }
+        }
+        if (c->out == NULL && (c->out = pool_get(&w->buffer_pool)) == NULL) {
+            perror("Failed to allocate connection buffer");
+            result = -1;
+            break;
+        }
+
+        log_message(w, MSG_RECEIVED_TCP, (const char *)frame + PROTO_FRAME_HEADER, len);
+        response_len = build_response(w, (const char *)frame + PROTO_FRAME_HEADER, len, c->out + c->out_len + PROTO_FRAME_HEADER);
+        log_message(w, MSG_SENT_TCP, c->out + c->out_len + PROTO_FRAME_HEADER, response_len);
+        c->out[c->out_len] = response_len >> 8;
+        c->out[c->out_len + 1] = response_len & 0xff;
+        c->out_len += PROTO_FRAME_HEADER + response_len;
+        off += PROTO_FRAME_HEADER + len;
+        requests++;
+    }
+
+    // Siirrä keskeneräinen viesti puskurin alkuun, tai palauta tyhjä puskuri varastoon
+    if (off == c->in_len) {
+        pool_put(&w->buffer_pool, c->in);
+        c->in = NULL;
+        c->in_len = 0;
+    } else if (off > 0) {
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    }
+    metrics_add(&w->metrics.requests, requests);
+    metrics_add(&w->metrics.tcp_requests, requests);
+    return result;
+}
+
+// Lukee TCP-yhteydeltä kaiken saapuneen datan ja vastaa kokonaisiin viesteihin. Kaikki samalla
+// kerralla luettujen viestien vastaukset lähetetään yhdellä send-kutsulla. Palauttaa 0 tai -1, jos
+// yhteys on suljettava.
+static int conn_read(struct conn *c) {
+    struct worker *w = c->w;
+
+    while (!c->blocked) {
+        ssize_t n;
+
+        if (c->in == NULL && (c->in = pool_get(&w->buffer_pool)) == NULL) {
+            perror("Failed to allocate connection buffer");
+            return -1;
+        }
+        n = recv(c->fd, c->in + c->in_len, CONN_BUFFER_SIZE - c->in_len, 0);
+        metrics_add(&w->metrics.syscalls, 1);
+        if (n == 0) {
+            return -1;  // Asiakas sulki yhteyden
+        }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                metrics_add(&w->metrics.errors, 1);
+                return -1;
+            }
+            if (c->in_len == 0) {
+                pool_put(&w->buffer_pool, c->in);
+                c->in = NULL;
+            }
+            break;
+        }
+        c->in_len += n;
+        metrics_add(&w->metrics.bytes_in, n);
+        if (conn_process(c) < 0 || conn_flush(c) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// TCP-yhteyden tapahtumien käsittelijä
+static void handle_conn(void *arg, struct event *ev) {
+    struct conn *c = arg;
+    bool resume = false;  // Jatketaanko keskeytettyä lukemista
+
+    // Kirjoituspuskurin tyhjennyttyä jatketaan keskeytettyjen viestien käsittelyä ja lukemista
+    if ((ev->flags & EVENT_WRITE) && c->out != NULL) {
+        int r = conn_flush(c);
+        if (r < 0) {
+            conn_close(c);
+            return;
+        }
+        if (r > 0 && c->blocked) {
+            if (conn_process(c) < 0 || conn_flush(c) < 0) {
+                conn_close(c);
+                return;
+            }
+            resume = true;
+        }
+    }
+    if ((resume || (ev->flags & (EVENT_READ | EVENT_ERROR))) && conn_read(c) < 0) {
+        conn_close(c);
+    }
+}
+
+// TCP-kuuntelijan tapahtumien käsittelijä: hyväksyy kaikki jonossa olevat yhteydet
+static void handle_listener(void *arg, struct event *ev) {
+    struct worker *w = arg;
+    int one = 1;
+
+    (void)ev;
+    while (true) {
+        int fd = accept4(w->tcp_listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        struct conn *c;
+
+        metrics_add(&w->metrics.syscalls, 1);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+                perror("Failed to accept connection");  // Esimerkiksi EMFILE: yhteydet jäävät jonoon
+            }
+            return;
+        }
+
+        // Vastaukset lähetetään heti ilman Naglen algoritmin viivettä
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c = pool_get(&w->conn_pool);
+        if (c == NULL) {
+            perror("Failed to allocate connection");
+            close(fd);
+            continue;
+        }
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+        c->w = w;
+        if (event_add(w->loop, fd, handle_conn, c) < 0) {
+            close(fd);
+            pool_put(&w->conn_pool, c);
+            continue;
+        }
+        metrics_add(&w->metrics.connections, 1);
+    }
+}
+
+// Palauttaa monotonisen ajan nanosekunteina
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Vastaa kaikkiin asiakkaan pyyntörenkaassa oleviin pyyntöihin. Vastaus muodostetaan suoraan
+// vastausrenkaan paikkaan, ja asiakas herätetään kerran lopuksi, jos se nukkuu. Asiakkaalla on
+// enintään SHM_SLOTS pyyntöä matkalla, joten vastausrengas ei täyty; jos niin silti käy, loput
+// pyynnöt jäävät renkaaseen seuraavaan kyselyyn. Palauttaa käsiteltyjen pyyntöjen määrän.
+static unsigned serve_shm_client(struct shm_client *c) {
+    struct worker *w = c->w;
+    struct shm_region *r = c->channel.region;
+    const struct shm_slot *request;
+    struct shm_slot *response;
+    size_t bytes_in = 0, bytes_out = 0;
+    unsigned n = 0;
+
+    while ((request = shm_peek(&r->requests)) != NULL && (response = shm_reserve(&r->responses)) != NULL) {
+        size_t len = request->len < BUFFER_SIZE - 1 ? request->len : BUFFER_SIZE - 1;
+
+        log_message(w, MSG_RECEIVED_SHM, request->data, len);
+        response->len = build_response(w, request->data, len, response->data);
+        log_message(w, MSG_SENT_SHM, response->data, response->len);
+        bytes_in += len;
+        bytes_out += response->len;
+        shm_release(&r->requests);
+        shm_commit(&r->responses);
+        n++;
+    }
+    if (n > 0) {
+        shm_wake_client(&c->channel);
+        metrics_add(&w->metrics.requests, n);
+        metrics_add(&w->metrics.shm_requests, n);
+        metrics_add(&w->metrics.messages, n);
+        metrics_add(&w->metrics.bytes_in, bytes_in);
+        metrics_add(&w->metrics.bytes_out, bytes_out);
+    }
+    return n;
+}
+
+// Kyselee kaikkien säikeen jaetun muistin asiakkaiden renkaat. Palauttaa käsiteltyjen pyyntöjen määrän.
+static unsigned poll_shm_clients(struct worker *w) {
+    unsigned n = 0;
+
+    for (struct shm_client *c = w->shm_clients; c != NULL; c = c->next) {
+        n += serve_shm_client(c);
+    }
+    return n;
+}
+
+// Merkitsee säikeen nukkuvaksi kaikkien asiakkaiden pyyntörenkaisiin. Palauttaa epätoden, jos
+// johonkin renkaaseen ehti tulla pyyntö (merkinnät poistetaan, ja kyselyä jatketaan).
+static bool sleep_shm_clients(struct worker *w) {
+    for (struct shm_client *c = w->shm_clients; c != NULL; c = c->next) {
+        if (!shm_sleep(&c->channel.region->requests)) {
+            for (struct shm_client *d = w->shm_clients; d != c; d = d->next) {
+                atomic_store(&d->channel.region->requests.sleeping, 0);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sulkee jaetun muistin asiakkaan kanavan
+static void shm_client_close(struct shm_client *c) {
+    struct worker *w = c->w;
+
+    event_del(w->loop, c->channel.eventfd);
+    event_del(w->loop, c->channel.sock);
+    shm_close(&c->channel);
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        w->shm_clients = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+    free(c);
+    metrics_sub(&w->metrics.shm_clients, 1);
+}
+
+// Jaetun muistin asiakkaan herätyskuvaajan käsittelijä: asiakas kirjoitti pyynnön nukkuvan säikeen renkaaseen
+static void handle_shm_kick(void *arg, struct event *ev) {
+    struct shm_client *c = arg;
+    uint64_t value;
+
+    (void)ev;
+    if (read(c->channel.eventfd, &value, sizeof(value)) == sizeof(value)) {
+        metrics_add(&c->w->metrics.syscalls, 1);
+    }
+    if (serve_shm_client(c) > 0) {
+        c->w->shm_active = monotonic_ns();
+    }
+}
+
+// Jaetun muistin asiakkaan socketin käsittelijä: asiakas ei lähetä socketiin mitään, joten luettavuus
+// tarkoittaa, että asiakas sulki yhteyden
+static void handle_shm_socket(void *arg, struct event *ev) {
+    struct shm_client *c = arg;
+    char byte;
+
+    if (ev->flags & (EVENT_READ | EVENT_ERROR)) {
+        ssize_t n = recv(c->channel.sock, &byte, sizeof(byte), MSG_DONTWAIT);
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            shm_client_close(c);
+        }
+    }
+}
+
+// Jaetun muistin Unix-socketin käsittelijä: luo kanavan jokaiselle jonossa olevalle asiakkaalle.
+// Kaikki säikeet seuraavat samaa socketia, ja asiakasta palvelee se säie, joka ehtii hyväksyä sen.
+static void handle_shm_listener(void *arg, struct event *ev) {
+    struct worker *w = arg;
+
+    (void)ev;
+    while (true) {
+        int fd = accept4(w->shm_listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        struct shm_client *c;
+
+        metrics_add(&w->metrics.syscalls, 1);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+                perror("Failed to accept shared memory client");
+            }
+            return;
+        }
+        if ((c = calloc(1, sizeof(*c))) == NULL) {
+            perror("Failed to allocate shared memory client");
+            close(fd);
+            continue;
+        }
+        c->w = w;
+        if (shm_accept(&c->channel, fd) < 0) {
+            free(c);
+            continue;
+        }
+        if (event_add(w->loop, c->channel.eventfd, handle_shm_kick, c) < 0) {
+            shm_close(&c->channel);
+            free(c);
+            continue;
+        }
+        if (event_add(w->loop, c->channel.sock, handle_shm_socket, c) < 0) {
+            event_del(w->loop, c->channel.eventfd);
+            shm_close(&c->channel);
+            free(c);
+            continue;
+        }
+        c->next = w->shm_clients;
+        if (c->next != NULL) {
+            c->next->prev = c;
+        }
+        w->shm_clients = c;
+        metrics_add(&w->metrics.shm_clients, 1);
+    }
+}
+
+// UDP-socketin tapahtumien käsittelijä
+static void handle_udp(void *arg, struct event *ev) {
+    struct worker *w = arg;
+
+    if (ev->flags & EVENT_DATAGRAM) {
+        // io_uring: ydin on jo vastaanottanut datagrammin
+        reply_datagram(w, ev->data, ev->len, ev->addr, ev->addrlen);
+    } else if (w->batch.max > 0) {
+        serve_batch(w);
+    } else {
+        serve_single(w);
+    }
+}
+
+// Palvelusäikeen pääfunktio
+static void *serve(void *arg) {
+    struct worker *w = arg;
+
+    // Sido säie prosessorilleen, jotta sen socket, puskurit ja välimuisti pysyvät samalla ytimellä
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            fprintf(stderr, "Säiettä %d ei voitu sitoa prosessorille %d\n", w->id, w->cpu);
+        }
+    }
+
+    // Palvele UDP-socketia, TCP-kuuntelijaa ja yhteyksiä samassa tapahtumasilmukassa. Jaetun muistin
+    // asiakkaiden renkaita kysellään SHM_SPIN_NS viimeisen pyynnön jälkeen; sinä aikana tapahtumat
+    // tarkistetaan odottamatta SHM_EVENTS_NS välein. Ennen odottamista säie merkitsee renkaisiin
+    // nukkuvansa, jolloin asiakas herättää sen herätyskuvaajalla.
+    uint64_t events_checked = 0;  // Milloin tapahtumat tarkistettiin viimeksi renkaiden kyselyn aikana
+
+    while (true) {
+        unsigned long before = event_syscalls(w->loop);
+        int timeout = -1;
+
+        if (w->shm_clients != NULL) {
+            uint64_t now = monotonic_ns();
+
+            if (poll_shm_clients(w) > 0) {
+                w->shm_active = now;
+            }
+            if (now - w->shm_active < SHM_SPIN_NS) {
+                if (now - events_checked < SHM_EVENTS_NS) {
+                    shm_relax();
+                    if (shm_yield) {
+                        metrics_add(&w->metrics.syscalls, 1);
+                    }
+                    continue;
+                }
+                events_checked = now;
+                timeout = 0;
+            } else if (!sleep_shm_clients(w)) {
+                w->shm_active = now;
+                continue;
+            }
+        }
+
+        if (event_run_once(w->loop, timeout) < 0) {
+            perror("Waiting for events failed");
+            return NULL;
+        }
+        metrics_add(&w->metrics.syscalls, event_syscalls(w->loop) - before);
+
+        // Herättyään säie kyselee taas itse, joten asiakkaiden ei tarvitse herättää sitä
+        if (timeout < 0) {
+            for (struct shm_client *c = w->shm_clients; c != NULL; c = c->next) {
+                atomic_store(&c->channel.region->requests.sleeping, 0);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Tulostaa säikeiden tilastot virhevirtaan
+static void print_stats(struct worker *workers, int nworkers) {
+    for (int i = 0; i < nworkers; i++) {
+        const struct metrics *m = &workers[i].metrics;
+        unsigned long requests = atomic_load(&m->requests);
+        unsigned long syscalls = atomic_load(&m->syscalls);
+        unsigned long messages = atomic_load(&m->messages);
+        unsigned long tcp_requests = atomic_load(&m->tcp_requests);
+        unsigned long connections = atomic_load(&m->connections);
+        unsigned long shm_requests = atomic_load(&m->shm_requests);
+        unsigned long pregen_stalls = atomic_load(&m->pregen_stalls);
+
+        fprintf(stderr, "Säie %d (prosessori %d): %lu pyyntöä, %.3f järjestelmäkutsua/pyyntö", i, workers[i].cpu, requests,
+                requests ? (double)syscalls / requests : 0.0);
+        if (workers[i].batch.max > 0) {
+            fprintf(stderr, ", %.2f vastausta/lähetysviesti%s", messages ? (double)requests / messages : 0.0,
+                    workers[i].batch.gso ? "" : " (ei GSO-tukea)");
+        }
+        fprintf(stderr, ", joista TCP %lu, %lu TCP-yhteyttä auki", tcp_requests, connections);
+        if (workers[i].shm_listener >= 0) {
+            fprintf(stderr, ", jaettu muisti %lu", shm_requests);
+        }
+        if (workers[i].pregen != NULL) {
+            fprintf(stderr, ", valmiiden rivien rengas tyhjä %lu kertaa", pregen_stalls);
+        }
+        fputc('\n', stderr);
+    }
+}
+
+// Tulostaa ohjelman käyttöohjeen
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Käyttö: %s [--workers N] [--cpu-steering] [--batch K] [--backend epoll|io_uring] [--stats PATH]\n"
+            "           [--shm PATH] [--pregen N] [--pregen-depth D] [--pregen-refill LOW:HIGH] [--log-rate N] [--quiet]\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    int nworkers = 0;              // Palvelusäikeiden määrä (0 = yksi socket ilman SO_REUSEPORT-valintaa)
+    bool cpu_steering = false;     // Ohjataanko paketit BPF-ohjelmalla prosessorin mukaan
+    bool quiet = false;            // Jätetäänkö viestit tulostamatta
+    int batch = 0;                 // Erän enimmäiskoko (0 = viesti kerrallaan)
+    int ncpus = sysconf(_SC_NPROCESSORS_ONLN);  // Prosessorien määrä säikeiden sitomista varten
+    struct worker *workers;        // Palvelusäikeiden tilat
+    struct metrics **metrics;      // Säikeiden mittarit tilastopalvelimelle
+    struct log_ring **logs;        // Säikeiden lokirenkaat lokisäikeelle
+    const char *stats_path = NULL; // Tilastopalvelimen Unix-socket (NULL = ei tilastopalvelinta)
+    const char *shm_path = NULL;   // Jaetun muistin asiakkaiden Unix-socket (NULL = ei käytössä)
+    int shm_listener = -1;         // Jaetun muistin asiakkaiden socket
+    int pregen = 0;                // Tuottajasäikeiden määrä (0 = ei esituotantoa)
+    unsigned pregen_depth = DEFAULT_PREGEN_DEPTH;  // Valmiiden rivien renkaan koko
+    unsigned pregen_low = 0, pregen_high = 0;      // Täytön rajat (0 = oletus renkaan koon mukaan)
+    struct pregen_ring **pregen_rings = NULL;      // Säikeiden renkaat tuottajille
+    double log_rate = DEFAULT_LOG_RATE;  // Tulostettavia viestejä sekunnissa säiettä kohden
+    sigset_t signals;              // Lopetussignaalit, joita pääsäie odottaa
+    int opt, sig;
+
+    // Komentoriviltä luettavat valinnat getopt_long-funktiolle
+    static const struct option long_options[] = {
+        {"workers", required_argument, NULL, 'w'},
+        {"cpu-steering", no_argument, NULL, 'c'},
+        {"batch", required_argument, NULL, 'b'},
+        {"backend", required_argument, NULL, 'e'},
+        {"stats", required_argument, NULL, 's'},
+        {"shm", required_argument, NULL, 'm'},
+        {"pregen", required_argument, NULL, 'g'},
+        {"pregen-depth", required_argument, NULL, 'G'},
+        {"pregen-refill", required_argument, NULL, 'R'},
+        {"log-rate", required_argument, NULL, 'l'},
+        {"quiet", no_argument, NULL, 'q'},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((opt = getopt_long(argc, argv, "w:cb:e:s:m:g:G:R:l:q", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'w':
+                nworkers = atoi(optarg);
+                if (nworkers < 1 || nworkers > MAX_WORKERS) {
+                    fprintf(stderr, "Säikeiden määrän täytyy olla väliltä 1-%d\n", MAX_WORKERS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                cpu_steering = true;
+                break;
+            case 'b':
+                batch = atoi(optarg);
+                if (batch < 1 || batch > MAX_BATCH) {
+                    fprintf(stderr, "Erän koon täytyy olla väliltä 1-%d\n", MAX_BATCH);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'e':
+                if (strcmp(optarg, "epoll") == 0) {
+                    backend = EVENT_EPOLL;
+                } else if (strcmp(optarg, "io_uring") == 0) {
+                    backend = EVENT_IO_URING;
+                } else {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                stats_path = optarg;
+                break;
+            case 'm':
+                shm_path = optarg;
+                break;
+            case 'g':
+                pregen = atoi(optarg);
+                if (pregen < 1 || pregen > MAX_WORKERS) {
+                    fprintf(stderr, "Tuottajasäikeiden määrän täytyy olla väliltä 1-%d\n", MAX_WORKERS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'G':
+                pregen_depth = atoi(optarg);
+                if (pregen_depth < 4 || pregen_depth > MAX_PREGEN_DEPTH || (pregen_depth & (pregen_depth - 1)) != 0) {
+                    fprintf(stderr, "Renkaan koon täytyy olla kahden potenssi väliltä 4-%d\n", MAX_PREGEN_DEPTH);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'R':
+                if (sscanf(optarg, "%u:%u", &pregen_low, &pregen_high) != 2) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                log_rate = atof(optarg);
+                if (log_rate < 0) {
+                    fprintf(stderr, "Tulostustahti ei voi olla negatiivinen\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
         }
+    }
+    if (cpu_steering && nworkers == 0) {
+        fprintf(stderr, "--cpu-steering vaatii valinnan --workers\n");
+        return EXIT_FAILURE;
+    }
+    if (batch > 0 && backend == EVENT_IO_URING) {
+        fprintf(stderr, "--batch ei ole käytettävissä io_uring-taustaosan kanssa (ydin vastaanottaa viestit jo erissä)\n");
+        return EXIT_FAILURE;
+    }
+    if (pregen_low == 0 && pregen_high == 0) {
+        pregen_low = pregen_depth / 4;
+        pregen_high = pregen_depth - 1;
+    }
+    if (pregen > 0 && (pregen_low >= pregen_high || pregen_high > pregen_depth - 1)) {
+        fprintf(stderr, "Täytön rajoille pätee LOW < HIGH <= %u (renkaan koko - 1)\n", pregen_depth - 1);
+        return EXIT_FAILURE;
+    }
+    if (cpu_steering && nworkers > ncpus) {
+        fprintf(stderr, "Varoitus: --cpu-steering ohjaa paketit vain %d ensimmäiselle säikeelle\n", ncpus);
+    }
 
-        buffer[len] = '\0';
-        printf("Vastaanotettiin viesti asiakkaalta: %s\n", buffer);
+    // Ilman --workers-valintaa palvellaan yhdellä tavallisella socketilla yhdessä säikeessä
+    bool reuseport = nworkers > 0;
+    if (nworkers == 0) {
+        nworkers = 1;
+    }
 
-        // Arvo lottonumerot
-        draw_lottery_numbers(numbers);
+    workers = aligned_alloc(64, nworkers * sizeof(*workers));
+    metrics = calloc(nworkers, sizeof(*metrics));
+    logs = calloc(nworkers, sizeof(*logs));
+    if (pregen > 0) {
+        pregen_rings = calloc(nworkers, sizeof(*pregen_rings));
+    }
+    if (workers == NULL || metrics == NULL || logs == NULL || (pregen > 0 && pregen_rings == NULL)) {
+        perror("Failed to allocate workers");
+        return EXIT_FAILURE;
+    }
+    memset(workers, 0, nworkers * sizeof(*workers));
+    metrics_init_clock();
+    shm_init();
+    if (shm_path != NULL && (shm_listener = shm_listen(shm_path)) < 0) {
+        return EXIT_FAILURE;
+    }
 
-        // Muodosta vastaus lottonumeroista asiakkaalle
-        char response[BUFFER_SIZE] = "Lottonumeronne ovat ";
-        lottery_numbers_to_string(numbers, response);
+    // Jokainen TCP-yhteys vie tiedostokuvaajan: nosta raja sallittuun enimmäismäärään
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
 
-        // Lähetä vastaus asiakkaalle sendto-funktiolla, parametreina socket, vastaus, vastauksen koko, liput 0 (ei lippuja), asiakkaan osoiterakenne ja osoiterakenteen koko
-        if (sendto(udp_socket, response, strlen(response), 0, (struct sockaddr *)&client_addr, client_len) < 0) {
-            perror("Failed to send response");
-        } else {
-            printf("  -> Lähetettiin vastaus asiakkaalle: %s\n", response);
+    // Luo socketit järjestyksessä: socketin paikka SO_REUSEPORT-ryhmässä on sama kuin säikeen numero
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        workers[i].cpu = reuseport ? i % ncpus : -1;
+        workers[i].shm_listener = shm_listener;
+        lotto_rng_seed_random(&workers[i].rng, i);
+        workers[i].udp_socket = create_socket(SOCK_DGRAM, reuseport);
+        workers[i].tcp_listener = create_socket(SOCK_STREAM, reuseport);
+        if (workers[i].udp_socket < 0 || workers[i].tcp_listener < 0) {
+            return EXIT_FAILURE;
+        }
+        if (batch > 0 && batch_init(&workers[i].batch, batch, workers[i].udp_socket) < 0) {
+            return EXIT_FAILURE;
+        }
+        metrics[i] = &workers[i].metrics;
+        if (!quiet) {
+            if ((logs[i] = aligned_alloc(64, sizeof(*logs[i]))) == NULL) {
+                perror("Failed to allocate log ring");
+                return EXIT_FAILURE;
+            }
+            log_ring_init(logs[i], log_rate);
+            workers[i].log = logs[i];
+        }
+        if (pregen > 0) {
+            if ((pregen_rings[i] = aligned_alloc(64, sizeof(*pregen_rings[i]))) == NULL) {
+                perror("Failed to allocate pregeneration ring");
+                return EXIT_FAILURE;
+            }
+            workers[i].pregen = pregen_rings[i];
+        }
+        pool_init(&workers[i].conn_pool, sizeof(struct conn), 1024);
+        pool_init(&workers[i].buffer_pool, CONN_BUFFER_SIZE, 64);
+        workers[i].loop = event_loop_create(backend);
+        if (workers[i].loop == NULL || event_add_datagrams(workers[i].loop, workers[i].udp_socket, handle_udp, &workers[i]) < 0 ||
+            event_add(workers[i].loop, workers[i].tcp_listener, handle_listener, &workers[i]) < 0) {
+            return EXIT_FAILURE;
+        }
+        if (shm_listener >= 0 && event_add(workers[i].loop, shm_listener, handle_shm_listener, &workers[i]) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (cpu_steering && attach_cpu_steering(workers[0].udp_socket, nworkers) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    // Estä lopetussignaalit kaikilta säikeiltä; pääsäie odottaa niitä sigwait-funktiolla
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // Tilasto- ja lokisäikeet käynnistetään vasta nyt, jotta nekin perivät estetyt signaalit
+    if (stats_path != NULL && metrics_serve(stats_path, metrics, nworkers) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (!quiet && log_start(logs, nworkers, print_log_entry) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (pregen > 0 && pregen_start(pregen_rings, nworkers, pregen, pregen_depth, pregen_low, pregen_high, ncpus) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, serve, &workers[i]) != 0) {
+            fprintf(stderr, "Säikeen luonti epäonnistui\n");
+            return EXIT_FAILURE;
         }
     }
 
-    // Sulje socket
-    close(udp_socket);
+    if (!reuseport) {
+        printf("Palvelin on käynnissä ja kuuntelee portissa %d (UDP ja TCP, %s)...\n", PORT, event_backend_name(backend));
+    } else {
+        printf("Palvelin on käynnissä ja kuuntelee portissa %d (UDP ja TCP, %s, %d säiettä%s)...\n", PORT,
+               event_backend_name(backend), nworkers, cpu_steering ? ", pakettien ohjaus prosessorin mukaan" : "");
+    }
+    if (pregen > 0) {
+        printf("Esituotanto: %d tuottajasäiettä, rengas %u riviä säiettä kohden, täyttö %u -> %u\n", pregen,
+               pregen_depth, pregen_low, pregen_high);
+    }
+    if (shm_path != NULL) {
+        printf("Jaetun muistin asiakkaat Unix-socketissa %s\n", shm_path);
+    }
+    if (stats_path != NULL) {
+        printf("Tilastot Unix-socketissa %s (ajanotto: %s)\n", stats_path, metrics_clock_name());
+    }
+    fflush(stdout);
+
+    // Odota lopetussignaalia, tulosta lokiin jääneet viestit ja säikeiden tilastot
+    sigwait(&signals, &sig);
+    log_stop();
+    if (stats_path != NULL) {
+        unlink(stats_path);
+    }
+    if (shm_path != NULL) {
+        unlink(shm_path);
+    }
+    print_stats(workers, nworkers);
     return EXIT_SUCCESS;
 }
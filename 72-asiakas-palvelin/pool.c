@@ -0,0 +1,53 @@
+/*
+ * pool.c
+ *
+ * Kiinteän kokoisten lohkojen varasto (ks. pool.h).
+ */
+
+#include "pool.h"
+
+#include <stdlib.h>
+
+void pool_init(struct pool *p, size_t size, size_t per_chunk) {
+    // Lohkon täytyy mahtua vapaiden listan osoittimeen ja pysyä välimuistirivin kohdistuksessa
+    size = size < sizeof(void *) ? sizeof(void *) : size;
+    p->size = (size + 63) & ~(size_t)63;
+    p->per_chunk = per_chunk;
+    p->free = NULL;
+    p->chunks = NULL;
+    p->nchunks = 0;
+    p->in_use = 0;
+}
+
+void *pool_get(struct pool *p) {
+    void *block;
+
+    if (p->free == NULL) {
+        char *chunk = aligned_alloc(64, p->size * p->per_chunk);
+        void **chunks = realloc(p->chunks, (p->nchunks + 1) * sizeof(*chunks));
+
+        if (chunk == NULL || chunks == NULL) {
+            free(chunk);
+            p->chunks = chunks ? chunks : p->chunks;
+            return NULL;
+        }
+        chunks[p->nchunks++] = chunk;
+        p->chunks = chunks;
+
+        // Ketjuta palan lohkot vapaiden listaan
+        for (size_t i = p->per_chunk; i-- > 0;) {
+            *(void **)(chunk + i * p->size) = p->free;
+            p->free = chunk + i * p->size;
+        }
+    }
+    block = p->free;
+    p->free = *(void **)block;
+    p->in_use++;
+    return block;
+}
+
+void pool_put(struct pool *p, void *block) {
+    *(void **)block = p->free;
+    p->free = block;
+    p->in_use--;
+}
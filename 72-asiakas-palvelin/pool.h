@@ -0,0 +1,34 @@
+/*
+ * pool.h
+ *
+ * Kiinteän kokoisten lohkojen varasto. Lohkot varataan suurina paloina ja vapautetut lohkot
+ * kierrätetään vapaiden listan kautta, joten yhteyksien puskureiden varaaminen ja vapauttaminen ei
+ * kutsu malloc-funktiota kuumalla polulla. Varasto ei ole säieturvallinen: jokaisella säikeellä on
+ * omansa. Palat säilyvät prosessin loppuun asti, koska palvelusäikeet toimivat koko sen ajan.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Lohkovarasto
+struct pool {
+    size_t size;       // Lohkon koko
+    size_t per_chunk;  // Lohkoja yhdessä palassa
+    void *free;        // Vapaiden lohkojen lista (lohkon alussa osoitin seuraavaan)
+    void **chunks;     // Varatut palat
+    size_t nchunks;    // Palojen määrä
+    size_t in_use;     // Käytössä olevien lohkojen määrä
+};
+
+// Alustaa varaston, jonka lohkot ovat size tavua ja joka varaa muistia per_chunk lohkoa kerrallaan
+void pool_init(struct pool *p, size_t size, size_t per_chunk);
+
+// Antaa lohkon varastosta. Palauttaa NULL, jos muisti loppuu.
+void *pool_get(struct pool *p);
+
+// Palauttaa lohkon varastoon
+void pool_put(struct pool *p, void *block);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * pregen.c
+ *
+ * Arvontojen esituotanto (ks. pregen.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "pregen.h"
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "lotto.h"
+
+// Tuottajasäie
+struct pregen_producer {
+    atomic_uint requests __attribute__((aligned(64)));  // Herätyspyyntöjen laskuri (futex)
+    atomic_bool sleeping;                               // Odottaako tuottaja herätystä
+    int cpu __attribute__((aligned(64)));               // Prosessori, jolle tuottaja on sidottu
+    struct pregen_ring **rings;                         // Täytettävät renkaat
+    int nrings;                                         // Renkaiden määrä
+    struct lotto_rng rng;                               // Tuottajan oma satunnaislukugeneraattori
+    pthread_t thread;                                   // Säikeen tunniste
+};
+
+void pregen_wake(struct pregen_ring *r) {
+    struct pregen_producer *p = r->producer;
+
+    // seq_cst: joko tuottaja näkee pyynnön ennen nukahtamista tai tämä säie näkee sen nukkuvan
+    atomic_fetch_add(&p->requests, 1);
+    if (atomic_load(&p->sleeping)) {
+        syscall(SYS_futex, &p->requests, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+// Arpoo yhden rivin ja muotoilee sen tekstivastauksen
+static void fill_entry(struct pregen_producer *p, struct pregen_entry *e) {
+    static const char prefix[] = "Lottonumeronne ovat ";
+
+    lotto_draw(&p->rng, PROTO_DEFAULT_POOL, PROTO_DEFAULT_PICK, e->numbers);
+    memcpy(e->text, prefix, sizeof(prefix) - 1);
+    e->text_len = sizeof(prefix) - 1 + lotto_format(e->numbers, PROTO_DEFAULT_PICK, e->text + sizeof(prefix) - 1);
+    e->text[e->text_len] = '\0';
+}
+
+// Täyttää renkaan ylärajalle, jos sen täyttöaste on laskenut alarajalle tai täyttö on kesken.
+// Rivit julkaistaan erissä, jotta palvelusäie saa ensimmäiset rivit jo täytön aikana. Palauttaa
+// toden, jos renkaaseen kirjoitettiin.
+static bool fill_ring(struct pregen_producer *p, struct pregen_ring *r) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned level = head - atomic_load_explicit(&r->tail, memory_order_acquire);
+    unsigned batch = 0;
+
+    if (level > r->low && !r->refilling) {
+        return false;
+    }
+    r->refilling = true;
+    while (level < r->high) {
+        fill_entry(p, &r->entries[head & r->mask]);
+        head++;
+        if (++batch == 64) {
+            atomic_store_explicit(&r->head, head, memory_order_release);
+            batch = 0;
+        }
+        level = head - atomic_load_explicit(&r->tail, memory_order_acquire);
+    }
+    atomic_store_explicit(&r->head, head, memory_order_release);
+    r->refilling = false;
+    return true;
+}
+
+// Tuottajasäikeen pääfunktio
+static void *producer_main(void *arg) {
+    struct pregen_producer *p = arg;
+    cpu_set_t set;
+
+    // Sido tuottaja ennen ensimmäistä täyttöä, jotta renkaiden muisti varataan sen NUMA-solmusta
+    CPU_ZERO(&set);
+    CPU_SET(p->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "Tuottajaa ei voitu sitoa prosessorille %d\n", p->cpu);
+    }
+
+    while (true) {
+        unsigned requests = atomic_load(&p->requests);
+        bool filled = false;
+
+        for (int i = 0; i < p->nrings; i++) {
+            filled |= fill_ring(p, p->rings[i]);
+        }
+        if (filled) {
+            continue;
+        }
+
+        // Kaikki renkaat ovat alarajan yläpuolella: nuku, kunnes jokin palvelusäie pyytää täyttöä.
+        // Pyyntö, joka tuli laskurin lukemisen jälkeen, estää nukahtamisen (futexin arvo on muuttunut).
+        atomic_store(&p->sleeping, true);
+        if (atomic_load(&p->requests) == requests) {
+            syscall(SYS_futex, &p->requests, FUTEX_WAIT_PRIVATE, requests, NULL, NULL, 0);
+        }
+        atomic_store(&p->sleeping, false);
+    }
+    return NULL;
+}
+
+int pregen_start(struct pregen_ring **rings, int n, int nproducers, unsigned depth, unsigned low, unsigned high,
+                 int ncpus) {
+    struct pregen_producer *producers = aligned_alloc(64, nproducers * sizeof(*producers));
+
+    if (producers == NULL) {
+        perror("Failed to allocate producers");
+        return -1;
+    }
+    memset(producers, 0, nproducers * sizeof(*producers));
+
+    for (int j = 0; j < nproducers; j++) {
+        struct pregen_producer *p = &producers[j];
+
+        p->cpu = ((ncpus - 1 - j) % ncpus + ncpus) % ncpus;
+        p->rings = calloc((n + nproducers - 1) / nproducers, sizeof(*p->rings));
+        if (p->rings == NULL) {
+            perror("Failed to allocate producer rings");
+            return -1;
+        }
+        lotto_rng_seed_random(&p->rng, 0x70726567 + j);
+    }
+
+    // Paikkoihin ei kosketa tässä, joten tuottaja varaa niiden sivut ensimmäisellä täytöllä
+    for (int i = 0; i < n; i++) {
+        struct pregen_ring *r = rings[i];
+        struct pregen_producer *p = &producers[i % nproducers];
+
+        memset(r, 0, sizeof(*r));
+        r->mask = depth - 1;
+        r->low = low;
+        r->high = high;
+        r->refilling = true;
+        r->producer = p;
+        r->entries = aligned_alloc(64, depth * sizeof(*r->entries));
+        if (r->entries == NULL) {
+            perror("Failed to allocate pregeneration ring");
+            return -1;
+        }
+        p->rings[p->nrings++] = r;
+    }
+
+    for (int j = 0; j < nproducers; j++) {
+        if (pthread_create(&producers[j].thread, NULL, producer_main, &producers[j]) != 0) {
+            fprintf(stderr, "Tuottajasäikeen luonti epäonnistui\n");
+            return -1;
+        }
+        pthread_detach(producers[j].thread);
+    }
+    return 0;
+}
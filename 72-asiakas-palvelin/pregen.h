@@ -0,0 +1,82 @@
+/*
+ * pregen.h
+ *
+ * Arvontojen esituotanto. Ilman sitä palvelusäie arpoo ja muotoilee numerot vastaanoton ja lähetyksen
+ * välissä, ja se työ lisätään suoraan vastauksen viiveeseen. Esituotannossa erilliset tuottajasäikeet
+ * täyttävät jokaisen palvelusäikeen omaa rengasta valmiiksi arvotuilla oletuspelin (7/40) riveillä,
+ * joissa on mukana myös valmiiksi muotoiltu tekstivastaus. Palvelusäie vain ottaa renkaasta rivin
+ * ja kopioi sen vastaukseen. Muiden pelien rivit arvotaan edelleen palvelusäikeessä.
+ *
+ * Renkaassa on yksi kirjoittaja (tuottaja) ja yksi lukija (palvelusäie), joten se toimii ilman
+ * lukkoja. Täyttö on porrastettu: kun renkaan täyttöaste laskee alarajalle (low), palvelusäie
+ * herättää tuottajan, joka täyttää renkaan ylärajalle (high) asti. Tuottaja ei siis herää jokaisen
+ * rivin jälkeen, ja palvelusäie tekee herätyksen vain, jos tuottaja nukkuu. Jos rengas on tyhjä,
+ * palvelusäie arpoo rivin itse ja kirjaa pysähdyksen (metrics.h: pregen_stalls), joten tuottajien
+ * jääminen jälkeen näkyy mittareissa eikä pysäytä palvelua.
+ *
+ * Tuottajat sidotaan prosessoreille lopusta alkaen (palvelusäikeet sidotaan alusta alkaen), ja
+ * tuottaja koskee renkaidensa muistiin ensimmäisenä, joten muisti varataan tuottajan NUMA-solmusta.
+ */
+
+#ifndef PREGEN_H
+#define PREGEN_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define PREGEN_TEXT_SIZE 55  // Tekstivastaus: etuliite ja seitsemän numeroa pilkuin eroteltuna sekä nollamerkki
+
+// Valmiiksi arvottu rivi (yksi välimuistirivi)
+struct pregen_entry {
+    uint8_t numbers[PROTO_DEFAULT_PICK];  // Rivi oletuspelistä
+    uint8_t text_len;                     // Tekstivastauksen pituus ilman nollamerkkiä
+    char text[PREGEN_TEXT_SIZE];          // Tekstivastaus nollamerkkeineen
+} __attribute__((aligned(64)));
+
+struct pregen_producer;
+
+// Palvelusäikeen rengas. Kirjoittajan ja lukijan kentät ovat eri välimuistiriveillä.
+struct pregen_ring {
+    atomic_uint head __attribute__((aligned(64)));  // Seuraava kirjoitettava paikka (tuottaja)
+    bool refilling;                                 // Täytetäänkö ylärajalle asti (tuottaja)
+    atomic_uint tail __attribute__((aligned(64)));  // Seuraava luettava paikka (palvelusäie)
+    unsigned mask;                                  // Renkaan koko - 1 (koko on kahden potenssi)
+    unsigned low;                                   // Täyttöaste, jolla tuottaja herätetään
+    unsigned high;                                  // Täyttöaste, johon tuottaja täyttää
+    struct pregen_producer *producer;               // Rengasta täyttävä tuottaja
+    struct pregen_entry *entries;                   // Paikat
+};
+
+// Herättää renkaan tuottajan (pregen_take kutsuu alarajalla)
+void pregen_wake(struct pregen_ring *r);
+
+// Ottaa renkaasta seuraavan rivin tai palauttaa NULL, jos rengas on tyhjä. Rivi on voimassa vain
+// seuraavaan kutsuun asti (paikka vapautetaan tuottajalle heti). Vain renkaan oma palvelusäie saa kutsua.
+static inline const struct pregen_entry *pregen_take(struct pregen_ring *r) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned level = atomic_load_explicit(&r->head, memory_order_acquire) - tail;
+    const struct pregen_entry *e;
+
+    if (level == 0) {
+        return NULL;
+    }
+    e = &r->entries[tail & r->mask];
+    // Paikka vapautetaan heti, mutta tuottaja jättää renkaaseen aina yhden tyhjän paikan, joten se ei
+    // kirjoita juuri luettuun paikkaan ennen kuin palvelusäie ottaa seuraavan rivin
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    if (level - 1 == r->low) {
+        pregen_wake(r);
+    }
+    return e;
+}
+
+// Varaa n palvelusäikeen renkaat (koko depth paikkaa, kahden potenssi) ja käynnistää nproducers
+// tuottajasäiettä. Tuottaja j täyttää renkaat j, j + nproducers, ... ja sidotaan prosessorille
+// ncpus - 1 - j (modulo ncpus). Rajat low < high <= depth - 1. Palauttaa 0 tai -1.
+int pregen_start(struct pregen_ring **rings, int n, int nproducers, unsigned depth, unsigned low, unsigned high,
+                 int ncpus);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * protocol.h
+ *
+ * Palvelimen ja asiakkaan binääriprotokolla. Pyyntö on pelkkä 12 tavun otsake, jossa on pyynnön
+ * tunniste, haluttujen rivien määrä ja pelin parametrit (numeroiden määrä ja arvottavien numeroiden
+ * määrä). Vastauksessa on sama otsake ja sen perässä rivit tiiviisti pakattuna: jokainen numero on
+ * yksi tavu ja jokainen rivi pick tavua. Vastaus mahtuu aina yhteen Ethernet-kehykseen, joten
+ * palvelin palauttaa enintään niin monta riviä kuin mahtuu; otsakkeen rivimäärä kertoo, montako
+ * riviä vastauksessa on. Asiakas voi pyytää loput uudella pyynnöllä, ja pyyntöjä voi olla matkalla
+ * useita yhtä aikaa, koska vastaukset tunnistetaan pyynnön tunnisteesta.
+ *
+ * Monitavuiset kentät ovat verkon tavujärjestyksessä. Ensimmäinen tavu (PROTO_MAGIC) ei ole
+ * tulostettava merkki, joten palvelin erottaa binääripyynnöt vanhoista tekstipyynnöistä.
+ *
+ * TCP-yhteydellä viestit (binääri- tai tekstiviestit) erotetaan toisistaan kehystämällä: jokaisen
+ * viestin edellä on sen pituus kahtena tavuna. Pyyntöjä voi lähettää useita vastauksia odottamatta,
+ * ja vastaukset tulevat samassa järjestyksessä.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROTO_MAGIC 0xA7         // Binääriviestin ensimmäinen tavu
+#define PROTO_VERSION 1          // Protokollan versio
+#define PROTO_HEADER_SIZE 12     // Otsakkeen koko tavuina
+#define PROTO_MAX_DATAGRAM 1472  // Vastauksen enimmäiskoko (Ethernet-kehys ilman IP- ja UDP-otsakkeita)
+#define PROTO_FRAME_HEADER 2     // TCP-viestin pituuskentän koko
+#define PROTO_DEFAULT_POOL 40    // Numeroiden määrä, jos pyynnössä on 0
+#define PROTO_DEFAULT_PICK 7     // Arvottavien numeroiden määrä, jos pyynnössä on 0
+
+// Viestin tyyppi
+enum proto_type {
+    PROTO_REQUEST = 1,   // Asiakkaan pyyntö
+    PROTO_RESPONSE = 2,  // Palvelimen vastaus
+};
+
+// Vastauksen tila
+enum proto_status {
+    PROTO_OK = 0,           // Rivit ovat vastauksessa
+    PROTO_BAD_VERSION = 1,  // Palvelin ei tue pyynnön versiota (vastauksen versio kertoo tuetun version)
+    PROTO_BAD_REQUEST = 2,  // Virheellinen pyyntö (tyyppi, pituus tai parametrit)
+};
+
+// Otsake purettuna (viestissä kentät ovat tässä järjestyksessä ilman täytettä)
+struct proto_header {
+    uint8_t magic;    // PROTO_MAGIC
+    uint8_t version;  // PROTO_VERSION
+    uint8_t type;     // enum proto_type
+    uint8_t status;   // enum proto_status (pyynnössä 0)
+    uint32_t id;      // Pyynnön tunniste, palautetaan vastauksessa sellaisenaan
+    uint16_t rows;    // Pyynnössä haluttujen, vastauksessa mukana olevien rivien määrä
+    uint8_t pool;     // Numerot väliltä 1..pool (0 = PROTO_DEFAULT_POOL)
+    uint8_t pick;     // Numeroita rivillä (0 = PROTO_DEFAULT_PICK)
+};
+
+// Kirjoittaa otsakkeen puskurin alkuun
+static inline void proto_write_header(char *buf, const struct proto_header *h) {
+    uint32_t id = htonl(h->id);
+    uint16_t rows = htons(h->rows);
+
+    buf[0] = h->magic;
+    buf[1] = h->version;
+    buf[2] = h->type;
+    buf[3] = h->status;
+    memcpy(buf + 4, &id, 4);
+    memcpy(buf + 8, &rows, 2);
+    buf[10] = h->pool;
+    buf[11] = h->pick;
+}
+
+// Lukee otsakkeen puskurin alusta. Palauttaa 0 tai -1, jos viesti ei ole binääriviesti.
+static inline int proto_read_header(const char *buf, size_t len, struct proto_header *h) {
+    uint32_t id;
+    uint16_t rows;
+
+    if (len < PROTO_HEADER_SIZE || (uint8_t)buf[0] != PROTO_MAGIC) {
+        return -1;
+    }
+    h->magic = buf[0];
+    h->version = buf[1];
+    h->type = buf[2];
+    h->status = buf[3];
+    memcpy(&id, buf + 4, 4);
+    memcpy(&rows, buf + 8, 2);
+    h->id = ntohl(id);
+    h->rows = ntohs(rows);
+    h->pool = buf[10];
+    h->pick = buf[11];
+    return 0;
+}
+
+// Palauttaa, montako riviä mahtuu yhteen vastaukseen
+static inline unsigned proto_max_rows(unsigned pick) {
+    return (PROTO_MAX_DATAGRAM - PROTO_HEADER_SIZE) / pick;
+}
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * shm.c
+ *
+ * Jaetun muistin kanava saman koneen asiakkaille (ks. shm.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "shm.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+bool shm_yield;
+
+// Palauttaa monotonisen ajan nanosekunteina
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Odottaa enintään timeout_ns nanosekuntia, jos sanan arvo on yhä value. Jaettu muisti, joten
+// FUTEX_PRIVATE_FLAG ei kelpaa.
+static void futex_wait(atomic_uint *word, unsigned value, uint64_t timeout_ns) {
+    struct timespec ts = {timeout_ns / 1000000000ULL, timeout_ns % 1000000000ULL};
+
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+void shm_relax(void) {
+    if (shm_yield) {
+        sched_yield();
+    } else {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+void shm_init(void) {
+    shm_yield = sysconf(_SC_NPROCESSORS_ONLN) <= 1;
+}
+
+// Alustaa kanavan tyhjäksi
+static void channel_init(struct shm_channel *c) {
+    c->region = NULL;
+    c->sock = -1;
+    c->memfd = -1;
+    c->eventfd = -1;
+}
+
+int shm_listen(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    int sock;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Jaetun muistin socketin polku on liian pitkä: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    if ((sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        perror("Shared memory socket creation failed");
+        return -1;
+    }
+    unlink(path);  // Edellisen ajon jättämä socket
+    if (bind(sock, (const struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0) {
+        perror("Binding shared memory socket failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int shm_accept(struct shm_channel *c, int sock) {
+    char cbuf[CMSG_SPACE(2 * sizeof(int))] = {0};
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = cbuf, .msg_controllen = sizeof(cbuf)};
+    struct cmsghdr *cmsg;
+    void *p;
+
+    channel_init(c);
+    c->sock = sock;
+    c->memfd = memfd_create("lotto-shm", MFD_CLOEXEC);
+    if (c->memfd < 0 || ftruncate(c->memfd, sizeof(struct shm_region)) < 0) {
+        perror("memfd_create");
+        shm_close(c);
+        return -1;
+    }
+    p = mmap(NULL, sizeof(struct shm_region), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, c->memfd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        shm_close(c);
+        return -1;
+    }
+    c->region = p;  // memfd on nollattu, joten renkaat ovat valmiiksi tyhjiä
+    c->region->magic = SHM_MAGIC;
+    c->region->slots = SHM_SLOTS;
+    c->region->slot_size = SHM_SLOT_SIZE;
+
+    c->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c->eventfd < 0) {
+        perror("eventfd");
+        shm_close(c);
+        return -1;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), (int[]){c->memfd, c->eventfd}, 2 * sizeof(int));
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
+        perror("sendmsg");
+        shm_close(c);
+        return -1;
+    }
+    return 0;
+}
+
+void shm_wake_client(struct shm_channel *c) {
+    if (shm_should_wake(&c->region->responses)) {
+        syscall(SYS_futex, &c->region->responses.head, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+int shm_connect(struct shm_channel *c, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    char cbuf[CMSG_SPACE(2 * sizeof(int))];
+    char byte;
+    struct iovec iov = {&byte, 1};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = cbuf, .msg_controllen = sizeof(cbuf)};
+    struct cmsghdr *cmsg;
+    int fds[2];
+    void *p;
+
+    channel_init(c);
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Jaetun muistin socketin polku on liian pitkä: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    c->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(c->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        shm_close(c);
+        return -1;
+    }
+    if (recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC) <= 0) {
+        perror("recvmsg");
+        shm_close(c);
+        return -1;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+        fprintf(stderr, "Palvelin ei lähettänyt muistialuetta\n");
+        shm_close(c);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    c->memfd = fds[0];
+    c->eventfd = fds[1];
+
+    p = mmap(NULL, sizeof(struct shm_region), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, c->memfd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        shm_close(c);
+        return -1;
+    }
+    c->region = p;
+    if (c->region->magic != SHM_MAGIC || c->region->slots != SHM_SLOTS || c->region->slot_size != SHM_SLOT_SIZE) {
+        fprintf(stderr, "Palvelimen muistialue on eri versiota\n");
+        shm_close(c);
+        return -1;
+    }
+    return 0;
+}
+
+int shm_send(struct shm_channel *c, const char *msg, size_t len) {
+    struct shm_slot *slot = shm_reserve(&c->region->requests);
+    uint64_t one = 1;
+
+    if (slot == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (len > sizeof(slot->data)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    memcpy(slot->data, msg, len);
+    slot->len = len;
+    shm_commit(&c->region->requests);
+
+    if (shm_should_wake(&c->region->requests) && write(c->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        return -1;
+    }
+    return 0;
+}
+
+int shm_receive(struct shm_channel *c, char *buf, size_t size) {
+    const struct shm_slot *slot = shm_peek(&c->region->responses);
+    size_t len;
+
+    if (slot == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+    len = slot->len < size ? slot->len : size;
+    memcpy(buf, slot->data, len);
+    shm_release(&c->region->responses);
+    return len;
+}
+
+bool shm_wait(struct shm_channel *c, uint64_t timeout_ns) {
+    struct shm_ring *r = &c->region->responses;
+    uint64_t start = now_ns(), now;
+
+    // Ensin kysellään: vastaus tulee yleensä ennen kuin nukahtaminen ja herätys ehtisivät
+    while (!shm_pending(r)) {
+        now = now_ns();
+        if (now - start >= timeout_ns) {
+            return false;
+        }
+        if (now - start >= SHM_SPIN_NS) {
+            break;
+        }
+        shm_relax();
+    }
+
+    // Sitten nukutaan head-indeksillä, kunnes palvelin kirjoittaa vastauksen
+    while (!shm_pending(r)) {
+        unsigned head = atomic_load(&r->head);
+
+        now = now_ns();
+        if (now - start >= timeout_ns) {
+            return false;
+        }
+        if (shm_sleep(r)) {
+            futex_wait(&r->head, head, timeout_ns - (now - start));
+            atomic_store(&r->sleeping, 0);
+        }
+    }
+    return true;
+}
+
+void shm_close(struct shm_channel *c) {
+    if (c->region != NULL) {
+        munmap(c->region, sizeof(struct shm_region));
+    }
+    if (c->memfd >= 0) {
+        close(c->memfd);
+    }
+    if (c->eventfd >= 0) {
+        close(c->eventfd);
+    }
+    if (c->sock >= 0) {
+        close(c->sock);
+    }
+    channel_init(c);
+}
@@ -0,0 +1,153 @@
+/*
+ * shm.h
+ *
+ * Saman koneen asiakkaiden jaetun muistin kanava. Asiakas ottaa yhteyden palvelimen Unix-socketiin,
+ * ja palvelin luo asiakkaalle memfd-muistialueen ja eventfd-kuvaajan ja lähettää ne socketin kautta
+ * (SCM_RIGHTS). Muistialueella on kaksi rengasta: pyynnöt asiakkaalta palvelimelle ja vastaukset
+ * palvelimelta asiakkaalle. Kummassakin renkaassa on yksi kirjoittaja ja yksi lukija, joten ne
+ * toimivat ilman lukkoja: kirjoittaja julkaisee viestin siirtämällä head-indeksiä ja lukija vapauttaa
+ * paikan siirtämällä tail-indeksiä. Viestit ovat samat kuin UDP:llä (protocol.h), ja palvelin
+ * kirjoittaa vastauksen suoraan renkaan paikkaan.
+ *
+ * Järjestelmäkutsuja tarvitaan vain, kun toinen osapuoli on jouten. Lukija kyselee rengasta ensin
+ * hetken (SHM_SPIN_NS), ja vasta sitten se merkitsee renkaaseen nukkuvansa ja odottaa: palvelin
+ * eventfd-kuvaajaa tapahtumasilmukassaan ja asiakas futexia vastausrenkaan head-indeksillä.
+ * Kirjoittaja herättää lukijan vain, jos tämä on merkinnyt nukkuvansa. Merkintä ja indeksit ovat
+ * peräkkäisjohdonmukaisia (seq_cst), joten herätys ei voi jäädä väliin: joko lukija näkee uuden
+ * viestin ennen nukahtamista tai kirjoittaja näkee merkinnän.
+ *
+ * Yksiprosessorisella koneella kysely antaa vuoron toiselle osapuolelle (sched_yield), koska
+ * pelkkä odottelu ei voisi koskaan nähdä toisen osapuolen kirjoitusta.
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_MAGIC 0x4c4f5454u  // Muistialueen tunniste ("LOTT")
+#define SHM_SLOTS 256          // Renkaan paikkojen määrä (kahden potenssi); asiakkaalla enintään näin monta pyyntöä matkalla
+#define SHM_SLOT_SIZE 1536     // Paikan koko: pituus ja viesti (vastaus enintään PROTO_MAX_DATAGRAM + nollamerkki)
+#define SHM_SPIN_NS 50000      // Kauanko lukija kyselee rengasta ennen nukahtamista (50 µs)
+
+// Renkaan paikka
+struct shm_slot {
+    uint32_t len;                                 // Viestin pituus
+    char data[SHM_SLOT_SIZE - sizeof(uint32_t)];  // Viesti
+};
+
+// Rengas. Kirjoittajan ja lukijan indeksit ja nukkumismerkintä ovat eri välimuistiriveillä.
+struct shm_ring {
+    atomic_uint head __attribute__((aligned(64)));      // Seuraava kirjoitettava paikka (kirjoittaja)
+    atomic_uint tail __attribute__((aligned(64)));      // Seuraava luettava paikka (lukija)
+    atomic_uint sleeping __attribute__((aligned(64)));  // Lukija odottaa herätystä
+    struct shm_slot slots[SHM_SLOTS] __attribute__((aligned(64)));
+};
+
+// Jaettu muistialue
+struct shm_region {
+    uint32_t magic;             // SHM_MAGIC
+    uint32_t slots;             // SHM_SLOTS (asiakas tarkistaa, että rakenne on sama)
+    uint32_t slot_size;         // SHM_SLOT_SIZE
+    struct shm_ring requests;   // Pyynnöt: asiakas kirjoittaa, palvelin lukee
+    struct shm_ring responses;  // Vastaukset: palvelin kirjoittaa, asiakas lukee (futex head-indeksillä)
+};
+
+// Kanavan toinen pää
+struct shm_channel {
+    struct shm_region *region;  // Liitetty muistialue (NULL = ei yhteyttä)
+    int sock;                   // Unix-socket (yhteyden katkeaminen kertoo, että toinen pää on poissa)
+    int memfd;                  // Muistialueen tiedosto (palvelin)
+    int eventfd;                // Palvelimen herätys
+};
+
+extern bool shm_yield;  // Annetaanko kyselyssä vuoro muille (yksi prosessori)
+
+// Palauttaa vapaan paikan kirjoittajalle tai NULL, jos rengas on täynnä
+static inline struct shm_slot *shm_reserve(struct shm_ring *r) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == SHM_SLOTS) {
+        return NULL;
+    }
+    return &r->slots[head & (SHM_SLOTS - 1)];
+}
+
+// Julkaisee shm_reserve-funktion antaman paikan lukijalle
+static inline void shm_commit(struct shm_ring *r) {
+    atomic_fetch_add(&r->head, 1);  // seq_cst: ks. shm_should_wake
+}
+
+// Palauttaa seuraavan luettavan viestin tai NULL, jos rengas on tyhjä
+static inline const struct shm_slot *shm_peek(struct shm_ring *r) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&r->head, memory_order_acquire)) {
+        return NULL;
+    }
+    return &r->slots[tail & (SHM_SLOTS - 1)];
+}
+
+// Vapauttaa shm_peek-funktion antaman paikan kirjoittajalle
+static inline void shm_release(struct shm_ring *r) {
+    atomic_store_explicit(&r->tail, atomic_load_explicit(&r->tail, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// Onko renkaassa luettavaa
+static inline bool shm_pending(struct shm_ring *r) {
+    return atomic_load(&r->tail) != atomic_load(&r->head);
+}
+
+// Kirjoittaja: palauttaa toden, jos lukija nukkuu ja se pitää herättää (merkintä poistetaan)
+static inline bool shm_should_wake(struct shm_ring *r) {
+    return atomic_load(&r->sleeping) && atomic_exchange(&r->sleeping, 0);
+}
+
+// Lukija: merkitsee nukkuvansa. Palauttaa epätoden (ja poistaa merkinnän), jos renkaaseen ehti tulla
+// viesti, jolloin lukijan on luettava se ennen odottamista.
+static inline bool shm_sleep(struct shm_ring *r) {
+    atomic_store(&r->sleeping, 1);
+    if (shm_pending(r)) {
+        atomic_store(&r->sleeping, 0);
+        return false;
+    }
+    return true;
+}
+
+// Kyselysilmukan tauko
+void shm_relax(void);
+
+// Valitsee kyselytavan prosessorien määrän mukaan
+void shm_init(void);
+
+// Palvelin: luo estämättömän Unix-socketin path, josta asiakkaat pyytävät kanavaa. Palauttaa socketin tai -1.
+int shm_listen(const char *path);
+
+// Palvelin: luo kanavan uudelle asiakkaalle ja lähettää sille muistialueen ja herätyskuvaajan
+// socketin sock kautta. Palauttaa 0 tai -1 (socket suljetaan).
+int shm_accept(struct shm_channel *c, int sock);
+
+// Palvelin: herättää asiakkaan, jos se nukkuu vastausta odottaen
+void shm_wake_client(struct shm_channel *c);
+
+// Asiakas: ottaa yhteyden palvelimen Unix-socketiin path ja liittää muistialueen. Palauttaa 0 tai -1.
+int shm_connect(struct shm_channel *c, const char *path);
+
+// Asiakas: kirjoittaa pyynnön ja herättää palvelimen tarvittaessa. Palauttaa 0 tai -1 (errno EAGAIN,
+// jos rengas on täynnä).
+int shm_send(struct shm_channel *c, const char *msg, size_t len);
+
+// Asiakas: kopioi seuraavan vastauksen puskuriin. Palauttaa pituuden tai -1 (errno EAGAIN, jos
+// vastausta ei ole).
+int shm_receive(struct shm_channel *c, char *buf, size_t size);
+
+// Asiakas: odottaa vastausta enintään timeout_ns nanosekuntia. Palauttaa toden, jos vastaus on luettavissa.
+bool shm_wait(struct shm_channel *c, uint64_t timeout_ns);
+
+// Sulkee kanavan
+void shm_close(struct shm_channel *c);
+
+#endif
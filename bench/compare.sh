@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# compare.sh
+#
+# Vertaa run.sh:n tuloksia perustasoon. Jokaisesta nimestä ja mittarista käytetään toistojen paras
+# arvo (pienin, läpäisyllä suurin). Heikkenemiseksi merkitään vain vakaat päämittarit: seinäkelloaika,
+# kellojaksot, käskyt, välimuistihudit, järjestelmäkutsut (myös pyyntöä kohden), läpäisy ja p99-viive.
+# Alle 50 ms kestävien ajojen seinäkelloaika vaihtelee liikaa, joten niissä se vain tulostetaan.
+# UDP-ajot (udp_*) kestävät kiinteän ajan, joten niiden kokonaismäärät (aika, jaksot, käskyt,
+# järjestelmäkutsut) kasvavat palveltujen pyyntöjen mukana. Niissä vertaillaan vain läpäisyä,
+# p99-viivettä ja järjestelmäkutsuja pyyntöä kohden. Muut mittarit tulostetaan tiedoksi. Päättyy
+# virheeseen, jos jokin päämittari on heikentynyt yli kynnyksen tai jokin ajo päättyi virheeseen.
+#
+# Käyttö: ./compare.sh perustaso.tsv tulokset.tsv [kynnys_prosentteina]
+
+set -e
+
+if [ $# -lt 2 ]; then
+    echo "Käyttö: $0 perustaso.tsv tulokset.tsv [kynnys_prosentteina]" >&2
+    exit 2
+fi
+
+awk -F '\t' -v threshold="${3:-10}" '
+    # Suuremmat arvot ovat parempia vain läpäisyllä
+    function higher_is_better(metric) {
+        return metric == "requests_per_s"
+    }
+    function gated(label, metric, base_value) {
+        if (label ~ /^udp_/) {
+            return metric ~ /^(syscalls_per_request|requests_per_s|p99_us)$/
+        }
+        if (metric == "wall_ms" && base_value < 50) {
+            return 0
+        }
+        return metric ~ /^(wall_ms|cycles|instructions|cache_misses|syscalls|syscalls_per_request|requests_per_s|p99_us)$/
+    }
+    function better(metric, a, b) {
+        return higher_is_better(metric) ? a > b : a < b
+    }
+    {
+        key = $1 SUBSEP $2
+        if (FILENAME == ARGV[1]) {
+            if (!(key in base) || better($2, $3 + 0, base[key])) {
+                base[key] = $3 + 0
+            }
+        } else {
+            if (!(key in result)) {
+                order[n++] = key
+            }
+            if (!(key in result) || better($2, $3 + 0, result[key])) {
+                result[key] = $3 + 0
+            }
+        }
+    }
+    END {
+        printf "%-26s %-22s %14s %14s %9s\n", "nimi", "mittari", "perustaso", "nyt", "muutos"
+        for (i = 0; i < n; i++) {
+            key = order[i]
+            split(key, part, SUBSEP)
+            if (part[2] == "exit_status") {
+                if (result[key] != 0) {
+                    printf "%-26s ohjelma päättyi tilaan %d\n", part[1], result[key]
+                    failed++
+                }
+                continue
+            }
+            if (!(key in base)) {
+                printf "%-26s %-22s %14s %14.6g %9s\n", part[1], part[2], "-", result[key], "uusi"
+                continue
+            }
+            if (base[key] == 0) {
+                change = result[key] == 0 ? 0 : 100
+            } else {
+                change = (result[key] - base[key]) * 100 / base[key]
+            }
+            worse = higher_is_better(part[2]) ? -change : change
+            flag = ""
+            if (gated(part[1], part[2], base[key]) && worse > threshold) {
+                flag = "  HEIKENTYNYT"
+                regressions++
+            }
+            printf "%-26s %-22s %14.6g %14.6g %+8.1f%%%s\n", part[1], part[2], base[key], result[key], change, flag
+        }
+        if (regressions > 0 || failed > 0) {
+            printf "\n%d mittaria heikentyi yli %s %%, %d ajoa epäonnistui\n", regressions, threshold, failed
+            exit 1
+        }
+        printf "\nEi heikentymiä (kynnys %s %%)\n", threshold
+    }' "$1" "$2"
@@ -0,0 +1,204 @@
+/*
+ * gentree
+ *
+ * Luo hakemistolistauksen mittauksia varten synteettisen hakemistopuun: jokaisessa hakemistossa on
+ * FILES tiedostoa ja, syvyyteen DEPTH asti, FANOUT alihakemistoa. Tiedostoille lisätään keskimäärin
+ * XATTR user.*-laajennettua attribuuttia (esim. 0.5 = joka toisella tiedostolla yksi, 2 = kaksi
+ * jokaisella). Tiedostojen sisältö on SIZE tavua. Puu on sama jokaisella ajolla, koska satunnaisluvut
+ * tulevat kiinteästä siemenestä.
+ *
+ * Hakemistot ja tiedostot luodaan hakemistokuvaajien suhteen (mkdirat, openat), joten polkuja ei
+ * tarvitse jäsentää uudelleen jokaiselle tiedostolle.
+ *
+ * Käyttö: ./gentree [-d DEPTH] [-f FANOUT] [-n FILES] [-x XATTR] [-s SIZE] [-r SIEMEN] polku
+ *   -d DEPTH   alihakemistotasojen määrä (oletus 3)
+ *   -f FANOUT  alihakemistoja hakemistoa kohden (oletus 8)
+ *   -n FILES   tiedostoja hakemistoa kohden (oletus 50)
+ *   -x XATTR   laajennettuja attribuutteja tiedostoa kohden keskimäärin (oletus 0)
+ *   -s SIZE    tiedostojen koko tavuina (oletus 0)
+ *   -r SIEMEN  satunnaislukujen siemen (oletus 1)
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+// Puun muoto
+struct shape {
+    int depth;     // Alihakemistotasojen määrä
+    int fanout;    // Alihakemistoja hakemistoa kohden
+    int files;     // Tiedostoja hakemistoa kohden
+    double xattr;  // Laajennettuja attribuutteja tiedostoa kohden keskimäärin
+    size_t size;   // Tiedostojen koko
+};
+
+// Luodut kohteet
+struct totals {
+    long dirs;    // Hakemistot
+    long files;   // Tiedostot
+    long xattrs;  // Laajennetut attribuutit
+};
+
+static uint64_t rng_state;  // xorshift64-generaattorin tila
+static char *content;       // Tiedostojen sisältö
+
+// Palauttaa seuraavan satunnaisluvun
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Palauttaa tiedostolle lisättävien attribuuttien määrän: keskiarvon kokonaisosa ja murto-osan
+// todennäköisyydellä yksi lisää
+static int xattr_count(double mean) {
+    int n = (int)mean;
+
+    if ((double)(next_random() >> 11) / (1ULL << 53) < mean - n) {
+        n++;
+    }
+    return n;
+}
+
+// Luo tiedoston hakemistoon dir. Palauttaa 0 tai -1.
+static int make_file(int dir, const char *name, const struct shape *s, struct totals *t) {
+    int fd = openat(dir, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int n;
+
+    if (fd < 0) {
+        perror(name);
+        return -1;
+    }
+    if (s->size > 0 && write(fd, content, s->size) != (ssize_t)s->size) {
+        perror("write");
+        close(fd);
+        return -1;
+    }
+    n = xattr_count(s->xattr);
+    for (int i = 0; i < n; i++) {
+        char key[32], value[32];
+        int len;
+
+        snprintf(key, sizeof(key), "user.bench%d", i);
+        len = snprintf(value, sizeof(value), "%016llx", (unsigned long long)next_random());
+        if (fsetxattr(fd, key, value, len, 0) < 0) {
+            perror("fsetxattr");
+            close(fd);
+            return -1;
+        }
+        t->xattrs++;
+    }
+    close(fd);
+    t->files++;
+    return 0;
+}
+
+// Täyttää hakemiston dir tiedostoilla ja, jos level < depth, alihakemistoilla. Palauttaa 0 tai -1.
+static int fill_dir(int dir, int level, const struct shape *s, struct totals *t) {
+    char name[32];
+
+    for (int i = 0; i < s->files; i++) {
+        snprintf(name, sizeof(name), "tiedosto%04d", i);
+        if (make_file(dir, name, s, t) < 0) {
+            return -1;
+        }
+    }
+    if (level == s->depth) {
+        return 0;
+    }
+    for (int i = 0; i < s->fanout; i++) {
+        int sub;
+
+        snprintf(name, sizeof(name), "hakemisto%03d", i);
+        if (mkdirat(dir, name, 0755) < 0 && errno != EEXIST) {
+            perror(name);
+            return -1;
+        }
+        if ((sub = openat(dir, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+            perror(name);
+            return -1;
+        }
+        t->dirs++;
+        if (fill_dir(sub, level + 1, s, t) < 0) {
+            close(sub);
+            return -1;
+        }
+        close(sub);
+    }
+    return 0;
+}
+
+// Tulostaa ohjelman käyttöohjeen
+static void usage(const char *program) {
+    fprintf(stderr, "Käyttö: %s [-d DEPTH] [-f FANOUT] [-n FILES] [-x XATTR] [-s SIZE] [-r SIEMEN] polku\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    struct shape s = {3, 8, 50, 0.0, 0};
+    struct totals t = {1, 0, 0};
+    unsigned long long seed = 1;
+    int opt, root;
+
+    while ((opt = getopt(argc, argv, "d:f:n:x:s:r:")) != -1) {
+        switch (opt) {
+            case 'd':
+                s.depth = atoi(optarg);
+                break;
+            case 'f':
+                s.fanout = atoi(optarg);
+                break;
+            case 'n':
+                s.files = atoi(optarg);
+                break;
+            case 'x':
+                s.xattr = atof(optarg);
+                break;
+            case 's':
+                s.size = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || s.depth < 0 || s.fanout < 0 || s.files < 0 || s.xattr < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    rng_state = seed * 0x9e3779b97f4a7c15ULL | 1;
+
+    if ((content = malloc(s.size + 1)) == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    memset(content, 'x', s.size);
+
+    if (mkdir(argv[optind], 0755) < 0 && errno != EEXIST) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if ((root = open(argv[optind], O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (fill_dir(root, 0, &s, &t) < 0) {
+        return EXIT_FAILURE;
+    }
+    close(root);
+    free(content);
+
+    printf("%ld hakemistoa, %ld tiedostoa, %ld laajennettua attribuuttia\n", t.dirs, t.files, t.xattrs);
+    return EXIT_SUCCESS;
+}
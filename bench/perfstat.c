@@ -0,0 +1,273 @@
+/*
+ * perfstat
+ *
+ * Ajaa komennon ja mittaa sen (ja kaikkien sen lapsiprosessien ja säikeiden) seinäkelloajan,
+ * käyttäjä- ja järjestelmäajan, muistin enimmäiskäytön sekä perf_event_open-laskurit: kellojaksot,
+ * käskyt, välimuistihudit, kontekstinvaihdot, sivuvirheet ja järjestelmäkutsut (raw_syscalls:sys_enter
+ * -jäljityspiste). Laskurit avataan ennen execve()-kutsua (enable_on_exec) ja periytyvät lapsille
+ * (inherit), joten mittaus kattaa vain komennon oman työn.
+ *
+ * Tulokset kirjoitetaan koneluettavina riveinä "nimi<TAB>mittari<TAB>arvo" tiedostoon (lisäten, yhdellä
+ * write()-kutsulla, joten useampi perfstat voi kirjoittaa samaan tiedostoon) tai virhevirtaan.
+ * Laskuri, jota ei voi avata (esimerkiksi laitteistolaskurit virtuaalikoneessa), jätetään pois.
+ * Jos laskureita on enemmän kuin prosessorissa on rekistereitä, ydin vuorottelee niitä, ja arvot
+ * skaalataan mitatun ajan osuudella.
+ *
+ * SIGINT ja SIGTERM välitetään komennolle, joten palvelinta voi mitata taustalla ja pysäyttää
+ * perfstatin kautta.
+ *
+ * Käyttö: ./perfstat [-o TIEDOSTO] [-l NIMI] [-q] komento [argumentit...]
+ *   -o TIEDOSTO  lisää tulosrivit tiedostoon (oletus virhevirta)
+ *   -l NIMI      tulosrivien nimi (oletus komennon nimi)
+ *   -q           älä ilmoita laskureista, joita ei voitu avata
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORD_SIZE 4096  // Tulosrivien puskuri
+
+// Mitattava laskuri
+struct counter {
+    const char *name;  // Mittarin nimi tulosrivillä
+    uint32_t type;     // PERF_TYPE_*
+    uint64_t config;   // Tapahtuma
+    int fd;            // Avattu laskuri (-1 = ei käytössä)
+};
+
+static struct counter counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+    {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1},
+    {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, -1},
+    {"page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, -1},
+    {"syscalls", PERF_TYPE_TRACEPOINT, 0, -1},  // config luetaan tracefs-tiedostosta
+};
+
+#define NCOUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+static volatile pid_t child;  // Mitattava komento (signaalien välitystä varten)
+
+// Välittää lopetussignaalin komennolle
+static void forward_signal(int sig) {
+    if (child > 0) {
+        kill(child, sig);
+    }
+}
+
+// Palauttaa raw_syscalls:sys_enter-jäljityspisteen tunnisteen tai -1, jos tracefs ei ole liitetty.
+// Ympäristömuuttuja PERFSTAT_TRACEFS ohittaa tavalliset liitoskohdat.
+static long syscall_tracepoint(void) {
+    const char *dirs[] = {getenv("PERFSTAT_TRACEFS"), "/sys/kernel/tracing", "/sys/kernel/debug/tracing"};
+    char path[512];
+    long id = -1;
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]) && id < 0; i++) {
+        FILE *f;
+
+        if (dirs[i] == NULL) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/events/raw_syscalls/sys_enter/id", dirs[i]);
+        if ((f = fopen(path, "r")) != NULL) {
+            if (fscanf(f, "%ld", &id) != 1) {
+                id = -1;
+            }
+            fclose(f);
+        }
+    }
+    return id;
+}
+
+// Avaa laskurit prosessille pid. Laskurit käynnistyvät, kun prosessi kutsuu execve()-funktiota.
+static void open_counters(pid_t pid, int quiet) {
+    long tracepoint = syscall_tracepoint();
+
+    for (size_t i = 0; i < NCOUNTERS; i++) {
+        struct counter *c = &counters[i];
+        struct perf_event_attr attr;
+
+        if (c->type == PERF_TYPE_TRACEPOINT) {
+            if (tracepoint < 0) {
+                if (!quiet) {
+                    fprintf(stderr, "perfstat: %s: tracefs ei ole liitetty (mount -t tracefs nodev /sys/kernel/tracing)\n",
+                            c->name);
+                }
+                continue;
+            }
+            c->config = tracepoint;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = c->type;
+        attr.config = c->config;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        c->fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (c->fd < 0 && !quiet) {
+            fprintf(stderr, "perfstat: %s: %s\n", c->name, strerror(errno));
+        }
+    }
+}
+
+// Lukee laskurin arvon ja skaalaa sen, jos laskuri oli vuorottelun vuoksi osan ajasta pois päältä.
+// Palauttaa 0 tai -1.
+static int read_counter(const struct counter *c, uint64_t *value) {
+    uint64_t v[3];  // Arvo, käytössä oloaika ja mittausaika
+
+    if (c->fd < 0 || read(c->fd, v, sizeof(v)) != sizeof(v)) {
+        return -1;
+    }
+    *value = v[2] > 0 && v[2] < v[1] ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+    return 0;
+}
+
+// Palauttaa monotonisen ajan nanosekunteina
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Lisää puskuriin tulosrivin
+static void add_record(char *buf, size_t *len, const char *label, const char *metric, const char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
+
+static void add_record(char *buf, size_t *len, const char *label, const char *metric, const char *fmt, ...) {
+    va_list ap;
+
+    if (*len >= RECORD_SIZE) {
+        return;
+    }
+    *len += snprintf(buf + *len, RECORD_SIZE - *len, "%s\t%s\t", label, metric);
+    if (*len >= RECORD_SIZE) {
+        return;
+    }
+    va_start(ap, fmt);
+    *len += vsnprintf(buf + *len, RECORD_SIZE - *len, fmt, ap);
+    va_end(ap);
+    if (*len < RECORD_SIZE) {
+        buf[(*len)++] = '\n';
+    }
+}
+
+// Tulostaa ohjelman käyttöohjeen
+static void usage(const char *program) {
+    fprintf(stderr, "Käyttö: %s [-o TIEDOSTO] [-l NIMI] [-q] komento [argumentit...]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL;  // Tulostiedosto (NULL = virhevirta)
+    const char *label = NULL;   // Tulosrivien nimi
+    int quiet = 0;              // Jätetäänkö avaamattomat laskurit ilmoittamatta
+    int ready[2];               // Putki, jolla lapsi pidetään odottamassa laskureiden avaamista
+    struct sigaction sa;
+    struct rusage ru;
+    uint64_t start, end;
+    char record[RECORD_SIZE];
+    size_t len = 0;
+    int opt, status, fd;
+
+    while ((opt = getopt(argc, argv, "+o:l:q")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (label == NULL) {
+        label = argv[optind];
+    }
+
+    if (pipe2(ready, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        return EXIT_FAILURE;
+    }
+    child = fork();
+    if (child < 0) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (child == 0) {
+        char byte;
+
+        // Odota, kunnes laskurit on avattu (putki sulkeutuu), ja käynnistä komento
+        close(ready[1]);
+        if (read(ready[0], &byte, 1) < 0) {
+            _exit(127);
+        }
+        execvp(argv[optind], argv + optind);
+        perror(argv[optind]);
+        _exit(127);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = forward_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    close(ready[0]);
+    open_counters(child, quiet);
+    start = now_ns();
+    close(ready[1]);
+    while (wait4(child, &status, 0, &ru) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            return EXIT_FAILURE;
+        }
+    }
+    end = now_ns();
+
+    add_record(record, &len, label, "wall_ms", "%.3f", (end - start) / 1e6);
+    add_record(record, &len, label, "user_ms", "%.3f", ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3);
+    add_record(record, &len, label, "sys_ms", "%.3f", ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3);
+    add_record(record, &len, label, "maxrss_kb", "%ld", ru.ru_maxrss);
+    for (size_t i = 0; i < NCOUNTERS; i++) {
+        uint64_t value;
+
+        if (read_counter(&counters[i], &value) == 0) {
+            add_record(record, &len, label, counters[i].name, "%llu", (unsigned long long)value);
+        }
+    }
+    add_record(record, &len, label, "exit_status", "%d",
+               WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+
+    fd = output != NULL ? open(output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : STDERR_FILENO;
+    if (fd < 0 || write(fd, record, len) != (ssize_t)len) {
+        perror(output != NULL ? output : "write");
+        return EXIT_FAILURE;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
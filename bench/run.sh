@@ -0,0 +1,149 @@
+#!/bin/sh
+#
+# run.sh
+#
+# Ajaa kaikkien kolmen ohjelman suorituskykyskenaariot perfstatin alla ja kirjoittaa tulokset
+# koneluettavaan TSV-tiedostoon (nimi, mittari, arvo). Jos perustaso annetaan, tuloksia verrataan
+# siihen (compare.sh), ja skripti päättyy virheeseen, jos jokin mittari on heikentynyt.
+#
+# Skenaariot:
+#   lister    hakemistolistaus gentree-puulla: yksi säie, kaikki säikeet, io_uring ja NDJSON
+#   udp       UDP-palvelin ja kuormitusasiakas paikallisen silmukan yli
+#   pingpong  kopioiden määrän pyyhkäisy signaaleilla sekä esihaarukoidulla joukolla ja futexilla
+#
+# Käyttö: ./run.sh [-o TULOS] [-b PERUSTASO] [-t KYNNYS] [-r TOISTOT] [skenaario...]
+#   -o TULOS      tulostiedosto (oletus results/AIKALEIMA.tsv)
+#   -b PERUSTASO  vertaa tuloksia perustasoon (esim. baseline.tsv)
+#   -t KYNNYS     sallittu heikkeneminen prosentteina (oletus 10)
+#   -r TOISTOT    kunkin ajon toistot (oletus 3), vertailussa käytetään parasta
+#
+# Ympäristömuuttujat: BENCH_TREE (valmis hakemistopuu gentreen sijaan), BENCH_DEPTH, BENCH_FANOUT,
+# BENCH_FILES ja BENCH_XATTR (gentreen puu), BENCH_UDP_SECONDS (kuormituksen kesto) ja BENCH_COPIES
+# (pingpongin kopioiden määrät).
+
+set -e
+
+cd "$(dirname "$0")"
+
+PERFSTAT=./perfstat
+LISTER=../50-Hakemistolistaus/50-Hakemistolistaus
+SERVER=../72-asiakas-palvelin/palvelin
+CLIENT=../72-asiakas-palvelin/asiakas
+PINGPONG="../22-signaali ping-pong/pingpong"
+
+OUT=results/$(date +%Y%m%d-%H%M%S).tsv
+BASELINE=
+THRESHOLD=10
+REPEAT=3
+
+while getopts o:b:t:r: opt; do
+    case $opt in
+        o) OUT=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        t) THRESHOLD=$OPTARG ;;
+        r) REPEAT=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+SCENARIOS=${*:-"lister udp pingpong"}
+
+mkdir -p "$(dirname "$OUT")"
+: > "$OUT"
+
+# Poista luotu puu ja pysäytä palvelin myös keskeytyksen jälkeen
+tree_tmp=
+server=
+cleanup() {
+    [ -n "$server" ] && kill -TERM "$server" 2> /dev/null
+    [ -n "$tree_tmp" ] && rm -rf "$tree_tmp"
+    return 0
+}
+trap cleanup EXIT
+
+# Järjestelmäkutsujen laskuri tarvitsee tracefsin; liitä se, jos voidaan
+if [ ! -e /sys/kernel/tracing/events ] && [ ! -e /sys/kernel/debug/tracing/events ]; then
+    if [ "$(id -u)" -eq 0 ] && mount -t tracefs nodev /sys/kernel/tracing 2> /dev/null; then
+        echo "tracefs liitetty: /sys/kernel/tracing"
+    else
+        echo "tracefs puuttuu, järjestelmäkutsuja ei lasketa" >&2
+    fi
+fi
+
+# Ajaa komennon perfstatin alla REPEAT kertaa nimellä $1. Epäonnistunut ajo ei keskeytä skriptiä:
+# sen tila kirjataan (exit_status), ja compare.sh raportoi sen.
+measure() {
+    label=$1
+    shift
+    for i in $(seq "$REPEAT"); do
+        $PERFSTAT -q -o "$OUT" -l "$label" "$@" > /dev/null || true
+    done
+    echo "  $label"
+}
+
+# Hakemistolistaus synteettisellä puulla. Ensimmäinen ajo lämmittää sivuvälimuistin.
+scenario_lister() {
+    tree=$BENCH_TREE
+    if [ -z "$tree" ]; then
+        tree_tmp=$(mktemp -d)
+        tree=$tree_tmp/puu
+        ./gentree -d "${BENCH_DEPTH:-3}" -f "${BENCH_FANOUT:-8}" -n "${BENCH_FILES:-50}" \
+            -x "${BENCH_XATTR:-0.5}" "$tree"
+    fi
+    $LISTER --recursive "$tree" > /dev/null
+    measure lister_t1 $LISTER --recursive --threads 1 "$tree"
+    measure lister_tn $LISTER --recursive --unordered "$tree"
+    measure lister_uring $LISTER --recursive --unordered --engine=uring "$tree"
+    measure lister_ndjson $LISTER --recursive --unordered --format=ndjson "$tree"
+}
+
+# UDP-kuormitus paikallisen silmukan yli: palvelin mitataan taustalla koko kuormituksen ajan, ja
+# asiakkaan läpäisy ja viiveet lisätään tuloksiin. Lisäksi lasketaan palvelimen järjestelmäkutsut
+# pyyntöä kohden.
+scenario_udp() {
+    log=$(mktemp)
+    for i in $(seq "$REPEAT"); do
+        $PERFSTAT -q -o "$OUT" -l udp_server $SERVER --quiet > /dev/null 2>&1 &
+        server=$!
+        sleep 0.3
+        $PERFSTAT -q -o "$OUT" -l udp_client $CLIENT --threads 1 --inflight 16 \
+            --duration "${BENCH_UDP_SECONDS:-2}" > "$log" || true
+        kill -TERM "$server"
+        wait "$server" || true
+        server=
+        requests=$(awk -v out="$OUT" '
+            /^Lähetetty/ { sub(/\(/, "", $5); rate = $5; requests = $2 }
+            $1 == "p50" { p50 = $2 }
+            $1 == "p99" { p99 = $2 }
+            END {
+                printf "udp_client\trequests_per_s\t%s\nudp_client\tp50_us\t%s\nudp_client\tp99_us\t%s\n",
+                    rate, p50, p99 >> out
+                print requests
+            }' "$log")
+        # Tämän ajon palvelinrivit ovat tiedoston viimeiset
+        awk -F '\t' -v requests="$requests" '
+            $1 == "udp_server" && $2 == "syscalls" { syscalls = $3 }
+            END { if (syscalls != "" && requests > 0) printf "udp_server\tsyscalls_per_request\t%.3f\n", syscalls / requests }
+            ' "$OUT" >> "$OUT"
+    done
+    rm -f "$log"
+    echo "  udp_server, udp_client"
+}
+
+# Kopioiden määrän pyyhkäisy
+scenario_pingpong() {
+    for n in ${BENCH_COPIES:-10 100 1000}; do
+        measure "pingpong_$n" "$PINGPONG" --kopioita "$n" --no-delay --quiet
+        measure "pingpong_pool_futex_$n" "$PINGPONG" --kopioita "$n" --no-delay --quiet --pool --transport futex
+    done
+}
+
+for scenario in $SCENARIOS; do
+    echo "$scenario:"
+    "scenario_$scenario"
+done
+echo "Tulokset: $OUT"
+
+if [ -n "$BASELINE" ]; then
+    ./compare.sh "$BASELINE" "$OUT" "$THRESHOLD"
+fi